@@ -0,0 +1,520 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Microbenchmarks of the building blocks on the I/O path: PRNG, sample objects, tracing,
+ * timestamping and storage driver dispatch.
+ * Each benchmark is run as a number of timed trials, each of a batch of operations sized to
+ * run for at least a minimum time.  Results are reported with their spread across trials,
+ * and may be saved as a CSV baseline, against which later runs can be compared. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "prng.h"
+#include "sample.h"
+#include "storage.h"
+#include "storage_priv.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+/* A benchmark: run iters operations, returning a value derived from their results so that
+ * the work cannot be optimised away */
+typedef struct bench {
+    char name[48];
+    uint64_t (*run)( struct bench *B, const uint64_t iters );
+    uint64_t bytes;             /* Bytes processed per operation, or 0 */
+    prng_t *P;
+    sample_t *S;
+    uint32_t seed;
+} bench_t;
+
+/* Result of a benchmark, as saved in a baseline */
+typedef struct result {
+    char name[48];
+    uint64_t iters;             /* Operations per trial */
+    unsigned trials;
+    double mean, sd, ci, min;   /* ns per operation */
+    double bytes_per_sec;       /* At the mean, or 0 */
+} result_t;
+
+#define BASELINE_HDR    "name,iters,trials,ns_per_op,sd,ci95,min,bytes_per_sec"
+
+static unsigned trials = 10;
+static double min_trial = 0.02;         /* Minimum duration of a trial, in seconds */
+static volatile uint64_t sink;
+
+static double elapsed( const struct timespec *t0, const struct timespec *t1 )
+{
+    struct timespec d;
+    time_delta( t0, t1, &d );
+    return (double)d.tv_sec + (double)d.tv_nsec / 1000000000.0;
+}
+
+static double time_batch( bench_t *B, const uint64_t iters )
+{
+    struct timespec t0, t1;
+    time_now( &t0 );
+    sink += B->run( B, iters );
+    time_now( &t1 );
+    return elapsed( &t0, &t1 );
+}
+
+/* Two-sided 95% critical values of Student's t, by degrees of freedom */
+static double t95( const unsigned df )
+{
+    static const double t[] = { 0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                                2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110,
+                                2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+                                2.052, 2.048, 2.045, 2.042 };
+    return df < ARRAYLEN(t) ? t[df] : 1.960;
+}
+
+/* Size the batch to the minimum trial time, warming up as we go, then time the trials */
+static void bench_measure( bench_t *B, result_t *R )
+{
+    uint64_t iters = 1;
+    double secs;
+    while ( (secs = time_batch( B, iters )) < min_trial ) {
+        iters = secs > min_trial / 64 ? iters * (min_trial / secs) * 1.1 + 1 : iters * 8;
+    }
+
+    double sum = 0.0, sumsq = 0.0, min = INFINITY;
+    for ( unsigned i=0; i < trials; i++ ) {
+        const double ns = time_batch( B, iters ) * 1e9 / iters;
+        sum += ns;
+        sumsq += ns * ns;
+        if ( ns < min ) {
+            min = ns;
+        }
+    }
+
+    memset( R, 0, sizeof(*R) );
+    strcpy( R->name, B->name );
+    R->iters = iters;
+    R->trials = trials;
+    R->mean = sum / trials;
+    R->min = min;
+    if ( trials > 1 ) {
+        const double var = (sumsq - sum * sum / trials) / (trials - 1);
+        R->sd = var > 0.0 ? sqrt( var ) : 0.0;
+        R->ci = t95( trials - 1 ) * R->sd / sqrt( trials );
+    }
+    if ( B->bytes > 0 ) {
+        R->bytes_per_sec = B->bytes * 1e9 / R->mean;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Benchmark kernels */
+
+static uint64_t run_prng_next( bench_t *B, const uint64_t iters )
+{
+    uint64_t acc = 0;
+    for ( uint64_t i=0; i < iters; i++ ) {
+        acc += prng_next( B->P );
+    }
+    return acc;
+}
+
+static uint64_t run_sample_init( bench_t *B, const uint64_t iters )
+{
+    for ( uint64_t i=0; i < iters; i++ ) {
+        prng_init( B->P, B->seed );
+        sample_init( B->S, B->P );
+    }
+    return sample_len( B->S );
+}
+
+static uint64_t run_sample_valid( bench_t *B, const uint64_t iters )
+{
+    uint64_t valid = 0;
+    for ( uint64_t i=0; i < iters; i++ ) {
+        prng_init( B->P, B->seed );
+        valid += sample_valid( B->S, B->P );
+    }
+    return valid;
+}
+
+static uint64_t run_trace( bench_t *B, const uint64_t iters )
+{
+    struct timespec ts, iop = { 0, 1000 };
+    time_now( &ts );
+    for ( uint64_t i=0; i < iters; i++ ) {
+        trace( TRACE_WRITE, &ts, &iop, NULL );
+    }
+    return ts.tv_nsec;
+}
+
+static uint64_t run_time_now( bench_t *B, const uint64_t iters )
+{
+    struct timespec ts;
+    uint64_t acc = 0;
+    for ( uint64_t i=0; i < iters; i++ ) {
+        time_now( &ts );
+        acc += ts.tv_nsec;
+    }
+    return acc;
+}
+
+static uint64_t run_time_delta( bench_t *B, const uint64_t iters )
+{
+    struct timespec t0 = { 1, 900000000 }, t1 = { 2, 100000000 }, d;
+    uint64_t acc = 0;
+    for ( uint64_t i=0; i < iters; i++ ) {
+        t1.tv_nsec = (t1.tv_nsec + 7) % 1000000000L;
+        time_delta( &t0, &t1, &d );
+        acc += d.tv_nsec;
+    }
+    return acc;
+}
+
+static uint64_t run_time_tick( bench_t *B, const uint64_t iters )
+{
+    uint64_t acc = 0;
+    for ( uint64_t i=0; i < iters; i++ ) {
+        acc += time_tick( );
+    }
+    return acc;
+}
+
+static uint64_t run_storage_write( bench_t *B, const uint64_t iters )
+{
+    uint64_t acc = 0;
+    for ( uint64_t i=0; i < iters; i++ ) {
+        acc += storage_write( 0, i, B->S );
+    }
+    return acc;
+}
+
+/* Driver entry points which do nothing, to time the dispatch through storage.c alone */
+static int noop_write( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
+{
+    return 0;
+}
+
+static int noop_read( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
+{
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+static result_t *results;
+static unsigned nresults;
+
+static int bench_run( bench_t *B )
+{
+    result_t *r = realloc( results, (nresults + 1) * sizeof(result_t) );
+    if ( r == NULL ) {
+        log_error( "Could not allocate result of %s", B->name );
+        return -1;
+    }
+    results = r;
+    bench_measure( B, &results[nresults] );
+
+    r = &results[nresults++];
+    printf( "%-32s %10.2f ns/op +/- %6.2f (sd %6.2f, min %9.2f)", r->name, r->mean, r->ci, r->sd, r->min );
+    if ( r->bytes_per_sec > 0.0 ) {
+        printf( " %10.2f MiB/s", r->bytes_per_sec / 1048576.0 );
+    }
+    printf( "\n" );
+    fflush( stdout );
+    return 0;
+}
+
+static int bench_prng( void )
+{
+    static const char *prng_impl_str[] = PRNG_IMPL_STR;
+    for ( unsigned i=0; prng_impl_str[i] != NULL; i++ ) {
+        bench_t B = { .run = run_prng_next, .bytes = sizeof(uint32_t) };
+        prng_select( i );
+        if ( (B.P = prng_create( 42 )) == NULL ) {
+            return -1;
+        }
+        snprintf( B.name, sizeof(B.name), "prng_next/%s", prng_impl_str[i] );
+        const int ret = bench_run( &B );
+        prng_destroy( B.P );
+        if ( ret < 0 ) {
+            return -1;
+        }
+    }
+    prng_select( PRNG_DEBUG );
+    return 0;
+}
+
+static int bench_sample( void )
+{
+    static const char *sizes[] = { "64", "1K", "4K", "64K", "1M" };
+    for ( unsigned i=0; i < ARRAYLEN(sizes); i++ ) {
+        char spec[32];
+        snprintf( spec, sizeof(spec), "fixed:%s", sizes[i] );
+        if ( sample_size_parse( spec ) < 0 ) {
+            return -1;
+        }
+
+        bench_t B = { .seed = 42 };
+        if ( (B.P = prng_create( B.seed )) == NULL || (B.S = sample_create( B.P )) == NULL ) {
+            return -1;
+        }
+        B.bytes = sample_len( B.S );
+
+        B.run = run_sample_init;
+        snprintf( B.name, sizeof(B.name), "sample_init/%s", sizes[i] );
+        int ret = bench_run( &B );
+
+        B.run = run_sample_valid;
+        snprintf( B.name, sizeof(B.name), "sample_valid/%s", sizes[i] );
+        if ( ret == 0 ) {
+            ret = bench_run( &B );
+        }
+        prng_init( B.P, B.seed );
+        if ( ret == 0 && !sample_valid( B.S, B.P ) ) {
+            log_error( "Sample of %s did not validate", sizes[i] );
+            ret = -1;
+        }
+
+        sample_destroy( B.S );
+        prng_destroy( B.P );
+        if ( ret < 0 ) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int bench_time( void )
+{
+    static const char *time_source_str[] = TIME_SOURCE_STR;
+    bench_t B = { .run = run_time_now, .name = "time_now" };
+    if ( bench_run( &B ) < 0 ) {
+        return -1;
+    }
+
+    B.run = run_time_delta;
+    strcpy( B.name, "time_delta" );
+    if ( bench_run( &B ) < 0 ) {
+        return -1;
+    }
+
+    for ( unsigned i=0; time_source_str[i] != NULL; i++ ) {
+        if ( time_source_select( i ) != i ) {
+            continue;
+        }
+        B.run = run_time_tick;
+        snprintf( B.name, sizeof(B.name), "time_tick/%s", time_source_str[i] );
+        if ( bench_run( &B ) < 0 ) {
+            return -1;
+        }
+    }
+    time_source_select( TIME_MONOTONIC );
+    return 0;
+}
+
+/* Every record goes through the ring to the flush thread, which encodes and writes it to a
+ * file in trace_dir while the benchmark runs */
+static int bench_trace( const char *trace_dir )
+{
+    const uint32_t id = getpid( );
+    bench_t B = { .run = run_trace, .name = "trace/flusher" };
+    trace_stats_t st;
+    char path[PATH_MAX];
+
+    if ( trace_init( trace_dir, id ) < 0 ) {
+        return -1;
+    }
+    const int ret = bench_run( &B );
+    trace_stats( &st );
+    if ( trace_fini( ) < 0 ) {
+        return -1;
+    }
+
+    log_info( "trace: %lu records, %lu stalled waiting for the flush thread",
+              (unsigned long)st.records, (unsigned long)st.stalls );
+    snprintf( path, sizeof(path), "%s/%x.trc", trace_dir, id );
+    unlink( path );
+    return ret;
+}
+
+static int bench_storage( void )
+{
+    static const char *storage_impl_str[] = STORAGE_IMPL_STR;
+    static storage_driver_t *drivers[] = { &storage_debug, &storage_dirtree, &storage_rados };
+
+    bench_t B = { .run = run_storage_write };
+    if ( (B.P = prng_create( 42 )) == NULL || (B.S = sample_create( B.P )) == NULL ) {
+        return -1;
+    }
+
+    int ret = 0;
+    for ( unsigned i=0; ret == 0 && i < ARRAYLEN(drivers); i++ ) {
+        const storage_driver_t saved = *drivers[i];
+        drivers[i]->storage_write = noop_write;
+        drivers[i]->storage_read = noop_read;
+        storage_select( i );
+
+        snprintf( B.name, sizeof(B.name), "storage_dispatch/%s", storage_impl_str[i] );
+        ret = bench_run( &B );
+        *drivers[i] = saved;
+    }
+    storage_select( STORAGE_DEBUG );
+
+    sample_destroy( B.S );
+    prng_destroy( B.P );
+    return ret;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Baselines */
+
+static int baseline_write( const char *path )
+{
+    FILE *fp = fopen( path, "w" );
+    if ( fp == NULL ) {
+        log_error( "open of baseline (%s) failed, (%d) ", path, errno );
+        return -1;
+    }
+    fprintf( fp, BASELINE_HDR "\n" );
+    for ( unsigned i=0; i < nresults; i++ ) {
+        const result_t *r = &results[i];
+        fprintf( fp, "%s,%lu,%u,%.3f,%.3f,%.3f,%.3f,%.0f\n", r->name, (unsigned long)r->iters,
+                 r->trials, r->mean, r->sd, r->ci, r->min, r->bytes_per_sec );
+    }
+    if ( fclose( fp ) != 0 ) {
+        log_error( "write of baseline (%s) failed, (%d) ", path, errno );
+        return -1;
+    }
+    log_info( "baseline of %u benchmarks written to %s", nresults, path );
+    return 0;
+}
+
+/* Compare results with those of a baseline.  A change is reported as significant if the
+ * confidence intervals of the two means do not overlap.  Returns the number of benchmarks
+ * significantly slower than the baseline, or -1 */
+static int baseline_compare( const char *path )
+{
+    FILE *fp = fopen( path, "r" );
+    char line[256];
+    int slower = 0;
+
+    if ( fp == NULL ) {
+        log_error( "open of baseline (%s) failed, (%d) ", path, errno );
+        return -1;
+    }
+    if ( fgets( line, sizeof(line), fp ) == NULL || strncmp( line, BASELINE_HDR, strlen(BASELINE_HDR) ) != 0 ) {
+        log_error( "%s is not a benchmark baseline", path );
+        fclose( fp );
+        return -1;
+    }
+
+    printf( "\n%-32s %12s %12s %8s\n", "compared with baseline", "base ns/op", "ns/op", "change" );
+    while ( fgets( line, sizeof(line), fp ) != NULL ) {
+        result_t b;
+        unsigned long iters;
+        if ( sscanf( line, "%47[^,],%lu,%u,%lf,%lf,%lf,%lf,%lf", b.name, &iters, &b.trials,
+                     &b.mean, &b.sd, &b.ci, &b.min, &b.bytes_per_sec ) != 8 ) {
+            log_warn( "Ignoring malformed baseline entry: %s", line );
+            continue;
+        }
+        for ( unsigned i=0; i < nresults; i++ ) {
+            const result_t *r = &results[i];
+            if ( strcmp( r->name, b.name ) != 0 ) {
+                continue;
+            }
+            const char *verdict = "";
+            if ( r->mean - r->ci > b.mean + b.ci ) {
+                verdict = "slower";
+                slower++;
+            } else if ( r->mean + r->ci < b.mean - b.ci ) {
+                verdict = "faster";
+            }
+            printf( "%-32s %12.2f %12.2f %+7.1f%% %s\n", r->name, b.mean, r->mean,
+                    100.0 * (r->mean - b.mean) / b.mean, verdict );
+        }
+    }
+    fclose( fp );
+    return slower;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+/* Handle argument parsing error */
+void fail( char *cmd )
+{
+    fprintf( stderr, "Usage: %s [-r <trials>] [-m <msecs>] [-t <trace_dir>] [-o <baseline>] [-c <baseline>]\n\n", cmd );
+    fprintf( stderr, "\t-r Number of timed trials of each benchmark (default 10)\n" );
+    fprintf( stderr, "\t-m Minimum duration of each trial, in ms (default 20)\n" );
+    fprintf( stderr, "\t-t Directory for the trace written by the trace benchmark (default /tmp)\n" );
+    fprintf( stderr, "\t-o Save the results as a CSV baseline\n" );
+    fprintf( stderr, "\t-c Compare the results with a baseline, failing if any are significantly slower\n" );
+    exit( 1 );
+}
+
+int main( int argc, char **argv )
+{
+    const char *trace_dir = "/tmp", *out = NULL, *cmp = NULL;
+    int c;
+
+    opterr = 0;
+    while (( c = getopt (argc, argv, "r:m:t:o:c:" )) != -1 ) {
+        switch (c)
+        {
+        case 'r':
+            trials = atoi( optarg );
+            if ( trials < 2 ) {
+                fail(argv[0]);
+            }
+            break;
+        case 'm':
+            min_trial = atof( optarg ) / 1000.0;
+            if ( min_trial <= 0.0 ) {
+                fail(argv[0]);
+            }
+            break;
+        case 't':
+            trace_dir = optarg;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 'c':
+            cmp = optarg;
+            break;
+        default:
+           fail(argv[0]);
+        }
+    }
+    if ( optind != argc ) {
+        fail(argv[0]);
+    }
+
+    /* Debug logging by the trace flush thread would be measured along with it */
+    log_set_level( LOG_INFO );
+    prng_select( PRNG_DEBUG );
+    sample_select( SAMPLE_DEBUG );
+    time_now( &time_benchmark );
+
+    printf( "%u trials of at least %.0fms each; +/- is the 95%% confidence interval of the mean\n",
+            trials, min_trial * 1000.0 );
+    if ( bench_prng( ) < 0 || bench_sample( ) < 0 || bench_time( ) < 0 ||
+         bench_trace( trace_dir ) < 0 || bench_storage( ) < 0 ) {
+        log_error( "benchmark failed" );
+        return 1;
+    }
+
+    if ( out != NULL && baseline_write( out ) < 0 ) {
+        return 1;
+    }
+    if ( cmp != NULL ) {
+        const int slower = baseline_compare( cmp );
+        if ( slower != 0 ) {
+            return 1;
+        }
+    }
+    free( results );
+    return 0;
+}
@@ -7,21 +7,45 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
-#include <semaphore.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 
+/* A sense-reversing barrier between processes, in shared memory.
+ * The futex word holds the phase, which the last participant to arrive advances to release
+ * all the others at once.  The barrier may be passed any number of times. */
 typedef struct barrier {
-    sem_t 		b_mutex;	/* count mutex */
-    sem_t		b_barrier;	/* barrier */
-    int 		b_count;	/* initialization value */
+    uint32_t		b_phase;	/* futex word: phases completed */
+    uint32_t		b_count;	/* participants arrived in this phase */
+    uint32_t		b_aborted;	/* set by barrier_abort */
     int			b_num;		/* total number of participants */
+    uint64_t		b_spin;		/* ns to spin before sleeping (0 = sleep at once) */
+    uint64_t		b_release;	/* CLOCK_MONOTONIC ns at which the last phase was released */
+    uint64_t		b_skew_last;	/* greatest delay from release to leaving, in the last phase */
+    uint64_t		b_skew_max;	/* ... in any phase */
     char		b_handle[];	/* handle to backing object */
 } barrier_t;
 
+/* Release skew: how long after a phase was released its participants left the barrier, ns */
+typedef struct barrier_skew {
+    uint32_t		phases;		/* phases completed */
+    uint64_t		last;		/* greatest delay in the last phase */
+    uint64_t		max;		/* greatest delay in any phase */
+} barrier_skew_t;
+
 barrier_t *barrier_init( const char *handle, const int count );
 void barrier_destroy( barrier_t *bp );
-void barrier_wait( barrier_t *bp );
+
+/* Spin for up to spin_ns waiting for the release, before sleeping on the futex */
+void barrier_set_spin( barrier_t *bp, const uint64_t spin_ns );
+
+/* Wait for all participants.  Returns 0, or -1 if the barrier has been aborted */
+int barrier_wait( barrier_t *bp );
+
+/* Release all waiters, now and in future, with failure: eg when a participant has died */
+void barrier_abort( barrier_t *bp );
+
+void barrier_skew( const barrier_t *bp, barrier_skew_t *skew );
 
 #endif                                                          /* __BARRIER_H__ */
@@ -0,0 +1,86 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Coordination of benchmark runs across nodes:
+ * A coordinator, listening on a TCP or UNIX socket, registers the motif instances of a run,
+ * starts each phase on all nodes together through cross-node barriers, and collects the
+ * results of every node when it completes. */
+/* Begun 2019, StackHPC Ltd */
+
+#ifndef __COORD_H__                                             /* __COORD_H__ */
+#define __COORD_H__                                             /* __COORD_H__ */
+
+#include <stdint.h>
+
+#include "utils.h"
+#include "stats.h"
+
+/* Addresses are HOST:PORT (TCP) or unix:PATH */
+#define COORD_UNIX_PREFIX       "unix:"
+
+/* Barriers between the phases of a run */
+#define COORD_BARRIER_START     0       /* All tasks of all nodes ready to start */
+#define COORD_BARRIER_READ      1       /* All tasks of all nodes have completed the write phase */
+
+/* Exchanges of timestamps with the coordinator per clock estimate: the one with the shortest
+ * round trip is taken, as the least delayed by queueing */
+#define COORD_CLOCK_SAMPLES     16
+
+/* Estimate of the offset of the wall clock (CLOCK_REALTIME) of a node from the coordinator's.
+ * The error of the offset is at most half the round trip */
+typedef struct coord_clock {
+    int64_t offset;             /* Added to times of the node to bring them onto the coordinator's, ns */
+    uint64_t rtt;               /* Round trip of the exchange the offset was taken from, ns (0: none) */
+    int64_t when;               /* Time of the exchange on the node's wall clock, ns */
+} coord_clock_t;
+
+/* Clock estimates of a node, before and after its run */
+#define COORD_CLOCK_START       0
+#define COORD_CLOCK_END         1
+#define COORD_NCLOCKS           2
+
+/* Results of a node, reported to the coordinator */
+typedef struct coord_result {
+    uint32_t tasks;
+    uint32_t failed;            /* Tasks which did not exit successfully */
+    stats_result_t phase[STATS_NPHASES];
+    coord_clock_t clock[COORD_NCLOCKS];
+} coord_result_t;
+
+/* Files sent with the results of a node */
+typedef enum coord_file {
+    COORD_FILE_SUMMARY = 0,     /* Run summary (JSON) */
+    COORD_FILE_HIST,            /* Latency histograms */
+    COORD_NFILES
+} coord_file_t;
+
+/*------------------------------------------------------------------------------------------------*/
+/* Motif instances */
+
+/* Register with the coordinator as a node running the given number of tasks.
+ * On success, the index of this node, the number of nodes and the run identifier shared by
+ * all nodes are returned */
+extern int coord_connect( const char *addr, const unsigned tasks, uint32_t *node, uint32_t *nodes,
+                          uint64_t *run_id );
+
+/* Estimate the offset of this node's clock from the coordinator's */
+extern int coord_clock( coord_clock_t *C );
+
+/* Drift of a node's clock from the coordinator's between two estimates, in parts per million */
+extern double coord_drift( const coord_clock_t *start, const coord_clock_t *end );
+
+/* Wait until every node has reached the barrier */
+extern int coord_barrier( const unsigned id );
+
+/* Report the results of the node, with its files (where present) */
+extern int coord_report( const coord_result_t *R, const char *paths[COORD_NFILES] );
+
+extern void coord_close( void );
+
+/*------------------------------------------------------------------------------------------------*/
+/* Coordinator */
+
+/* Register the given number of nodes, coordinate their barriers, and write their results
+ * (and their aggregate) into outdir.  Returns 0 when all nodes have reported, or -1 if any
+ * node failed or disconnected */
+extern int coord_serve( const char *addr, const unsigned nodes, const char *outdir );
+
+#endif                                                          /* __COORD_H__ */
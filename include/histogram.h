@@ -0,0 +1,90 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Latency histograms:
+ * Log-linear bucketed histograms (in the style of HdrHistogram) of nanosecond latencies,
+ * cheap enough to update for every I/O operation and mergeable across workers and hosts. */
+/* Begun 2019, StackHPC Ltd */
+
+#ifndef __HISTOGRAM_H__                                         /* __HISTOGRAM_H__ */
+#define __HISTOGRAM_H__                                         /* __HISTOGRAM_H__ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Each power of 2 is divided into 2^HIST_SUB_BITS buckets (< 1% relative error).
+ * Values of 2^HIST_MAX_BITS ns (about 18 minutes) and above share the final bucket. */
+#define HIST_SUB_BITS       7
+#define HIST_MAX_BITS       40
+#define HIST_SUB_COUNT      (1U << HIST_SUB_BITS)
+#define HIST_LIMIT          (1ULL << HIST_MAX_BITS)
+#define HIST_NBUCKETS       ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct histogram {
+    uint64_t count;                 /* Number of values recorded */
+    uint64_t sum;                   /* Sum of values recorded, in ns */
+    uint64_t min, max;              /* Exact extreme values, in ns */
+    uint64_t bucket[HIST_NBUCKETS];
+} histogram_t;
+
+/* Bucket index for a value */
+static inline unsigned histogram_index( uint64_t v )
+{
+    if( v >= HIST_LIMIT )           v = HIST_LIMIT - 1;
+    if( v < HIST_SUB_COUNT )        return (unsigned)v;
+
+    const unsigned shift = 63 - __builtin_clzll( v ) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (unsigned)((v >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+/* Record a single value, in ns */
+static inline void histogram_record( histogram_t *H, const uint64_t v )
+{
+    H->bucket[histogram_index( v )]++;
+    H->count++;
+    H->sum += v;
+    if( v < H->min )    H->min = v;
+    if( v > H->max )    H->max = v;
+}
+
+/* Record a value n times, eg for a sample standing for n operations */
+static inline void histogram_record_n( histogram_t *H, const uint64_t v, const uint64_t n )
+{
+    H->bucket[histogram_index( v )] += n;
+    H->count += n;
+    H->sum += v * n;
+    if( v < H->min )    H->min = v;
+    if( v > H->max )    H->max = v;
+}
+
+/* Convert a timespec to ns, for recording */
+static inline uint64_t histogram_ns( const struct timespec *ts )
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+extern void histogram_init( histogram_t *H );
+
+/* Add the contents of src into dst.
+ * NOTE: this is safe against concurrent merges into dst, eg from several processes */
+extern void histogram_merge( histogram_t *dst, const histogram_t *src );
+
+/* Value (ns) at or below which the given percentage of recorded values fall */
+extern uint64_t histogram_percentile( const histogram_t *H, const double pct );
+
+/* Allocate histograms in memory that will be shared with child processes */
+extern histogram_t *histogram_shared_create( const unsigned n );
+extern void histogram_shared_destroy( histogram_t *H, const unsigned n );
+
+/* Print a one-line summary (count, mean, p50, p90, p99, p99.9, max) at LOG_INFO */
+extern void histogram_report( const char *name, const histogram_t *H );
+
+/* Binary histogram files: a set of named histograms, which can be merged across runs or hosts */
+#define HIST_NAME_LEN       8
+
+extern int histogram_write( const char *path, const char *names[], const histogram_t *H, const unsigned n );
+
+/* Read the histograms from a file, merging each into the entry of H with the same name.
+ * Returns the number of histograms read, or -1 on error */
+extern int histogram_read( const char *path, const char *names[], histogram_t *H, const unsigned n );
+
+#endif                                                          /* __HISTOGRAM_H__ */
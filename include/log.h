@@ -19,12 +19,33 @@ typedef enum { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_FATAL }
 
 #define LOG_LEVEL_STR 	{ "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL", NULL }
 
-#define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(...)  log_log(LOG_INFO,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(...)  log_log(LOG_WARN,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+/* Messages below LOG_COMPILE_LEVEL are compiled out entirely (eg, -DLOG_COMPILE_LEVEL=LOG_INFO).
+ * Messages below the runtime level are skipped inline, without a function call. */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_TRACE
+#endif
+
+#ifdef __GNUC__
+#define LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define LOG_UNLIKELY(x) (x)
+#endif
+
+#define log_at(level, ...) \
+  do { \
+    if ((level) >= LOG_COMPILE_LEVEL && LOG_UNLIKELY((level) >= log_level)) \
+      log_log((level), __FILE__, __LINE__, __VA_ARGS__); \
+  } while (0)
+
+#define log_trace(...) log_at(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) log_at(LOG_FATAL, __VA_ARGS__)
+
+/* Current runtime logging level: use log_set_level() to change it */
+extern int log_level;
 
 void log_set_udata(void *udata);
 void log_set_lock(log_LockFn fn);
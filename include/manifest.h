@@ -0,0 +1,83 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Dataset manifests:
+ * A run which keeps its objects in place lists them in a manifest, so that later runs can read
+ * them back without writing them again.  The manifest is a header followed by an array of
+ * fixed-size entries, one for each object written by each task, and is used mapped into
+ * memory: tasks fill in their own entries as they write, and readers index the entries. */
+/* Begun 2019, StackHPC Ltd */
+
+#ifndef __MANIFEST_H__                                          /* __MANIFEST_H__ */
+#define __MANIFEST_H__                                          /* __MANIFEST_H__ */
+
+#include <stdint.h>
+
+#define MANIFEST_MAGIC          "MOTIFMAN"
+#define MANIFEST_VERSION        1
+#define MANIFEST_ENDIAN         0x01020304U
+#define MANIFEST_SIZE_LEN       64
+#define MANIFEST_HOST_LEN       64
+
+/* Fields may be added at the end: readers use hdr_len to find the first entry */
+typedef struct manifest_hdr {
+    char magic[8];              /* MANIFEST_MAGIC */
+    uint32_t version;           /* MANIFEST_VERSION */
+    uint32_t endian;            /* Reads as MANIFEST_ENDIAN on hosts of the same byte order */
+    uint32_t hdr_len;           /* Length of the header in the file */
+    uint32_t storage;           /* storage_impl_t the objects were written with */
+    uint32_t sample;            /* sample_impl_t and prng_impl_t generating their contents */
+    uint32_t prng;
+    int32_t seed;               /* Seed of the sequences of object IDs (0: chosen by each task) */
+    uint32_t node;              /* Node which wrote the objects, in a coordinated run */
+    uint32_t tasks;             /* Tasks which wrote the objects */
+    uint32_t count;             /* Objects written by each task */
+    uint64_t run_id;            /* Run which wrote the objects */
+    uint64_t nobj;              /* Entries: tasks * count */
+    uint64_t bytes;             /* Total length of the objects */
+    uint64_t max_len;           /* Length of the largest object */
+    int64_t created;            /* Wall clock time the manifest was completed, in seconds */
+    char size[MANIFEST_SIZE_LEN];       /* Object size distribution ("" for the default) */
+    char host[MANIFEST_HOST_LEN];       /* Host which wrote the objects */
+} manifest_hdr_t;
+
+/* An object: its name is formed from the client and object identifiers, and its contents
+ * are generated from the object identifier */
+typedef struct manifest_obj {
+    uint32_t client_id;
+    uint32_t obj_id;
+    uint32_t len;
+} manifest_obj_t;
+
+typedef struct manifest {
+    manifest_hdr_t *hdr;
+    manifest_obj_t *obj;
+    uint64_t nobj;
+    void *base;
+    size_t len;
+    char *path;
+} manifest_t;
+
+/* Create a manifest for the objects of a run, shared with the tasks it forks */
+extern manifest_t *manifest_create( const char *path, const unsigned tasks, const unsigned count );
+
+/* Record the object written by a task (as the i'th of its objects) */
+static inline void manifest_record( manifest_t *M, const unsigned ordinal, const unsigned i,
+                                    const uint32_t client_id, const uint32_t obj_id, const uint32_t len )
+{
+    manifest_obj_t *e = &M->obj[(uint64_t)ordinal * M->hdr->count + i];
+    e->client_id = client_id;
+    e->obj_id = obj_id;
+    e->len = len;
+}
+
+/* Complete the manifest, once all tasks have written their objects.  hdr gives the fields of
+ * the header describing the run: the remainder are filled in from the entries */
+extern int manifest_finish( manifest_t *M, const manifest_hdr_t *hdr );
+
+/* Abandon a manifest being created, removing it */
+extern void manifest_discard( manifest_t *M );
+
+/* Open a completed manifest for reading */
+extern manifest_t *manifest_open( const char *path );
+extern void manifest_close( manifest_t *M );
+
+#endif                                                          /* __MANIFEST_H__ */
@@ -0,0 +1,59 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Trace-driven replay:
+ * The reads and writes of a recorded trace are replayed against a storage driver, in place of
+ * the synthetic write and read phases.  Traces are either motif trace files (.trc, including
+ * merged traces of several workers or nodes) or CSV files of timestamp, op, object and size.
+ *
+ * Each operation belongs to a stream (a worker of a .trc file, or the stream column of a CSV
+ * file, defaulting to the object).  Streams which address the same objects are grouped, and all
+ * operations of a group are replayed in order by the same worker, so that a read follows the
+ * write of another stream it depends on.  Every write creates a new version of its object under
+ * a name of its own, so that overwrites do not depend on the storage driver replacing objects,
+ * and each read is validated against the version it follows.  Objects read before being written
+ * are created before the replay starts.
+ *
+ * Motif traces do not record which object an operation addressed: the writes of each stream
+ * are taken to create new objects, and its reads to cycle through the objects it has written,
+ * as motif_1 does.  Their sizes are drawn from the object size distribution. */
+/* Begun 2019, StackHPC Ltd */
+
+#ifndef __REPLAY_H__                                            /* __REPLAY_H__ */
+#define __REPLAY_H__                                            /* __REPLAY_H__ */
+
+#include <stdint.h>
+
+/* An operation to replay, or an object to create beforehand */
+typedef struct replay_op {
+    uint64_t when;              /* ns from the first operation of the trace */
+    uint32_t stream;
+    uint32_t op;                /* TRACE_READ or TRACE_WRITE */
+    uint32_t client_id;         /* Name of the version of the object written, or read */
+    uint32_t obj_id;            /* (also the seed of its contents) */
+    uint32_t len;               /* Its length (0: drawn from the object size distribution) */
+} replay_op_t;
+
+typedef struct replay {
+    unsigned nworker;           /* Workers the streams are shared between */
+    replay_op_t *op;            /* Operations, grouped by worker, each in order of time */
+    uint64_t *op_first;         /* Index of each worker's first operation (nworker + 1) */
+    replay_op_t *preload;       /* Objects to create before the replay, grouped by worker */
+    uint64_t *preload_first;
+    uint64_t nop, npreload;
+    uint64_t nread, nwrite;
+    uint64_t nignored;          /* Operations of other types, not replayed */
+    uint64_t nversion;          /* Objects created, by preloading or by writes */
+    uint32_t nstream;
+    uint32_t ngroup;            /* Groups of streams sharing objects, each replayed by one worker */
+    uint64_t duration;          /* ns from the first operation to the last */
+    uint64_t max_len;           /* Longest object of a given length */
+} replay_t;
+
+/* Parse a timing mode: "fast" (as fast as possible), "original" (at the recorded times) or
+ * "scale:FACTOR" (FACTOR times faster than recorded).  speed is the factor, or 0 for fast. */
+extern int replay_timing_parse( const char *spec, double *speed );
+
+/* Load a trace, sharing its groups of streams between the given number of workers */
+extern int replay_load( replay_t *R, const char *path, const unsigned workers );
+extern void replay_free( replay_t *R );
+
+#endif                                                          /* __REPLAY_H__ */
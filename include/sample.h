@@ -12,6 +12,7 @@
 #ifndef __SAMPLE_H__                                              /* __SAMPLE_H__ */
 #define __SAMPLE_H__                                              /* __SAMPLE_H__ */
 
+/* Default object size distribution is uniform over [SAMPLE_LEN_MAX/2, SAMPLE_LEN_MAX) */
 /* NOTE: byte length defined here must be an integral number of 32-bit words */
 #define SAMPLE_LEN_WORDS    384
 #define SAMPLE_LEN_MAX      (SAMPLE_LEN_WORDS * sizeof(uint32_t))
@@ -28,14 +29,25 @@ extern void sample_destroy( sample_t *S );
 /* Re-initialise a pre-allocated sample data object */
 extern sample_t *sample_init( sample_t *S, prng_t *P );
 
+/* Re-initialise a sample of a given length, rather than one drawn from the size distribution.
+ * Only the contents are generated from the PRNG, so the length must be given to validate it. */
+extern sample_t *sample_init_len( sample_t *S, prng_t *P, const size_t len );
+
 /* Initialise a sample_t object (NB, unvalidated) from storage data */
 extern void sample_read( sample_t *S, const void *data, const size_t len );
 
+/* Load storage data direct into a sample_t object (NB, unvalidated), avoiding a copy:
+ * borrow a writable buffer of at least cap bytes (NULL if the sample cannot hold that much),
+ * fill it, then commit the number of bytes received. */
+extern void *sample_buffer( sample_t *S, const size_t cap );
+extern void sample_commit( sample_t *S, const size_t len );
+
 /* Finalise a sample data object (de-initialise without deallocation) */
 extern void sample_fini( sample_t *S );
 
 /* Validate a sample data object that has been read back */
 extern bool sample_valid( sample_t *S, prng_t *P );
+extern bool sample_valid_len( sample_t *S, prng_t *P, const size_t len );
 
 /* Retrieve the length of a sample data object */
 extern size_t sample_len( sample_t *S );
@@ -43,6 +55,49 @@ extern size_t sample_len( sample_t *S );
 /* Access the data from a sample data object */
 extern const void *sample_data( sample_t *S );
 
+/* Streaming access to sample data, for objects too large to hold in one buffer.
+ * The data stream is identical to that of a sample_t initialised from the same PRNG state,
+ * but is generated or validated a chunk at a time through a caller-supplied buffer. */
+typedef struct sample_stream_s sample_stream_t;
+
+extern sample_stream_t *sample_stream_create( void );
+extern void sample_stream_destroy( sample_stream_t *T );
+
+/* Start a new object from the PRNG sequence, returning its total length.
+ * NOTE: the PRNG object is used by the stream until the object is complete */
+extern size_t sample_stream_init( sample_stream_t *T, prng_t *P );
+
+/* Generate the next chunk of up to len bytes, returning the number of bytes generated */
+extern size_t sample_stream_generate( sample_stream_t *T, void *buf, const size_t len );
+
+/* Validate the next chunk of len bytes that has been read back */
+extern bool sample_stream_valid( sample_stream_t *T, const void *buf, const size_t len );
+
+/* Number of bytes of the object still to be generated or validated */
+extern size_t sample_stream_remain( sample_stream_t *T );
+
+/* Pipelined generation and validation on a helper thread, keeping the PRNG off the I/O path.
+ * Each object's contents are generated from its own seed, so validation is unaffected.
+ * Write phase:
+ *   sample_pipe_generate, then for each object sample_pipe_take ... sample_pipe_release
+ * Read phase:
+ *   sample_pipe_validate, then for each object sample_pipe_slot ... sample_pipe_submit
+ * Either phase ends with sample_pipe_finish, which returns the count of invalid samples. */
+typedef struct sample_pipe_s sample_pipe_t;
+
+extern sample_pipe_t *sample_pipe_create( const unsigned depth );
+extern void sample_pipe_destroy( sample_pipe_t *Q );
+
+extern int sample_pipe_generate( sample_pipe_t *Q, prng_t *P, const unsigned count );
+extern sample_t *sample_pipe_take( sample_pipe_t *Q, uint32_t *seed );
+extern void sample_pipe_release( sample_pipe_t *Q );
+
+extern int sample_pipe_validate( sample_pipe_t *Q );
+extern sample_t *sample_pipe_slot( sample_pipe_t *Q );
+extern void sample_pipe_submit( sample_pipe_t *Q, const uint32_t seed, const unsigned idx );
+
+extern unsigned sample_pipe_finish( sample_pipe_t *Q );
+
 /* Select an implementation of sample data object
  * NOTE: this cannot be done while sample objects are in use */
 typedef enum sample_impl
@@ -54,4 +109,38 @@ typedef enum sample_impl
 
 extern void sample_select( sample_impl_t impl );
 
+/* Select a distribution of object sizes.
+ * NOTE: this must be done before sample objects are created */
+typedef enum sample_size_dist
+{
+    SAMPLE_SIZE_FIXED,
+    SAMPLE_SIZE_UNIFORM,        /* Default */
+    SAMPLE_SIZE_LOGNORMAL,
+    SAMPLE_SIZE_HISTOGRAM,
+} sample_size_dist_t;
+
+#define SAMPLE_SIZE_STR     { "FIXED", "UNIFORM", "LOGNORMAL", "HISTOGRAM", NULL }
+
+/* Configure from a specification, eg "fixed:4K", "uniform:1K:1M", "lognormal:4K:2M",
+ * "histogram:sizes.txt".  Returns 0 on success, -1 if the specification is invalid. */
+extern int sample_size_parse( const char *spec );
+
+/* Draw the next object length from the PRNG sequence */
+extern size_t sample_size_next( prng_t *P );
+
+/* Largest object length that can be generated by the selected distribution */
+extern size_t sample_size_max( void );
+
+/* Per-worker pool of sample data buffers, allocated once from a single arena.
+ * Buffers are always SAMPLE_ALIGN-aligned (suitable for direct I/O).  The arena is
+ * pre-faulted, and may be backed by huge pages and locked into memory.
+ * NOTE: must be called after the size distribution is selected, before samples are created */
+#define SAMPLE_ALIGN            4096
+
+#define SAMPLE_POOL_HUGEPAGE    0x1         /* Use MAP_HUGETLB, or transparent huge pages */
+#define SAMPLE_POOL_LOCK        0x2         /* Lock the arena into memory with mlock */
+
+extern int sample_pool_init( const unsigned count, const unsigned flags );
+extern void sample_pool_fini( void );
+
 #endif                                                          /* __SAMPLE_H__ */
@@ -0,0 +1,118 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Live interval statistics:
+ * Each worker updates running totals in its own slot of a shared memory block, which the
+ * parent process samples periodically to report throughput while the benchmark is running. */
+/* Begun 2019, StackHPC Ltd */
+
+#ifndef __STATS_H__                                             /* __STATS_H__ */
+#define __STATS_H__                                             /* __STATS_H__ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+/* Running totals for one type of operation */
+typedef struct stats_counter {
+    uint64_t ops;               /* Operations completed */
+    uint64_t bytes;             /* Bytes transferred */
+    uint64_t errors;            /* Operations failed */
+    uint64_t latency;           /* Sum of latencies of operations completed, in ns */
+} stats_counter_t;
+
+/* Timed phases of a worker's run, each made up of operations of one type */
+typedef enum stats_phase {
+    STATS_PHASE_WRITE = 0,
+    STATS_PHASE_READ,
+    STATS_NPHASES
+} stats_phase_t;
+
+/* Time window of a phase, from time_now: zero if the worker did not complete the phase */
+typedef struct stats_window {
+    struct timespec start, end;
+} stats_window_t;
+
+/* One slot per worker, padded to a cache line so that workers do not share lines */
+typedef struct stats_slot {
+    stats_counter_t c[TRACE_NTYPES];
+    stats_window_t phase[STATS_NPHASES];
+    uint64_t invalid;           /* Objects read back that failed validation */
+} __attribute__((aligned(64))) stats_slot_t;
+
+/* Slot of the calling worker, or NULL if statistics are not being gathered */
+extern stats_slot_t *stats_self;
+
+/* Each slot has a single writer: plain increments published with relaxed stores suffice
+ * for the parent to see untorn, monotonically increasing values */
+static inline void stats_add( uint64_t *ctr, const uint64_t n )
+{
+    __atomic_store_n( ctr, *ctr + n, __ATOMIC_RELAXED );
+}
+
+/* Record a completed operation and its latency */
+static inline void stats_op( const trace_type_t tt, const uint64_t ns )
+{
+    if( stats_self != NULL && tt < TRACE_NTYPES )
+    {
+        stats_add( &stats_self->c[tt].ops, 1 );
+        stats_add( &stats_self->c[tt].latency, ns );
+    }
+}
+
+/* Record the outcome of a storage operation: bytes transferred, or an error if result < 0 */
+static inline void stats_io( const trace_type_t tt, const int result, const uint64_t bytes )
+{
+    if( stats_self != NULL )
+    {
+        if( result < 0 )    stats_add( &stats_self->c[tt].errors, 1 );
+        else                stats_add( &stats_self->c[tt].bytes, bytes );
+    }
+}
+
+/* Record the window of a completed phase */
+static inline void stats_phase( const stats_phase_t ph, const struct timespec *start, const struct timespec *end )
+{
+    if( stats_self != NULL )
+    {
+        stats_self->phase[ph].start = *start;
+        stats_self->phase[ph].end = *end;
+    }
+}
+
+/* Record objects that failed validation */
+static inline void stats_invalid( const uint64_t n )
+{
+    if( stats_self != NULL )
+    {
+        stats_add( &stats_self->invalid, n );
+    }
+}
+
+/* Allocate slots for n workers in memory shared with child processes */
+extern stats_slot_t *stats_create( const unsigned n );
+extern void stats_destroy( stats_slot_t *slots, const unsigned n );
+
+/* Select the slot to be updated by the calling worker */
+extern void stats_attach( stats_slot_t *slots, const unsigned ordinal );
+
+/* Sample the totals across all workers, and report the change since the previous sample.
+ * If fp is not NULL, a CSV record of the interval is also written to it. */
+extern void stats_sample( const stats_slot_t *slots, const unsigned n, FILE *fp );
+
+/* Aggregate results of a phase, over the union of the windows of the workers completing it */
+typedef struct stats_result {
+    unsigned workers;           /* Workers which completed the phase */
+    int64_t first, last;        /* Union of their windows, in ns */
+    uint64_t ops, bytes, errors, invalid;
+} stats_result_t;
+
+extern void stats_result( const stats_slot_t *slots, const unsigned n, const stats_phase_t ph,
+                          stats_result_t *R );
+
+/* Write the results of all workers, once they have completed, as members of a JSON object:
+ * "phases", holding the aggregate results of each phase over the union of the workers'
+ * windows, with the spread across workers and latency percentiles from hist (indexed by
+ * trace type), and "workers", holding the results of each worker */
+extern void stats_summary( FILE *fp, const stats_slot_t *slots, const unsigned n, const histogram_t *hist );
+
+#endif                                                          /* __STATS_H__ */
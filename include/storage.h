@@ -4,6 +4,7 @@
  * Read back an object for subsequent validation. */
 /* Begun 2018-2019, StackHPC Ltd */
 
+#include <stdbool.h>
 #include <sys/types.h>
 
 #include "sample.h"
@@ -27,6 +28,24 @@ extern int storage_write( const uint32_t client_id, const uint32_t obj_id, sampl
 /* Read a sample object from storage */
 extern int storage_read( const uint32_t client_id, const uint32_t obj_id, sample_t *S );
 
+/* Write an object a chunk at a time through a working buffer of len bytes, generating it from a
+ * sample stream started for the object with sample_stream_init.  Objects of any size can be
+ * written without a sample buffer to hold them.  Only drivers for which storage_streams() is
+ * true can do this. */
+extern bool storage_streams( void );
+extern int storage_write_stream( const uint32_t client_id, const uint32_t obj_id, sample_stream_t *T,
+                                 void *buf, const size_t len );
+
+/* Read back an object a chunk at a time, validating it against a sample stream started for the
+ * object.  valid is set to whether the whole object matched the stream. */
+extern int storage_read_stream( const uint32_t client_id, const uint32_t obj_id, sample_stream_t *T,
+                                void *buf, const size_t len, bool *valid );
+
+/* Remove the objects written by a worker, where the driver does not remove its workspace
+ * as a whole on shutdown.  Returns the number of objects removed (0 if left to the driver),
+ * or -1 on failure */
+extern int storage_worker_remove( const uint32_t client_id, const uint32_t *obj_id, const unsigned n );
+
 /* Select an implementation of storage backend.
  * NOTE: this cannot be done while the application is active */
 typedef enum storage_impl
@@ -40,4 +59,15 @@ typedef enum storage_impl
 
 extern void storage_select( storage_impl_t impl );
 
+/* Options for all storage implementations */
+#define STORAGE_FSYNC           0x1     /* Flush each object to stable storage when written */
+#define STORAGE_CLEAN_URING     0x2     /* Remove files of the workspace with io_uring (file drivers,
+                                         * if built with STORAGE_URING=1) */
+#define STORAGE_KEEP            0x4     /* Leave the objects in place on shutdown, for later runs */
+
+extern void storage_set_flags( const unsigned flags );
+
+/* Set the number of threads removing the workspace on shutdown (0: one per CPU) */
+extern void storage_set_clean_threads( const unsigned threads );
+
 #endif                                                          /* __STORAGE_H__ */
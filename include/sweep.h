@@ -0,0 +1,72 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Concurrency sweeps:
+ * Step the number of tasks through a series, measuring throughput and tail latency at each
+ * step, until throughput stops scaling or latency exceeds an objective, and locate the knee
+ * of the throughput/latency curve. */
+/* Begun 2019, StackHPC Ltd */
+
+#ifndef __SWEEP_H__                                             /* __SWEEP_H__ */
+#define __SWEEP_H__                                             /* __SWEEP_H__ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Series of concurrencies stepped through */
+typedef enum sweep_series {
+    SWEEP_GEOMETRIC = 0,        /* START, START * FACTOR, ... up to MAX */
+    SWEEP_ADAPTIVE,             /* Geometric, then bisecting towards the knee */
+} sweep_series_t;
+
+#define SWEEP_SERIES_STR        { "geometric", "adaptive" }
+
+#define SWEEP_PHASE_TIME        10.0    /* Default time bound of each phase of a step, in seconds */
+
+/* Measurements of a step */
+typedef struct sweep_point {
+    unsigned tasks;
+    double iops;                /* Aggregate operations per second */
+    double bytes_per_sec;       /* Aggregate bandwidth */
+    uint64_t p99;               /* 99th percentile latency, in ns */
+    double gain;                /* Throughput gain over the previous point, per FACTOR of tasks */
+    bool within_slo;
+} sweep_point_t;
+
+typedef struct sweep {
+    /* Specification */
+    sweep_series_t series;
+    unsigned start, max;        /* Range of concurrencies */
+    double factor;              /* Ratio of successive concurrencies */
+    double min_gain;            /* Throughput gain per FACTOR below which scaling has stopped */
+    uint64_t slo;               /* Latency objective for the p99, in ns (0: none) */
+    double phase_time;          /* Time bound of each phase of a step, in seconds (0: none) */
+
+    /* Progress */
+    sweep_point_t *pt;          /* Points measured, in order */
+    unsigned npt;
+    int knee;                   /* Index in pt of the knee, or -1 */
+    unsigned lo, hi;            /* Concurrencies bracketing the knee, while bisecting */
+    unsigned next;              /* Concurrency of the next step (0: done) */
+    bool saturated;             /* Scaling stopped, or the objective was exceeded */
+} sweep_t;
+
+/* Parse a sweep specification: a series,
+ *   geometric:START:MAX[:FACTOR] or adaptive:START:MAX[:FACTOR]
+ * optionally followed by comma-separated stopping criteria:
+ *   gain:PERCENT (throughput gain per FACTOR of tasks, default 5) and slo:USECONDS (p99)
+ * and by time:SECONDS, the time bound of each phase of a step (default 10, 0 for none) */
+extern int sweep_parse( sweep_t *W, const char *spec );
+
+/* Number of tasks for the next step, or 0 when the sweep is complete */
+extern unsigned sweep_next( const sweep_t *W );
+
+/* Record the measurements of the step just run, choosing the next step */
+extern int sweep_record( sweep_t *W, const unsigned tasks, const double iops, const double bytes_per_sec,
+                         const uint64_t p99 );
+
+/* Point at the knee: the highest concurrency that improved throughput sufficiently while
+ * meeting the latency objective, or NULL if there is none */
+extern const sweep_point_t *sweep_knee( const sweep_t *W );
+
+extern void sweep_fini( sweep_t *W );
+
+#endif                                                          /* __SWEEP_H__ */
@@ -0,0 +1,187 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Trace file format:
+ * Version 1 files are a raw array of trace_entry_t, with no header.
+ * Version 2 files are self-describing: a header identifying the run, worker, host and clock,
+ * followed by independently decodable blocks of compactly encoded records. */
+/* Begun 2019, StackHPC Ltd */
+
+#ifndef __TRACEFILE_H__                                         /* __TRACEFILE_H__ */
+#define __TRACEFILE_H__                                         /* __TRACEFILE_H__ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "utils.h"
+
+#define TRACE_MAGIC             "MOTIFTRC"
+#define TRACE_VERSION           2
+#define TRACE_ENDIAN            0x01020304U
+#define TRACE_HOST_LEN          64
+
+/* Source of trace timestamps */
+typedef enum trace_clock {
+    TRACE_CLOCK_MONOTONIC = 0,  /* clock_gettime( CLOCK_MONOTONIC ) */
+    TRACE_CLOCK_TSC,            /* TSC, calibrated against CLOCK_MONOTONIC */
+} trace_clock_t;
+
+#define TRACE_CLOCK_STR         { "MONOTONIC", "TSC" }
+
+/* Sampling policy applied to operations of a trace (see trace_set_sampling).
+ * Operations at least as slow as the threshold are always kept, whatever the policy. */
+typedef enum trace_sample {
+    TRACE_SAMPLE_ALL = 0,       /* Every operation */
+    TRACE_SAMPLE_NONE,          /* Only slow operations */
+    TRACE_SAMPLE_NTH,           /* One in every sample_n operations */
+    TRACE_SAMPLE_RESERVOIR,     /* A uniform sample of sample_n operations per interval */
+} trace_sample_t;
+
+#define TRACE_SAMPLE_STR        { "all", "none", "nth", "reservoir" }
+
+/* Version 2 file header.
+ * Fields may be added at the end: readers use hdr_len to find the first block. */
+typedef struct trace_file_hdr {
+    char magic[8];              /* TRACE_MAGIC */
+    uint32_t version;           /* TRACE_VERSION */
+    uint32_t endian;            /* Reads as TRACE_ENDIAN on hosts of the same byte order */
+    uint32_t hdr_len;           /* Length of the header in the file */
+    uint32_t ordinal;           /* Worker that wrote the trace */
+    uint64_t run_id;            /* Identifier shared by all workers of a run */
+    uint32_t clock;             /* trace_clock_t */
+    uint32_t flags;             /* TRACE_FLAG_* */
+    int64_t epoch_sec;          /* Wall clock time of timestamp zero */
+    int64_t epoch_nsec;
+    char host[TRACE_HOST_LEN];  /* Host name of the writer, NUL-terminated */
+
+    /* Sampling: zero (all operations kept) in files written before it was supported.
+     * In reservoir mode, each interval's sample is preceded by a TRACE_WEIGHT record whose
+     * timestamp is the start of the interval, and whose duration is the number of
+     * operations (not slow enough to be kept regardless) seen in the interval.  In merged
+     * files, weights apply to the records of their own source, and a TRACE_WEIGHT record
+     * has the timestamp of the record of its source that follows it. */
+    uint32_t sample_mode;       /* trace_sample_t */
+    uint32_t sample_n;          /* 1-in-N, or reservoir size */
+    uint64_t sample_interval;   /* Reservoir interval, in ns */
+    uint64_t sample_slow;       /* Operations at least this slow are all kept, in ns (0: none) */
+    uint64_t sample_seen;       /* Operations traced */
+    uint64_t sample_kept;       /* Operations written to the file */
+
+    /* Merged files: the table of the traces merged, within the header */
+    uint32_t nsource;           /* Number of entries */
+    uint32_t source_off;        /* Offset of the first entry in the file */
+
+    /* Offset of the wall clock of the writer from a reference clock, measured as the run
+     * started: added to the epoch to place timestamps on the reference clock.  Its error is at
+     * most half the round trip of the measurement, which is zero if there was none. */
+    int64_t clock_offset;       /* ns */
+    uint64_t clock_rtt;         /* ns */
+} trace_file_hdr_t;
+
+/* Header flags: readers reject files with flags they do not know */
+#define TRACE_FLAG_MERGED       0x1     /* Records of several traces, each with a source index */
+#define TRACE_FLAGS_KNOWN       (TRACE_FLAG_MERGED)
+
+/* Identity of a trace merged into a file */
+typedef struct trace_source {
+    char host[TRACE_HOST_LEN];
+    uint32_t ordinal;
+    uint32_t clock;             /* trace_clock_t */
+    uint64_t run_id;
+    int64_t offset;             /* Clock offset applied to its records, in ns */
+} trace_source_t;
+
+/* Each block is preceded by this header and holds nrec records in raw_len bytes,
+ * stored in stored_len bytes (compressed if TRACE_BLOCK_ZLIB is set) */
+typedef struct trace_block_hdr {
+    uint32_t nrec;
+    uint32_t flags;
+    uint32_t raw_len;
+    uint32_t stored_len;
+} trace_block_hdr_t;
+
+#define TRACE_BLOCK_ZLIB        0x1
+
+/* Each record is encoded as:
+ * - a byte holding the operation type (low 4 bits) and tag length (high 4 bits)
+ * - the tag characters, if any
+ * - in merged files, the index of the record's source, as a varint
+ * - the start time in ns, as a zigzag varint delta from the previous record in the block
+ * - the duration in ns, as a varint */
+#define TRACE_RECORD_MAX        (1 + 7 + 5 + 10 + 10)
+#define TRACE_BLOCK_NREC        4096
+#define TRACE_BLOCK_MAX         (TRACE_BLOCK_NREC * TRACE_RECORD_MAX)
+
+/* Fill in a version 2 header for the calling process */
+extern void trace_header_init( trace_file_hdr_t *hdr, const uint32_t ordinal );
+
+/* Set the run identifier recorded in the headers of subsequent traces */
+extern void trace_set_run_id( const uint64_t run_id );
+
+/* Set the offset from the reference clock recorded in the headers of subsequent traces */
+extern void trace_set_clock_offset( const int64_t offset, const uint64_t rtt );
+
+/* Encode a record at p, returning the end of the encoding.  prev_ns must be 0 at block start */
+extern uint8_t *trace_record_encode( uint8_t *p, const trace_entry_t *te, uint64_t *prev_ns );
+
+/* Encode a record of a merged file, from the given source */
+extern uint8_t *trace_record_encode_source( uint8_t *p, const trace_entry_t *te, const uint32_t src,
+                                            uint64_t *prev_ns );
+
+/* Write a block of nrec encoded records, compressing it if supported */
+extern int trace_block_write( FILE *fp, const uint8_t *raw, const size_t len, const unsigned nrec );
+
+/* Decode the records of a block, given the data stored after its header and the flags of
+ * the file.  scratch must hold TRACE_BLOCK_MAX bytes, for decompression.  The source index
+ * of each record of a merged file is stored in src, unless it is NULL.
+ * Returns the number of records decoded into te, or -1 if the block is corrupt */
+extern int trace_block_decode( const trace_block_hdr_t *bh, const uint8_t *data, uint8_t *scratch,
+                               const uint32_t flags, trace_entry_t *te, uint32_t *src );
+
+/*------------------------------------------------------------------------------------------------*/
+/* Sequential reading of trace files of either version */
+
+typedef struct trace_reader trace_reader_t;
+
+extern trace_reader_t *trace_reader_open( const char *path );
+extern void trace_reader_close( trace_reader_t *R );
+
+/* Header of the file.  For version 1 files, only version is meaningful.
+ * Fields beyond the header length of the file are zero. */
+extern const trace_file_hdr_t *trace_reader_header( const trace_reader_t *R );
+
+/* Read the next record: returns 1 on success, 0 at end of file, or -1 on error */
+extern int trace_reader_next( trace_reader_t *R, trace_entry_t *te );
+
+/* Trace of the record last read: from the source table of a merged file, or else from
+ * the file header (for version 1 files, a source with no host) */
+extern const trace_source_t *trace_reader_source( const trace_reader_t *R );
+
+/* Table of the traces merged into a file, with the number of entries in n */
+extern const trace_source_t *trace_reader_sources( const trace_reader_t *R, unsigned *n );
+
+/*------------------------------------------------------------------------------------------------*/
+/* Direct access to the blocks of a trace file mapped into memory, for parallel analysis.
+ * Blocks are identified by their offset in the file: those of version 1 files are runs of
+ * TRACE_BLOCK_NREC records. */
+
+typedef struct trace_map {
+    trace_file_hdr_t hdr;       /* As for trace_reader_header */
+    const uint8_t *base;        /* File contents */
+    size_t len;
+    size_t first;               /* Offset of the first block */
+} trace_map_t;
+
+extern int trace_map_open( trace_map_t *M, const char *path );
+extern void trace_map_close( trace_map_t *M );
+
+/* Offset of the block following the one at off, without decoding it */
+extern size_t trace_map_skip( const trace_map_t *M, const size_t off );
+
+/* Decode the block at *off into te (which must hold TRACE_BLOCK_NREC records), and advance
+ * *off to the next block.  scratch must hold TRACE_BLOCK_MAX bytes, for decompression.  The
+ * source index of each record is stored in src, unless it is NULL (0 if the file is not merged).
+ * Returns the number of records decoded, 0 at the end of the file, or -1 on error */
+extern int trace_map_block( const trace_map_t *M, size_t *off, uint8_t *scratch, trace_entry_t *te,
+                            uint32_t *src );
+
+#endif                                                          /* __TRACEFILE_H__ */
@@ -5,9 +5,13 @@
 #ifndef __UTILS_H__                                              /* __UTILS_H__ */
 #define __UTILS_H__                                              /* __UTILS_H__ */
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <time.h>
 
+#include "histogram.h"
+
 /* Return the number of members in a statically-defined array */
 #define ARRAYLEN(x)     (sizeof(x) / sizeof(*x))
 
@@ -16,6 +20,12 @@
 
 #include "log.h"
 
+/*------------------------------------------------------------------------------------------------*/
+/* JSON output */
+
+/* Output a string as a JSON string literal, escaping it as necessary */
+extern void json_str( FILE *fp, const char *str );
+
 /*------------------------------------------------------------------------------------------------*/
 /* Timestamping functions:
  * Get current time with nanosecond resolution and manipulate timestamps. */
@@ -30,6 +40,58 @@ extern void time_delta( const struct timespec *t1, const struct timespec *t2, st
 extern struct timespec time_start;          /* A timestamp set at application startup. */
 extern struct timespec time_benchmark;      /* A timestamp set at the start of the benchmark run. */
 
+/* Tick counts, for timing operations with minimal overhead.
+ * Ticks are read from the selected time source, and only converted to ns when needed. */
+typedef enum time_source
+{
+    TIME_MONOTONIC = 0,         /* clock_gettime( CLOCK_MONOTONIC ): ticks are ns (default) */
+    TIME_TSC,                   /* Invariant TSC, calibrated against CLOCK_MONOTONIC */
+} time_source_t;
+
+#define TIME_SOURCE_STR         { "MONOTONIC", "TSC", NULL }
+
+extern time_source_t time_source;
+extern uint64_t time_tsc_mult;              /* ns per TSC tick, in 32.32 fixed point */
+extern uint64_t time_benchmark_tick;        /* Tick count at the start of the benchmark run. */
+
+/* Select the time source, calibrating it if necessary.
+ * Falls back to TIME_MONOTONIC if the TSC is unsuitable, returning the source selected. */
+extern time_source_t time_source_select( const time_source_t src );
+
+/* Compare the calibrated tick rate against CLOCK_MONOTONIC, warning of any drift.
+ * Returns the error in parts per million. */
+extern double time_source_check( void );
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TIME_HAVE_TSC
+#endif
+
+static inline uint64_t time_tick( void )
+{
+#ifdef TIME_HAVE_TSC
+    if( time_source == TIME_TSC )
+    {
+        /* RDTSCP waits for earlier instructions to complete before reading the counter */
+        uint32_t lo, hi;
+        __asm__ __volatile__( "rdtscp" : "=a" (lo), "=d" (hi) : : "ecx" );
+        return ((uint64_t)hi << 32) | lo;
+    }
+#endif
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Convert a tick interval to ns */
+static inline uint64_t time_tick_ns( const uint64_t ticks )
+{
+    if( time_source == TIME_MONOTONIC )
+    {
+        return ticks;
+    }
+    return (uint64_t)(((unsigned __int128)ticks * time_tsc_mult) >> 32);
+}
+
 /*------------------------------------------------------------------------------------------------*/
 /* Emitting performance traces.
  * Generating telemetry streams during benchmark execution */
@@ -46,7 +108,19 @@ extern struct timespec time_benchmark;      /* A timestamp set at the start of t
 typedef enum trace_type {
    TRACE_READ = 0,
    TRACE_WRITE,
-   TRACE_MISC
+   TRACE_MISC,
+
+   /* Components of object operations, if span tracing is enabled */
+   TRACE_OPEN,			/* Open or create (including stat, for reads) */
+   TRACE_DATA,			/* Data transfer */
+   TRACE_CLOSE,
+   TRACE_FSYNC,
+   TRACE_MKDIR,			/* Directory creation */
+
+   TRACE_NTYPES,		/* Number of trace types */
+
+   /* Not an operation: weight of the sampled records that follow (see tracefile.h) */
+   TRACE_WEIGHT = TRACE_NTYPES
 } trace_type_t;
 
 typedef struct trace_entry {
@@ -60,15 +134,72 @@ typedef struct trace_entry {
 
 extern const char *trace_type_str( const trace_type_t T );
 
+/* Set the number of entries in the trace buffer (rounded up to a power of 2) */
+/* NOTE: must be called before trace_init */
+extern void trace_set_size( const size_t nent );
+
+/* Select the operations to be written to the trace, by a comma-separated list of:
+ *   all                 every operation (the default)
+ *   none                no operations, other than slow ones
+ *   nth:N               one in every N operations
+ *   reservoir:K:SECS    a uniform random sample of K operations in each interval of SECS
+ *   slow:USECS          every operation taking at least USECS, in addition to those sampled
+ *                       (alone, implies none)
+ * Components of an operation are kept or discarded with it.  Latency histograms and live
+ * statistics include every operation, whatever is sampled.
+ * Returns -1 if the specification is invalid. */
+/* NOTE: must be called before trace_init */
+extern int trace_set_sampling( const char *spec );
+
 /* A pthread is created by this task for periodic flush of buffered trace data */
 extern int trace_init( const char *trace_dir, const uint32_t trace_id );
 
 /* Complete tracing, flush buffers and close files, terminate the captive thread */
 extern int trace_fini( void );
 
+/* Counts of trace records, including those delayed or lost */
+typedef struct trace_stats {
+    uint64_t records;		/* Records traced */
+    uint64_t stalls;		/* Records delayed waiting for space in the trace buffer */
+    struct timespec stall_time;	/* Total time spent waiting for space */
+    uint64_t dropped;		/* Records lost after a trace file write failure */
+    uint64_t ops;		/* Operations traced, before sampling */
+    uint64_t kept;		/* Operations recorded after sampling */
+} trace_stats_t;
+
+extern void trace_stats( trace_stats_t *st );
+
+/* Latency histogram of every operation of a type traced since trace_init */
+extern const histogram_t *trace_histogram( const trace_type_t tt );
+
 extern int trace( const trace_type_t tt, const struct timespec *ts, 
                   const struct timespec *iop, const char *tag );
 
+/* Timing of an object operation and (optionally) its components.
+ * A driver calls trace_op_begin, then trace_op_span as each component completes,
+ * and trace_op_end once the operation has succeeded.  The operation is traced as a single
+ * record, and if span tracing is enabled, each component is traced as a separate record
+ * immediately following it, covering a part of the operation's time. */
+#define TRACE_SPAN_MAX 8
+
+typedef struct trace_op {
+    trace_type_t type;
+    uint64_t start;		/* Start of the operation, in ticks */
+    uint64_t mark;		/* Start of the current component, in ticks */
+    unsigned nspan;
+    struct {
+        trace_type_t type;
+        uint64_t start, duration;
+    } span[TRACE_SPAN_MAX];
+} trace_op_t;
+
+/* Enable or disable tracing of operation components */
+extern void trace_set_spans( const int enable );
+
+extern void trace_op_begin( trace_op_t *op, const trace_type_t tt );
+extern void trace_op_span( trace_op_t *op, const trace_type_t span );
+extern int trace_op_end( trace_op_t *op );
+
 /* Record timestamp and elapsed delta for an IOP */
 static inline int
 trace_read( const struct timespec *ts, const struct timespec *iop )
@@ -34,10 +34,11 @@ static struct {
   void *udata;
   log_LockFn lock;
   FILE *fp;
-  int level;
   int quiet;
 } L;
 
+int log_level = LOG_TRACE;
+
 static const char *level_names[] = {
   /* TRACE  DEBUG   INFO    WARN    ERROR   FATAL */
      "++",  "--",   "ii",   "??",   "!!",   "XX"
@@ -80,7 +81,7 @@ void log_set_fp(FILE *fp) {
 
 
 void log_set_level(int level) {
-  L.level = level;
+  log_level = level;
 }
 
 
@@ -90,7 +91,7 @@ void log_set_quiet(int enable) {
 
 
 void log_log(int level, const char *file, int line, const char *fmt, ...) {
-  if (level < L.level) {
+  if (level < log_level) {
     return;
   }
 
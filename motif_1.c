@@ -16,10 +16,16 @@
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <limits.h>
 #include <argp.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/utsname.h>
+#include <pthread.h>
 
 
 #include "prng.h"
@@ -28,8 +34,48 @@
 #include "utils.h"
 #include "info.h"
 #include "barrier.h"
+#include "stats.h"
+#include "tracefile.h"
+#include "sweep.h"
+#include "coord.h"
+#include "manifest.h"
+#include "replay.h"
 
 #define STORAGE_WORKSPACE "motif_1-data" 
+#define HISTOGRAM_FILE "motif_1.hst"
+#define STATS_FILE "motif_1-stats.csv"
+#define SUMMARY_FILE "motif_1-summary.json"
+#define SWEEP_FILE "motif_1-sweep.csv"
+
+/* Latency histograms for each trace type, shared between all tasks */
+static histogram_t *motif_hist;
+
+/* Concurrency sweep, if selected */
+static sweep_t motif_sweep;
+
+/* Barrier between the tasks and the parent, passed once as the tasks start.  In a coordinated
+ * run, tasks also pass it twice at each barrier between phases: on arriving, and on being
+ * released by the parent once every task of every node has arrived */
+#define MOTIF_NGATES    (COORD_BARRIER_READ + 1)
+
+static barrier_t *motif_barrier;
+static bool motif_gated;
+static pthread_t motif_coord_thread;                    /* Releases the tasks in a coordinated run */
+static bool motif_coord_running;
+static barrier_skew_t motif_skew;
+static pid_t *motif_pids;
+static int motif_npids;
+
+/* Index of this node in a coordinated run, and the number of nodes */
+static uint32_t motif_node = 0, motif_nodes = 1;
+static coord_clock_t motif_clock[COORD_NCLOCKS];      /* Offsets from the coordinator's clock */
+
+/* Manifest of the objects kept by this run, or of the dataset read by a read-only run: mapped
+ * before the tasks are forked, so that they share it */
+static manifest_t *motif_manifest;
+
+/* Trace replayed in place of the write and read phases, planned before the tasks are forked */
+static replay_t motif_replay;
 
 const char *argp_program_version = VERSION;
 const char *argp_program_bug_address = SUPPORT_CONTACT;
@@ -52,12 +98,42 @@ static struct argp_option options[] =
     { "prng", 'r', "PRNG", 0, "Pseudo-random number generator to use" },
     { "seed", 'R', "SEED", 0, "Pseudo-random number generator seed" },
     { "sample", 's', "SAMPLE", 0, "Sample type to use" },
+    { "size", 'z', "SIZE", 0, "Object size distribution: fixed:LEN, uniform:MIN:MAX, "
+                              "lognormal:MEDIAN:P99[:MAX] or histogram:FILE" },
     { "storage", 'S', "STORAGE", 0, "Storage type to use" } ,
+    { "buffers", 'b', "BUFFER COUNT", 0, "Number of sample buffers in each worker's pool" },
+    { "hugepages", 'H', 0, 0, "Back sample buffers with huge pages" },
+    { "mlock", 'L', 0, 0, "Lock sample buffers into memory" },
+    { "pipeline", 'q', "DEPTH", 0, "Generate and validate samples on a helper thread, DEPTH samples ahead" },
+    { "chunk", 'Z', "BYTES", 0, "Write and read objects BYTES at a time through one working buffer, "
+                                "generating and validating them as they go (DIRTREE storage only)" },
     { "workspace", 'W', "WORKSPACE", 0, "Storage workspace to use" },
     { "tracedir", 't', "TRACEDIR", 0, "Directory for traces" },
+    { "tracebuf", 'T', "ENTRIES", 0, "Number of entries in each worker's trace buffer" },
+    { "spans", 'D', 0, 0, "Trace the open, data, close, fsync and mkdir components of each operation" },
+    { "fsync", 'f', 0, 0, "Flush each object to stable storage when written" },
+    { "clean-threads", 'j', "THREADS", 0, "Threads removing the workspace at exit (default: one per CPU)" },
+    { "uring", 'u', 0, 0, "Remove the workspace with io_uring (if built with STORAGE_URING=1)" },
+    { "keep", 'k', "MANIFEST", 0, "Leave the objects written in place, listing them in MANIFEST" },
+    { "read-only", 'o', "MANIFEST", 0, "Read the objects listed in MANIFEST by an earlier run with --keep, "
+                                       "without writing any" },
+    { "replay", 'y', "TRACE", 0, "Replay the reads and writes of TRACE (a .trc file, or CSV of "
+                                 "timestamp,op,object,size[,stream]) in place of the write and read phases" },
+    { "timing", 'Y', "TIMING", 0, "Replay timing: fast, original (the default) or scale:FACTOR" },
+    { "sampling", 'x', "SPEC", 0, "Operations to trace: all, none, nth:N, reservoir:K:SECONDS "
+                                  "and/or slow:USECONDS, comma-separated" },
+    { "clock", 'C', "CLOCK", 0, "Timestamp source: MONOTONIC or TSC" },
+    { "interval", 'i', "SECONDS", 0, "Report aggregate throughput every SECONDS during the run" },
     { "write count", 'c', "OBJECT WRITE COUNT", 0, "Object write count" },
     { "read count", 'n', "OBJECT READ COUNT", 0, "Object read count" },
     { "parallel", 'p', "TASK COUNT", 0, "Number of parallel tasks" },
+    { "coordinator", 'm', "ADDRESS", 0, "Run in step with other nodes, coordinated by utils/coordinator "
+                                        "at HOST:PORT or unix:PATH, and report results to it" },
+    { "sweep", 'P', "SPEC", 0, "Step the number of tasks to find where throughput saturates: "
+                               "geometric:START:MAX[:FACTOR] or adaptive:START:MAX[:FACTOR], "
+                               "with optional ,gain:PERCENT and ,slo:USECONDS (p99), and "
+                               ",time:SECONDS bounding each phase of a step (default 10)" },
+    { "spin", 'B', "USECONDS", 0, "Spin for up to USECONDS at barriers before sleeping" },
     { "verbose", 'v', "VERBOSITY", 0, "Verbosity level" },
     { 0 }
 };
@@ -66,15 +142,36 @@ static struct argp_option options[] =
 struct motif_arguments
 {
     sample_impl_t 	sample;		    /* Sample used in test */
+    char		*size;		    /* Object size distribution */
+    unsigned		pool_count;	    /* Sample buffers per worker */
+    unsigned		pool_flags;	    /* Sample buffer pool options */
+    unsigned		pipe_depth;	    /* Sample pipeline depth (0 = inline) */
+    size_t		chunk;		    /* Bytes written and read at a time (0 = whole samples) */
     prng_impl_t 	prng;		    /* Random number generator */
     int 		seed;		    /* PRNG seed value */
     storage_impl_t	storage;	    /* Storage selection */
     log_level_t         verbosity;          /* Logging verbosity level */
     char		*trace_dir;	    /* Directory for traces */
+    unsigned		trace_nent;	    /* Trace buffer entries */
+    unsigned		interval;	    /* Seconds between live statistics (0 = none) */
+    int			spans;		    /* Trace components of each operation */
+    char		*sampling;	    /* Trace sampling specification */
+    time_source_t	clock;		    /* Timestamp source */
+    unsigned		storage_flags;	    /* Storage driver options */
+    unsigned		clean_threads;	    /* Threads removing the workspace (0: one per CPU) */
+    char		*keep;		    /* Manifest of the objects to keep (NULL: remove them) */
+    char		*read_only;	    /* Manifest of the objects to read (NULL: write them) */
+    char		*replay;	    /* Trace to replay (NULL: none) */
+    char		*replay_timing;	    /* Replay timing specification */
+    double		replay_speed;	    /* Replay speed relative to the trace (0: as fast as possible) */
     char		*workspace;	    /* Workspace pointer */
     unsigned		object_write_count; /* Number of objects */
     unsigned		object_read_count;  /* Number of objects */
+    double		phase_time;	    /* Time bound of each phase, in seconds (0: none) */
     int			task_count;	    /* Number of tasks */
+    char		*sweep;		    /* Concurrency sweep specification */
+    char		*coord;		    /* Coordinator address (NULL: none) */
+    unsigned		barrier_spin;	    /* Barrier spin, in us */
     char		**forward_argv;     /* Forward arguments (handled downstream) */
     int		        forward_argc;       /* Forward argument count */
 };
@@ -114,6 +211,7 @@ static error_t parse_opt( int key, char *arg, struct argp_state *state )
     char *prng_impl_str[] = 	PRNG_IMPL_STR;
     char *sample_impl_str[] = 	SAMPLE_IMPL_STR;
     char *log_level_str[] =     LOG_LEVEL_STR;
+    char *time_source_str[] =   TIME_SOURCE_STR;
     char options[PATH_MAX];
 
     switch (key) {
@@ -132,6 +230,21 @@ static error_t parse_opt( int key, char *arg, struct argp_state *state )
             argp_failure( state, 1, 0, "Task count must be greater than 0" );
         break;
 
+    case 'm':
+        motif_arguments->coord = arg;
+        break;
+
+    case 'B':
+        if ( (int)(motif_arguments->barrier_spin = atoi( arg )) < 0 )
+            argp_failure( state, 1, 0, "Barrier spin must not be negative" );
+        break;
+
+    case 'P':
+        if ( sweep_parse( &motif_sweep, arg ) < 0 )
+            argp_failure( state, 1, 0, "Invalid sweep specification '%s'", arg );
+        motif_arguments->sweep = arg;
+        break;
+
     case 'r':
         if ( (motif_arguments->prng = find_match( prng_impl_str, arg )) < 0 )
             argp_failure( state, 1, 0, 
@@ -150,6 +263,36 @@ static error_t parse_opt( int key, char *arg, struct argp_state *state )
                           possible_options( sample_impl_str, options ));
         break;
     
+    case 'z':
+        motif_arguments->size = arg;
+        break;
+
+    case 'b':
+        if ( (int)(motif_arguments->pool_count = atoi( arg )) <= 0 )
+            argp_failure( state, 1, 0, "Buffer count must be greater than 0" );
+        break;
+
+    case 'H':
+        motif_arguments->pool_flags |= SAMPLE_POOL_HUGEPAGE;
+        break;
+
+    case 'L':
+        motif_arguments->pool_flags |= SAMPLE_POOL_LOCK;
+        break;
+
+    case 'q':
+        if ( (int)(motif_arguments->pipe_depth = atoi( arg )) < 0 )
+            argp_failure( state, 1, 0, "Pipeline depth must not be negative" );
+        break;
+
+    case 'Z': {
+        char *end;
+        motif_arguments->chunk = strtoul( arg, &end, 10 );
+        if ( *end != '\0' || motif_arguments->chunk == 0 )
+            argp_failure( state, 1, 0, "Chunk must be a number of bytes greater than 0" );
+        break;
+    }
+
     case 'S':
         if ( (motif_arguments->storage = find_match( storage_impl_str, arg ))  < 0)
             argp_failure( state, 1, 0, "Storage must be one of %s", 
@@ -166,11 +309,82 @@ static error_t parse_opt( int key, char *arg, struct argp_state *state )
         motif_arguments->trace_dir = arg;
         break;
 
+    case 'T':
+        if ( (int)(motif_arguments->trace_nent = atoi( arg )) <= 0 )
+            argp_failure( state, 1, 0, "Trace buffer entries must be greater than 0" );
+        break;
+
+    case 'D':
+        motif_arguments->spans = 1;
+        break;
+
+    case 'x':
+        if ( trace_set_sampling( arg ) < 0 )
+            argp_failure( state, 1, 0, "Invalid trace sampling specification '%s'", arg );
+        motif_arguments->sampling = arg;
+        break;
+
+    case 'f':
+        motif_arguments->storage_flags |= STORAGE_FSYNC;
+        break;
+
+    case 'j':
+        if ( (int)(motif_arguments->clean_threads = atoi( arg )) <= 0 )
+            argp_failure( state, 1, 0, "Cleanup threads must be greater than 0" );
+        break;
+
+    case 'u':
+        motif_arguments->storage_flags |= STORAGE_CLEAN_URING;
+        break;
+
+    case 'k':
+        motif_arguments->keep = arg;
+        motif_arguments->storage_flags |= STORAGE_KEEP;
+        break;
+
+    case 'o':
+        motif_arguments->read_only = arg;
+        motif_arguments->storage_flags |= STORAGE_KEEP;
+        break;
+
+    case 'y':
+        motif_arguments->replay = arg;
+        break;
+
+    case 'Y':
+        if ( replay_timing_parse( arg, &motif_arguments->replay_speed ) < 0 )
+            argp_failure( state, 1, 0, "Replay timing must be fast, original or scale:FACTOR" );
+        motif_arguments->replay_timing = arg;
+        break;
+
+    case 'C':
+        if ( (motif_arguments->clock = find_match( time_source_str, arg ))  < 0)
+            argp_failure( state, 1, 0, "Clock must be one of %s", 
+                          possible_options( time_source_str, options ));
+        break;
+
+    case 'i':
+        if ( (int)(motif_arguments->interval = atoi( arg )) <= 0 )
+            argp_failure( state, 1, 0, "Interval must be greater than 0" );
+        break;
+
     case 'W':
         motif_arguments->workspace = arg;
         break;
 
     case ARGP_KEY_END: 
+        if ( motif_arguments->keep != NULL && motif_arguments->read_only != NULL )
+            argp_failure( state, 1, 0, "A run cannot both keep a dataset and read one" );
+        if ( motif_arguments->keep != NULL && motif_arguments->sweep != NULL )
+            argp_failure( state, 1, 0, "A concurrency sweep cannot keep a dataset" );
+        if ( motif_arguments->replay != NULL &&
+             (motif_arguments->keep != NULL || motif_arguments->read_only != NULL || motif_arguments->sweep != NULL) )
+            argp_failure( state, 1, 0, "A replay cannot keep or read a dataset, or be swept" );
+        if ( motif_arguments->chunk > 0 &&
+             (motif_arguments->pipe_depth > 0 || motif_arguments->keep != NULL ||
+              motif_arguments->read_only != NULL || motif_arguments->replay != NULL) )
+            argp_failure( state, 1, 0, "Objects written in chunks cannot be pipelined, kept, read from a "
+                                       "manifest or replayed" );
         return 0;
 
     case ARGP_KEY_ARG:
@@ -180,12 +394,33 @@ static error_t parse_opt( int key, char *arg, struct argp_state *state )
     case ARGP_KEY_INIT:
         /* Set default argument values */
         motif_arguments->sample =	SAMPLE_DEBUG;
+        motif_arguments->size =		NULL;
+        motif_arguments->pool_count =	1;
+        motif_arguments->pool_flags =	0;
+        motif_arguments->pipe_depth =	0;
+        motif_arguments->chunk =	0;
         motif_arguments->prng = 	PRNG_DEBUG;
         motif_arguments->storage = 	STORAGE_DEBUG;
-        motif_arguments->verbosity =    LOG_DEBUG;
+        motif_arguments->verbosity =    LOG_INFO;
         motif_arguments->workspace = 	STORAGE_WORKSPACE;
         motif_arguments->task_count =	1;
+        motif_arguments->sweep =	NULL;
+        motif_arguments->phase_time =	0.0;
+        motif_arguments->coord =	NULL;
+        motif_arguments->barrier_spin =	0;
         motif_arguments->trace_dir =	".";
+        motif_arguments->trace_nent =	0;
+        motif_arguments->interval =	0;
+        motif_arguments->spans =	0;
+        motif_arguments->sampling =	"all";
+        motif_arguments->clock =	TIME_MONOTONIC;
+        motif_arguments->storage_flags = 0;
+        motif_arguments->clean_threads = 0;
+        motif_arguments->keep =		NULL;
+        motif_arguments->read_only =	NULL;
+        motif_arguments->replay =	NULL;
+        motif_arguments->replay_timing = "original";
+        motif_arguments->replay_speed =	1.0;
         motif_arguments->forward_argv =	malloc( sizeof( char * ) * state->argc );
         motif_arguments->forward_argc = 0;
         break;
@@ -198,28 +433,630 @@ static error_t parse_opt( int key, char *arg, struct argp_state *state )
 
 static struct argp argp = { options, parse_opt, args_doc, prog_doc };
 int run_motif( struct motif_arguments *map, barrier_t *bp, const int ordinal );
+static int summary_motif( struct motif_arguments *map, const char *path, const stats_slot_t *stats,
+                          const uint64_t run_id, const struct timespec *wall );
+
+/* Number of tasks which did not exit successfully */
+static unsigned motif_failed = 0;
+
+/* Statistics slots allocated for the current step */
+static unsigned stats_count = 0;
+
+static void motif_reaped( const pid_t pid, const int status )
+{
+    log_debug( "reaped child - %d", pid );
+    if( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+    {
+        log_warn( "task %d failed (status 0x%x)", pid, status );
+        motif_failed++;
+    }
+}
+
+/*
+ * Once a task has failed, release the others from any barrier at which they wait for it, and
+ * stop the coordinator thread, whose run cannot now complete.
+ */
+static void motif_fail( void )
+{
+    barrier_abort( motif_barrier );
+    if( motif_coord_running )
+    {
+        pthread_cancel( motif_coord_thread );
+    }
+}
+
+/*
+ * Report interval statistics until all tasks have completed.
+ * SIGCHLD is blocked, so that the wait for each interval can be cut short when a task exits.
+ */
+static void monitor_motif( struct motif_arguments *map, stats_slot_t *stats, const sigset_t *sigchld )
+{
+    char path[PATH_MAX];
+    struct timespec now, next, timeout;
+    int running = map->task_count, status;
+    pid_t pid;
+
+    snprintf( path, sizeof(path), "%s/%s", map->trace_dir, STATS_FILE );
+    FILE *fp = fopen( path, "w" );
+    if( fp == NULL )
+    {
+        log_warn( "Could not create statistics file %s: %s", path, strerror(errno) );
+    }
+
+    time_now( &next );
+    next.tv_sec += map->interval;
+    while( running > 0 )
+    {
+        time_now( &now );
+        if( now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec >= next.tv_nsec) )
+        {
+            stats_sample( stats, map->task_count, fp );
+            next.tv_sec += map->interval;
+            continue;
+        }
+        time_delta( &now, &next, &timeout );
+        sigtimedwait( sigchld, NULL, &timeout );
+
+        while( running > 0 && (pid = waitpid( -1, &status, WNOHANG )) > 0 )
+        {
+            motif_reaped( pid, status );
+            running--;
+            if( motif_failed > 0 )
+            {
+                motif_fail( );
+            }
+        }
+    }
+
+    /* Report the final partial interval */
+    stats_sample( stats, map->task_count, fp );
+    if( fp != NULL )
+    {
+        fclose( fp );
+    }
+}
+
+/* Stop all tasks, eg when the coordinated run has been aborted */
+static void motif_abort( void )
+{
+    log_error( "Stopping all tasks" );
+    for( int i=0; i < motif_npids; i++ )
+    {
+        if( motif_pids[i] > 0 )
+        {
+            kill( motif_pids[i], SIGTERM );
+        }
+    }
+}
+
+/*
+ * Release the tasks from each barrier between phases once every task of every node
+ * has reached it.  The thread is only cancelled while it waits for the other nodes.
+ */
+static void *coord_motif( void *arg )
+{
+    pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, NULL );
+    for( unsigned g=0; g < MOTIF_NGATES; g++ )
+    {
+        if( barrier_wait( motif_barrier ) < 0 )
+        {
+            /* A task has failed: leave, so that the coordinator aborts the other nodes */
+            log_error( "Leaving the coordinated run at barrier %u", g );
+            coord_close( );
+            return NULL;
+        }
+        pthread_setcancelstate( PTHREAD_CANCEL_ENABLE, NULL );
+        const int released = coord_barrier( g );
+        pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, NULL );
+        if( released < 0 )
+        {
+            motif_abort( );
+            return NULL;
+        }
+        barrier_wait( motif_barrier );
+    }
+    return NULL;
+}
+
+/* Wait at a barrier between phases, in a coordinated run.  Returns -1 if the run has failed */
+static int motif_sync( const unsigned g )
+{
+    if( motif_gated && (barrier_wait( motif_barrier ) < 0 || barrier_wait( motif_barrier ) < 0) )
+    {
+        log_error( "Abandoning the run at barrier %u", g );
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Run the tasks of a single step of the benchmark, and wait for them to complete.
+ * The latency histograms and the statistics slots (replacing those of any earlier step)
+ * hold the results of the step.
+ */
+static int spawn_motif( struct motif_arguments *map, stats_slot_t **stats, const sigset_t *sigchld )
+{
+    char handle[NAME_MAX];
+    int status, ret;
+
+    for( unsigned i=0; i < TRACE_NTYPES; i++ )
+    {
+        histogram_init( &motif_hist[i] );
+    }
+
+    /* Every task reports its results through its statistics slot */
+    stats_destroy( *stats, stats_count );
+    if( (*stats = stats_create( map->task_count )) == NULL )
+    {
+        return -1;
+    }
+    stats_count = map->task_count;
+
+    /* Barriers are named for this process, so that instances on the same host are independent */
+    snprintf( handle, sizeof(handle), "/motif_1-%d", (int)getpid() );
+    if( (motif_barrier = barrier_init( handle, map->task_count + 1 )) == NULL )
+    {
+        log_error( "Could not create barrier %s", handle );
+        return -1;
+    }
+    barrier_set_spin( motif_barrier, map->barrier_spin * 1000ULL );
+    motif_gated = map->coord != NULL;
+
+    free( motif_pids );
+    if( (motif_pids = calloc( map->task_count, sizeof(pid_t) )) == NULL )
+    {
+        log_error( "Could not allocate state for %d tasks", map->task_count );
+        return -1;
+    }
+    motif_npids = map->task_count;
+
+    /* Spawn individual test tasks */
+    for( int i=0; i < map->task_count; i++ )
+    {
+        pid_t pid;
+        if( (pid = motif_pids[i] = fork()) == 0 ) {
+            sigprocmask( SIG_UNBLOCK, sigchld, NULL );
+            stats_attach( *stats, i );
+            exit( run_motif( map, motif_barrier, i ) );
+        }
+        if ( pid < 0 )
+        {
+            log_error( "fork failed - %d\n", pid );
+            return -1;
+        }
+    }
+
+    log_debug( "main waiting for barrier" );
+    barrier_wait( motif_barrier );
+    log_debug( "main passed barrier" );
+    time_now( &time_benchmark );
+
+    motif_coord_running = false;
+    if( map->coord != NULL )
+    {
+        if( (ret = pthread_create( &motif_coord_thread, NULL, coord_motif, NULL )) != 0 )
+        {
+            log_error( "pthread_create failed - %d", ret );
+            motif_abort( );
+            map->coord = NULL;
+        }
+        else
+        {
+            motif_coord_running = true;
+        }
+    }
+
+    if( map->interval > 0 )
+    {
+        monitor_motif( map, *stats, sigchld );
+    }
+
+    /* wait for tests to complete: tasks waiting for one which failed cannot be released */
+    while( (ret = wait( &status )) > 0 )
+    {
+        motif_reaped( ret, status );
+        if( motif_failed > 0 )
+        {
+            motif_fail( );
+        }
+    }
+    const int wait_errno = errno;
+
+    if( motif_coord_running )
+    {
+        void *exit_status;
+        pthread_join( motif_coord_thread, &exit_status );
+        motif_coord_running = false;
+
+        /* A cancelled thread may have left a message half sent: the run cannot be reported */
+        if( exit_status == PTHREAD_CANCELED )
+        {
+            log_error( "Leaving the coordinated run" );
+            coord_close( );
+            map->coord = NULL;
+        }
+    }
+    barrier_skew( motif_barrier, &motif_skew );
+    barrier_destroy( motif_barrier );
+    log_info( "Barrier release skew %.3fus (%u phases)", motif_skew.max / 1e3, motif_skew.phases );
+
+    errno = wait_errno;
+
+    if( errno != ECHILD )
+    {
+        log_debug( "error in wait() - %d", errno );
+        return -1;
+    }
+    return 0;
+}
+
+/* Save the latency histograms of all tasks, for merging with other runs */
+static int histogram_motif( const char *path )
+{
+    const char *hist_names[TRACE_NTYPES];
+    for( unsigned i=0; i < TRACE_NTYPES; i++ )
+    {
+        hist_names[i] = trace_type_str( i );
+    }
+    return histogram_write( path, hist_names, motif_hist, TRACE_NTYPES );
+}
+
+/*
+ * Step the number of tasks through the series of the sweep, until throughput saturates or
+ * tail latency exceeds the objective.  Each phase of a step is bounded in time, and the traces,
+ * statistics, histograms and summary of each step are kept in a directory of its own, named
+ * for its number of tasks.  The curve measured is saved for plotting.
+ */
+static int sweep_motif( struct motif_arguments *map, stats_slot_t **stats, const sigset_t *sigchld,
+                        const uint64_t run_id, const struct timespec *wall )
+{
+    char path[PATH_MAX], step_dir[PATH_MAX];
+    char *trace_dir = map->trace_dir;
+    unsigned tasks;
+
+    map->phase_time = motif_sweep.phase_time;
+    while( (tasks = sweep_next( &motif_sweep )) > 0 )
+    {
+        stats_result_t R[STATS_NPHASES];
+        uint64_t ops = 0, bytes = 0, p99 = 0;
+        int64_t first = INT64_MAX, last = 0;
+
+        snprintf( step_dir, sizeof(step_dir), "%s/sweep-%u", trace_dir, tasks );
+        if( mkdir( step_dir, 0755 ) < 0 && errno != EEXIST )
+        {
+            log_error( "Could not create sweep step directory %s: %s", step_dir, strerror(errno) );
+            return -1;
+        }
+        map->trace_dir = step_dir;
+        map->task_count = tasks;
+        const int spawned = spawn_motif( map, stats, sigchld );
+        if( spawned == 0 )
+        {
+            snprintf( path, sizeof(path), "%s/sweep-%u/%s", trace_dir, tasks, HISTOGRAM_FILE );
+            histogram_motif( path );
+            snprintf( path, sizeof(path), "%s/sweep-%u/%s", trace_dir, tasks, SUMMARY_FILE );
+            summary_motif( map, path, *stats, run_id, wall );
+        }
+        map->trace_dir = trace_dir;
+        if( spawned < 0 )
+        {
+            return -1;
+        }
+
+        /* Throughput over the union of the windows of both phases, and the worst p99 of either */
+        for( unsigned ph=0; ph < STATS_NPHASES; ph++ )
+        {
+            stats_result( *stats, tasks, ph, &R[ph] );
+            if( R[ph].workers == 0 )
+            {
+                continue;
+            }
+            ops += R[ph].ops;
+            bytes += R[ph].bytes;
+            if( R[ph].first < first )   first = R[ph].first;
+            if( R[ph].last > last )     last = R[ph].last;
+        }
+        const uint64_t p99_write = histogram_percentile( &motif_hist[TRACE_WRITE], 99.0 );
+        const uint64_t p99_read = histogram_percentile( &motif_hist[TRACE_READ], 99.0 );
+        p99 = p99_write > p99_read ? p99_write : p99_read;
+        const double secs = last > first ? (last - first) / 1e9 : 0.0;
+        const double iops = secs > 0.0 ? ops / secs : 0.0, bps = secs > 0.0 ? bytes / secs : 0.0;
+
+        log_info( "sweep: %4u tasks %10.0f ops/s %9.2f MiB/s p99 %9.1fus", tasks, iops,
+                  bps / 1048576.0, p99 / 1000.0 );
+        if( sweep_record( &motif_sweep, tasks, iops, bps, p99 ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    const sweep_point_t *knee = sweep_knee( &motif_sweep );
+    snprintf( path, sizeof(path), "%s/%s", trace_dir, SWEEP_FILE );
+    FILE *fp = fopen( path, "w" );
+    if( fp == NULL )
+    {
+        log_warn( "Could not create sweep file %s: %s", path, strerror(errno) );
+    }
+    else
+    {
+        fprintf( fp, "tasks,iops,mbytes_per_sec,p99_us,gain,within_slo,knee\n" );
+        for( unsigned i=0; i < motif_sweep.npt; i++ )
+        {
+            const sweep_point_t *pt = &motif_sweep.pt[i];
+            fprintf( fp, "%u,%.1f,%.3f,%.1f,%.4f,%d,%d\n", pt->tasks, pt->iops, pt->bytes_per_sec / 1048576.0,
+                     pt->p99 / 1000.0, pt->gain, pt->within_slo, pt == knee );
+        }
+        fclose( fp );
+    }
+
+    if( knee == NULL )
+    {
+        log_warn( "sweep: latency objective not met at %u tasks", motif_sweep.pt[0].tasks );
+    }
+    else
+    {
+        log_info( "sweep: knee at %u tasks: %.0f ops/s, %.2f MiB/s, p99 %.1fus%s", knee->tasks, knee->iops,
+                  knee->bytes_per_sec / 1048576.0, knee->p99 / 1000.0,
+                  motif_sweep.saturated ? "" : " (not saturated at the maximum concurrency)" );
+    }
+    return 0;
+}
+
+/*
+ * Prepare a read-only run from the manifest of the dataset: the objects are generated and sized
+ * as when they were written, and no objects are written by this run.
+ */
+static int load_motif( struct motif_arguments *map )
+{
+    char *storage_impl_str[] = 	STORAGE_IMPL_STR;
+    char *prng_impl_str[] = 	PRNG_IMPL_STR;
+    char *sample_impl_str[] = 	SAMPLE_IMPL_STR;
+
+    if( (motif_manifest = manifest_open( map->read_only )) == NULL )
+    {
+        return -1;
+    }
+    const manifest_hdr_t *H = motif_manifest->hdr;
+    if( H->storage >= sizeof(storage_impl_str) / sizeof(char *) - 1 ||
+        H->prng >= sizeof(prng_impl_str) / sizeof(char *) - 1 ||
+        H->sample >= sizeof(sample_impl_str) / sizeof(char *) - 1 ||
+        memchr( H->size, '\0', sizeof(H->size) ) == NULL )
+    {
+        log_error( "Manifest %s describes objects this build cannot read", map->read_only );
+        return -1;
+    }
+    if( H->storage != (uint32_t)map->storage )
+    {
+        log_error( "Manifest %s lists objects in %s storage: select it with -S", map->read_only,
+                   storage_impl_str[H->storage] );
+        return -1;
+    }
+
+    map->prng = H->prng;
+    map->sample = H->sample;
+    if( map->size == NULL && H->size[0] != '\0' )
+    {
+        map->size = (char *)H->size;
+    }
+    map->object_write_count = 0;
+    log_info( "Reading %lu objects (%lu bytes) written by %u tasks on %s, run %016lx",
+              (unsigned long)H->nobj, (unsigned long)H->bytes, H->tasks, H->host, (unsigned long)H->run_id );
+    return 0;
+}
+
+/*
+ * Complete the manifest of the objects kept by the run.  If any were not written, the dataset
+ * is incomplete: the manifest is removed, and so are the objects, where the driver can.
+ */
+static int keep_motif( struct motif_arguments *map, const stats_slot_t *stats, const uint64_t run_id )
+{
+    stats_result_t R;
+
+    stats_result( stats, map->task_count, STATS_PHASE_WRITE, &R );
+    if( motif_failed > 0 || R.errors > 0 )
+    {
+        log_error( "Dataset is incomplete (%u failed tasks, %lu failed writes): manifest %s removed",
+                   motif_failed, (unsigned long)R.errors, map->keep );
+        manifest_discard( motif_manifest );
+        motif_manifest = NULL;
+        storage_set_flags( map->storage_flags & ~STORAGE_KEEP );
+        return -1;
+    }
+
+    manifest_hdr_t H = {
+        .storage = map->storage, .sample = map->sample, .prng = map->prng, .seed = map->seed,
+        .node = motif_node, .tasks = map->task_count, .run_id = run_id
+    };
+    if( map->size != NULL )
+    {
+        strncpy( H.size, map->size, sizeof(H.size) - 1 );
+    }
+    const int ret = manifest_finish( motif_manifest, &H );
+    motif_manifest = NULL;
+    return ret;
+}
+
+/*
+ * Write a machine-readable summary of the run: its configuration and host, and the results
+ * gathered from all tasks through their statistics slots.
+ */
+static int summary_motif( struct motif_arguments *map, const char *path, const stats_slot_t *stats,
+                          const uint64_t run_id, const struct timespec *wall )
+{
+    char *storage_impl_str[] = 	STORAGE_IMPL_STR;
+    char *prng_impl_str[] = 	PRNG_IMPL_STR;
+    char *sample_impl_str[] = 	SAMPLE_IMPL_STR;
+    char *time_source_str[] =   TIME_SOURCE_STR;
+    char host[TRACE_HOST_LEN], started[32];
+    struct utsname un;
+    struct tm tm;
+
+    FILE *fp = fopen( path, "w" );
+    if( fp == NULL )
+    {
+        log_error( "Could not create summary file %s: %s", path, strerror(errno) );
+        return -1;
+    }
+
+    gmtime_r( &wall->tv_sec, &tm );
+    strftime( started, sizeof(started), "%Y-%m-%dT%H:%M:%SZ", &tm );
+    fprintf( fp, "{\n  \"version\": " );
+    json_str( fp, VERSION );
+    fprintf( fp, ",\n  \"run_id\": \"%016lx\",\n  \"started\": \"%s\",\n  \"failed_tasks\": %u,\n",
+             (unsigned long)run_id, started, motif_failed );
+    fprintf( fp, "  \"barrier\": {\"spin_us\": %u, \"phases\": %u, \"skew_max_ns\": %lu, \"skew_last_ns\": %lu},\n",
+             map->barrier_spin, motif_skew.phases, (unsigned long)motif_skew.max, (unsigned long)motif_skew.last );
+    if( map->coord != NULL )
+    {
+        fprintf( fp, "  \"coordinator\": " );
+        json_str( fp, map->coord );
+        fprintf( fp, ", \"node\": %u, \"nodes\": %u,\n", motif_node, motif_nodes );
+        fprintf( fp, "  \"clock_sync\": {\"offset_ns\": %ld, \"rtt_ns\": %lu, \"end_offset_ns\": %ld, "
+                 "\"end_rtt_ns\": %lu, \"drift_ppm\": %.3f},\n",
+                 (long)motif_clock[COORD_CLOCK_START].offset, (unsigned long)motif_clock[COORD_CLOCK_START].rtt,
+                 (long)motif_clock[COORD_CLOCK_END].offset, (unsigned long)motif_clock[COORD_CLOCK_END].rtt,
+                 coord_drift( &motif_clock[COORD_CLOCK_START], &motif_clock[COORD_CLOCK_END] ) );
+    }
+
+    fprintf( fp, "  \"config\": {\"prng\": \"%s\", \"seed\": %d, \"sample\": \"%s\", \"size\": ",
+             prng_impl_str[map->prng], map->seed, sample_impl_str[map->sample] );
+    json_str( fp, map->size != NULL ? map->size : "default" );
+    fprintf( fp, ", \"max_object_size\": %zu,\n    \"storage\": \"%s\", \"fsync\": %s, \"workspace\": ",
+             sample_size_max(), storage_impl_str[map->storage],
+             map->storage_flags & STORAGE_FSYNC ? "true" : "false" );
+    json_str( fp, map->workspace );
+    fprintf( fp, ", \"storage_args\": [" );
+    for( int i=0; i < map->forward_argc; i++ )
+    {
+        fprintf( fp, "%s", i ? ", " : "" );
+        json_str( fp, map->forward_argv[i] );
+    }
+    fprintf( fp, "],\n    \"buffers\": %u, \"hugepages\": %s, \"mlock\": %s, \"pipeline\": %u, \"chunk\": %zu,\n",
+             map->pool_count, map->pool_flags & SAMPLE_POOL_HUGEPAGE ? "true" : "false",
+             map->pool_flags & SAMPLE_POOL_LOCK ? "true" : "false", map->pipe_depth, map->chunk );
+    fprintf( fp, "    \"tracedir\": " );
+    json_str( fp, map->trace_dir );
+    fprintf( fp, ", \"tracebuf\": %u, \"spans\": %s, \"sampling\": ", map->trace_nent,
+             map->spans ? "true" : "false" );
+    json_str( fp, map->sampling );
+    fprintf( fp, ", \"clock\": \"%s\", \"interval\": %u,\n", time_source_str[time_source], map->interval );
+    if( map->keep != NULL || map->read_only != NULL )
+    {
+        fprintf( fp, "    \"%s\": ", map->keep != NULL ? "keep" : "read_only" );
+        json_str( fp, map->keep != NULL ? map->keep : map->read_only );
+        fprintf( fp, ",\n" );
+    }
+    if( map->replay != NULL )
+    {
+        fprintf( fp, "    \"replay\": " );
+        json_str( fp, map->replay );
+        fprintf( fp, ", \"timing\": " );
+        json_str( fp, map->replay_timing );
+        fprintf( fp, ", \"streams\": %u, \"replay_reads\": %lu, \"replay_writes\": %lu, \"preloaded\": %lu,\n",
+                 motif_replay.nstream, (unsigned long)motif_replay.nread, (unsigned long)motif_replay.nwrite,
+                 (unsigned long)motif_replay.npreload );
+    }
+    if( map->sweep != NULL )
+    {
+        fprintf( fp, "    \"sweep\": " );
+        json_str( fp, map->sweep );
+        fprintf( fp, ", \"phase_time\": %g,\n", map->phase_time );
+    }
+    fprintf( fp, "    \"write_count\": %u, \"read_count\": %u, \"tasks\": %d},\n",
+             map->object_write_count, map->object_read_count, map->task_count );
+
+    if( gethostname( host, sizeof(host) - 1 ) < 0 )
+    {
+        strcpy( host, "unknown" );
+    }
+    host[sizeof(host) - 1] = '\0';
+    fprintf( fp, "  \"host\": {\"name\": " );
+    json_str( fp, host );
+    if( uname( &un ) == 0 )
+    {
+        fprintf( fp, ", \"os\": " );
+        json_str( fp, un.sysname );
+        fprintf( fp, ", \"release\": " );
+        json_str( fp, un.release );
+        fprintf( fp, ", \"machine\": " );
+        json_str( fp, un.machine );
+    }
+    fprintf( fp, ", \"cpus\": %ld, \"memory\": %llu},\n", sysconf( _SC_NPROCESSORS_ONLN ),
+             (unsigned long long)sysconf( _SC_PHYS_PAGES ) * (unsigned long long)sysconf( _SC_PAGESIZE ) );
+
+    stats_summary( fp, stats, map->task_count, motif_hist );
+    fprintf( fp, "\n}\n" );
+
+    if( fclose( fp ) != 0 )
+    {
+        log_error( "Could not write summary file %s: %s", path, strerror(errno) );
+        return -1;
+    }
+    log_info( "Summary written to %s", path );
+    return 0;
+}
 
 int main( int argc, char *argv[] )
 {
     struct motif_arguments motif_arguments;
-    int status, ret;
-    barrier_t *bp;
+    stats_slot_t *stats = NULL;
+    sigset_t sigchld;
 
     time_now( &time_start );
     argp_parse( &argp, argc, argv, 0, 0, &motif_arguments );
 
     log_set_level( motif_arguments.verbosity );
 
+    /* Identify the traces of all tasks in this run: in a coordinated run, of all nodes */
+    struct timespec wall;
+    clock_gettime( CLOCK_REALTIME, &wall );
+    uint64_t run_id = ((uint64_t)wall.tv_sec << 32) ^ (uint64_t)wall.tv_nsec ^ (uint64_t)getpid();
+    if( motif_arguments.coord != NULL )
+    {
+        if( motif_arguments.sweep != NULL )
+        {
+            log_error( "A concurrency sweep cannot be coordinated across nodes" );
+            return 1;
+        }
+        if( coord_connect( motif_arguments.coord, motif_arguments.task_count, &motif_node, &motif_nodes, &run_id ) < 0 ||
+            coord_clock( &motif_clock[COORD_CLOCK_START] ) < 0 )
+        {
+            return 1;
+        }
+        trace_set_clock_offset( motif_clock[COORD_CLOCK_START].offset, motif_clock[COORD_CLOCK_START].rtt );
+    }
+    trace_set_run_id( run_id );
+
+    /* A read-only run generates and sizes its objects as the run which wrote them */
+    if( motif_arguments.read_only != NULL && load_motif( &motif_arguments ) < 0 )
+    {
+        return 1;
+    }
+
     log_debug( "Arguments:" );
     log_debug( "  sample = %d", motif_arguments.sample );
+    log_debug( "  size = %s", motif_arguments.size ? motif_arguments.size : "default" );
     log_debug( "  prng = %d", motif_arguments.prng );
     log_debug( "  storage = %d", motif_arguments.storage );
     log_debug( "  workspace = %s", motif_arguments.workspace );
     log_debug( "  trace_dir = %s", motif_arguments.trace_dir );
+    log_debug( "  trace_nent = %u", motif_arguments.trace_nent );
+    log_debug( "  interval = %u", motif_arguments.interval );
+    log_debug( "  spans = %d", motif_arguments.spans );
+    log_debug( "  sampling = %s", motif_arguments.sampling );
+    log_debug( "  clock = %d", motif_arguments.clock );
+    log_debug( "  storage flags = 0x%x", motif_arguments.storage_flags );
     log_debug( "  write count = %d", motif_arguments.object_write_count );
     log_debug( "  read count = %d", motif_arguments.object_read_count );
     log_debug( "  task_count = %d", motif_arguments.task_count );
+    log_debug( "  sweep = %s", motif_arguments.sweep ? motif_arguments.sweep : "none" );
+    log_debug( "  coordinator = %s", motif_arguments.coord ? motif_arguments.coord : "none" );
+    log_debug( "  keep = %s", motif_arguments.keep ? motif_arguments.keep : "none" );
+    log_debug( "  read only = %s", motif_arguments.read_only ? motif_arguments.read_only : "none" );
+    log_debug( "  replay = %s (%s)", motif_arguments.replay ? motif_arguments.replay : "none",
+               motif_arguments.replay_timing );
     log_debug( "  seed = %d", motif_arguments.seed );
+    log_debug( "  run id = %016lx", (unsigned long)run_id );
 
     log_debug( "  forward arguments:" );
     for( int i=0; i<motif_arguments.forward_argc; i++)
@@ -229,6 +1066,53 @@ int main( int argc, char *argv[] )
 
     sample_select( motif_arguments.sample );
     storage_select( motif_arguments.storage );
+    storage_set_flags( motif_arguments.storage_flags );
+    storage_set_clean_threads( motif_arguments.clean_threads );
+    trace_set_spans( motif_arguments.spans );
+    time_source_select( motif_arguments.clock );
+
+    /* Configure object sizes before any sample or storage driver buffers are allocated */
+    if( motif_arguments.size != NULL && sample_size_parse( motif_arguments.size ) < 0 )
+    {
+        return -1;
+    }
+    log_debug( "  max object size = %zu", sample_size_max() );
+    if( motif_manifest != NULL && sample_size_max() < motif_manifest->hdr->max_len )
+    {
+        log_error( "Objects of up to %lu bytes in manifest %s do not fit samples of %zu bytes",
+                   (unsigned long)motif_manifest->hdr->max_len, motif_arguments.read_only, sample_size_max() );
+        return 1;
+    }
+
+    /* A replay is shared between the tasks of all nodes, and takes the place of both phases */
+    if( motif_arguments.replay != NULL )
+    {
+        if( replay_load( &motif_replay, motif_arguments.replay, motif_nodes * motif_arguments.task_count ) < 0 )
+        {
+            return 1;
+        }
+        if( motif_replay.max_len > sample_size_max() )
+        {
+            log_error( "Objects of up to %lu bytes in trace %s do not fit samples of %zu bytes: "
+                       "select a size distribution reaching it with -z", (unsigned long)motif_replay.max_len,
+                       motif_arguments.replay, sample_size_max() );
+            return 1;
+        }
+        if( motif_arguments.pipe_depth > 0 )
+        {
+            log_warn( "Samples of a replay are generated and validated inline: -q is ignored" );
+            motif_arguments.pipe_depth = 0;
+        }
+        motif_arguments.object_write_count = motif_arguments.object_read_count = 0;
+    }
+    log_debug( "  buffer pool = %u (flags 0x%x)", motif_arguments.pool_count, motif_arguments.pool_flags );
+    log_debug( "  pipeline depth = %u", motif_arguments.pipe_depth );
+    log_debug( "  chunk = %zu", motif_arguments.chunk );
+    if( motif_arguments.chunk > 0 && !storage_streams( ) )
+    {
+        log_error( "The storage driver cannot write and read objects in chunks: -Z needs DIRTREE storage" );
+        return 1;
+    }
 
 
     const int result = storage_driver_create( motif_arguments.workspace,
@@ -239,42 +1123,259 @@ int main( int argc, char *argv[] )
         return -1;
     }
 
-    bp = barrier_init( "/motif_1", motif_arguments.task_count + 1 );
+    if( (motif_hist = histogram_shared_create( TRACE_NTYPES )) == NULL )
+    {
+        return -1;
+    }
+    if( motif_arguments.keep != NULL &&
+        (motif_manifest = manifest_create( motif_arguments.keep, motif_arguments.task_count,
+                                           motif_arguments.object_write_count )) == NULL )
+    {
+        return 1;
+    }
+    sigemptyset( &sigchld );
+    sigaddset( &sigchld, SIGCHLD );
+    if( motif_arguments.interval > 0 )
+    {
+        sigprocmask( SIG_BLOCK, &sigchld, NULL );
+    }
 
-    /* Spawn individual test tasks */
-    for( int i=0; i < motif_arguments.task_count; i++ )
+    if( motif_arguments.sweep != NULL )
     {
-        pid_t pid;
-        if( (pid = fork()) == 0 ) {
-            return( run_motif( &motif_arguments, bp, i ) );
-        }
-        if ( pid < 0 )
+        if( sweep_motif( &motif_arguments, &stats, &sigchld, run_id, &wall ) < 0 )
         {
-            log_error( "fork failed - %d\n", pid );
             return 1;
         }
     }
+    else if( spawn_motif( &motif_arguments, &stats, &sigchld ) < 0 )
+    {
+        return 1;
+    }
+    if( motif_arguments.keep != NULL )
+    {
+        keep_motif( &motif_arguments, stats, run_id );
+    }
 
-    log_debug( "main waiting for barrier" );
-    barrier_wait( bp );
-    log_debug( "main passed barrier" );
+    /* Report latencies across all tasks, and save them for merging with other runs */
+    char hist_path[PATH_MAX], summary_path[PATH_MAX];
+    for( unsigned i=0; i < TRACE_NTYPES; i++ )
+    {
+        histogram_report( trace_type_str( i ), &motif_hist[i] );
+    }
+    snprintf( hist_path, sizeof(hist_path), "%s/%s", motif_arguments.trace_dir, HISTOGRAM_FILE );
+    snprintf( summary_path, sizeof(summary_path), "%s/%s", motif_arguments.trace_dir, SUMMARY_FILE );
+    const int hist_ok = histogram_motif( hist_path );
 
-    /* wait for tests to complete */
-    while( (ret = wait( &status )) > 0 )
+    /* Measure the offset again, to estimate the drift of the clock over the run */
+    if( motif_arguments.coord != NULL && coord_clock( &motif_clock[COORD_CLOCK_END] ) == 0 )
     {
-        log_debug( "reaped child - %d", ret );
+        const double drift = coord_drift( &motif_clock[COORD_CLOCK_START], &motif_clock[COORD_CLOCK_END] );
+        log_info( "Clock offset from coordinator %+.3fus (round trip %.3fus), drift %.3f ppm",
+                  motif_clock[COORD_CLOCK_START].offset / 1e3, motif_clock[COORD_CLOCK_START].rtt / 1e3, drift );
     }
+    const int summary_ok = summary_motif( &motif_arguments, summary_path, stats, run_id, &wall );
 
-    if( errno != ECHILD )
+    /* Report to the coordinator, with the files from which the results of all nodes are merged */
+    if( motif_arguments.coord != NULL )
     {
-        log_debug( "error in wait() - %d", errno );
-        return 1;
+        coord_result_t R = { .tasks = motif_arguments.task_count, .failed = motif_failed };
+        const char *paths[COORD_NFILES] = { summary_ok == 0 ? summary_path : NULL,
+                                            hist_ok == 0 ? hist_path : NULL };
+        for( unsigned ph=0; ph < STATS_NPHASES; ph++ )
+        {
+            stats_result( stats, motif_arguments.task_count, ph, &R.phase[ph] );
+        }
+        memcpy( R.clock, motif_clock, sizeof(R.clock) );
+        coord_report( &R, paths );
+        coord_close( );
     }
+    histogram_shared_destroy( motif_hist, TRACE_NTYPES );
+    time_source_check( );
+    stats_destroy( stats, stats_count );
+    sweep_fini( &motif_sweep );
+    manifest_close( motif_manifest );
+    replay_free( &motif_replay );
 
     storage_driver_destroy( );
     return 0;
 }
 
+/* Whether a phase which started at start has run for its time (never, if phases are not bounded) */
+static bool motif_expired( const struct motif_arguments *map, const struct timespec *start )
+{
+    struct timespec now, elapsed;
+
+    if( map->phase_time <= 0.0 )
+    {
+        return false;
+    }
+    time_now( &now );
+    time_delta( start, &now, &elapsed );
+    return elapsed.tv_sec + elapsed.tv_nsec / 1e9 >= map->phase_time;
+}
+
+/*
+ * The object read by a task as the i'th of its reads: one which it wrote, or in a read-only run,
+ * one of the dataset.  The tasks of all nodes read the dataset between them, each taking every
+ * readers'th object of the manifest from its own offset, however many tasks wrote it.
+ */
+static unsigned object_motif( const struct motif_arguments *map, const int ordinal, const uint32_t *obj_id,
+                              const unsigned written, const unsigned i, uint32_t *client_id, uint32_t *id )
+{
+    if( map->read_only == NULL )
+    {
+        const unsigned obj_idx = i % written;       /* FIXME: randomise selection? */
+        *client_id = ordinal;
+        *id = obj_id[obj_idx];
+        return obj_idx;
+    }
+
+    const uint64_t readers = (uint64_t)motif_nodes * map->task_count;
+    const uint64_t reader = (uint64_t)motif_node * map->task_count + ordinal;
+    const uint64_t obj_idx = (reader + i * readers) % motif_manifest->nobj;
+    *client_id = motif_manifest->obj[obj_idx].client_id;
+    *id = motif_manifest->obj[obj_idx].obj_id;
+    return obj_idx;
+}
+
+/*
+ * Create the objects which the streams of a replay shared out to this task read before they
+ * write them.  This is set up before the replay starts: it is neither traced nor counted.
+ */
+static int preload_motif( const unsigned g, sample_t *S, prng_t *O )
+{
+    stats_slot_t *self = stats_self;
+    const uint64_t first = motif_replay.preload_first[g], last = motif_replay.preload_first[g + 1];
+
+    stats_self = NULL;
+    for( uint64_t i=first; i < last; i++ )
+    {
+        const replay_op_t *op = &motif_replay.preload[i];
+        prng_init( O, op->obj_id );
+        if( op->len > 0 )   sample_init_len( S, O, op->len );
+        else                sample_init( S, O );
+        if( storage_write( op->client_id, op->obj_id, S ) < 0 )
+        {
+            stats_self = self;
+            return -1;
+        }
+    }
+    stats_self = self;
+    if( last > first )
+    {
+        log_info( "Created %lu objects to be read by the replay", (unsigned long)(last - first) );
+    }
+    return 0;
+}
+
+/*
+ * Replay the operations of the streams shared out to this task, each at its time in the trace
+ * divided by the speed, or as fast as possible if the speed is 0.  Operations which fall due
+ * while the task is busy are issued at once, and the lag behind the trace is reported.
+ */
+static void replay_motif( struct motif_arguments *map, const unsigned g, sample_t *S, prng_t *O,
+                          struct timespec *ts_end )
+{
+    const uint64_t first = motif_replay.op_first[g], last = motif_replay.op_first[g + 1];
+    const int64_t start_ns = (int64_t)time_benchmark.tv_sec * 1000000000LL + time_benchmark.tv_nsec;
+    uint64_t lag_sum = 0, lag_max = 0;
+    struct timespec ts_delta;
+
+    for( uint64_t i=first; i < last; i++ )
+    {
+        const replay_op_t *op = &motif_replay.op[i];
+        if( map->replay_speed > 0.0 )
+        {
+            struct timespec now;
+            const int64_t due = start_ns + (int64_t)(op->when / map->replay_speed);
+            time_now( &now );
+            const int64_t now_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+            if( now_ns < due )
+            {
+                const struct timespec at = { .tv_sec = due / 1000000000LL, .tv_nsec = due % 1000000000LL };
+                while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL ) == EINTR )
+                    ;
+            }
+            else
+            {
+                const uint64_t lag = now_ns - due;
+                lag_sum += lag;
+                if( lag > lag_max )     lag_max = lag;
+            }
+        }
+
+        prng_init( O, op->obj_id );
+        if( op->op == TRACE_WRITE )
+        {
+            if( op->len > 0 )   sample_init_len( S, O, op->len );
+            else                sample_init( S, O );
+            storage_write( op->client_id, op->obj_id, S );
+        }
+        else if( storage_read( op->client_id, op->obj_id, S ) == 0 &&
+                 !(op->len > 0 ? sample_valid_len( S, O, op->len ) : sample_valid( S, O )) )
+        {
+            log_error( "Object %08x-%08x is not valid", op->client_id, op->obj_id );
+            stats_invalid( 1 );
+        }
+    }
+
+    /* Reads and writes are interleaved: each is reported over the whole replay */
+    time_now( ts_end );
+    stats_phase( STATS_PHASE_WRITE, &time_benchmark, ts_end );
+    stats_phase( STATS_PHASE_READ, &time_benchmark, ts_end );
+    time_delta( &time_benchmark, ts_end, &ts_delta );
+    const double ops_per_sec = (last - first) / ((double)ts_delta.tv_sec + (double)ts_delta.tv_nsec / 1000000000.0);
+    log_info( "Replayed %lu operations in %ld.%03lds = %g operations/second", (unsigned long)(last - first),
+            ts_delta.tv_sec, ts_delta.tv_nsec / 1000000l, ops_per_sec );
+    if( map->replay_speed > 0.0 && last > first )
+    {
+        log_info( "Lag behind the trace: mean %.3fms, max %.3fms", lag_sum / 1e6 / (last - first), lag_max / 1e6 );
+    }
+}
+
+/*
+ * Remove the objects created by the streams of a replay shared out to this task (the latest
+ * version of each written, and all those overwritten), where the storage driver leaves that to
+ * its workers.  Objects are removed in batches of those created by the same stream.
+ */
+#define MOTIF_REMOVE_BATCH 256
+
+static int replay_remove_motif( const unsigned g )
+{
+    const replay_op_t *lists[] = { motif_replay.preload, motif_replay.op };
+    const uint64_t *firsts[] = { motif_replay.preload_first, motif_replay.op_first };
+    uint32_t batch[MOTIF_REMOVE_BATCH], client_id = 0;
+    unsigned n = 0;
+    int removed = 0, ret;
+
+    for( unsigned l=0; l < ARRAYLEN(lists); l++ )
+    {
+        for( uint64_t i=firsts[l][g]; i <= firsts[l][g + 1]; i++ )
+        {
+            const replay_op_t *op = i < firsts[l][g + 1] ? &lists[l][i] : NULL;
+            if( op != NULL && op->op != TRACE_WRITE )
+            {
+                continue;
+            }
+            if( n > 0 && (op == NULL || op->client_id != client_id || n == MOTIF_REMOVE_BATCH) )
+            {
+                if( (ret = storage_worker_remove( client_id, batch, n )) < 0 )
+                {
+                    return -1;
+                }
+                removed += ret;
+                n = 0;
+            }
+            if( op != NULL )
+            {
+                client_id = op->client_id;
+                batch[n++] = op->obj_id;
+            }
+        }
+    }
+    return removed;
+}
+
 /*
  * Control function for execution of the requested motif. 
  */
@@ -282,7 +1383,12 @@ int
 run_motif( struct motif_arguments *map, barrier_t *bp, const int ordinal )
 {
     uint32_t *obj_id;
-    struct timespec ts_read, ts_write, ts_delta;
+    struct timespec ts_read, ts_write, ts_start_read, ts_delta;
+    sample_pipe_t *Q = NULL;
+    sample_t *S = NULL;
+    sample_stream_t *T = NULL;
+    void *chunk = NULL;
+    unsigned written = 0, reads = 0;
 
     log_debug( "child: ordinal %d", ordinal );
 
@@ -296,21 +1402,49 @@ run_motif( struct motif_arguments *map, barrier_t *bp, const int ordinal )
     }
 
     log_debug( "ord %d waiting for barrier", ordinal );
-    barrier_wait( bp );
+    if( barrier_wait( bp ) < 0 )
+    {
+        return -1;
+    }
     log_debug( "ord %d passed barrier", ordinal );
 
     obj_id = malloc( map->object_write_count * sizeof(uint32_t) );
-    if( obj_id == NULL )
+    if( obj_id == NULL && map->object_write_count > 0 )
     {
         log_error( "Could not alloc seed vector for %u objects", map->object_write_count );
         return -1;
     }
 
     /* Application setup and early configuration */
-    trace_init( map->trace_dir, ordinal );
     prng_select( map->prng );
-    prng_t *P = prng_create( map->seed );
-    sample_t *S = sample_create( P );
+    prng_t *P = prng_create( map->seed );           /* Sequence of object IDs */
+    prng_t *O = prng_create( 0 );                   /* Contents of each object, seeded by ID */
+
+    /* One sample for inline use, plus one for each stage of the pipeline, or a working buffer
+     * through which objects are streamed */
+    if( map->chunk > 0 )
+    {
+        T = sample_stream_create( );
+        if( T == NULL || posix_memalign( &chunk, SAMPLE_ALIGN, map->chunk ) != 0 )
+        {
+            log_error( "Could not allocate a working buffer of %zu bytes", map->chunk );
+            return -1;
+        }
+    }
+    else
+    {
+        const unsigned pool_count = map->pool_count > map->pipe_depth ? map->pool_count : map->pipe_depth + 1;
+        if( sample_pool_init( pool_count, map->pool_flags ) < 0 )
+        {
+            return -1;
+        }
+        S = sample_create( O );
+    }
+    if( map->pipe_depth > 0 && (Q = sample_pipe_create( map->pipe_depth )) == NULL )
+    {
+        log_error( "Could not create sample pipeline of depth %u", map->pipe_depth );
+        return -1;
+    }
 
     const int result = storage_worker_create( map->workspace, map->forward_argc, map->forward_argv );
     if( result < 0 )
@@ -318,44 +1452,186 @@ run_motif( struct motif_arguments *map, barrier_t *bp, const int ordinal )
         return -1;
     }
 
+    /* The trace starts once any objects a replay needs have been created */
+    const unsigned g = motif_node * map->task_count + ordinal;
+    if( map->replay != NULL && preload_motif( g, S, O ) < 0 )
+    {
+        return -1;
+    }
+    if( map->trace_nent > 0 )
+    {
+        trace_set_size( map->trace_nent );
+    }
+    trace_init( map->trace_dir, ordinal );
+
     /* Synchronise and start the benchmark */
+    if( motif_sync( COORD_BARRIER_START ) < 0 )
+    {
+        return -1;
+    }
     time_now( &time_benchmark );
+    time_benchmark_tick = time_tick( );
 
-    /* Write out phase */
-    for( unsigned i=0; i < map->object_write_count; i++ )
+    /* Write out phase, listing the objects in the manifest if they are kept (none if read-only),
+     * or a replay in place of both phases.  Phases bounded in time end early when it is up. */
+    if( map->replay != NULL )
     {
-        obj_id[i] = prng_peek(P);
-        sample_init( S, P );
-        storage_write( ordinal, obj_id[i], S );
+        replay_motif( map, g, S, O, &ts_write );
     }
+    else if( map->read_only != NULL )
+    {
+        ts_write = time_benchmark;
+    }
+    else
+    {
+        if( Q != NULL )
+        {
+            sample_pipe_generate( Q, P, map->object_write_count );
+            for( unsigned i=0; i < map->object_write_count && !motif_expired( map, &time_benchmark ); i++ )
+            {
+                sample_t *QS = sample_pipe_take( Q, &obj_id[i] );
+                storage_write( ordinal, obj_id[i], QS );
+                if( map->keep != NULL )
+                {
+                    manifest_record( motif_manifest, ordinal, i, ordinal, obj_id[i], sample_len( QS ) );
+                }
+                sample_pipe_release( Q );
+                written++;
+            }
+            sample_pipe_finish( Q );
+        }
+        else if( T != NULL )
+        {
+            for( unsigned i=0; i < map->object_write_count && !motif_expired( map, &time_benchmark ); i++ )
+            {
+                obj_id[i] = prng_next( P );
+                prng_init( O, obj_id[i] );
+                sample_stream_init( T, O );
+                storage_write_stream( ordinal, obj_id[i], T, chunk, map->chunk );
+                written++;
+            }
+        }
+        else
+        {
+            for( unsigned i=0; i < map->object_write_count && !motif_expired( map, &time_benchmark ); i++ )
+            {
+                obj_id[i] = prng_next( P );
+                prng_init( O, obj_id[i] );
+                sample_init( S, O );
+                storage_write( ordinal, obj_id[i], S );
+                if( map->keep != NULL )
+                {
+                    manifest_record( motif_manifest, ordinal, i, ordinal, obj_id[i], sample_len( S ) );
+                }
+                written++;
+            }
+        }
 
-    time_now( &ts_write );
-    time_delta( &time_benchmark, &ts_write, &ts_delta );
-    const float writes_per_sec = (float)map->object_write_count / ((float)ts_delta.tv_sec + (float)ts_delta.tv_nsec / 1000000000.0);
-    log_info( "Wrote %u objects in %ld.%03lds = %g objects/second", map->object_write_count,
-            ts_delta.tv_sec, ts_delta.tv_nsec / 1000000l, writes_per_sec );
+        time_now( &ts_write );
+        stats_phase( STATS_PHASE_WRITE, &time_benchmark, &ts_write );
+        time_delta( &time_benchmark, &ts_write, &ts_delta );
+        const double writes_per_sec = written / ((double)ts_delta.tv_sec + (double)ts_delta.tv_nsec / 1000000000.0);
+        log_info( "Wrote %u objects in %ld.%03lds = %g objects/second", written,
+                ts_delta.tv_sec, ts_delta.tv_nsec / 1000000l, writes_per_sec );
+    }
 
 
-    /* Read back phase */
-    prng_init( P, map->seed );
-    for( unsigned i=0; i < map->object_read_count; i++ )
+    /* Read back phase, starting on all nodes together in a coordinated run */
+    if( motif_sync( COORD_BARRIER_READ ) < 0 )
+    {
+        return -1;
+    }
+    ts_start_read = ts_write;
+    if( map->coord != NULL )
+    {
+        time_now( &ts_start_read );
+    }
+    const unsigned to_read = map->read_only != NULL || written > 0 ? map->object_read_count : 0;
+    if( Q != NULL )
+    {
+        sample_pipe_validate( Q );
+        for( ; reads < to_read && !motif_expired( map, &ts_start_read ); reads++ )
+        {
+            uint32_t client_id, id;
+            const unsigned obj_idx = object_motif( map, ordinal, obj_id, written, reads, &client_id, &id );
+            storage_read( client_id, id, sample_pipe_slot( Q ) );
+            sample_pipe_submit( Q, id, obj_idx );
+        }
+    }
+    else if( T != NULL )
     {
-        const unsigned obj_idx = i % map->object_write_count;           /* FIXME: randomise selection? */
-        prng_init( P, obj_id[obj_idx] );
-        storage_read( ordinal, obj_id[obj_idx], S );
-        if( !sample_valid( S, P ) )
+        for( ; reads < to_read && !motif_expired( map, &ts_start_read ); reads++ )
         {
-            log_error( "Object %d is not valid", obj_idx );
+            uint32_t client_id, id;
+            bool valid;
+            const unsigned obj_idx = object_motif( map, ordinal, obj_id, written, reads, &client_id, &id );
+            prng_init( O, id );
+            sample_stream_init( T, O );
+            storage_read_stream( client_id, id, T, chunk, map->chunk, &valid );
+            if( !valid )
+            {
+                log_error( "Object %d is not valid", obj_idx );
+                stats_invalid( 1 );
+            }
+        }
+    }
+    else
+    {
+        for( ; reads < to_read && !motif_expired( map, &ts_start_read ); reads++ )
+        {
+            uint32_t client_id, id;
+            const unsigned obj_idx = object_motif( map, ordinal, obj_id, written, reads, &client_id, &id );
+            prng_init( O, id );
+            storage_read( client_id, id, S );
+            if( !sample_valid( S, O ) )
+            {
+                log_error( "Object %d is not valid", obj_idx );
+                stats_invalid( 1 );
+            }
         }
     }
 
     time_now( &ts_read );
-    time_delta( &ts_write, &ts_read, &ts_delta );
-    const float reads_per_sec = (float)map->object_read_count / ((float)ts_delta.tv_sec + (float)ts_delta.tv_nsec / 1000000000.0);
-    log_info( "Read %u objects in %ld.%03lds = %g objects/second", map->object_read_count,
-            ts_delta.tv_sec, ts_delta.tv_nsec / 1000000l, reads_per_sec );
+    if( Q != NULL )
+    {
+        /* Complete validation of the final objects outside the timed phase */
+        stats_invalid( sample_pipe_finish( Q ) );
+    }
+    if( map->replay == NULL )
+    {
+        stats_phase( STATS_PHASE_READ, &ts_start_read, &ts_read );
+        time_delta( &ts_start_read, &ts_read, &ts_delta );
+        const double reads_per_sec = reads / ((double)ts_delta.tv_sec + (double)ts_delta.tv_nsec / 1000000000.0);
+        log_info( "Read %u objects in %ld.%03lds = %g objects/second", reads,
+                ts_delta.tv_sec, ts_delta.tv_nsec / 1000000l, reads_per_sec );
+    }
 
     trace_fini( );
+    for( unsigned i=0; i < TRACE_NTYPES; i++ )
+    {
+        histogram_merge( &motif_hist[i], trace_histogram( i ) );
+    }
+
+    /* Remove the objects written, where the storage driver leaves that to its workers */
+    struct timespec ts_start_remove, ts_remove;
+    time_now( &ts_start_remove );
+    const int removed = map->replay != NULL ? replay_remove_motif( g ) :
+                        storage_worker_remove( ordinal, obj_id, written );
+    time_now( &ts_remove );
+    if( removed > 0 )
+    {
+        time_delta( &ts_start_remove, &ts_remove, &ts_delta );
+        const double removes_per_sec = removed / ((double)ts_delta.tv_sec + (double)ts_delta.tv_nsec / 1000000000.0);
+        log_info( "Removed %d objects in %ld.%03lds = %g objects/second", removed,
+                ts_delta.tv_sec, ts_delta.tv_nsec / 1000000l, removes_per_sec );
+    }
     storage_worker_destroy( );
+    sample_pipe_destroy( Q );
+    sample_destroy( S );
+    sample_stream_destroy( T );
+    free( chunk );
+    sample_pool_fini( );
+    prng_destroy( O );
+    prng_destroy( P );
     return 0;
 }
@@ -53,11 +53,26 @@ sample_t *sample_init( sample_t *S, prng_t *P )
     return sample->sample_init( S, P );
 }
 
+sample_t *sample_init_len( sample_t *S, prng_t *P, const size_t len )
+{
+    return sample->sample_init_len( S, P, len );
+}
+
 void sample_read( sample_t *S, const void *data, const size_t len )
 {
     sample->sample_read( S, data, len );
 }
 
+void *sample_buffer( sample_t *S, const size_t cap )
+{
+    return sample->sample_buffer( S, cap );
+}
+
+void sample_commit( sample_t *S, const size_t len )
+{
+    sample->sample_commit( S, len );
+}
+
 void sample_fini( sample_t *S )
 {
     sample->sample_fini( S );
@@ -68,6 +83,11 @@ bool sample_valid( sample_t *S, prng_t *P )
     return sample->sample_valid( S, P );
 }
 
+bool sample_valid_len( sample_t *S, prng_t *P, const size_t len )
+{
+    return sample->sample_valid_len( S, P, len );
+}
+
 size_t sample_len( sample_t *S )
 {
     return sample->sample_len( S );
@@ -77,3 +97,36 @@ void const *sample_data( sample_t *S )
 {
     return sample->sample_data( S );
 }
+
+/*------------------------------------------------------------------------------------------------*/
+/* Streaming access to sample data */
+
+sample_stream_t *sample_stream_create( void )
+{
+    return sample->sample_stream_create( );
+}
+
+void sample_stream_destroy( sample_stream_t *T )
+{
+    sample->sample_stream_destroy( T );
+}
+
+size_t sample_stream_init( sample_stream_t *T, prng_t *P )
+{
+    return sample->sample_stream_init( T, P );
+}
+
+size_t sample_stream_generate( sample_stream_t *T, void *buf, const size_t len )
+{
+    return sample->sample_stream_generate( T, buf, len );
+}
+
+bool sample_stream_valid( sample_stream_t *T, const void *buf, const size_t len )
+{
+    return sample->sample_stream_valid( T, buf, len );
+}
+
+size_t sample_stream_remain( sample_stream_t *T )
+{
+    return sample->sample_stream_remain( T );
+}
@@ -17,18 +17,19 @@
 /*------------------------------------------------------------------------------------------------*/
 /* Simple implementation of data object samples for debug */
 
-/* NOTE: sample_debug_len_max must be an integral number of uint32_t words.  We depend on this. */
-static const size_t sample_debug_len_min = SAMPLE_LEN_MAX/2, sample_debug_len_max = SAMPLE_LEN_MAX;
+/* Object lengths are drawn from the selected size distribution (see sample_size.c).
+ * NOTE: the data buffer is always an integral number of uint32_t words.  We depend on this. */
 
 struct sample_s
 {
     size_t len;
+    size_t cap;                 /* Allocated length of data, in bytes */
     uint32_t *data;
 };
 
 static size_t sample_debug_len_calc( prng_t *P )
 {
-    return prng_next(P) % (sample_debug_len_max - sample_debug_len_min) + sample_debug_len_min;
+    return sample_size_next( P );
 }
 
 
@@ -36,10 +37,10 @@ static size_t sample_debug_len_calc( prng_t *P )
 
 /* Initialise and finalise a pre-allocated sample object */
 /* Initialise can be used to reset a sample to a seed value */
-static sample_t *sample_debug_init( sample_t *S, prng_t *P )
+static sample_t *sample_debug_init_len( sample_t *S, prng_t *P, const size_t len )
 {
-    S->len = sample_debug_len_calc( P );
-    assert( S->len <= sample_debug_len_max );       /* Paranoia */
+    S->len = len;
+    assert( S->len <= S->cap );                     /* Paranoia */
 
     const unsigned whole_words = S->len / sizeof(uint32_t);
     const unsigned remain = S->len % sizeof(uint32_t);
@@ -48,24 +49,40 @@ static sample_t *sample_debug_init( sample_t *S, prng_t *P )
         S->data[i] = prng_next( P );
 
     /* Write a final word if there was a non-zero byte remainder */
-    /* NOTE: we depend on sample_debug_len_max being a unit number of uint32_t words */
+    /* NOTE: we depend on the buffer capacity being a unit number of uint32_t words */
     if( remain ) S->data[whole_words] = prng_next( P );
 
     return S;
 }
 
+static sample_t *sample_debug_init( sample_t *S, prng_t *P )
+{
+    return sample_debug_init_len( S, P, sample_debug_len_calc( P ) );
+}
+
 static void sample_debug_read( sample_t *S, const void *data, const size_t len )
 {
-    assert( len <= SAMPLE_LEN_MAX );
+    assert( len <= S->cap );
     S->len = len;
     memcpy( S->data, data, len );
 }
 
+/* Lend the sample data buffer for storage drivers to read into directly */
+static void *sample_debug_buffer( sample_t *S, const size_t cap )
+{
+    return cap <= S->cap ? (void *)S->data : NULL;
+}
+
+static void sample_debug_commit( sample_t *S, const size_t len )
+{
+    assert( len <= S->cap );
+    S->len = len;
+}
+
 /* Compare a sample value with the PRNG sequence that generated it. */
-static bool sample_debug_valid( sample_t *S, prng_t *P )
+static bool sample_debug_valid_len( sample_t *S, prng_t *P, const size_t valid_len )
 {
     /* NOTE: the PRNG sequence must be applied in the same order as upon init */
-    const size_t valid_len = sample_debug_len_calc( P );
     if( S->len != valid_len )
     {
         log_error( "Length mismatch: Wanted %zd, got %zd", valid_len, S->len );
@@ -87,7 +104,7 @@ static bool sample_debug_valid( sample_t *S, prng_t *P )
 
     /* Check the final word if there was a non-zero byte remainder */
 
-    /* NOTE: we depend on sample_debug_len_max being a unit number of uint32_t words */
+    /* NOTE: we depend on the buffer capacity being a unit number of uint32_t words */
     if( remain )
     {
         /* We can't use the same method as in buffer init: overspill space will not be read in */
@@ -105,6 +122,11 @@ static bool sample_debug_valid( sample_t *S, prng_t *P )
     return true;
 }
 
+static bool sample_debug_valid( sample_t *S, prng_t *P )
+{
+    return sample_debug_valid_len( S, P, sample_debug_len_calc( P ) );
+}
+
 static void sample_debug_fini( sample_t *S )
 {
     /* Retain the memory allocated on fini, in case it is reused by a subsequent call to init */
@@ -118,7 +140,9 @@ static sample_t *sample_debug_create( prng_t *P )
     sample_t *S = malloc( sizeof(struct sample_s) );
     if( S != NULL )
     {
-        S->data = malloc( sample_debug_len_max );       /* Always alloc the max, for reuse */
+        /* Always alloc the max, for reuse, rounded up to whole words */
+        S->cap = (sample_size_max() + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+        S->data = sample_pool_alloc( S->cap );
         if( S->data != NULL )
         {
             sample_debug_init( S, P );
@@ -140,7 +164,7 @@ static void sample_debug_destroy( sample_t *S )
     {
         if( S->data != NULL )                           /* Defensive */
         {
-            free( S->data );
+            sample_pool_free( S->data );
         }
         free( S );
     }
@@ -156,6 +180,106 @@ static const void *sample_debug_data( sample_t *S )
     return S->data;
 }
 
+/*------------------------------------------------------------------------------------------------*/
+/* Streaming generation and validation.
+ * The byte stream matches sample_debug_init: one PRNG word per 4 bytes, with the final word
+ * truncated.  Chunk boundaries need not fall on word boundaries. */
+
+#define SAMPLE_DEBUG_STREAM_WORDS   1024        /* Scratch space for validation */
+
+struct sample_stream_s
+{
+    prng_t *P;
+    size_t len;                 /* Total length of the object */
+    size_t remain;              /* Bytes still to generate or validate */
+    uint32_t word;              /* Word split across a chunk boundary */
+    unsigned used;              /* Bytes of word already consumed (0 if none pending) */
+};
+
+static sample_stream_t *sample_debug_stream_create( void )
+{
+    return calloc( 1, sizeof(struct sample_stream_s) );
+}
+
+static void sample_debug_stream_destroy( sample_stream_t *T )
+{
+    free( T );
+}
+
+static size_t sample_debug_stream_init( sample_stream_t *T, prng_t *P )
+{
+    T->P = P;
+    T->len = T->remain = sample_debug_len_calc( P );
+    T->used = 0;
+    return T->len;
+}
+
+static size_t sample_debug_stream_generate( sample_stream_t *T, void *buf, const size_t len )
+{
+    uint8_t *out = buf;
+    const uint8_t *word = (const uint8_t *)&T->word;
+    const size_t n = len < T->remain ? len : T->remain;
+    size_t i = 0;
+
+    /* Complete a word left part-way through by the previous chunk */
+    while( T->used != 0 && i < n )
+    {
+        out[i++] = word[T->used++];
+        if( T->used == sizeof(uint32_t) )   T->used = 0;
+    }
+
+    for( ; i + sizeof(uint32_t) <= n; i += sizeof(uint32_t) )
+    {
+        const uint32_t w = prng_next( T->P );
+        memcpy( out + i, &w, sizeof(uint32_t) );
+    }
+
+    /* Start a new word if the chunk ends part-way through it */
+    if( i < n )
+    {
+        T->word = prng_next( T->P );
+        while( i < n )
+        {
+            out[i++] = word[T->used++];
+        }
+    }
+
+    T->remain -= n;
+    return n;
+}
+
+static bool sample_debug_stream_valid( sample_stream_t *T, const void *buf, const size_t len )
+{
+    uint32_t check[SAMPLE_DEBUG_STREAM_WORDS];
+    const uint8_t *in = buf;
+    size_t done = 0;
+
+    if( len > T->remain )
+    {
+        log_error( "Length mismatch: Wanted %zd, got at least %zd", T->len, T->len - T->remain + len );
+        return false;
+    }
+
+    while( done < len )
+    {
+        const size_t offset = T->len - T->remain;
+        const size_t n = sample_debug_stream_generate( T, check,
+                                  len - done < sizeof(check) ? len - done : sizeof(check) );
+        if( memcmp( check, in + done, n ) != 0 )
+        {
+            log_error( "Data mismatch in %zd-byte chunk at offset %zd", n, offset );
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+static size_t sample_debug_stream_remain( sample_stream_t *T )
+{
+    return T->remain;
+}
+
 /*------------------------------------------------------------------------------------------------*/
 /* Sample methods for this implementation */
 
@@ -164,9 +288,19 @@ sample_driver_t sample_debug =
     .sample_create = sample_debug_create,
     .sample_destroy = sample_debug_destroy,
     .sample_init = sample_debug_init,
+    .sample_init_len = sample_debug_init_len,
     .sample_read = sample_debug_read,
+    .sample_buffer = sample_debug_buffer,
+    .sample_commit = sample_debug_commit,
     .sample_fini = sample_debug_fini,
     .sample_valid = sample_debug_valid,
+    .sample_valid_len = sample_debug_valid_len,
     .sample_len = sample_debug_len,
     .sample_data = sample_debug_data,
+    .sample_stream_create = sample_debug_stream_create,
+    .sample_stream_destroy = sample_debug_stream_destroy,
+    .sample_stream_init = sample_debug_stream_init,
+    .sample_stream_generate = sample_debug_stream_generate,
+    .sample_stream_valid = sample_debug_stream_valid,
+    .sample_stream_remain = sample_debug_stream_remain,
 };
@@ -0,0 +1,275 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Pipelined generation and validation of sample objects.
+ * A helper thread generates upcoming samples while the current one is being written, or
+ * validates samples after they have been read, keeping the PRNG off the I/O critical path. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "sample.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+/* Each slot holds one sample object and the seed from which its contents were generated */
+typedef struct sample_slot
+{
+    sample_t *S;
+    uint32_t seed;              /* PRNG seed for this object's contents */
+    unsigned idx;               /* Caller's index for this object, for reporting */
+} sample_slot_t;
+
+/* The slots form a single-producer single-consumer ring:
+ * - Write: the helper thread fills slots and the I/O thread drains them.
+ * - Read: the I/O thread fills slots and the helper thread drains them. */
+struct sample_pipe_s
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;               /* Helper thread has been started */
+    bool stop;                  /* Pipeline is being stopped */
+
+    sample_slot_t *slot;
+    unsigned depth;             /* Number of slots */
+    unsigned head;              /* Next slot to fill */
+    unsigned tail;              /* Next slot to drain */
+    unsigned count;             /* Number of filled slots */
+
+    prng_t *P;                  /* Sequence of object seeds (write) */
+    prng_t *O;                  /* Per-object content sequence */
+    unsigned todo;              /* Samples still to generate (write) */
+    unsigned invalid;           /* Samples that failed validation (read) */
+};
+
+/* Wait until the producer may fill a slot, or NULL if the pipeline is being stopped */
+static sample_slot_t *sample_pipe_wait_free( sample_pipe_t *Q )
+{
+    sample_slot_t *slot = NULL;
+    pthread_mutex_lock( &Q->lock );
+    while( Q->count == Q->depth && !Q->stop )
+    {
+        pthread_cond_wait( &Q->cond, &Q->lock );
+    }
+    if( !Q->stop )
+    {
+        slot = &Q->slot[Q->head];
+    }
+    pthread_mutex_unlock( &Q->lock );
+    return slot;
+}
+
+/* Hand a filled slot to the consumer */
+static void sample_pipe_fill( sample_pipe_t *Q )
+{
+    pthread_mutex_lock( &Q->lock );
+    Q->head = (Q->head + 1) % Q->depth;
+    Q->count++;
+    pthread_cond_signal( &Q->cond );
+    pthread_mutex_unlock( &Q->lock );
+}
+
+/* Wait until the consumer has a filled slot to use, or NULL if the producer has stopped */
+static sample_slot_t *sample_pipe_wait_full( sample_pipe_t *Q )
+{
+    sample_slot_t *slot = NULL;
+    pthread_mutex_lock( &Q->lock );
+    while( Q->count == 0 && !Q->stop )
+    {
+        pthread_cond_wait( &Q->cond, &Q->lock );
+    }
+    if( Q->count > 0 )
+    {
+        slot = &Q->slot[Q->tail];
+    }
+    pthread_mutex_unlock( &Q->lock );
+    return slot;
+}
+
+/* Return a drained slot to the producer */
+static void sample_pipe_drain( sample_pipe_t *Q )
+{
+    pthread_mutex_lock( &Q->lock );
+    Q->tail = (Q->tail + 1) % Q->depth;
+    Q->count--;
+    pthread_cond_signal( &Q->cond );
+    pthread_mutex_unlock( &Q->lock );
+}
+
+/* Helper thread for the write phase: generate samples ahead of the I/O thread */
+static void *sample_pipe_producer( void *arg )
+{
+    sample_pipe_t *Q = arg;
+
+    for( unsigned i=0; i < Q->todo; i++ )
+    {
+        sample_slot_t *slot = sample_pipe_wait_free( Q );
+        if( slot == NULL )
+        {
+            break;
+        }
+        slot->seed = prng_next( Q->P );
+        slot->idx = i;
+        prng_init( Q->O, slot->seed );
+        sample_init( slot->S, Q->O );
+        sample_pipe_fill( Q );
+    }
+    return NULL;
+}
+
+/* Helper thread for the read phase: validate samples after the I/O thread has read them */
+static void *sample_pipe_consumer( void *arg )
+{
+    sample_pipe_t *Q = arg;
+    sample_slot_t *slot;
+
+    while( (slot = sample_pipe_wait_full( Q )) != NULL )
+    {
+        prng_init( Q->O, slot->seed );
+        if( !sample_valid( slot->S, Q->O ) )
+        {
+            log_error( "Object %u is not valid", slot->idx );
+            Q->invalid++;
+        }
+        sample_pipe_drain( Q );
+    }
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+/* Create a pipeline of depth sample objects */
+sample_pipe_t *sample_pipe_create( const unsigned depth )
+{
+    sample_pipe_t *Q = calloc( 1, sizeof(struct sample_pipe_s) );
+    if( Q == NULL )
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init( &Q->lock, NULL );
+    pthread_cond_init( &Q->cond, NULL );
+
+    Q->depth = depth;
+    Q->slot = calloc( depth, sizeof(sample_slot_t) );
+    Q->O = prng_create( 0 );
+    if( Q->slot == NULL || Q->O == NULL )
+    {
+        sample_pipe_destroy( Q );
+        return NULL;
+    }
+    for( unsigned i=0; i < depth; i++ )
+    {
+        if( (Q->slot[i].S = sample_create( Q->O )) == NULL )
+        {
+            sample_pipe_destroy( Q );
+            return NULL;
+        }
+    }
+    return Q;
+}
+
+void sample_pipe_destroy( sample_pipe_t *Q )
+{
+    if( Q != NULL )
+    {
+        if( Q->running )
+        {
+            sample_pipe_finish( Q );
+        }
+        if( Q->slot != NULL )
+        {
+            for( unsigned i=0; i < Q->depth; i++ )
+            {
+                if( Q->slot[i].S != NULL )      sample_destroy( Q->slot[i].S );
+            }
+            free( Q->slot );
+        }
+        if( Q->O != NULL )
+        {
+            prng_destroy( Q->O );
+        }
+        pthread_mutex_destroy( &Q->lock );
+        pthread_cond_destroy( &Q->cond );
+        free( Q );
+    }
+}
+
+/* Reset the ring and start a helper thread */
+static int sample_pipe_start( sample_pipe_t *Q, void *(*fn)( void * ) )
+{
+    Q->head = Q->tail = Q->count = 0;
+    Q->invalid = 0;
+    Q->stop = false;
+
+    const int ret = pthread_create( &Q->thread, NULL, fn, Q );
+    if( ret != 0 )
+    {
+        log_error( "pthread_create failed - %d", ret );
+        return -1;
+    }
+    Q->running = true;
+    return 0;
+}
+
+/* Write: start generating count samples, seeded in turn from the sequence P.
+ * NOTE: P is used by the helper thread until sample_pipe_finish */
+int sample_pipe_generate( sample_pipe_t *Q, prng_t *P, const unsigned count )
+{
+    Q->P = P;
+    Q->todo = count;
+    return sample_pipe_start( Q, sample_pipe_producer );
+}
+
+/* Write: take the next generated sample, and the seed from which it was generated */
+sample_t *sample_pipe_take( sample_pipe_t *Q, uint32_t *seed )
+{
+    sample_slot_t *slot = sample_pipe_wait_full( Q );
+    *seed = slot->seed;
+    return slot->S;
+}
+
+/* Write: return the sample taken, once it has been written */
+void sample_pipe_release( sample_pipe_t *Q )
+{
+    sample_pipe_drain( Q );
+}
+
+/* Read: start validating samples as they are submitted */
+int sample_pipe_validate( sample_pipe_t *Q )
+{
+    return sample_pipe_start( Q, sample_pipe_consumer );
+}
+
+/* Read: obtain a sample to read the next object into */
+sample_t *sample_pipe_slot( sample_pipe_t *Q )
+{
+    return sample_pipe_wait_free( Q )->S;
+}
+
+/* Read: submit the sample for validation against the seed of its contents */
+void sample_pipe_submit( sample_pipe_t *Q, const uint32_t seed, const unsigned idx )
+{
+    sample_slot_t *slot = &Q->slot[Q->head];
+    slot->seed = seed;
+    slot->idx = idx;
+    sample_pipe_fill( Q );
+}
+
+/* Wait for the helper thread to complete, returning the number of invalid samples */
+unsigned sample_pipe_finish( sample_pipe_t *Q )
+{
+    if( Q->running )
+    {
+        pthread_mutex_lock( &Q->lock );
+        Q->stop = true;
+        pthread_cond_signal( &Q->cond );
+        pthread_mutex_unlock( &Q->lock );
+
+        pthread_join( Q->thread, NULL );
+        Q->running = false;
+    }
+    return Q->invalid;
+}
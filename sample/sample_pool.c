@@ -0,0 +1,181 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Pool of sample data buffers.
+ * Each worker allocates its sample buffers once, from a single page-aligned arena that can be
+ * backed by huge pages and pre-faulted, so that page faults do not appear in I/O latencies. */
+/* Begun 2019, StackHPC Ltd */
+
+#define _DEFAULT_SOURCE                 /* For MAP_ANONYMOUS, MAP_HUGETLB and madvise */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "utils.h"
+#include "sample.h"
+#include "sample_priv.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+#define SAMPLE_POOL_HUGE_SIZE   (2UL << 20)     /* Assumed huge page size for MAP_HUGETLB */
+
+#define ROUNDUP(x, a)           (((x) + (a) - 1) / (a) * (a))
+
+static struct
+{
+    uint8_t *arena;             /* Base of mapped arena (NULL if no pool) */
+    size_t arena_len;           /* Length of mapping */
+    size_t stride;              /* Length of each buffer, a multiple of SAMPLE_ALIGN */
+    unsigned count;             /* Number of buffers in the arena */
+    unsigned nfree;             /* Number of entries on the free stack */
+    unsigned *free;             /* Stack of free buffer indices */
+} pool;
+
+/* Create a pool of count buffers, each large enough for the largest sample */
+/* NOTE: must be called after the size distribution has been selected */
+int sample_pool_init( const unsigned count, const unsigned flags )
+{
+    if( pool.arena != NULL )
+    {
+        sample_pool_fini( );
+    }
+    if( count == 0 )
+    {
+        return 0;
+    }
+
+    /* A large buffer count or object size must not wrap the arena length, once rounded up */
+    const size_t page = (size_t)sysconf( _SC_PAGESIZE );
+    if( sample_size_max() > SIZE_MAX - SAMPLE_ALIGN ||
+        count > (SIZE_MAX - SAMPLE_POOL_HUGE_SIZE - page) / ROUNDUP( sample_size_max() ? sample_size_max() : 1, SAMPLE_ALIGN ) )
+    {
+        log_error( "Sample pool of %u buffers of %zu bytes is too large", count, sample_size_max() );
+        return -1;
+    }
+    pool.stride = ROUNDUP( sample_size_max() ? sample_size_max() : 1, SAMPLE_ALIGN );
+    pool.arena_len = ROUNDUP( pool.stride * count, page );
+    pool.arena = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if( flags & SAMPLE_POOL_HUGEPAGE )
+    {
+        /* Explicit huge pages need to be reserved by the administrator: fall back if not */
+        const size_t huge_len = ROUNDUP( pool.arena_len, SAMPLE_POOL_HUGE_SIZE );
+        pool.arena = mmap( NULL, huge_len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if( pool.arena != MAP_FAILED )
+        {
+            pool.arena_len = huge_len;
+            log_debug( "Sample pool of %u x %zu bytes in huge pages", count, pool.stride );
+        }
+        else
+        {
+            log_debug( "No huge pages available (%s), using transparent huge pages", strerror(errno) );
+        }
+    }
+#endif
+
+    if( pool.arena == MAP_FAILED )
+    {
+        pool.arena = mmap( NULL, pool.arena_len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if( pool.arena == MAP_FAILED )
+        {
+            log_error( "Could not map %zu bytes for sample pool: %s", pool.arena_len, strerror(errno) );
+            pool.arena = NULL;
+            return -1;
+        }
+#ifdef MADV_HUGEPAGE
+        if( flags & SAMPLE_POOL_HUGEPAGE )
+        {
+            madvise( pool.arena, pool.arena_len, MADV_HUGEPAGE );
+        }
+#endif
+    }
+
+    pool.free = malloc( count * sizeof(unsigned) );
+    if( pool.free == NULL )
+    {
+        log_error( "Insufficient memory for sample pool of %u buffers", count );
+        munmap( pool.arena, pool.arena_len );
+        pool.arena = NULL;
+        return -1;
+    }
+    pool.count = pool.nfree = count;
+    for( unsigned i=0; i < count; i++ )
+    {
+        pool.free[i] = count - 1 - i;           /* Hand out buffers in address order */
+    }
+
+    /* Pre-fault the arena, so that the first accesses to each buffer do not take page faults */
+    if( flags & SAMPLE_POOL_LOCK )
+    {
+        if( mlock( pool.arena, pool.arena_len ) < 0 )
+        {
+            log_warn( "Could not lock %zu bytes of sample pool: %s", pool.arena_len, strerror(errno) );
+            memset( pool.arena, 0, pool.arena_len );
+        }
+    }
+    else
+    {
+        memset( pool.arena, 0, pool.arena_len );
+    }
+    return 0;
+}
+
+/* Release the pool arena.  Samples allocated from the pool must have been destroyed. */
+void sample_pool_fini( void )
+{
+    if( pool.arena != NULL )
+    {
+        if( pool.nfree != pool.count )
+        {
+            log_warn( "Sample pool released with %u buffers in use", pool.count - pool.nfree );
+        }
+        munmap( pool.arena, pool.arena_len );
+        free( pool.free );
+        memset( &pool, 0, sizeof(pool) );
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+/* Allocate an aligned buffer of at least len bytes, from the pool if one is configured (NULL
+ * if it has no buffer free, or none large enough), or otherwise from the heap.
+ * NOTE: the pool is not thread-safe: buffers should be allocated during worker setup. */
+void *sample_pool_alloc( const size_t len )
+{
+    if( pool.arena != NULL )
+    {
+        if( len > pool.stride || pool.nfree == 0 )
+        {
+            log_error( "No sample buffer of %zu bytes free in the pool of %u", len, pool.count );
+            return NULL;
+        }
+        return pool.arena + pool.free[--pool.nfree] * pool.stride;
+    }
+
+    /* Without a pool, use the heap, with the same alignment */
+    void *buf;
+    if( posix_memalign( &buf, SAMPLE_ALIGN, ROUNDUP( len ? len : 1, SAMPLE_ALIGN ) ) != 0 )
+    {
+        return NULL;
+    }
+    return buf;
+}
+
+void sample_pool_free( void *buf )
+{
+    uint8_t *b = buf;
+    if( pool.arena != NULL && b >= pool.arena && b < pool.arena + pool.stride * pool.count )
+    {
+        pool.free[pool.nfree++] = (b - pool.arena) / pool.stride;
+    }
+    else
+    {
+        free( buf );
+    }
+}
@@ -15,17 +15,34 @@ typedef struct
     /* Initialise and finalise a pre-allocated SAMPLE object */
     /* Initialise can be used to reset a SAMPLE to a seed value */
     sample_t *(*sample_init)( sample_t *S, prng_t *P );
+    sample_t *(*sample_init_len)( sample_t *S, prng_t *P, const size_t len );
     void (*sample_read)( sample_t *S, const void *data, const size_t len );
+    void *(*sample_buffer)( sample_t *S, const size_t cap );
+    void (*sample_commit)( sample_t *S, const size_t len );
     void (*sample_fini)( sample_t *S );
 
     bool (*sample_valid)( sample_t *S, prng_t *P );
+    bool (*sample_valid_len)( sample_t *S, prng_t *P, const size_t len );
 
     size_t (*sample_len)( sample_t *S );
 
     const void *(*sample_data)( sample_t *S );
 
+    /* Streaming generation and validation */
+    sample_stream_t *(*sample_stream_create)( void );
+    void (*sample_stream_destroy)( sample_stream_t *T );
+    size_t (*sample_stream_init)( sample_stream_t *T, prng_t *P );
+    size_t (*sample_stream_generate)( sample_stream_t *T, void *buf, const size_t len );
+    bool (*sample_stream_valid)( sample_stream_t *T, const void *buf, const size_t len );
+    size_t (*sample_stream_remain)( sample_stream_t *T );
+
 } sample_driver_t;
 
+/* Allocate and release aligned data buffers, from the sample pool if one is configured (NULL
+ * once all its buffers are in use), or otherwise from the heap */
+extern void *sample_pool_alloc( const size_t len );
+extern void sample_pool_free( void *buf );
+
 /* Sample implementations */
 extern sample_driver_t sample_debug;
 
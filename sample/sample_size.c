@@ -0,0 +1,316 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Object size distributions for pseudo-random sample objects.
+ * The length of each sample is drawn from the PRNG sequence that generates its content,
+ * so that it can be regenerated for validation from the same seed. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+
+#include "utils.h"
+#include "sample.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+/* Standard normal quantile at p=0.99, used to fit a log-normal to a median and p99 */
+#define SAMPLE_SIZE_Z99         2.3263478740
+
+#ifndef M_PI
+#define M_PI                    3.14159265358979323846
+#endif
+
+/* A log-normal distribution is unbounded: clamp to a multiple of p99 unless told otherwise */
+#define SAMPLE_SIZE_LOGN_CAP    4
+
+/* One bin of an empirical size histogram: sizes are uniform within (previous edge, edge] */
+typedef struct sample_size_bin
+{
+    size_t edge;                /* Upper bound of this bin, in bytes */
+    double cdf;                 /* Cumulative weight, normalised to 1.0 */
+} sample_size_bin_t;
+
+static struct
+{
+    sample_size_dist_t dist;
+    size_t min, max;            /* Bounds on all sizes generated */
+    double mu, sigma;           /* Log-normal parameters */
+    sample_size_bin_t *bins;    /* Empirical histogram */
+    unsigned nbins;
+} sz =
+{
+    .dist = SAMPLE_SIZE_UNIFORM,
+    .min = SAMPLE_LEN_MAX/2,
+    .max = SAMPLE_LEN_MAX,
+};
+
+/* Convert a PRNG draw into a double in the open interval (0,1) */
+static double sample_size_unit( prng_t *P )
+{
+    return ((double)prng_next( P ) + 0.5) / 4294967296.0;
+}
+
+/* Draw an integer uniformly in [0, range) from two PRNG values, so that sizes are not limited
+ * to 32 bits.  Draws from the incomplete final multiple of range are rejected, so that the
+ * result is not biased towards small values. */
+static uint64_t sample_size_range( prng_t *P, const uint64_t range )
+{
+    const uint64_t limit = -range % range;          /* 2^64 mod range */
+    uint64_t r;
+    do
+    {
+        r = (uint64_t)prng_next( P ) << 32;
+        r |= prng_next( P );
+    }
+    while( r < limit );
+    return r % range;
+}
+
+/* Parse a byte count with an optional binary suffix (K, M, G) */
+static int sample_size_bytes( const char *str, size_t *len )
+{
+    char *end;
+    errno = 0;
+    const unsigned long long val = strtoull( str, &end, 10 );
+    if( errno != 0 || end == str )
+    {
+        return -1;
+    }
+
+    unsigned long long scale = 1;
+    switch( *end )
+    {
+        case 'k': case 'K':     scale = 1ULL << 10;     end++; break;
+        case 'm': case 'M':     scale = 1ULL << 20;     end++; break;
+        case 'g': case 'G':     scale = 1ULL << 30;     end++; break;
+        default:                                        break;
+    }
+    if( *end != '\0' && *end != ':' )
+    {
+        return -1;
+    }
+    if( val > SIZE_MAX / scale )
+    {
+        log_error( "Size '%.*s' is too large", (int)(end - str), str );
+        return -1;
+    }
+    *len = (size_t)(val * scale);
+    return 0;
+}
+
+/* Load an empirical histogram: one "SIZE WEIGHT" pair per line, in increasing order of size */
+static int sample_size_load( const char *path )
+{
+    FILE *fp = fopen( path, "r" );
+    if( fp == NULL )
+    {
+        log_error( "Could not open size histogram %s: %s", path, strerror(errno) );
+        return -1;
+    }
+
+    char line[256];
+    unsigned lineno = 0, nalloc = 0;
+    double total = 0.0;
+    size_t prev = 0;
+
+    free( sz.bins );
+    sz.bins = NULL;
+    sz.nbins = 0;
+
+    while( fgets( line, sizeof(line), fp ) != NULL )
+    {
+        char size_str[64];
+        double weight;
+
+        lineno++;
+        if( line[0] == '#' || line[strspn( line, " \t\r\n" )] == '\0' )
+        {
+            continue;
+        }
+        if( sscanf( line, "%63s %lf", size_str, &weight ) != 2 || weight < 0.0 )
+        {
+            log_error( "%s:%u: expected SIZE WEIGHT", path, lineno );
+            fclose( fp );
+            return -1;
+        }
+
+        size_t edge;
+        if( sample_size_bytes( size_str, &edge ) < 0 || edge < prev )
+        {
+            log_error( "%s:%u: bad or decreasing size '%s'", path, lineno, size_str );
+            fclose( fp );
+            return -1;
+        }
+
+        if( sz.nbins == nalloc )
+        {
+            nalloc = nalloc ? nalloc * 2 : 32;
+            sample_size_bin_t *bins = realloc( sz.bins, nalloc * sizeof(sample_size_bin_t) );
+            if( bins == NULL )
+            {
+                log_error( "Insufficient memory for size histogram %s", path );
+                fclose( fp );
+                return -1;
+            }
+            sz.bins = bins;
+        }
+
+        total += weight;
+        sz.bins[sz.nbins].edge = prev = edge;
+        sz.bins[sz.nbins].cdf = total;
+        sz.nbins++;
+    }
+    fclose( fp );
+
+    if( sz.nbins == 0 || total <= 0.0 )
+    {
+        log_error( "Size histogram %s has no weighted entries", path );
+        return -1;
+    }
+    for( unsigned i=0; i < sz.nbins; i++ )
+    {
+        sz.bins[i].cdf /= total;
+    }
+    sz.min = 0;
+    sz.max = sz.bins[sz.nbins-1].edge;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+/* Configure the object size distribution from a specification string:
+ *   fixed:LEN
+ *   uniform:MIN:MAX                    (MAX exclusive, the default is 768:1536)
+ *   lognormal:MEDIAN:P99[:MAX]
+ *   histogram:FILE */
+int sample_size_parse( const char *spec )
+{
+    static const char *dist_str[] = SAMPLE_SIZE_STR;
+    const char *arg = strchr( spec, ':' );
+    const size_t dist_len = arg ? (size_t)(arg - spec) : strlen( spec );
+    size_t v[3] = { 0, 0, 0 };
+    unsigned nv = 0;
+    int dist = -1;
+
+    for( unsigned i=0; dist_str[i] != NULL; i++ )
+    {
+        if( strlen( dist_str[i] ) == dist_len && strncasecmp( dist_str[i], spec, dist_len ) == 0 )
+        {
+            dist = i;
+        }
+    }
+    if( dist < 0 || arg == NULL )
+    {
+        log_error( "Unrecognised size distribution '%s'", spec );
+        return -1;
+    }
+    arg++;
+
+    if( dist == SAMPLE_SIZE_HISTOGRAM )
+    {
+        if( sample_size_load( arg ) < 0 )
+        {
+            return -1;
+        }
+        sz.dist = SAMPLE_SIZE_HISTOGRAM;
+        return 0;
+    }
+
+    /* Remaining distributions take a colon-separated list of byte counts */
+    while( nv < ARRAYLEN(v) )
+    {
+        if( sample_size_bytes( arg, &v[nv++] ) < 0 )
+        {
+            log_error( "Bad size parameter in '%s'", spec );
+            return -1;
+        }
+        if( (arg = strchr( arg, ':' )) == NULL )
+        {
+            break;
+        }
+        arg++;
+    }
+
+    switch( dist )
+    {
+        case SAMPLE_SIZE_FIXED:
+            if( nv != 1 )       break;
+            sz.min = sz.max = v[0];
+            sz.dist = SAMPLE_SIZE_FIXED;
+            return 0;
+
+        case SAMPLE_SIZE_UNIFORM:
+            if( nv != 2 || v[1] <= v[0] )       break;
+            sz.min = v[0];
+            sz.max = v[1];
+            sz.dist = SAMPLE_SIZE_UNIFORM;
+            return 0;
+
+        case SAMPLE_SIZE_LOGNORMAL:
+            if( nv < 2 || v[0] == 0 || v[1] <= v[0] )      break;
+            if( nv == 3 && v[2] < v[1] )                    break;
+            if( nv == 2 && v[1] > SIZE_MAX / SAMPLE_SIZE_LOGN_CAP )  break;
+            sz.mu = log( (double)v[0] );
+            sz.sigma = (log( (double)v[1] ) - sz.mu) / SAMPLE_SIZE_Z99;
+            sz.min = 1;
+            sz.max = nv == 3 ? v[2] : v[1] * SAMPLE_SIZE_LOGN_CAP;
+            sz.dist = SAMPLE_SIZE_LOGNORMAL;
+            return 0;
+    }
+
+    log_error( "Invalid parameters for size distribution '%s'", spec );
+    return -1;
+}
+
+/* Draw the length of the next sample object from the PRNG sequence.
+ * NOTE: each distribution consumes a fixed number of values from the sequence, except for the
+ * rare rejected draws of a uniform range (see sample_size_range). */
+size_t sample_size_next( prng_t *P )
+{
+    switch( sz.dist )
+    {
+        case SAMPLE_SIZE_FIXED:
+            return sz.max;
+
+        case SAMPLE_SIZE_UNIFORM:
+        default:
+            return sample_size_range( P, sz.max - sz.min ) + sz.min;
+
+        case SAMPLE_SIZE_LOGNORMAL:
+        {
+            /* Box-Muller transform of two uniform draws */
+            const double u1 = sample_size_unit( P ), u2 = sample_size_unit( P );
+            const double z = sqrt( -2.0 * log( u1 ) ) * cos( 2.0 * M_PI * u2 );
+            const double len = exp( sz.mu + sz.sigma * z );
+            if( len < (double)sz.min )  return sz.min;
+            if( len > (double)sz.max )  return sz.max;
+            return (size_t)len;
+        }
+
+        case SAMPLE_SIZE_HISTOGRAM:
+        {
+            /* Select a bin by cumulative weight, then a size uniformly within it */
+            const double u = sample_size_unit( P );
+            unsigned lo = 0, hi = sz.nbins - 1;
+            while( lo < hi )
+            {
+                const unsigned mid = (lo + hi) / 2;
+                if( sz.bins[mid].cdf < u )      lo = mid + 1;
+                else                            hi = mid;
+            }
+            const size_t base = lo ? sz.bins[lo-1].edge : 0;
+            const size_t span = sz.bins[lo].edge - base;
+            return span ? base + 1 + sample_size_range( P, span ) : base;
+        }
+    }
+}
+
+/* Largest sample length that the current distribution can generate */
+size_t sample_size_max( void )
+{
+    return sz.max;
+}
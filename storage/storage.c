@@ -5,6 +5,7 @@
 /* Begun 2018-2019, StackHPC Ltd */
 
 #include "utils.h"
+#include "stats.h"
 #include "storage.h"
 #include "storage_priv.h"
 
@@ -13,6 +14,8 @@
 /* Pointer to storage implementation selected */
 static storage_driver_t *storage = &storage_debug;
 
+unsigned storage_flags = 0;
+
 /* storage implementation selector */
 void storage_select( storage_impl_t impl )
 {
@@ -33,6 +36,16 @@ void storage_select( storage_impl_t impl )
     }
 }
 
+/* Set options for the storage driver */
+void storage_set_flags( const unsigned flags )
+{
+    storage_flags = flags;
+}
+
+void storage_set_clean_threads( const unsigned threads )
+{
+    storage_clean_threads = threads;
+}
 
 /*------------------------------------------------------------------------------------------------*/
 /* Set up a storage driver on application startup */
@@ -63,11 +76,60 @@ int storage_worker_destroy( void )
 /* Write a sample object to storage */
 int storage_write( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
 {
-    return storage->storage_write( client_id, obj_id, S );
+    const int result = storage->storage_write( client_id, obj_id, S );
+    stats_io( TRACE_WRITE, result, sample_len(S) );
+    return result;
 }
 
 /* Read a sample object from storage */
 int storage_read( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
 {
-    return storage->storage_read( client_id, obj_id, S );
+    const int result = storage->storage_read( client_id, obj_id, S );
+    stats_io( TRACE_READ, result, sample_len(S) );
+    return result;
+}
+
+/* Write and read back objects a chunk at a time, where the driver can */
+bool storage_streams( void )
+{
+    return storage->storage_write_stream != NULL && storage->storage_read_stream != NULL;
+}
+
+int storage_write_stream( const uint32_t client_id, const uint32_t obj_id, sample_stream_t *T,
+                          void *buf, const size_t len )
+{
+    const size_t obj_len = sample_stream_remain( T );
+    if( storage->storage_write_stream == NULL )
+    {
+        log_error( "The storage driver cannot write objects a chunk at a time" );
+        return -1;
+    }
+    const int result = storage->storage_write_stream( client_id, obj_id, T, buf, len );
+    stats_io( TRACE_WRITE, result, obj_len );
+    return result;
+}
+
+int storage_read_stream( const uint32_t client_id, const uint32_t obj_id, sample_stream_t *T,
+                         void *buf, const size_t len, bool *valid )
+{
+    const size_t obj_len = sample_stream_remain( T );
+    *valid = false;
+    if( storage->storage_read_stream == NULL )
+    {
+        log_error( "The storage driver cannot read objects a chunk at a time" );
+        return -1;
+    }
+    const int result = storage->storage_read_stream( client_id, obj_id, T, buf, len, valid );
+    stats_io( TRACE_READ, result, obj_len );
+    return result;
+}
+
+/* Remove the objects written by a worker */
+int storage_worker_remove( const uint32_t client_id, const uint32_t *obj_id, const unsigned n )
+{
+    if( storage->storage_worker_remove == NULL || (storage_flags & STORAGE_KEEP) )
+    {
+        return 0;
+    }
+    return storage->storage_worker_remove( client_id, obj_id, n );
 }
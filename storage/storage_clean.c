@@ -0,0 +1,537 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Removal of the workspace of file-based storage drivers.
+ * A pool of threads shares a stack of work items: directories to scan, and batches of names
+ * of files to remove from a directory.  Scanning a directory pushes a batch for every
+ * CLEAN_BATCH files found, so that even a single flat directory is removed in parallel, and
+ * an item for each subdirectory.  Entry types come from d_type where the filesystem provides
+ * it, and all access is relative to directory file descriptors.  Each directory counts its
+ * outstanding items, and is removed by whichever thread completes the last of them. */
+/* Begun 2019, StackHPC Ltd */
+
+#define _DEFAULT_SOURCE                 /* For d_type, and syscall */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef STORAGE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "utils.h"
+#include "storage.h"
+#include "storage_priv.h"
+
+#define CLEAN_BATCH             256     /* Files removed per work item */
+#define CLEAN_QUEUE_MAX         4       /* Batches queued per thread before scanners remove their own */
+#define CLEAN_URING_DEPTH       64      /* Submission queue entries per thread */
+
+unsigned storage_clean_threads = 0;
+
+/* A directory being removed: it is removed once its scan, the batches of its files and its
+ * subdirectories are all complete */
+typedef struct clean_dir {
+    struct clean_dir *parent;
+    unsigned pending;
+    char path[];                /* Relative to the workspace */
+} clean_dir_t;
+
+typedef struct clean_item {
+    struct clean_item *next;
+    clean_dir_t *dir;
+    unsigned nname;             /* 0: scan the directory.  Otherwise, files to remove */
+    char **name;
+} clean_item_t;
+
+static struct {
+    int root;                   /* Workspace */
+    int (*valid)( const char *name );
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    clean_item_t *top;          /* Stack of work items */
+    unsigned batches;           /* Batches on the stack */
+    unsigned busy;              /* Threads working on an item */
+    unsigned threads;
+    int failed;
+    uint64_t files, dirs;
+} C;
+
+/*------------------------------------------------------------------------------------------------*/
+/* Removal of a batch of files, by unlinkat or (optionally) by io_uring */
+
+#ifdef STORAGE_URING
+typedef struct clean_ring {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqe_len;
+} clean_ring_t;
+
+static int clean_ring_init( clean_ring_t *R )
+{
+    struct io_uring_params p;
+    memset( &p, 0, sizeof(p) );
+    memset( R, 0, sizeof(*R) );
+    if( (R->fd = syscall( __NR_io_uring_setup, CLEAN_URING_DEPTH, &p )) < 0 )
+    {
+        return -1;
+    }
+
+    R->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    R->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    R->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    R->sq_map = mmap( NULL, R->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, R->fd, IORING_OFF_SQ_RING );
+    R->cq_map = mmap( NULL, R->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, R->fd, IORING_OFF_CQ_RING );
+    R->sqe = mmap( NULL, R->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, R->fd, IORING_OFF_SQES );
+    if( R->sq_map == MAP_FAILED || R->cq_map == MAP_FAILED || R->sqe == MAP_FAILED )
+    {
+        close( R->fd );
+        return -1;
+    }
+    R->sq_tail = (unsigned *)((char *)R->sq_map + p.sq_off.tail);
+    R->sq_mask = (unsigned *)((char *)R->sq_map + p.sq_off.ring_mask);
+    R->sq_array = (unsigned *)((char *)R->sq_map + p.sq_off.array);
+    R->cq_head = (unsigned *)((char *)R->cq_map + p.cq_off.head);
+    R->cq_tail = (unsigned *)((char *)R->cq_map + p.cq_off.tail);
+    R->cq_mask = (unsigned *)((char *)R->cq_map + p.cq_off.ring_mask);
+    R->cqe = (struct io_uring_cqe *)((char *)R->cq_map + p.cq_off.cqes);
+    return 0;
+}
+
+static void clean_ring_fini( clean_ring_t *R )
+{
+    munmap( R->sqe, R->sqe_len );
+    munmap( R->cq_map, R->cq_len );
+    munmap( R->sq_map, R->sq_len );
+    close( R->fd );
+}
+
+/* Remove up to CLEAN_URING_DEPTH files, returning the number removed, or -1 if io_uring
+ * cannot remove files (before kernel 5.11) */
+static int clean_ring_unlink( clean_ring_t *R, const int dirfd, char **name, const unsigned n )
+{
+    unsigned tail = *R->sq_tail;
+    for( unsigned i=0; i < n; i++, tail++ )
+    {
+        const unsigned idx = tail & *R->sq_mask;
+        struct io_uring_sqe *sqe = &R->sqe[idx];
+        memset( sqe, 0, sizeof(*sqe) );
+        sqe->opcode = IORING_OP_UNLINKAT;
+        sqe->fd = dirfd;
+        sqe->addr = (uintptr_t)name[i];
+        sqe->user_data = i;
+        R->sq_array[idx] = idx;
+    }
+    __atomic_store_n( R->sq_tail, tail, __ATOMIC_RELEASE );
+
+    int ret;
+    while( (ret = syscall( __NR_io_uring_enter, R->fd, n, n, IORING_ENTER_GETEVENTS, NULL, 0 )) < 0 && errno == EINTR )
+        ;
+    if( ret < 0 )
+    {
+        return -1;
+    }
+
+    int removed = 0;
+    unsigned head = *R->cq_head;
+    for( unsigned done=0; done < n; )
+    {
+        if( head == __atomic_load_n( R->cq_tail, __ATOMIC_ACQUIRE ) )
+        {
+            /* Reap the remainder */
+            syscall( __NR_io_uring_enter, R->fd, 0, n - done, IORING_ENTER_GETEVENTS, NULL, 0 );
+            continue;
+        }
+        const struct io_uring_cqe *cqe = &R->cqe[head & *R->cq_mask];
+        if( cqe->res == -EINVAL )
+        {
+            removed = -1;
+        }
+        else if( cqe->res < 0 && cqe->res != -ENOENT )
+        {
+            log_error( "Unable to remove %s: %s", name[cqe->user_data], strerror(-cqe->res) );
+            C.failed = 1;
+        }
+        else if( removed >= 0 && cqe->res == 0 )
+        {
+            removed++;
+        }
+        head++;
+        done++;
+    }
+    __atomic_store_n( R->cq_head, head, __ATOMIC_RELEASE );
+    return removed;
+}
+#else
+typedef int clean_ring_t;
+#endif
+
+static void clean_batch( clean_item_t *I, clean_ring_t *R, bool *uring )
+{
+    if( C.failed )
+    {
+        return;
+    }
+    const int fd = openat( C.root, I->dir->path, O_RDONLY | O_DIRECTORY );
+    if( fd < 0 )
+    {
+        log_error( "Unable to open directory %s: %s", I->dir->path, strerror(errno) );
+        C.failed = 1;
+        return;
+    }
+
+    uint64_t removed = 0;
+    unsigned i = 0;
+#ifdef STORAGE_URING
+    while( *uring && i < I->nname )
+    {
+        const unsigned n = I->nname - i < CLEAN_URING_DEPTH ? I->nname - i : CLEAN_URING_DEPTH;
+        const int ret = clean_ring_unlink( R, fd, &I->name[i], n );
+        if( ret < 0 )
+        {
+            log_warn( "io_uring cannot remove files on this kernel: using unlinkat" );
+            *uring = false;
+            break;
+        }
+        removed += ret;
+        i += n;
+    }
+#endif
+    for( ; i < I->nname; i++ )
+    {
+        if( unlinkat( fd, I->name[i], 0 ) == 0 )
+        {
+            removed++;
+        }
+        else if( errno != ENOENT )
+        {
+            log_error( "Unable to remove %s/%s: %s", I->dir->path, I->name[i], strerror(errno) );
+            C.failed = 1;
+        }
+    }
+    close( fd );
+    __atomic_add_fetch( &C.files, removed, __ATOMIC_RELAXED );
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Work items */
+
+static void clean_release( clean_dir_t *D )
+{
+    while( D != NULL && __atomic_sub_fetch( &D->pending, 1, __ATOMIC_ACQ_REL ) == 0 )
+    {
+        clean_dir_t *parent = D->parent;
+        if( parent != NULL && !C.failed )
+        {
+            if( unlinkat( C.root, D->path, AT_REMOVEDIR ) == 0 )
+            {
+                __atomic_add_fetch( &C.dirs, 1, __ATOMIC_RELAXED );
+            }
+            else
+            {
+                log_error( "Unable to remove directory %s: %s", D->path, strerror(errno) );
+                C.failed = 1;
+            }
+        }
+        free( D );
+        D = parent;
+    }
+}
+
+static void clean_item_free( clean_item_t *I )
+{
+    for( unsigned i=0; i < I->nname; i++ )
+    {
+        free( I->name[i] );
+    }
+    free( I->name );
+    free( I );
+}
+
+static void clean_push( clean_item_t *I )
+{
+    pthread_mutex_lock( &C.lock );
+    I->next = C.top;
+    C.top = I;
+    C.batches += I->nname > 0;
+    pthread_cond_signal( &C.cond );
+    pthread_mutex_unlock( &C.lock );
+}
+
+static clean_item_t *clean_item( clean_dir_t *D )
+{
+    clean_item_t *I = calloc( 1, sizeof(clean_item_t) );
+    if( I == NULL || (I->name = malloc( CLEAN_BATCH * sizeof(char *) )) == NULL )
+    {
+        log_error( "Could not allocate a batch of files to remove" );
+        free( I );
+        return NULL;
+    }
+    I->dir = D;
+    __atomic_add_fetch( &D->pending, 1, __ATOMIC_RELAXED );
+    return I;
+}
+
+/* Queue a full batch, or remove its files here if the other threads are behind */
+static void clean_dispatch( clean_item_t *I, clean_ring_t *R, bool *uring )
+{
+    if( __atomic_load_n( &C.batches, __ATOMIC_RELAXED ) < C.threads * CLEAN_QUEUE_MAX )
+    {
+        clean_push( I );
+        return;
+    }
+    clean_batch( I, R, uring );
+    clean_release( I->dir );
+    clean_item_free( I );
+}
+
+static void clean_scan( clean_dir_t *D, clean_ring_t *R, bool *uring )
+{
+    const int fd = openat( C.root, D->path, O_RDONLY | O_DIRECTORY );
+    DIR *dir = fd < 0 ? NULL : fdopendir( fd );
+    if( dir == NULL )
+    {
+        log_error( "Unable to open directory %s: %s", D->path, strerror(errno) );
+        C.failed = 1;
+        if( fd >= 0 )
+        {
+            close( fd );
+        }
+        return;
+    }
+
+    clean_item_t *batch = NULL;
+    struct dirent *ent;
+    while( !C.failed && (ent = readdir( dir )) != NULL )
+    {
+        if( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 )
+        {
+            continue;
+        }
+
+        unsigned type = ent->d_type;
+        if( type == DT_UNKNOWN )
+        {
+            struct stat st;
+            if( fstatat( fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+            {
+                log_error( "Couldn't stat object %s/%s prior to removal", D->path, ent->d_name );
+                continue;
+            }
+            type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+        }
+
+        if( type == DT_DIR )
+        {
+            const size_t len = strlen( D->path ) + 1 + strlen( ent->d_name ) + 1;
+            clean_dir_t *sub = malloc( sizeof(clean_dir_t) + len );
+            clean_item_t *I = sub == NULL ? NULL : calloc( 1, sizeof(clean_item_t) );
+            if( I == NULL )
+            {
+                log_error( "Could not allocate state to remove directory %s/%s", D->path, ent->d_name );
+                free( sub );
+                C.failed = 1;
+                break;
+            }
+            snprintf( sub->path, len, "%s/%s", D->path, ent->d_name );
+            sub->parent = D;
+            sub->pending = 1;
+            __atomic_add_fetch( &D->pending, 1, __ATOMIC_RELAXED );
+            log_debug( "Pruning directory %s", sub->path );
+            I->dir = sub;
+            clean_push( I );
+            continue;
+        }
+
+        /* Paranoia: remove only the objects of the benchmark */
+        if( type != DT_REG || !C.valid( ent->d_name ) )
+        {
+            log_error( "Found non-matching filename %s/%s, aborting removal", D->path, ent->d_name );
+            C.failed = 1;
+            break;
+        }
+        if( batch == NULL && (batch = clean_item( D )) == NULL )
+        {
+            C.failed = 1;
+            break;
+        }
+        if( (batch->name[batch->nname] = strdup( ent->d_name )) == NULL )
+        {
+            C.failed = 1;
+            break;
+        }
+        if( ++batch->nname == CLEAN_BATCH )
+        {
+            clean_dispatch( batch, R, uring );
+            batch = NULL;
+        }
+    }
+    closedir( dir );
+
+    if( batch != NULL )
+    {
+        clean_dispatch( batch, R, uring );
+    }
+}
+
+static void *clean_thread( void *arg )
+{
+    clean_ring_t R;
+    bool uring = false;
+
+#ifdef STORAGE_URING
+    if( storage_flags & STORAGE_CLEAN_URING )
+    {
+        if( clean_ring_init( &R ) == 0 )
+        {
+            uring = true;
+        }
+        else
+        {
+            log_warn( "Could not set up io_uring: %s", strerror(errno) );
+        }
+    }
+#endif
+
+    pthread_mutex_lock( &C.lock );
+    for( ;; )
+    {
+        while( C.top == NULL && C.busy > 0 )
+        {
+            pthread_cond_wait( &C.cond, &C.lock );
+        }
+        if( C.top == NULL )
+        {
+            /* Nothing left, and nothing more to come */
+            pthread_cond_broadcast( &C.cond );
+            break;
+        }
+
+        clean_item_t *I = C.top;
+        C.top = I->next;
+        C.batches -= I->nname > 0;
+        C.busy++;
+        pthread_mutex_unlock( &C.lock );
+
+        if( I->nname > 0 )
+        {
+            clean_batch( I, &R, &uring );
+        }
+        else if( !C.failed )
+        {
+            clean_scan( I->dir, &R, &uring );
+        }
+        clean_release( I->dir );
+        clean_item_free( I );
+
+        pthread_mutex_lock( &C.lock );
+        C.busy--;
+    }
+    pthread_mutex_unlock( &C.lock );
+
+#ifdef STORAGE_URING
+    if( uring )
+    {
+        clean_ring_fini( &R );
+    }
+#endif
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+int storage_clean( const char *workspace, int (*valid)( const char *name ) )
+{
+    struct timespec start, end, delta;
+    pthread_t *thread;
+    clean_dir_t *root;
+    clean_item_t *I;
+
+    time_now( &start );
+    memset( &C, 0, sizeof(C) );
+    C.valid = valid;
+    C.threads = storage_clean_threads;
+    if( C.threads == 0 )
+    {
+        const long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+        C.threads = cpus > 0 ? cpus : 1;
+    }
+#ifndef STORAGE_URING
+    if( storage_flags & STORAGE_CLEAN_URING )
+    {
+        log_warn( "io_uring support not built (make STORAGE_URING=1): using unlinkat" );
+    }
+#endif
+
+    if( (C.root = open( workspace, O_RDONLY | O_DIRECTORY )) < 0 )
+    {
+        log_error( "Workspace %s could not be entered: %s", workspace, strerror(errno) );
+        return -1;
+    }
+    thread = calloc( C.threads, sizeof(pthread_t) );
+    root = malloc( sizeof(clean_dir_t) + 2 );
+    I = calloc( 1, sizeof(clean_item_t) );
+    if( thread == NULL || root == NULL || I == NULL )
+    {
+        log_error( "Could not allocate state to remove workspace %s", workspace );
+        close( C.root );
+        free( thread );
+        free( root );
+        free( I );
+        return -1;
+    }
+    strcpy( root->path, "." );
+    root->parent = NULL;
+    root->pending = 2;          /* Its scan, and this function */
+    I->dir = root;
+
+    pthread_mutex_init( &C.lock, NULL );
+    pthread_cond_init( &C.cond, NULL );
+    C.top = I;
+
+    unsigned started = 0;
+    for( ; started < C.threads; started++ )
+    {
+        if( pthread_create( &thread[started], NULL, clean_thread, NULL ) != 0 )
+        {
+            break;
+        }
+    }
+    if( started == 0 )
+    {
+        clean_thread( NULL );
+    }
+    for( unsigned i=0; i < started; i++ )
+    {
+        pthread_join( thread[i], NULL );
+    }
+    clean_release( root );
+
+    pthread_cond_destroy( &C.cond );
+    pthread_mutex_destroy( &C.lock );
+    close( C.root );
+    free( thread );
+
+    time_now( &end );
+    time_delta( &start, &end, &delta );
+    const double secs = delta.tv_sec + delta.tv_nsec / 1e9;
+    log_info( "Removed %lu files and %lu directories in %.3fs: %.0f files/second (%u threads%s)",
+              (unsigned long)C.files, (unsigned long)C.dirs, secs, secs > 0.0 ? C.files / secs : 0.0,
+              started ? started : 1, storage_flags & STORAGE_CLEAN_URING ? ", io_uring" : "" );
+    return C.failed ? -1 : 0;
+}
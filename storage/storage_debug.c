@@ -28,7 +28,6 @@
 /* Simple implementation of file-based storage */
 
 static char *storage_debug_workspace = NULL;
-static char storage_debug_cwd[PATH_MAX];
 
 /* Set up a storage driver on application startup */
 /* For file-based storage implementations, the workspace is a directory pathname */
@@ -51,7 +50,7 @@ static int storage_debug_driver_create( const char *workspace, int argc, char *a
 	    return -1;
 	}
     }
-    else
+    else if( !(storage_flags & STORAGE_KEEP) )
     {
         log_warn( "Workspace %s already exists: performance results may be impacted", workspace );
     }
@@ -64,9 +63,6 @@ static int storage_debug_driver_create( const char *workspace, int argc, char *a
         log_error( "Insufficient memory to alloc state for workspace %s", workspace );
         return -1;
     }
-
-    /* Allocate a PRNG object for use in generating files */
-    getcwd( storage_debug_cwd, sizeof(storage_debug_cwd) );
     return 0;
 }
 
@@ -75,7 +71,6 @@ static int storage_debug_driver_create( const char *workspace, int argc, char *a
 static int storage_debug_worker_create( const char *workspace, int argc, char *argv[] )
 {
     assert( storage_debug_workspace != NULL );
-    assert( strlen(storage_debug_cwd) > 0 );
 
     /* Change directory into the workspace */
     log_trace( "Entering workspace %s", storage_debug_workspace );
@@ -88,53 +83,36 @@ static int storage_debug_worker_create( const char *workspace, int argc, char *a
         storage_debug_workspace = NULL;
         return -1;
     }
-
-    /* Allocate a PRNG object for use in generating files */
     return 0;
 }
 
+/* Only files named for objects are removed from the workspace */
+static int storage_debug_valid( const char *name )
+{
+    unsigned val1, val2;
+    return sscanf( name, "%08x-%08x", &val1, &val2 ) == 2;
+}
+
 /* Cleanup state from a storage driver on application shutdown */
 static int storage_debug_driver_destroy( void )
 {
     /* Deallocate the workspace (this might take a while...) */
-    if( storage_debug_workspace != NULL )
+    if( storage_debug_workspace != NULL && (storage_flags & STORAGE_KEEP) )
     {
-        chdir( storage_debug_workspace );
-
-        /* Erase all files in the directory */
-        DIR *D = opendir( "." );
-        if( D != NULL )
+        log_info( "Leaving workspace %s in place", storage_debug_workspace );
+        free( storage_debug_workspace );
+        storage_debug_workspace = NULL;
+    }
+    else if( storage_debug_workspace != NULL )
+    {
+        /* Erase all files in the directory, in parallel */
+        if( storage_clean( storage_debug_workspace, storage_debug_valid ) < 0 )
         {
-            struct dirent *obj;
-            while( (obj=readdir(D)) != NULL )
-            {
-                struct stat st;
-                const int stat_result = stat( obj->d_name, &st );
-                if( stat_result < 0 )
-                {
-                    log_error( "Couldn't stat object %s prior to removal", obj->d_name );
-                    continue;
-                }
-
-                if( S_ISREG(st.st_mode) )
-                {
-		    unsigned val1, val2;
-		    if( sscanf(obj->d_name, "%08x-%08x", &val1, &val2) != 2 )
-		    {	
-			log_error( "Unrecognised file %s in workspace, aborting!", obj->d_name );
-			abort();
-		    }
-
-                    log_trace( "Removing object %s", obj->d_name );
-                    unlink( obj->d_name );
-                }
-            }
-            closedir( D );
+            free( storage_debug_workspace );
+            storage_debug_workspace = NULL;
+            return -1;
         }
 
-        log_trace( "Returning to %s", storage_debug_cwd );
-        chdir( storage_debug_cwd );
-
         const int rmdir_result = rmdir( storage_debug_workspace );
         if( rmdir_result < 0 )
         {
@@ -156,11 +134,11 @@ static int storage_debug_worker_destroy( void )
 /* Write a sample object to storage */
 static int storage_debug_write( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
 {
-    struct timespec iop_start, iop_end, iop_delta, ts_delta;
+    trace_op_t op;
     char filename[20];
     snprintf( filename, sizeof(filename), "%08x-%08x", client_id, obj_id );
 
-    time_now( &iop_start );
+    trace_op_begin( &op, TRACE_WRITE );
     const int fd = open( filename, O_CREAT|O_EXCL|O_WRONLY, 0644 );
     if( fd < 0 )
     {
@@ -168,12 +146,25 @@ static int storage_debug_write( const uint32_t client_id, const uint32_t obj_id,
         return -1;
     }
 
+    trace_op_span( &op, TRACE_OPEN );
+
     const ssize_t write_result = write( fd, sample_data(S), sample_len(S) );
     if( write_result != sample_len(S) )
     {
         log_error( "Error %zd writing data to fd %d file %s: %s", write_result, fd, filename, strerror(errno) );
         return -1;
     }
+    trace_op_span( &op, TRACE_DATA );
+
+    if( storage_flags & STORAGE_FSYNC )
+    {
+        if( fsync( fd ) < 0 )
+        {
+            log_error( "Unable to sync file %s: %s", filename, strerror(errno) );
+            return -1;
+        }
+        trace_op_span( &op, TRACE_FSYNC );
+    }
 
     const int close_result = close( fd );
     if( close_result < 0 )
@@ -181,10 +172,8 @@ static int storage_debug_write( const uint32_t client_id, const uint32_t obj_id,
         log_error( "Unable to close file %s: %s", filename, strerror(errno) );
         return -1;
     }
-    time_now( &iop_end );
-    time_delta( &iop_start, &iop_end, &iop_delta );
-    time_delta( &time_benchmark, &iop_start, &ts_delta );
-    trace_write( &ts_delta, &iop_delta );
+    trace_op_span( &op, TRACE_CLOSE );
+    trace_op_end( &op );
 
     return 0;
 }
@@ -192,12 +181,11 @@ static int storage_debug_write( const uint32_t client_id, const uint32_t obj_id,
 /* Read a sample object from storage */
 static int storage_debug_read( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
 {
-    struct timespec iop_start, iop_end, iop_delta, ts_delta;
-    uint8_t obj_data[SAMPLE_LEN_MAX];
+    trace_op_t op;
     char filename[20];
     snprintf( filename, sizeof(filename), "%08x-%08x", client_id, obj_id );
 
-    time_now( &iop_start );
+    trace_op_begin( &op, TRACE_READ );
     const int fd = open( filename, O_RDONLY );
     if( fd < 0 )
     {
@@ -212,15 +200,24 @@ static int storage_debug_read( const uint32_t client_id, const uint32_t obj_id,
         log_error( "Unable to stat file %s: %s", filename, strerror(errno) );
         return -1;
     }
-    assert( st.st_size <= SAMPLE_LEN_MAX );
 
-    /* We'd like to cut out a copy here by loading data direct into the sample data object */
+    trace_op_span( &op, TRACE_OPEN );
+
+    /* Load data direct into the sample data object */
+    void *obj_data = sample_buffer( S, st.st_size );
+    if( obj_data == NULL )
+    {
+        log_error( "File %s is larger than any sample (%zd bytes)", filename, (ssize_t)st.st_size );
+        close( fd );
+        return -1;
+    }
     const ssize_t read_result = read( fd, obj_data, st.st_size );
     if( read_result != st.st_size )
     {
         log_error( "Error %zd loading data from file %s: %s", read_result, filename, strerror(errno) );
         return -1;
     }
+    trace_op_span( &op, TRACE_DATA );
 
     const int close_result = close( fd );
     if( close_result < 0 )
@@ -228,13 +225,10 @@ static int storage_debug_read( const uint32_t client_id, const uint32_t obj_id,
         log_error( "Unable to close file %s: %s", filename, strerror(errno) );
         return -1;
     }
-    time_now( &iop_end );
-    time_delta( &iop_start, &iop_end, &iop_delta );
-    time_delta( &time_benchmark, &iop_start, &ts_delta );
-    trace_read( &ts_delta, &iop_delta );
+    trace_op_span( &op, TRACE_CLOSE );
+    trace_op_end( &op );
 
-    /* Transfer the data into our sample object */
-    sample_read( S, obj_data, st.st_size );
+    sample_commit( S, read_result );
     return 0;
 }
 
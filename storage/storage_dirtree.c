@@ -29,7 +29,6 @@
  * to become unmanageable. */
 
 static char *storage_dirtree_workspace = NULL;
-static char storage_dirtree_cwd[PATH_MAX];
 
 static char *storage_dirtree_pathname( char *buf, const uint32_t client_id, const uint32_t obj_id )
 {
@@ -79,7 +78,7 @@ static int storage_dirtree_driver_create( const char *workspace, int argc, char
 	    return -1;
 	}
     }
-    else
+    else if( !(storage_flags & STORAGE_KEEP) )
     {
         log_warn( "Workspace %s already exists: performance results may be affected", workspace );
     }
@@ -92,8 +91,6 @@ static int storage_dirtree_driver_create( const char *workspace, int argc, char
         log_error( "Insufficient memory to alloc state for workspace %s", workspace );
         return -1;
     }
-    getcwd( storage_dirtree_cwd, sizeof(storage_dirtree_cwd) );
-
     return 0;
 }
 
@@ -102,7 +99,6 @@ static int storage_dirtree_driver_create( const char *workspace, int argc, char
 static int storage_dirtree_worker_create( const char *workspace, int argc, char *argv[] )
 {
     /* Change directory into the workspace */
-    getcwd( storage_dirtree_cwd, sizeof(storage_dirtree_cwd) );
     log_trace( "Entering workspace %s", storage_dirtree_workspace );
     const int chdir_result = chdir( storage_dirtree_workspace );
     if( chdir_result < 0 )
@@ -113,86 +109,37 @@ static int storage_dirtree_worker_create( const char *workspace, int argc, char
         storage_dirtree_workspace = NULL;
         return -1;
     }
-
-    /* Allocate a PRNG object for use in generating files */
     return 0;
 }
 
 
-/* Remove all files in the current working directory - use with caution! */
-static void storage_dirtree_rmdir( void )
+/* Only files named for objects are removed from the workspace - use with caution! */
+static int storage_dirtree_valid( const char *name )
 {
-    /* Erase all files in the directory */
-    DIR *D = opendir( "." );
-    if( D != NULL )
-    {
-        struct dirent *obj;
-        while( (obj=readdir(D)) != NULL )
-        {
-            struct stat st;
-            const int stat_result = stat( obj->d_name, &st );
-            if( stat_result < 0 )
-            {
-                log_error( "Couldn't stat object %s prior to removal", obj->d_name );
-                continue;
-            }
-
-            if( strcmp(obj->d_name, ".")==0 || strcmp(obj->d_name, "..")==0 )
-            {
-                continue;
-            }
-
-            if( S_ISREG(st.st_mode) )
-            {
-		/* Paranoia */
-		unsigned id1, id2;
-		if( sscanf( obj->d_name, "%08X-%08X", &id1, &id2 ) != 2 )
-		{
-		    log_error( "Found non-matching filename %s, aborting", obj->d_name );
-		    abort( );
-		}
-                log_trace( "Removing object %s", obj->d_name );
-                unlink( obj->d_name );
-            }
-            if( S_ISDIR(st.st_mode) )
-            {
-                char cwd[PATH_MAX];
-
-                log_debug( "Pruning directory %s", obj->d_name );
-
-                getcwd( cwd, sizeof(cwd) );
-                chdir( obj->d_name );
-                storage_dirtree_rmdir( );
-                chdir( cwd );
-                rmdir( obj->d_name );
-            }
-        }
-        closedir( D );
-    }
+    unsigned id1, id2;
+    return sscanf( name, "%08X-%08X", &id1, &id2 ) == 2;
 }
 
 /* Cleanup state from a storage driver on application shutdown */
 static int storage_dirtree_driver_destroy( void )
 {
     /* Deallocate the workspace (this might take a while...) */
-    if( storage_dirtree_workspace != NULL )
+    if( storage_dirtree_workspace != NULL && (storage_flags & STORAGE_KEEP) )
     {
-	const int chdir_result = chdir( storage_dirtree_workspace );
-	if( chdir_result < 0 )
-	{
-	    log_error( "Workspace %s could not be entered: %s",
-			storage_dirtree_workspace, strerror(errno) );
-	    free( storage_dirtree_workspace );
-	    storage_dirtree_workspace = NULL;
-	    return -1;
-	}
-
-        /* Recursively remove files and directories in the workspace */
-        storage_dirtree_rmdir( );
+        log_info( "Leaving workspace %s in place", storage_dirtree_workspace );
+        free( storage_dirtree_workspace );
+        storage_dirtree_workspace = NULL;
+    }
+    else if( storage_dirtree_workspace != NULL )
+    {
+        /* Remove files and directories in the workspace, in parallel */
+        if( storage_clean( storage_dirtree_workspace, storage_dirtree_valid ) < 0 )
+        {
+            free( storage_dirtree_workspace );
+            storage_dirtree_workspace = NULL;
+            return -1;
+        }
 
-        log_trace( "Returning to %s", storage_dirtree_cwd );
-        chdir( storage_dirtree_cwd );
-    
         const int rmdir_result = rmdir( storage_dirtree_workspace );
         if( rmdir_result < 0 )
         {
@@ -210,20 +157,17 @@ static int storage_dirtree_worker_destroy( void )
     return 0;
 }
 
-/* Write a sample object to storage */
-static int storage_dirtree_write( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
+/* Create the file of an object, generating its directory path if need be */
+static int storage_dirtree_create( const char *filename, const uint32_t client_id, const uint32_t obj_id,
+                                   trace_op_t *op )
 {
-    struct timespec iop_start, iop_end, iop_delta, ts_delta;
-    char filename[48];
-    storage_dirtree_pathname( filename, client_id, obj_id );
-
-    time_now( &iop_start );
     int fd = open( filename, O_CREAT|O_EXCL|O_WRONLY, 0644 );
     if( fd < 0 )
     {
-        /* Generate the directory path and try again */
+        /* Generate the directory path and try again: the cost is part of the write */
+        trace_op_span( op, TRACE_OPEN );
         storage_dirtree_pathgen( client_id, obj_id );
-        time_now( &iop_start );
+        trace_op_span( op, TRACE_MKDIR );
         fd = open( filename, O_CREAT|O_EXCL|O_WRONLY, 0644 );
         if( fd < 0 )
         {
@@ -231,13 +175,43 @@ static int storage_dirtree_write( const uint32_t client_id, const uint32_t obj_i
             return -1;
         }
     }
+    trace_op_span( op, TRACE_OPEN );
+    return fd;
+}
+
+/* Write a sample object to storage */
+static int storage_dirtree_write( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
+{
+    trace_op_t op;
+    char filename[48];
+    storage_dirtree_pathname( filename, client_id, obj_id );
+
+    trace_op_begin( &op, TRACE_WRITE );
+    const int fd = storage_dirtree_create( filename, client_id, obj_id, &op );
+    if( fd < 0 )
+    {
+        return -1;
+    }
 
     const ssize_t write_result = write( fd, sample_data(S), sample_len(S) );
     if( write_result != sample_len(S) )
     {
         log_error( "Error %zd writing data to fd %d file %s: %s", write_result, fd, filename, strerror(errno) );
+        close( fd );
         return -1;
     }
+    trace_op_span( &op, TRACE_DATA );
+
+    if( storage_flags & STORAGE_FSYNC )
+    {
+        if( fsync( fd ) < 0 )
+        {
+            log_error( "Unable to sync file %s: %s", filename, strerror(errno) );
+            close( fd );
+            return -1;
+        }
+        trace_op_span( &op, TRACE_FSYNC );
+    }
 
     const int close_result = close( fd );
     if( close_result < 0 )
@@ -245,10 +219,8 @@ static int storage_dirtree_write( const uint32_t client_id, const uint32_t obj_i
         log_error( "Unable to close file %s: %s", filename, strerror(errno) );
         return -1;
     }
-    time_now( &iop_end );
-    time_delta( &iop_start, &iop_end, &iop_delta );
-    time_delta( &time_benchmark, &iop_start, &ts_delta );
-    trace_write( &ts_delta, &iop_delta );
+    trace_op_span( &op, TRACE_CLOSE );
+    trace_op_end( &op );
 
     return 0;
 }
@@ -256,12 +228,11 @@ static int storage_dirtree_write( const uint32_t client_id, const uint32_t obj_i
 /* Read a sample object from storage */
 static int storage_dirtree_read( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
 {
-    struct timespec iop_start, iop_end, iop_delta, ts_delta;
-    uint8_t obj_data[SAMPLE_LEN_MAX];
+    trace_op_t op;
     char filename[48];
     storage_dirtree_pathname( filename, client_id, obj_id );
 
-    time_now( &iop_start );
+    trace_op_begin( &op, TRACE_READ );
     const int fd = open( filename, O_RDONLY );
     if( fd < 0 )
     {
@@ -274,34 +245,145 @@ static int storage_dirtree_read( const uint32_t client_id, const uint32_t obj_id
     if( st_result < 0 )
     {
         log_error( "Unable to stat file %s: %s", filename, strerror(errno) );
+        close( fd );
         return -1;
     }
-    assert( st.st_size <= SAMPLE_LEN_MAX );
 
-    /* We'd like to cut out a copy here by loading data direct into the sample data object */
+    trace_op_span( &op, TRACE_OPEN );
+
+    /* Load data direct into the sample data object */
+    void *obj_data = sample_buffer( S, st.st_size );
+    if( obj_data == NULL )
+    {
+        log_error( "File %s is larger than any sample (%zd bytes)", filename, (ssize_t)st.st_size );
+        close( fd );
+        return -1;
+    }
     const ssize_t read_result = read( fd, obj_data, st.st_size );
     if( read_result != st.st_size )
     {
         log_error( "Error %zd loading data from file %s: %s", read_result, filename, strerror(errno) );
+        close( fd );
+        return -1;
+    }
+    trace_op_span( &op, TRACE_DATA );
+
+    const int close_result = close( fd );
+    if( close_result < 0 )
+    {
+        log_error( "Unable to close file %s: %s", filename, strerror(errno) );
+        return -1;
+    }
+    trace_op_span( &op, TRACE_CLOSE );
+    trace_op_end( &op );
+
+    sample_commit( S, read_result );
+    return 0;
+}
+
+/* Write an object a chunk at a time, generated from a sample stream.
+ * Generation of each chunk is part of the DATA component of the write. */
+static int storage_dirtree_write_stream( const uint32_t client_id, const uint32_t obj_id, sample_stream_t *T,
+                                         void *buf, const size_t len )
+{
+    trace_op_t op;
+    char filename[48];
+    storage_dirtree_pathname( filename, client_id, obj_id );
+
+    trace_op_begin( &op, TRACE_WRITE );
+    const int fd = storage_dirtree_create( filename, client_id, obj_id, &op );
+    if( fd < 0 )
+    {
         return -1;
     }
 
+    while( sample_stream_remain( T ) > 0 )
+    {
+        const size_t n = sample_stream_generate( T, buf, len );
+        const ssize_t write_result = write( fd, buf, n );
+        if( write_result != n )
+        {
+            log_error( "Error %zd writing data to fd %d file %s: %s", write_result, fd, filename, strerror(errno) );
+            close( fd );
+            return -1;
+        }
+    }
+    trace_op_span( &op, TRACE_DATA );
+
+    if( storage_flags & STORAGE_FSYNC )
+    {
+        if( fsync( fd ) < 0 )
+        {
+            log_error( "Unable to sync file %s: %s", filename, strerror(errno) );
+            close( fd );
+            return -1;
+        }
+        trace_op_span( &op, TRACE_FSYNC );
+    }
+
     const int close_result = close( fd );
     if( close_result < 0 )
     {
         log_error( "Unable to close file %s: %s", filename, strerror(errno) );
         return -1;
     }
-    time_now( &iop_end );
-    time_delta( &iop_start, &iop_end, &iop_delta );
-    time_delta( &time_benchmark, &iop_start, &ts_delta );
-    trace_read( &ts_delta, &iop_delta );
+    trace_op_span( &op, TRACE_CLOSE );
+    trace_op_end( &op );
 
-    /* Transfer the data into our sample object */
-    sample_read( S, obj_data, st.st_size );
     return 0;
 }
 
+/* Read an object back a chunk at a time, validating each against a sample stream.
+ * The whole object is read even if an earlier chunk is not valid. */
+static int storage_dirtree_read_stream( const uint32_t client_id, const uint32_t obj_id, sample_stream_t *T,
+                                        void *buf, const size_t len, bool *valid )
+{
+    trace_op_t op;
+    char filename[48];
+    storage_dirtree_pathname( filename, client_id, obj_id );
+
+    trace_op_begin( &op, TRACE_READ );
+    const int fd = open( filename, O_RDONLY );
+    if( fd < 0 )
+    {
+        log_error( "Unable to open file %s: %s", filename, strerror(errno) );
+        return -1;
+    }
+    trace_op_span( &op, TRACE_OPEN );
+
+    ssize_t read_result;
+    *valid = true;
+    while( (read_result = read( fd, buf, len )) > 0 )
+    {
+        if( *valid && !sample_stream_valid( T, buf, read_result ) )
+        {
+            *valid = false;
+        }
+    }
+    if( read_result < 0 )
+    {
+        log_error( "Error %zd loading data from file %s: %s", read_result, filename, strerror(errno) );
+        close( fd );
+        return -1;
+    }
+    if( *valid && sample_stream_remain( T ) > 0 )
+    {
+        log_error( "File %s is %zd bytes short", filename, sample_stream_remain( T ) );
+        *valid = false;
+    }
+    trace_op_span( &op, TRACE_DATA );
+
+    const int close_result = close( fd );
+    if( close_result < 0 )
+    {
+        log_error( "Unable to close file %s: %s", filename, strerror(errno) );
+        return -1;
+    }
+    trace_op_span( &op, TRACE_CLOSE );
+    trace_op_end( &op );
+
+    return 0;
+}
 
 /*------------------------------------------------------------------------------------------------*/
 /* Storage methods for this implementation */
@@ -314,4 +396,6 @@ storage_driver_t storage_dirtree =
     .storage_worker_destroy = storage_dirtree_worker_destroy,
     .storage_write = storage_dirtree_write,
     .storage_read = storage_dirtree_read,
+    .storage_write_stream = storage_dirtree_write_stream,
+    .storage_read_stream = storage_dirtree_read_stream,
 };
@@ -24,8 +24,30 @@ typedef struct
     /* Read a sample object from storage */
     int (*storage_read)( const uint32_t client_id, const uint32_t obj_id, sample_t *S );
 
+    /* Write or read back an object a chunk at a time through a working buffer, generating or
+     * validating it with a sample stream.  NULL where the driver only handles whole samples */
+    int (*storage_write_stream)( const uint32_t client_id, const uint32_t obj_id, sample_stream_t *T,
+                                 void *buf, const size_t len );
+    int (*storage_read_stream)( const uint32_t client_id, const uint32_t obj_id, sample_stream_t *T,
+                                void *buf, const size_t len, bool *valid );
+
+    /* Remove the objects written by a worker, returning the number removed or -1.
+     * NULL where the workspace is removed as a whole by storage_driver_destroy */
+    int (*storage_worker_remove)( const uint32_t client_id, const uint32_t *obj_id, const unsigned n );
+
 } storage_driver_t;
 
+/* Options selected for the storage driver (STORAGE_FSYNC, etc) */
+extern unsigned storage_flags;
+
+/* Threads removing the workspace of file-based drivers (0: one per CPU) */
+extern unsigned storage_clean_threads;
+
+/* Remove the files and directories within a workspace in parallel, leaving the workspace
+ * itself.  Removal stops at any file for which valid() is false, as it cannot have been
+ * written by the benchmark.  Returns 0, or -1 if anything could not be removed */
+extern int storage_clean( const char *workspace, int (*valid)( const char *name ) );
+
 /* Storage driver implementations */
 extern storage_driver_t storage_debug;
 extern storage_driver_t storage_dirtree;
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <limits.h>
+#include <errno.h>
 
 #include <rados/librados.h>
 
@@ -24,6 +25,8 @@ static char *storage_rados_pool = "benchmark";
 static char *storage_rados_ceph_conf = "ceph.conf";
 /*static char *storage_rados_ceph_conf = "/etc/ceph/ceph.conf";*/
 
+#define STORAGE_RADOS_REMOVE_WINDOW     64      /* Removals in flight per worker */
+
 /* Set up a storage driver on application startup */
 /* For file-based storage implementations, the workspace is a directory pathname */
 static int storage_rados_driver_create( const char *workspace, int argc, char *argv[] )
@@ -93,11 +96,11 @@ static int storage_rados_worker_destroy( void )
 /* Write a sample object to storage */
 static int storage_rados_write( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
 {
-    struct timespec iop_start, iop_end, iop_delta, ts_delta;
+    trace_op_t op;
     char filename[20];
     snprintf( filename, sizeof(filename), "%08x-%08x", client_id, obj_id );
 
-    time_now( &iop_start );
+    trace_op_begin( &op, TRACE_WRITE );
 
     const int rados_err = rados_write_full( storage_rados_ctx, filename,
                                             sample_data(S), sample_len(S) );
@@ -108,10 +111,7 @@ static int storage_rados_write( const uint32_t client_id, const uint32_t obj_id,
         return rados_err;
     }
 
-    time_now( &iop_end );
-    time_delta( &iop_start, &iop_end, &iop_delta );
-    time_delta( &time_benchmark, &iop_start, &ts_delta );
-    trace_write( &ts_delta, &iop_delta );
+    trace_op_end( &op );
 
     return 0;
 }
@@ -119,15 +119,22 @@ static int storage_rados_write( const uint32_t client_id, const uint32_t obj_id,
 /* Read a sample object from storage */
 static int storage_rados_read( const uint32_t client_id, const uint32_t obj_id, sample_t *S )
 {
-    struct timespec iop_start, iop_end, iop_delta, ts_delta;
-    char obj_data[SAMPLE_LEN_MAX];
+    trace_op_t op;
     char filename[20];
     snprintf( filename, sizeof(filename), "%08x-%08x", client_id, obj_id );
 
-    time_now( &iop_start );
+    /* Load data direct into the sample data object */
+    char *obj_data = sample_buffer( S, sample_size_max() );
+    if( obj_data == NULL )
+    {
+        log_error( "Sample cannot hold a %zu-byte object", sample_size_max() );
+        return -1;
+    }
+
+    trace_op_begin( &op, TRACE_READ );
 
     const int rados_result = rados_read( storage_rados_ctx, filename,
-                                         obj_data, sizeof(obj_data), 0UL );
+                                         obj_data, sample_size_max(), 0UL );
     if( rados_result < 0 )
     {
         log_error( "Cannot read object %s from pool %s: %s\n",
@@ -135,17 +142,86 @@ static int storage_rados_read( const uint32_t client_id, const uint32_t obj_id,
         return rados_result;
     }
 
-    time_now( &iop_end );
-    time_delta( &iop_start, &iop_end, &iop_delta );
-    time_delta( &time_benchmark, &iop_start, &ts_delta );
-    trace_read( &ts_delta, &iop_delta );
+    trace_op_end( &op );
 
-    /* Transfer the data into our sample object */
-    sample_read( S, obj_data, rados_result );
+    sample_commit( S, rados_result );
     return 0;
 }
 
 
+/* Wait for a removal to complete, returning 1 if the object was removed, 0 if it had already
+ * gone (as when the same object was written twice), or -1 */
+static int storage_rados_remove_wait( rados_completion_t c )
+{
+    rados_aio_wait_for_complete( c );
+    const int rados_result = rados_aio_get_return_value( c );
+    rados_aio_release( c );
+    if( rados_result == -ENOENT )
+    {
+        return 0;
+    }
+    if( rados_result < 0 )
+    {
+        log_error( "Cannot remove object from pool %s: %s", storage_rados_pool, strerror(-rados_result) );
+        return -1;
+    }
+    return 1;
+}
+
+/* Remove the objects written by this worker, keeping a bounded window of removals in flight
+ * so that the round trip to the cluster is not paid for each one */
+static int storage_rados_worker_remove( const uint32_t client_id, const uint32_t *obj_id, const unsigned n )
+{
+    rados_completion_t window[STORAGE_RADOS_REMOVE_WINDOW];
+    unsigned issued = 0, waited = 0;
+    int removed = 0, failed = 0, ret;
+
+    for( ; issued < n && !failed; issued++ )
+    {
+        /* Wait for the oldest removal in flight, to make room for another */
+        rados_completion_t *c = &window[issued % STORAGE_RADOS_REMOVE_WINDOW];
+        if( issued - waited == STORAGE_RADOS_REMOVE_WINDOW )
+        {
+            if( (ret = storage_rados_remove_wait( *c )) < 0 )
+            {
+                failed = 1;
+            }
+            removed += ret > 0;
+            waited++;
+        }
+
+        char filename[20];
+        snprintf( filename, sizeof(filename), "%08x-%08x", client_id, obj_id[issued] );
+        const int create_err = rados_aio_create_completion( NULL, NULL, NULL, c );
+        if( create_err < 0 )
+        {
+            log_error( "Cannot create completion to remove object %s: %s", filename, strerror(-create_err) );
+            failed = 1;
+            break;
+        }
+        const int remove_err = rados_aio_remove( storage_rados_ctx, filename, *c );
+        if( remove_err < 0 )
+        {
+            log_error( "Cannot remove object %s from pool %s: %s", filename, storage_rados_pool, strerror(-remove_err) );
+            rados_aio_release( *c );
+            failed = 1;
+            break;
+        }
+    }
+
+    /* Drain the window */
+    for( ; waited < issued; waited++ )
+    {
+        if( (ret = storage_rados_remove_wait( window[waited % STORAGE_RADOS_REMOVE_WINDOW] )) < 0 )
+        {
+            failed = 1;
+        }
+        removed += ret > 0;
+    }
+    return failed ? -1 : removed;
+}
+
+
 /*------------------------------------------------------------------------------------------------*/
 /* Storage methods for this implementation */
 
@@ -157,4 +233,5 @@ storage_driver_t storage_rados =
     .storage_worker_destroy = storage_rados_worker_destroy,
     .storage_write = storage_rados_write,
     .storage_read = storage_rados_read,
+    .storage_worker_remove = storage_rados_worker_remove,
 };
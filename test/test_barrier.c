@@ -0,0 +1,104 @@
+/*--------------------------------------------------------------------------------------------*/
+/* Barriers between processes: check that no process passes a phase before all have reached
+ * it, over many phases with and without spinning, that release skew is recorded, and that
+ * aborting the barrier releases its waiters with failure. */
+/* Begun 2019, StackHPC Ltd */
+
+#define _DEFAULT_SOURCE                 /* For MAP_ANONYMOUS */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "barrier.h"
+
+#define TASKS       6
+#define PHASES      200
+#define HANDLE      "/test_barrier"
+
+/* Arrivals at each phase, shared by the tasks */
+static unsigned *arrived;
+
+static int task( barrier_t *bp )
+{
+    for( unsigned p=0; p < PHASES; p++ )
+    {
+        __atomic_add_fetch( &arrived[p], 1, __ATOMIC_SEQ_CST );
+        if( barrier_wait( bp ) < 0 )
+        {
+            return 1;
+        }
+        if( __atomic_load_n( &arrived[p], __ATOMIC_SEQ_CST ) != TASKS )
+        {
+            return 2;
+        }
+    }
+    return 0;
+}
+
+static void run( const uint64_t spin_ns )
+{
+    barrier_skew_t skew;
+    int status;
+
+    memset( arrived, 0, PHASES * sizeof(unsigned) );
+    barrier_t *bp = barrier_init( HANDLE, TASKS );
+    assert( bp != NULL );
+    barrier_set_spin( bp, spin_ns );
+
+    for( unsigned i=0; i < TASKS; i++ )
+    {
+        if( fork() == 0 )
+        {
+            exit( task( bp ) );
+        }
+    }
+    for( unsigned i=0; i < TASKS; i++ )
+    {
+        assert( wait( &status ) > 0 );
+        assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+    }
+
+    barrier_skew( bp, &skew );
+    assert( skew.phases == PHASES );
+    assert( skew.max >= skew.last );
+    barrier_destroy( bp );
+}
+
+int main( int argc, char *argv[] )
+{
+    int status;
+
+    arrived = mmap( NULL, PHASES * sizeof(unsigned), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    assert( arrived != MAP_FAILED );
+
+    run( 0 );
+    run( 50000 );
+
+    /* A participant which never arrives: aborting releases the others with failure */
+    barrier_t *bp = barrier_init( HANDLE, TASKS + 1 );
+    assert( bp != NULL );
+    for( unsigned i=0; i < TASKS; i++ )
+    {
+        if( fork() == 0 )
+        {
+            exit( barrier_wait( bp ) < 0 ? 0 : 1 );
+        }
+    }
+    usleep( 10000 );
+    barrier_abort( bp );
+    for( unsigned i=0; i < TASKS; i++ )
+    {
+        assert( wait( &status ) > 0 );
+        assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+    }
+    assert( barrier_wait( bp ) < 0 );
+    barrier_destroy( bp );
+
+    printf( "Barrier tests passed\n" );
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*--------------------------------------------------------------------------------------------*/
+/* Removal of the workspaces of file-based storage drivers: check that a tree of objects laid
+ * out as each driver writes them is removed entirely, with one thread and with several (and
+ * with io_uring), and that removal stops at a file the benchmark could not have written. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "storage.h"
+
+#define WORKSPACE   "test/test_clean-data"
+#define CLIENTS     3
+#define OBJECTS     1000
+
+static void create( const char *path )
+{
+    const int fd = open( path, O_CREAT | O_EXCL | O_WRONLY, 0644 );
+    assert( fd >= 0 );
+    close( fd );
+}
+
+/* Objects in a flat directory, as written by the DEBUG driver */
+static void populate_debug( void )
+{
+    char path[64];
+    for( unsigned c=0; c < CLIENTS; c++ )
+    {
+        for( unsigned i=0; i < OBJECTS; i++ )
+        {
+            snprintf( path, sizeof(path), "%s/%08x-%08x", WORKSPACE, c, i * 7919 );
+            create( path );
+        }
+    }
+}
+
+/* Objects in a three-level tree, as written by the DIRTREE driver */
+static void populate_dirtree( void )
+{
+    char path[96];
+    for( unsigned c=0; c < CLIENTS; c++ )
+    {
+        for( unsigned i=0; i < OBJECTS; i++ )
+        {
+            const unsigned obj = i * 104729;
+            snprintf( path, sizeof(path), "%s/%04X", WORKSPACE, c );
+            mkdir( path, 0755 );
+            snprintf( path, sizeof(path), "%s/%04X/%04X", WORKSPACE, c, 0 );
+            mkdir( path, 0755 );
+            snprintf( path, sizeof(path), "%s/%04X/%04X/%04X", WORKSPACE, c, 0, obj >> 16 );
+            mkdir( path, 0755 );
+            snprintf( path, sizeof(path), "%s/%04X/%04X/%04X/%08X-%08X", WORKSPACE, c, 0, obj >> 16, c, obj );
+            create( path );
+        }
+    }
+}
+
+static int exists( const char *path )
+{
+    struct stat st;
+    return stat( path, &st ) == 0;
+}
+
+static void run( const storage_impl_t impl, void (*populate)( void ), const unsigned threads )
+{
+    storage_select( impl );
+    storage_set_clean_threads( threads );
+    assert( storage_driver_create( WORKSPACE, 0, NULL ) == 0 );
+    populate( );
+    assert( storage_driver_destroy( ) == 0 );
+    assert( !exists( WORKSPACE ) );
+}
+
+int main( int argc, char *argv[] )
+{
+    log_set_level( LOG_INFO );
+
+    run( STORAGE_DEBUG, populate_debug, 1 );
+    run( STORAGE_DEBUG, populate_debug, 4 );
+    run( STORAGE_DIRTREE, populate_dirtree, 1 );
+    run( STORAGE_DIRTREE, populate_dirtree, 4 );
+
+    /* With io_uring, where built in (otherwise falling back to unlinkat) */
+    storage_set_flags( STORAGE_CLEAN_URING );
+    run( STORAGE_DIRTREE, populate_dirtree, 4 );
+    storage_set_flags( 0 );
+
+    /* A file which is not an object is left in place, with the workspace */
+    storage_select( STORAGE_DIRTREE );
+    assert( storage_driver_create( WORKSPACE, 0, NULL ) == 0 );
+    populate_dirtree( );
+    create( WORKSPACE "/0001/0000/precious" );
+    assert( storage_driver_destroy( ) < 0 );
+    assert( exists( WORKSPACE "/0001/0000/precious" ) );
+    unlink( WORKSPACE "/0001/0000/precious" );
+    assert( storage_driver_create( WORKSPACE, 0, NULL ) == 0 );
+    assert( storage_driver_destroy( ) == 0 );
+    assert( !exists( WORKSPACE ) );
+
+    printf( "Cleanup tests passed\n" );
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*--------------------------------------------------------------------------------------------*/
+/* Coordination of several nodes, simulated by processes on this host: over a UNIX socket and
+ * over TCP loopback, check that no node passes a barrier before all have reached it, that
+ * clock offsets (from the same clock) are estimated within their error bounds, that results
+ * are collected and merged, and that the loss of a node aborts the run. */
+/* Begun 2019, StackHPC Ltd */
+
+#define _DEFAULT_SOURCE                 /* For MAP_ANONYMOUS */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "stats.h"
+#include "coord.h"
+
+#define NODES       3
+#define OUTDIR      "test"
+
+/* Arrivals at each barrier, shared by the simulated nodes */
+static unsigned *arrived;
+
+static int node( const char *addr, const unsigned tasks, const int lost )
+{
+    uint32_t n, nodes;
+    uint64_t run_id;
+    coord_clock_t C[COORD_NCLOCKS];
+    char path[64];
+
+    if( coord_connect( addr, tasks, &n, &nodes, &run_id ) < 0 || nodes != NODES )
+    {
+        return 1;
+    }
+    if( lost )
+    {
+        /* Once the others are waiting at the first barrier */
+        while( __atomic_load_n( &arrived[0], __ATOMIC_SEQ_CST ) < NODES - 1 )
+        {
+            sched_yield( );
+        }
+        _exit( 0 );
+    }
+
+    /* The clock is shared with the coordinator: the offset is within half the round trip */
+    for( unsigned c=0; c < COORD_NCLOCKS; c++ )
+    {
+        assert( coord_clock( &C[c] ) == 0 );
+        assert( C[c].rtt > 0 );
+        assert( llabs( C[c].offset ) <= (long long)(C[c].rtt / 2 + 1) );
+    }
+    assert( C[COORD_CLOCK_END].when >= C[COORD_CLOCK_START].when );
+
+    for( unsigned b=0; b <= COORD_BARRIER_READ; b++ )
+    {
+        __atomic_add_fetch( &arrived[b], 1, __ATOMIC_SEQ_CST );
+        if( coord_barrier( b ) < 0 )
+        {
+            return 2;
+        }
+        assert( __atomic_load_n( &arrived[b], __ATOMIC_SEQ_CST ) == NODES );
+    }
+
+    /* A histogram of tasks latencies of 1us, and results of a one second phase */
+    const char *names[TRACE_NTYPES];
+    histogram_t H[TRACE_NTYPES];
+    for( unsigned t=0; t < TRACE_NTYPES; t++ )
+    {
+        names[t] = trace_type_str( t );
+        histogram_init( &H[t] );
+    }
+    for( unsigned i=0; i < tasks; i++ )
+    {
+        histogram_record( &H[TRACE_WRITE], 1000 );
+    }
+    snprintf( path, sizeof(path), "%s/test_coord%u.hst", OUTDIR, n );
+    assert( histogram_write( path, names, H, TRACE_NTYPES ) == 0 );
+
+    coord_result_t R;
+    memset( &R, 0, sizeof(R) );
+    R.tasks = tasks;
+    R.phase[STATS_PHASE_WRITE].workers = tasks;
+    R.phase[STATS_PHASE_WRITE].ops = 100 * tasks;
+    R.phase[STATS_PHASE_WRITE].first = 1000000000LL * n;
+    R.phase[STATS_PHASE_WRITE].last = 1000000000LL * (n + 1);
+    memcpy( R.clock, C, sizeof(R.clock) );
+    const char *paths[COORD_NFILES] = { NULL, path };
+    const int ret = coord_report( &R, paths );
+    coord_close( );
+    unlink( path );
+    return ret < 0 ? 3 : 0;
+}
+
+/* Run a coordinator and its nodes, returning the exit status of the coordinator */
+static int run( const char *addr, const int lose )
+{
+    pid_t coordinator, pid[NODES];
+    int status;
+
+    memset( arrived, 0, 2 * sizeof(unsigned) );
+    if( (coordinator = fork()) == 0 )
+    {
+        exit( coord_serve( addr, NODES, OUTDIR ) < 0 ? 1 : 0 );
+    }
+    for( unsigned i=0; i < NODES; i++ )
+    {
+        if( (pid[i] = fork()) == 0 )
+        {
+            exit( node( addr, i + 1, lose && i == NODES - 1 ) );
+        }
+    }
+
+    for( unsigned i=0; i < NODES; i++ )
+    {
+        assert( waitpid( pid[i], &status, 0 ) == pid[i] );
+        assert( WIFEXITED( status ) );
+        assert( WEXITSTATUS( status ) == (lose && i < NODES - 1 ? 2 : 0) );
+    }
+    assert( waitpid( coordinator, &status, 0 ) == coordinator );
+    assert( WIFEXITED( status ) );
+    return WEXITSTATUS( status );
+}
+
+static void check_results( void )
+{
+    const char *names[TRACE_NTYPES];
+    histogram_t H[TRACE_NTYPES];
+    for( unsigned t=0; t < TRACE_NTYPES; t++ )
+    {
+        names[t] = trace_type_str( t );
+        histogram_init( &H[t] );
+    }
+    assert( histogram_read( OUTDIR "/motif_1.hst", names, H, TRACE_NTYPES ) == TRACE_NTYPES );
+    assert( H[TRACE_WRITE].count == 1 + 2 + 3 );
+
+    /* 600 operations by 6 tasks, in the longest window of a second */
+    char line[256];
+    int found = 0, clocks = 0;
+    FILE *fp = fopen( OUTDIR "/coordinator-summary.json", "r" );
+    assert( fp != NULL );
+    while( fgets( line, sizeof(line), fp ) != NULL )
+    {
+        if( strstr( line, "\"write\": {\"nodes\": 3, \"tasks\": 6, \"elapsed\": 1.000000000, \"ops\": 600," ) )
+        {
+            found = 1;
+        }
+        clocks += strstr( line, "\"clock\": {\"offset_ns\": " ) != NULL;
+    }
+    fclose( fp );
+    assert( found );
+    assert( clocks == NODES );
+
+    unlink( OUTDIR "/motif_1.hst" );
+    unlink( OUTDIR "/coordinator-summary.json" );
+    for( unsigned i=0; i < NODES; i++ )
+    {
+        char path[64];
+        snprintf( path, sizeof(path), "%s/node%u.hst", OUTDIR, i );
+        unlink( path );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    char addr[64];
+
+    arrived = mmap( NULL, 2 * sizeof(unsigned), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    assert( arrived != MAP_FAILED );
+
+    snprintf( addr, sizeof(addr), "unix:%s/test_coord.sock", OUTDIR );
+    assert( run( addr, 0 ) == 0 );
+    check_results( );
+
+    snprintf( addr, sizeof(addr), "127.0.0.1:%d", 20000 + getpid() % 20000 );
+    assert( run( addr, 0 ) == 0 );
+    check_results( );
+
+    /* The loss of a node after registering aborts the others at the first barrier */
+    snprintf( addr, sizeof(addr), "unix:%s/test_coord.sock", OUTDIR );
+    assert( run( addr, 1 ) == 1 );
+    unlink( OUTDIR "/coordinator-summary.json" );
+
+    printf( "Coordination tests passed\n" );
+    return 0;
+}
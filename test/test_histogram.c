@@ -0,0 +1,74 @@
+/*--------------------------------------------------------------------------------------------*/
+/* Storage benchmark motif 1: scattered small-file I/O
+ * This motif aims to measure storage candidate performance for an
+ * application workload with the following characteristics:
+ * - Generate stimulus based on highly-concurrent access to a
+ *   very large number of small files.
+ * - Telemetry will be gathered for the factors that are likely to
+ *   dominate overall performance.
+ * - This scenario would adapt well to either file-based or object-based
+ *   storage paradigms.
+ *
+ * Begun 2018-2019, StackHPC Ltd. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "utils.h"
+
+#define TEST_FILE "test/test_histogram.hst"
+
+int main( int argc, char *argv[] )
+{
+    const char *names[] = { "READ", "WRITE" };
+    histogram_t *H = malloc( 4 * sizeof(histogram_t) );
+    assert( H != NULL );
+
+    /* Bucket boundaries are monotonic and small values are exact */
+    for( uint64_t v=0; v < HIST_SUB_COUNT; v++ )
+    {
+        assert( histogram_index( v ) == v );
+    }
+    for( uint64_t v=1; v < HIST_LIMIT; v = v * 3 + 1 )
+    {
+        assert( histogram_index( v ) <= histogram_index( v + 1 ) );
+        assert( histogram_index( v ) < HIST_NBUCKETS );
+    }
+    assert( histogram_index( UINT64_MAX ) == HIST_NBUCKETS - 1 );
+
+    /* Record 1..100000 ns and check percentiles to within the bucket resolution */
+    histogram_init( &H[0] );
+    histogram_init( &H[1] );
+    for( uint64_t v=1; v <= 100000; v++ )
+    {
+        histogram_record( &H[0], v );
+    }
+    assert( H[0].count == 100000 && H[0].min == 1 && H[0].max == 100000 );
+    const double pct[] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+    for( unsigned i=0; i < ARRAYLEN(pct); i++ )
+    {
+        const double expect = pct[i] * 1000.0;
+        const double got = histogram_percentile( &H[0], pct[i] );
+        printf( "p%g = %.0f (expected %.0f)\n", pct[i], got, expect );
+        assert( got >= expect && got <= expect * 1.01 );
+    }
+    histogram_record( &H[1], 42 );
+
+    /* Merging and the file format round-trip */
+    assert( histogram_write( TEST_FILE, names, H, 2 ) == 0 );
+    histogram_init( &H[2] );
+    histogram_init( &H[3] );
+    assert( histogram_read( TEST_FILE, names, &H[2], 2 ) == 2 );
+    assert( histogram_read( TEST_FILE, names, &H[2], 2 ) == 2 );
+    assert( H[2].count == 200000 && H[2].min == 1 && H[2].max == 100000 );
+    assert( histogram_percentile( &H[2], 50.0 ) == histogram_percentile( &H[0], 50.0 ) );
+    assert( H[3].count == 2 && H[3].min == 42 && H[3].max == 42 );
+    unlink( TEST_FILE );
+
+    free( H );
+    printf( "Histogram tests passed\n" );
+    return 0;
+}
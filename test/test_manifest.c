@@ -0,0 +1,88 @@
+/*--------------------------------------------------------------------------------------------*/
+/* Dataset manifests: check that entries recorded by forked tasks are read back with the
+ * header describing them, and that a manifest which was never completed, or was truncated,
+ * is refused. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "manifest.h"
+
+#define MANIFEST    "test/test_manifest.man"
+#define TASKS       3
+#define COUNT       1000
+
+static void record( manifest_t *M, const unsigned ordinal )
+{
+    for( unsigned i=0; i < COUNT; i++ )
+    {
+        manifest_record( M, ordinal, i, ordinal, i * 7919 + ordinal, 100 + i );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    int status;
+
+    log_set_level( LOG_INFO );
+
+    /* Each task records its entries in the shared mapping */
+    manifest_t *M = manifest_create( MANIFEST, TASKS, COUNT );
+    assert( M != NULL );
+    for( unsigned t=0; t < TASKS; t++ )
+    {
+        const pid_t pid = fork( );
+        assert( pid >= 0 );
+        if( pid == 0 )
+        {
+            record( M, t );
+            exit( 0 );
+        }
+        assert( waitpid( pid, &status, 0 ) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+    }
+
+    /* Until it is complete, the manifest cannot be read */
+    assert( manifest_open( MANIFEST ) == NULL );
+
+    manifest_hdr_t H = { .storage = 1, .sample = 0, .prng = 1, .seed = 42, .tasks = TASKS, .run_id = 0x1234 };
+    strcpy( H.size, "uniform:100:1099" );
+    assert( manifest_finish( M, &H ) == 0 );
+
+    M = manifest_open( MANIFEST );
+    assert( M != NULL );
+    assert( M->nobj == TASKS * COUNT );
+    assert( M->hdr->storage == 1 && M->hdr->prng == 1 && M->hdr->seed == 42 && M->hdr->run_id == 0x1234 );
+    assert( M->hdr->tasks == TASKS && M->hdr->count == COUNT );
+    assert( strcmp( M->hdr->size, "uniform:100:1099" ) == 0 );
+    assert( M->hdr->max_len == 100 + COUNT - 1 );
+    assert( M->hdr->bytes == TASKS * (100ULL * COUNT + (uint64_t)COUNT * (COUNT - 1) / 2) );
+    for( unsigned t=0; t < TASKS; t++ )
+    {
+        for( unsigned i=0; i < COUNT; i++ )
+        {
+            const manifest_obj_t *e = &M->obj[t * COUNT + i];
+            assert( e->client_id == t && e->obj_id == i * 7919 + t && e->len == 100 + i );
+        }
+    }
+    manifest_close( M );
+
+    /* A manifest missing entries is refused */
+    assert( truncate( MANIFEST, sizeof(manifest_hdr_t) + sizeof(manifest_obj_t) * (TASKS * COUNT - 1) ) == 0 );
+    assert( manifest_open( MANIFEST ) == NULL );
+
+    /* A discarded manifest is removed */
+    M = manifest_create( MANIFEST, TASKS, COUNT );
+    assert( M != NULL );
+    manifest_discard( M );
+    assert( access( MANIFEST, F_OK ) < 0 );
+
+    printf( "Manifest tests passed\n" );
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*--------------------------------------------------------------------------------------------*/
+/* Trace-driven replay: check the planning of CSV and motif traces, that operations are shared
+ * out between workers by group of streams addressing the same objects in order of time, that each write creates a new version of its
+ * object which later reads follow, and that objects read before being written are created
+ * beforehand. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "utils.h"
+#include "replay.h"
+
+#define CSV_FILE    "test/test_replay.csv"
+#define TRC_FILE    "test/test_replay.trc"
+
+static void write_file( const char *path, const char *text )
+{
+    FILE *fp = fopen( path, "w" );
+    assert( fp != NULL );
+    fputs( text, fp );
+    fclose( fp );
+}
+
+static void test_timing( void )
+{
+    double speed;
+    assert( replay_timing_parse( "fast", &speed ) == 0 && speed == 0.0 );
+    assert( replay_timing_parse( "original", &speed ) == 0 && speed == 1.0 );
+    assert( replay_timing_parse( "scale:2.5", &speed ) == 0 && speed == 2.5 );
+    assert( replay_timing_parse( "scale:0", &speed ) < 0 );
+    assert( replay_timing_parse( "scale:", &speed ) < 0 );
+    assert( replay_timing_parse( "slow", &speed ) < 0 );
+}
+
+static void test_csv( void )
+{
+    replay_t R;
+
+    /* Streams s1 and s2 both address y, so are replayed in order by the same worker */
+    write_file( CSV_FILE,
+                "timestamp,op,object,size,stream\n"
+                "# objects x and y are written, then x is overwritten\n"
+                "1.5,write,x,100,s1\n"
+                "1.25,write,y,200,s2\n"
+                "1.75,read,y,0,s1\n"
+                "2,read,z,50,s2\n"
+                "2.5,WRITE,x,300,s1\n"
+                "3,r,x,,s1\n"
+                "3.0,stat,x,0,s1\n" );
+    assert( replay_load( &R, CSV_FILE, 2 ) == 0 );
+    assert( R.nread == 3 && R.nwrite == 3 && R.nignored == 1 && R.nstream == 2 && R.ngroup == 1 );
+    assert( R.nversion == 4 && R.max_len == 300 && R.duration == 1750000000ULL );
+
+    assert( R.op_first[0] == 0 && R.op_first[1] == 6 && R.op_first[2] == 6 );
+    const replay_op_t *w0 = &R.op[R.op_first[0]];
+    assert( w0[0].op == TRACE_WRITE && w0[0].when == 0 && w0[0].len == 200 );
+    assert( w0[1].op == TRACE_WRITE && w0[1].when == 250000000ULL && w0[1].len == 100 );
+    assert( w0[2].op == TRACE_READ && w0[2].when == 500000000ULL );
+    assert( w0[2].client_id == w0[0].client_id && w0[2].obj_id == w0[0].obj_id && w0[2].len == 200 );
+    assert( w0[3].op == TRACE_READ && w0[3].len == 50 );
+    assert( w0[4].op == TRACE_WRITE && w0[4].len == 300 && w0[4].obj_id != w0[1].obj_id );
+    assert( w0[5].op == TRACE_READ && w0[5].obj_id == w0[4].obj_id && w0[5].len == 300 );
+
+    /* z is read before it is written, so it is created beforehand by the worker reading it */
+    assert( R.npreload == 1 && R.preload_first[1] == 1 && R.preload_first[2] == 1 );
+    assert( R.preload[0].obj_id == w0[3].obj_id && R.preload[0].len == 50 );
+    replay_free( &R );
+
+    /* A read of an object written by another stream joins their groups, even when the streams
+     * would otherwise be shared out to different workers: s1 and s3 are replayed by worker 0,
+     * and s2 and s4 (which address objects of their own) by workers 1 and 0 */
+    write_file( CSV_FILE,
+                "0,write,a,10,s1\n"
+                "0.5,write,b,20,s2\n"
+                "1,read,a,10,s3\n"
+                "1.5,write,c,30,s4\n"
+                "2,read,b,20,s2\n" );
+    assert( replay_load( &R, CSV_FILE, 2 ) == 0 );
+    assert( R.nstream == 4 && R.ngroup == 3 && R.npreload == 0 );
+    assert( R.op_first[0] == 0 && R.op_first[1] == 3 && R.op_first[2] == 5 );
+    assert( R.op[0].op == TRACE_WRITE && R.op[0].len == 10 && R.op[0].stream == 0 );
+    assert( R.op[1].op == TRACE_READ && R.op[1].stream == 2 );
+    assert( R.op[1].client_id == R.op[0].client_id && R.op[1].obj_id == R.op[0].obj_id );
+    assert( R.op[2].op == TRACE_WRITE && R.op[2].len == 30 && R.op[2].stream == 3 );
+    assert( R.op[3].stream == 1 && R.op[4].stream == 1 && R.op[4].obj_id == R.op[3].obj_id );
+    replay_free( &R );
+
+    /* Without streams, the operations on each object are kept together */
+    write_file( CSV_FILE, "0,write,a,10\n0.5,write,b,10\n1,read,a,10\n" );
+    assert( replay_load( &R, CSV_FILE, 3 ) == 0 );
+    assert( R.nstream == 2 && R.op_first[1] == 2 && R.op[0].obj_id == R.op[1].obj_id );
+    replay_free( &R );
+
+    /* Records which cannot be parsed are refused */
+    write_file( CSV_FILE, "0,write,a,10\nlater,read,a,10\n" );
+    assert( replay_load( &R, CSV_FILE, 1 ) < 0 );
+    write_file( CSV_FILE, "0,write,a,ten\n" );
+    assert( replay_load( &R, CSV_FILE, 1 ) < 0 );
+    write_file( CSV_FILE, "timestamp,op,object,size\n" );
+    assert( replay_load( &R, CSV_FILE, 1 ) < 0 );
+    unlink( CSV_FILE );
+}
+
+static void test_trc( void )
+{
+    /* A version 1 trace of one worker: a read before any write, then two writes and reads
+     * cycling through the objects written, with a component record and a miscellaneous one */
+    const struct { trace_type_t op; long when; } rec[] = {
+        { TRACE_READ, 0 }, { TRACE_WRITE, 10 }, { TRACE_OPEN, 10 }, { TRACE_WRITE, 20 },
+        { TRACE_MISC, 25 }, { TRACE_READ, 30 }, { TRACE_READ, 40 }, { TRACE_READ, 50 },
+    };
+    replay_t R;
+
+    FILE *fp = fopen( TRC_FILE, "w" );
+    assert( fp != NULL );
+    for( unsigned i=0; i < ARRAYLEN(rec); i++ )
+    {
+        trace_entry_t te;
+        memset( &te, 0, sizeof(te) );
+        te.info.op = rec[i].op;
+        te.timestamp.tv_nsec = 1000 + rec[i].when;
+        te.duration.tv_nsec = 5;
+        assert( fwrite( &te, sizeof(te), 1, fp ) == 1 );
+    }
+    fclose( fp );
+
+    assert( replay_load( &R, TRC_FILE, 2 ) == 0 );
+    assert( R.nstream == 1 && R.nread == 4 && R.nwrite == 2 && R.nignored == 1 && R.npreload == 1 );
+    assert( R.op_first[1] == 6 && R.op_first[2] == 6 && R.duration == 50 );
+    assert( R.op[0].op == TRACE_READ && R.op[0].obj_id == R.preload[0].obj_id );
+    assert( R.op[3].obj_id == R.op[1].obj_id && R.op[4].obj_id == R.op[2].obj_id );
+    assert( R.op[5].obj_id == R.op[1].obj_id && R.op[1].obj_id != R.op[2].obj_id );
+    for( unsigned i=0; i < R.nop; i++ )
+    {
+        assert( R.op[i].len == 0 && R.op[i].client_id == 0 );
+    }
+    replay_free( &R );
+    unlink( TRC_FILE );
+}
+
+int main( int argc, char *argv[] )
+{
+    log_set_level( LOG_INFO );
+
+    test_timing( );
+    test_csv( );
+    test_trc( );
+
+    printf( "Replay tests passed\n" );
+    return 0;
+}
@@ -15,6 +15,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "prng.h"
@@ -42,5 +44,127 @@ int main( int argc, char *argv[] )
     printf( "Sample is %s\n", valid ? "valid" : "INVALID" );
     sample_destroy( S );
     assert( valid );
+
+    /* Check that each size distribution regenerates the same length on validation */
+    const char *sizes[] = { "fixed:4K", "uniform:1K:1M", "lognormal:4K:2M", "lognormal:1K:64K:8M" };
+    for( unsigned i=0; i < ARRAYLEN(sizes); i++ )
+    {
+        assert( sample_size_parse( sizes[i] ) == 0 );
+        S = sample_create( P );
+        for( unsigned j=0; j < 100; j++ )
+        {
+            const uint32_t seed = 42 + j;
+            prng_init( P, seed );
+            sample_init( S, P );
+            assert( sample_len( S ) <= sample_size_max() );
+            prng_init( P, seed );
+            assert( sample_valid( S, P ) );
+        }
+        printf( "Sizes %s: max %zu bytes, valid\n", sizes[i], sample_size_max() );
+        sample_destroy( S );
+    }
+    /* Streamed data must match a whole sample, in chunks that split words */
+    sample_stream_t *T = sample_stream_create( );
+    uint8_t chunk[1001];
+    assert( sample_size_parse( "uniform:1K:64K" ) == 0 );
+    S = sample_create( P );
+    for( unsigned j=0; j < 10; j++ )
+    {
+        prng_init( P, 42 + j );
+        sample_init( S, P );
+        data = sample_data( S );
+
+        prng_init( P, 42 + j );
+        assert( sample_stream_init( T, P ) == sample_len( S ) );
+        size_t offset = 0, n;
+        while( (n = sample_stream_generate( T, chunk, sizeof(chunk) )) > 0 )
+        {
+            assert( memcmp( chunk, data + offset, n ) == 0 );
+            offset += n;
+        }
+        assert( offset == sample_len( S ) );
+
+        prng_init( P, 42 + j );
+        sample_stream_init( T, P );
+        for( offset = 0; offset < sample_len( S ); offset += n )
+        {
+            n = sample_len( S ) - offset < 777 ? sample_len( S ) - offset : 777;
+            assert( sample_stream_valid( T, data + offset, n ) );
+        }
+        assert( sample_stream_remain( T ) == 0 );
+    }
+    prng_init( P, 42 );
+    sample_stream_init( T, P );
+    memset( chunk, 0, sizeof(chunk) );
+    assert( !sample_stream_valid( T, chunk, sizeof(chunk) ) );
+    printf( "Streamed samples valid\n" );
+
+    /* Sizes are drawn from 64 bits, so that streamed objects may be larger than 4 GiB */
+    assert( sample_size_parse( "uniform:1:64G" ) == 0 );
+    size_t largest = 0;
+    for( unsigned j=0; j < 100; j++ )
+    {
+        prng_init( P, 42 + j );
+        const size_t drawn = sample_size_next( P );
+        assert( drawn >= 1 && drawn < (64ULL << 30) );
+        if( drawn > largest )   largest = drawn;
+        prng_init( P, 42 + j );
+        assert( sample_stream_init( T, P ) == drawn );
+    }
+    assert( largest > (4ULL << 30) );
+    printf( "Sizes uniform:1:64G: largest of 100 is %zu bytes\n", largest );
+    sample_stream_destroy( T );
+    sample_destroy( S );
+
+    /* Pool buffers are aligned, reused through the free stack, and run out */
+    sample_t *pooled[3];
+    const void *addr[3];
+    assert( sample_size_parse( "fixed:5000" ) == 0 );
+    assert( sample_pool_init( 3, 0 ) == 0 );
+    for( unsigned i=0; i < ARRAYLEN(pooled); i++ )
+    {
+        assert( (pooled[i] = sample_create( P )) != NULL );
+        addr[i] = sample_data( pooled[i] );
+        assert( (uintptr_t)addr[i] % SAMPLE_ALIGN == 0 );
+        assert( i == 0 || addr[i] != addr[i - 1] );
+    }
+    assert( sample_create( P ) == NULL );
+    sample_destroy( pooled[1] );
+    assert( (pooled[1] = sample_create( P )) != NULL && sample_data( pooled[1] ) == addr[1] );
+    for( unsigned i=0; i < ARRAYLEN(pooled); i++ )
+    {
+        sample_destroy( pooled[i] );
+    }
+    sample_pool_fini( );
+
+    /* Without reserved huge pages, the pool falls back to ordinary (or transparent huge) pages */
+    assert( sample_pool_init( 2, SAMPLE_POOL_HUGEPAGE ) == 0 );
+    for( unsigned i=0; i < 2; i++ )
+    {
+        assert( (pooled[i] = sample_create( P )) != NULL );
+        assert( (uintptr_t)sample_data( pooled[i] ) % SAMPLE_ALIGN == 0 );
+        prng_init( P, 42 + i );
+        sample_init( pooled[i], P );
+        prng_init( P, 42 + i );
+        assert( sample_valid( pooled[i], P ) );
+    }
+    sample_destroy( pooled[0] );
+    sample_destroy( pooled[1] );
+    sample_pool_fini( );
+
+    /* Pools whose length would wrap are refused */
+    assert( sample_size_parse( "fixed:16G" ) == 0 );
+    assert( sample_pool_init( UINT_MAX, 0 ) < 0 );
+    assert( sample_size_parse( "fixed:18446744073709551615" ) == 0 );
+    assert( sample_pool_init( 1, 0 ) < 0 );
+    printf( "Sample pool valid\n" );
+
+    assert( sample_size_parse( "uniform:1M:1K" ) < 0 );
+    assert( sample_size_parse( "bogus:1K" ) < 0 );
+    assert( sample_size_parse( "fixed:99999999999G" ) < 0 );
+    assert( sample_size_parse( "uniform:1K:17179869184G" ) < 0 );
+    assert( sample_size_parse( "fixed:99999999999999999999" ) < 0 );
+    assert( sample_size_parse( "lognormal:4K:17179869183G" ) < 0 );
+    assert( sample_size_parse( "fixed:17179869183G" ) == 0 && sample_size_max() == 17179869183ULL << 30 );
     return 0;
 }
@@ -0,0 +1,103 @@
+/*--------------------------------------------------------------------------------------------*/
+/* Concurrency sweeps: check the series stepped through and the knee found, against a
+ * synthetic storage candidate which scales linearly up to 12 tasks and then saturates. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "utils.h"
+#include "sweep.h"
+
+static double iops( const unsigned tasks )
+{
+    return 1000.0 * (tasks < 12 ? tasks : 12);
+}
+
+/* Latency grows with queueing once saturated */
+static uint64_t p99( const unsigned tasks )
+{
+    return tasks < 12 ? 100000 : 100000ULL * tasks / 12;
+}
+
+/* Run a sweep to completion, returning the number of steps */
+static unsigned run( sweep_t *W, const unsigned limit )
+{
+    unsigned steps = 0, tasks;
+    while( (tasks = sweep_next( W )) > 0 )
+    {
+        assert( tasks <= W->max );
+        const int recorded = sweep_record( W, tasks, iops( tasks ), iops( tasks ) * 4096, p99( tasks ) );
+        assert( recorded == 0 );
+        steps++;
+        assert( steps <= limit );
+    }
+    return steps;
+}
+
+int main( int argc, char *argv[] )
+{
+    const sweep_point_t *knee;
+    unsigned steps;
+    sweep_t W;
+    int ret;
+
+    static const char *invalid[] = {
+        "geometric:0:8", "geometric:8:4", "geometric:1:8:1", "slo:100", "linear:1:8", "geometric:1:8,time:-1"
+    };
+    for( unsigned i=0; i < ARRAYLEN(invalid); i++ )
+    {
+        ret = sweep_parse( &W, invalid[i] );
+        assert( ret < 0 );
+    }
+
+    /* Each phase of a step is bounded in time, unless the bound is 0 */
+    ret = sweep_parse( &W, "geometric:1:8" );
+    assert( ret == 0 && W.phase_time == SWEEP_PHASE_TIME );
+    sweep_fini( &W );
+    ret = sweep_parse( &W, "geometric:1:8,time:0.5" );
+    assert( ret == 0 && W.phase_time == 0.5 );
+    sweep_fini( &W );
+    ret = sweep_parse( &W, "geometric:1:8,time:0" );
+    assert( ret == 0 && W.phase_time == 0.0 );
+    sweep_fini( &W );
+
+    /* 1, 2, 4, 8, 16, 32: no gain at 32, so the knee is at 16 */
+    ret = sweep_parse( &W, "geometric:1:64" );
+    assert( ret == 0 );
+    steps = run( &W, 10 );
+    knee = sweep_knee( &W );
+    assert( steps == 6 && W.saturated );
+    assert( knee != NULL && knee->tasks == 16 );
+    sweep_fini( &W );
+
+    /* Doubling from 8 to 16 gains only 50%: bisection between them finds the saturation point */
+    ret = sweep_parse( &W, "adaptive:1:64,gain:60" );
+    assert( ret == 0 );
+    run( &W, 20 );
+    knee = sweep_knee( &W );
+    assert( W.saturated );
+    assert( knee != NULL && knee->tasks == 12 );
+    sweep_fini( &W );
+
+    /* A latency objective stops the sweep before throughput saturates */
+    ret = sweep_parse( &W, "geometric:1:64:3,slo:90" );
+    assert( ret == 0 );
+    steps = run( &W, 10 );
+    knee = sweep_knee( &W );
+    assert( steps == 1 && knee == NULL );
+    sweep_fini( &W );
+
+    /* Reaching the maximum concurrency while still scaling */
+    ret = sweep_parse( &W, "adaptive:2:6" );
+    assert( ret == 0 );
+    steps = run( &W, 10 );
+    knee = sweep_knee( &W );
+    assert( steps == 3 && !W.saturated );
+    assert( knee != NULL && knee->tasks == 6 );
+    sweep_fini( &W );
+
+    printf( "Sweep tests passed\n" );
+    return 0;
+}
@@ -16,12 +16,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/stat.h>
 
 #include "utils.h"
+#include "tracefile.h"
 
 int main( int argc, char *argv[] )
 {
-    struct timespec t_start, t_iter, t_delta;
+    struct timespec t_start, t_iter, t_delta, t_first;
+    trace_entry_t te;
+    trace_reader_t *R;
     int i;
 
     time_now( &t_start );
@@ -34,11 +38,162 @@ int main( int argc, char *argv[] )
     for( i=0; i<10; i++ ) {
         time_now( &t_iter );
         time_delta( &t_start, &t_iter, &t_delta );
+        if( i == 0 )    t_first = t_delta;
         trace_read( &t_delta, &t_delta );
         trace_write( &t_delta, &t_delta );
         trace( TRACE_MISC, &t_delta, &t_delta, "teststr" );
     }
     
     trace_fini();
+
+    /* Read back the records, which are delta-encoded in the file */
+    R = trace_reader_open( "0.trc" );
+    assert( R != NULL && trace_reader_header( R )->version == 2 );
+    for( i=0; trace_reader_next( R, &te ) > 0; i++ ) {
+        assert( te.info.op == i % 3 );
+        if( te.info.op == TRACE_MISC )  assert( strcmp( te.info.tag, "teststr" ) == 0 );
+        else                            assert( te.info.tag[0] == '\0' );
+        if( i == 0 ) {
+            assert( te.timestamp.tv_sec == t_first.tv_sec && te.timestamp.tv_nsec == t_first.tv_nsec );
+            assert( te.duration.tv_sec == t_first.tv_sec && te.duration.tv_nsec == t_first.tv_nsec );
+        }
+    }
+    assert( i == 30 );
+    trace_reader_close( R );
+
+    /* Stress a small ring: every record must reach the file, in order and intact, however
+     * often we stall and wrap (the size asked for is rounded up to a power of 2) */
+    const unsigned nrec = 1000000;
+    trace_stats_t st;
+    struct stat sb;
+
+    trace_set_size( 1000 );
+    if (trace_init( ".", 1)) {
+        log_error( "trace init failed" );
+        exit(1);
+    }
+    for( i=0; i<nrec; i++ ) {
+        const struct timespec t_rec = { i / 1000, (i % 1000) * 1000 }, t_dur = { 0, i };
+        trace_write( &t_rec, &t_dur );
+    }
+    trace_fini();
+    trace_stats( &st );
+    printf( "%lu records, %lu stalls, %lu dropped\n", (unsigned long)st.records,
+            (unsigned long)st.stalls, (unsigned long)st.dropped );
+    assert( st.records == nrec && st.dropped == 0 );
+    assert( stat( "1.trc", &sb ) == 0 && sb.st_size < nrec * sizeof(trace_entry_t) );
+    R = trace_reader_open( "1.trc" );
+    assert( R != NULL );
+    for( i=0; trace_reader_next( R, &te ) > 0; i++ ) {
+        assert( te.info.op == TRACE_WRITE );
+        assert( te.timestamp.tv_sec == i / 1000 && te.timestamp.tv_nsec == (i % 1000) * 1000 );
+        assert( te.duration.tv_sec == 0 && te.duration.tv_nsec == i );
+    }
+    assert( i == nrec );
+    trace_reader_close( R );
+    printf( "%u records in %ld bytes\n", nrec, (long)sb.st_size );
+
+    /* The same records are found by mapping the file, a block at a time */
+    trace_map_t M;
+    trace_entry_t *blk = malloc( TRACE_BLOCK_NREC * sizeof(trace_entry_t) );
+    uint8_t *scratch = malloc( TRACE_BLOCK_MAX );
+    size_t off, nblock = 0;
+    int n;
+    assert( trace_map_open( &M, "1.trc" ) == 0 && M.hdr.version == 2 && M.hdr.ordinal == 1 );
+    for( off = M.first; off < M.len; off = trace_map_skip( &M, off ) )
+        nblock++;
+    for( i=0, off = M.first; (n = trace_map_block( &M, &off, scratch, blk, NULL )) > 0; i += n )
+        nblock--;
+    assert( n == 0 && i == nrec && nblock == 0 );
+    trace_map_close( &M );
+    free( blk );
+    free( scratch );
+
+    /* Tick counts from the TSC (if usable) convert to the same ns as CLOCK_MONOTONIC */
+    const struct timespec pause = { 0, 10000000L };
+    printf( "time source %d\n", time_source_select( TIME_TSC ) );
+    const uint64_t tick = time_tick( );
+    time_now( &t_start );
+    nanosleep( &pause, NULL );
+    const uint64_t ticks = time_tick( ) - tick;
+    time_now( &t_iter );
+    time_delta( &t_start, &t_iter, &t_delta );
+    printf( "10ms sleep: %lu ns by ticks, %ld ns by clock\n",
+            (unsigned long)time_tick_ns( ticks ), t_delta.tv_nsec );
+    assert( time_tick_ns( ticks ) >= 9500000 && time_tick_ns( ticks ) <= (uint64_t)t_delta.tv_nsec * 105 / 100 );
+
+    /* Components of an operation follow it, within its interval */
+    trace_op_t op;
+    trace_entry_t parent;
+    trace_set_spans( 1 );
+    if (trace_init( ".", 2)) {
+        log_error( "trace init failed" );
+        exit(1);
+    }
+    trace_op_begin( &op, TRACE_WRITE );
+    trace_op_span( &op, TRACE_OPEN );
+    trace_op_span( &op, TRACE_DATA );
+    trace_op_span( &op, TRACE_CLOSE );
+    trace_op_end( &op );
+    trace_fini();
+    assert( trace_histogram( TRACE_DATA )->count == 1 );
+
+    R = trace_reader_open( "2.trc" );
+    assert( R != NULL && trace_reader_next( R, &parent ) > 0 && parent.info.op == TRACE_WRITE );
+    for( i=0; trace_reader_next( R, &te ) > 0; i++ ) {
+        assert( te.info.op == TRACE_OPEN + i );
+        assert( te.timestamp.tv_sec > parent.timestamp.tv_sec ||
+                (te.timestamp.tv_sec == parent.timestamp.tv_sec && te.timestamp.tv_nsec >= parent.timestamp.tv_nsec) );
+    }
+    assert( i == 3 );
+    trace_reader_close( R );
+
+    /* One in every 10 operations is written, but every operation is counted */
+    const struct timespec fast = { 0, 1000 }, slow = { 1, 0 };
+    trace_set_spans( 0 );
+    assert( trace_set_sampling( "nth:0" ) < 0 && trace_set_sampling( "bogus" ) < 0 );
+    assert( trace_set_sampling( "nth:10" ) == 0 );
+    if (trace_init( ".", 2)) {
+        log_error( "trace init failed" );
+        exit(1);
+    }
+    for( i=0; i<1000; i++ ) {
+        trace_write( &fast, &fast );
+    }
+    trace_fini();
+    trace_stats( &st );
+    assert( trace_histogram( TRACE_WRITE )->count == 1000 );
+    assert( st.ops == 1000 && st.kept == 100 && st.records == 100 );
+    R = trace_reader_open( "2.trc" );
+    assert( R != NULL );
+    assert( trace_reader_header( R )->sample_mode == TRACE_SAMPLE_NTH && trace_reader_header( R )->sample_n == 10 );
+    assert( trace_reader_header( R )->sample_seen == 1000 && trace_reader_header( R )->sample_kept == 100 );
+    for( i=0; trace_reader_next( R, &te ) > 0; i++ )
+        ;
+    assert( i == 100 );
+    trace_reader_close( R );
+
+    /* Slow operations are always kept, and a reservoir sample follows its weight */
+    assert( trace_set_sampling( "reservoir:5:1000,slow:500000" ) == 0 );
+    if (trace_init( ".", 2)) {
+        log_error( "trace init failed" );
+        exit(1);
+    }
+    for( i=0; i<100; i++ ) {
+        trace_write( &fast, &fast );
+        if( i % 50 == 0 )   trace_read( &slow, &slow );
+    }
+    trace_fini();
+    trace_stats( &st );
+    assert( st.ops == 102 && st.kept == 7 );
+    R = trace_reader_open( "2.trc" );
+    assert( R != NULL );
+    for( i=0; trace_reader_next( R, &te ) > 0; i++ ) {
+        if( i < 2 )         assert( te.info.op == TRACE_READ );
+        else if( i == 2 )   assert( te.info.op == TRACE_WEIGHT && te.duration.tv_nsec == 100 );
+        else                assert( te.info.op == TRACE_WRITE );
+    }
+    assert( i == 8 );
+    trace_reader_close( R );
     return 0;
 }
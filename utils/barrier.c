@@ -1,13 +1,44 @@
 /*------------------------------------------------------------------------------------------------*/
-/* Synchronization routines to support parallel execution. */
+/* Synchronization routines to support parallel execution.
+ * Waiters sleep on a futex in shared memory, and are woken together by a single FUTEX_WAKE
+ * when the last participant arrives, rather than one after another. */
 /* Begun 2019, StackHPC Ltd */
 
+#define _DEFAULT_SOURCE                 /* For syscall */
+
 #include <stdio.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "barrier.h"
 
-/* 
+#define BARRIER_SPIN_CHECK      64      /* Spins between reads of the clock */
+
+static inline uint64_t barrier_now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void barrier_relax( void )
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause( );
+#endif
+}
+
+/* Shared between processes: FUTEX_PRIVATE_FLAG does not apply */
+static inline long futex( uint32_t *uaddr, const int op, const uint32_t val )
+{
+    return syscall( SYS_futex, uaddr, op, val, NULL, NULL, 0 );
+}
+
+/*
  * Initialize a barrier structure in shared memory to allow inter-process
  * synchronization.
  */
@@ -16,20 +47,22 @@ barrier_t *barrier_init( const char *handle, const int count )
     int fd = shm_open( handle, O_RDWR | O_CREAT, 0666 );
     int size_needed = sizeof( barrier_t ) + strlen( handle ) + 1;
 
-    if ( (fd < 0) || ftruncate( fd, size_needed )) 
+    if ( (fd < 0) || ftruncate( fd, size_needed ))
     {
         return NULL;
     }
 
     barrier_t *bp = mmap( NULL, size_needed, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0 );
 
-    if( bp != MAP_FAILED ) 
+    if( bp != MAP_FAILED )
     {
+        memset( bp, 0, sizeof( barrier_t ) );
         bp->b_num = count;
-        bp->b_count = 0;
         strcpy( bp->b_handle, handle );
-        sem_init( &bp->b_mutex, 1, 1 );
-        sem_init( &bp->b_barrier, 1, 0 );
+    }
+    else
+    {
+        bp = NULL;
     }
     close( fd );
     return( bp );
@@ -41,28 +74,86 @@ void barrier_destroy( barrier_t *bp )
     char handle[strlen( bp->b_handle ) + 1];
 
     strcpy( handle, bp->b_handle );
-    sem_destroy( &bp->b_mutex );
-    sem_destroy( &bp->b_barrier );
     munmap( bp, sizeof( *bp )  + strlen( bp->b_handle ) + 1 );
     shm_unlink( handle );
 }
 
-void barrier_wait( barrier_t *bp )
+void barrier_set_spin( barrier_t *bp, const uint64_t spin_ns )
 {
-    bool signal = 0;
-    sem_wait( &bp->b_mutex );
-    if( (signal = (++bp->b_count == bp->b_num)) )
+    bp->b_spin = spin_ns;
+}
+
+/*
+ * The phase read on arrival is this participant's sense of the barrier: it is released when
+ * the phase moves on.  The count is reset before the phase is advanced, so participants
+ * released early may arrive for the next phase while others are still waking.
+ */
+int barrier_wait( barrier_t *bp )
+{
+    const uint32_t phase = __atomic_load_n( &bp->b_phase, __ATOMIC_ACQUIRE );
+    if( __atomic_load_n( &bp->b_aborted, __ATOMIC_ACQUIRE ) )
     {
-         bp->b_count = 0;   /* reset barrier for next use */
+        return -1;
     }
-    sem_post( &bp->b_mutex );
 
-    if( signal )
+    if( __atomic_add_fetch( &bp->b_count, 1, __ATOMIC_ACQ_REL ) == (uint32_t)bp->b_num )
+    {
+        __atomic_store_n( &bp->b_count, 0, __ATOMIC_RELAXED );
+        __atomic_store_n( &bp->b_skew_last, 0, __ATOMIC_RELAXED );
+        __atomic_store_n( &bp->b_release, barrier_now( ), __ATOMIC_RELAXED );
+        __atomic_store_n( &bp->b_phase, phase + 1, __ATOMIC_RELEASE );
+        futex( &bp->b_phase, FUTEX_WAKE, INT_MAX );
+        return 0;
+    }
+
+    /* Spin briefly, for releases that follow closely, then sleep until the phase moves on */
+    if( bp->b_spin > 0 )
+    {
+        const uint64_t until = barrier_now( ) + bp->b_spin;
+        for( unsigned i=1; __atomic_load_n( &bp->b_phase, __ATOMIC_ACQUIRE ) == phase; i++ )
+        {
+            barrier_relax( );
+            if( i % BARRIER_SPIN_CHECK == 0 && barrier_now( ) >= until )
+            {
+                break;
+            }
+        }
+    }
+    while( __atomic_load_n( &bp->b_phase, __ATOMIC_ACQUIRE ) == phase )
     {
-        sem_post( &bp->b_barrier );
+        /* Returns at once (EAGAIN) if the phase has already moved on */
+        futex( &bp->b_phase, FUTEX_WAIT, phase );
+    }
+    if( __atomic_load_n( &bp->b_aborted, __ATOMIC_ACQUIRE ) )
+    {
+        return -1;
     }
 
-    sem_wait( &bp->b_barrier );	/* wait for barrier to free */
-    sem_post( &bp->b_barrier ); /* notify next waiter */
+    /* Record how long after the release this participant left */
+    const uint64_t release = __atomic_load_n( &bp->b_release, __ATOMIC_RELAXED );
+    const uint64_t now = barrier_now( );
+    const uint64_t skew = now > release ? now - release : 0;
+    uint64_t prev = __atomic_load_n( &bp->b_skew_last, __ATOMIC_RELAXED );
+    while( skew > prev && !__atomic_compare_exchange_n( &bp->b_skew_last, &prev, skew, true,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+    prev = __atomic_load_n( &bp->b_skew_max, __ATOMIC_RELAXED );
+    while( skew > prev && !__atomic_compare_exchange_n( &bp->b_skew_max, &prev, skew, true,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+    return 0;
 }
 
+void barrier_abort( barrier_t *bp )
+{
+    __atomic_store_n( &bp->b_aborted, 1, __ATOMIC_RELEASE );
+    __atomic_add_fetch( &bp->b_phase, 1, __ATOMIC_ACQ_REL );
+    futex( &bp->b_phase, FUTEX_WAKE, INT_MAX );
+}
+
+void barrier_skew( const barrier_t *bp, barrier_skew_t *skew )
+{
+    skew->phases = __atomic_load_n( &bp->b_phase, __ATOMIC_ACQUIRE );
+    skew->last = __atomic_load_n( &bp->b_skew_last, __ATOMIC_RELAXED );
+    skew->max = __atomic_load_n( &bp->b_skew_max, __ATOMIC_RELAXED );
+}
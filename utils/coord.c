@@ -0,0 +1,801 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Coordination of benchmark runs across nodes:
+ * Each message is a coord_msg_t header followed by len bytes of payload.  A node registers
+ * (HELLO), and is told its index, the number of nodes and the run identifier (WELCOME).
+ * At any time, it may ask for the coordinator's clock (TIME), to estimate its offset.  It then
+ * reaches each barrier in turn (BARRIER), and is released once every node has reached it
+ * (RELEASE).  Finally, it reports its results and files (RESULT, FILE), and
+ * closes the connection (DONE).  If any node is lost, the others are told to ABORT. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "utils.h"
+#include "stats.h"
+#include "coord.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+typedef enum coord_msg_type {
+    COORD_HELLO = 1,            /* arg: tasks; payload: host name */
+    COORD_WELCOME,              /* payload: coord_welcome_t */
+    COORD_BARRIER,              /* arg: barrier */
+    COORD_RELEASE,              /* arg: barrier */
+    COORD_RESULT,               /* payload: coord_result_t */
+    COORD_FILE,                 /* arg: coord_file_t; payload: file contents */
+    COORD_DONE,
+    COORD_ABORT,
+    COORD_TIME,                 /* Request: none.  Reply: payload: coord_time_t */
+} coord_msg_type_t;
+
+typedef struct coord_msg {
+    uint32_t type;
+    uint32_t len;               /* Length of the payload that follows */
+    uint64_t arg;
+} coord_msg_t;
+
+typedef struct coord_welcome {
+    uint32_t node;
+    uint32_t nodes;
+    uint64_t run_id;
+} coord_welcome_t;
+
+/* Coordinator's wall clock on receipt of a time request, and on sending its reply */
+typedef struct coord_time {
+    int64_t received;
+    int64_t sent;
+} coord_time_t;
+
+#define COORD_HOST_LEN          64
+#define COORD_PAYLOAD_MAX       (64U << 20)
+#define COORD_CONNECT_SECS      30      /* Time allowed for the coordinator to start listening */
+
+static const char *coord_file_str[COORD_NFILES] = { "summary.json", "hst" };
+
+/*------------------------------------------------------------------------------------------------*/
+/* Messages */
+
+static int coord_write( const int fd, const void *buf, size_t len )
+{
+    const uint8_t *p = buf;
+    while( len > 0 )
+    {
+        const ssize_t n = send( fd, p, len, MSG_NOSIGNAL );
+        if( n < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if( n <= 0 )
+        {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Returns 1 once len bytes have been read, 0 at end of file before any, or -1 */
+static int coord_read( const int fd, void *buf, size_t len )
+{
+    uint8_t *p = buf;
+    while( len > 0 )
+    {
+        const ssize_t n = read( fd, p, len );
+        if( n < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if( n == 0 && p == buf )
+        {
+            return 0;
+        }
+        if( n <= 0 )
+        {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int coord_send( const int fd, const coord_msg_type_t type, const uint64_t arg,
+                       const void *payload, const size_t len )
+{
+    const coord_msg_t m = { .type = type, .len = len, .arg = arg };
+    if( coord_write( fd, &m, sizeof(m) ) < 0 || (len > 0 && coord_write( fd, payload, len ) < 0) )
+    {
+        log_error( "Coordination message could not be sent: %s", strerror(errno) );
+        return -1;
+    }
+    return 0;
+}
+
+/* Receive a message, with its payload (NUL-terminated) in *payload, to be freed by the caller.
+ * Returns 1 on success, 0 if the peer has closed the connection, or -1 */
+static int coord_recv( const int fd, coord_msg_t *m, uint8_t **payload )
+{
+    *payload = NULL;
+    const int ret = coord_read( fd, m, sizeof(*m) );
+    if( ret <= 0 )
+    {
+        return ret;
+    }
+    if( m->len > COORD_PAYLOAD_MAX || (*payload = malloc( m->len + 1 )) == NULL )
+    {
+        log_error( "Coordination message of %u bytes could not be received", m->len );
+        return -1;
+    }
+    if( m->len > 0 && coord_read( fd, *payload, m->len ) <= 0 )
+    {
+        free( *payload );
+        *payload = NULL;
+        return -1;
+    }
+    (*payload)[m->len] = '\0';
+    return 1;
+}
+
+static inline int64_t coord_wall_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Sockets */
+
+/* Open a socket for the address, listening on it or connecting to it.
+ * Returns the socket, or -1 (with errno set, if the connection was refused) */
+static int coord_socket( const char *addr, const bool listening )
+{
+    int fd = -1;
+
+    if( strncmp( addr, COORD_UNIX_PREFIX, strlen(COORD_UNIX_PREFIX) ) == 0 )
+    {
+        struct sockaddr_un sun;
+        const char *path = addr + strlen(COORD_UNIX_PREFIX);
+        if( strlen( path ) >= sizeof(sun.sun_path) || (fd = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0 )
+        {
+            log_error( "Could not create socket for %s", addr );
+            return -1;
+        }
+        memset( &sun, 0, sizeof(sun) );
+        sun.sun_family = AF_UNIX;
+        strcpy( sun.sun_path, path );
+
+        if( listening )
+        {
+            unlink( path );
+            if( bind( fd, (struct sockaddr *)&sun, sizeof(sun) ) < 0 || listen( fd, SOMAXCONN ) < 0 )
+            {
+                log_error( "Could not listen on %s: %s", addr, strerror(errno) );
+                close( fd );
+                return -1;
+            }
+        }
+        else if( connect( fd, (struct sockaddr *)&sun, sizeof(sun) ) < 0 )
+        {
+            const int err = errno;
+            close( fd );
+            errno = err;
+            return -1;
+        }
+        return fd;
+    }
+
+    /* HOST:PORT, where the host may be omitted when listening */
+    char host[256];
+    const char *colon = strrchr( addr, ':' );
+    if( colon == NULL || colon - addr >= (ptrdiff_t)sizeof(host) )
+    {
+        log_error( "Invalid coordinator address %s", addr );
+        return -1;
+    }
+    memcpy( host, addr, colon - addr );
+    host[colon - addr] = '\0';
+
+    struct addrinfo hints, *res, *ai;
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    const int gai = getaddrinfo( host[0] ? host : NULL, colon + 1, &hints, &res );
+    if( gai != 0 )
+    {
+        log_error( "Could not resolve %s: %s", addr, gai_strerror( gai ) );
+        return -1;
+    }
+
+    int err = 0;
+    for( ai = res; ai != NULL; ai = ai->ai_next )
+    {
+        if( (fd = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol )) < 0 )
+        {
+            continue;
+        }
+        if( listening )
+        {
+            const int one = 1;
+            setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+            if( bind( fd, ai->ai_addr, ai->ai_addrlen ) == 0 && listen( fd, SOMAXCONN ) == 0 )
+            {
+                break;
+            }
+        }
+        else if( connect( fd, ai->ai_addr, ai->ai_addrlen ) == 0 )
+        {
+            /* Barrier messages are small, and latency matters */
+            const int one = 1;
+            setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+            break;
+        }
+        err = errno;
+        close( fd );
+        fd = -1;
+    }
+    freeaddrinfo( res );
+
+    if( fd < 0 && listening )
+    {
+        log_error( "Could not listen on %s: %s", addr, strerror(err) );
+    }
+    errno = err;
+    return fd;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Motif instances */
+
+static int coord_fd = -1;
+
+int coord_connect( const char *addr, const unsigned tasks, uint32_t *node, uint32_t *nodes,
+                   uint64_t *run_id )
+{
+    char host[COORD_HOST_LEN];
+    coord_msg_t m;
+    uint8_t *payload;
+
+    /* Allow for the coordinator to be started alongside the nodes */
+    for( unsigned i=0; (coord_fd = coord_socket( addr, false )) < 0; i++ )
+    {
+        if( (errno != ECONNREFUSED && errno != ENOENT) || i == COORD_CONNECT_SECS * 10 )
+        {
+            log_error( "Could not connect to coordinator %s: %s", addr, strerror(errno) );
+            return -1;
+        }
+        const struct timespec retry = { 0, 100000000 };
+        nanosleep( &retry, NULL );
+    }
+
+    if( gethostname( host, sizeof(host) - 1 ) < 0 )
+    {
+        strcpy( host, "unknown" );
+    }
+    host[sizeof(host) - 1] = '\0';
+    if( coord_send( coord_fd, COORD_HELLO, tasks, host, strlen(host) ) < 0 )
+    {
+        return -1;
+    }
+
+    if( coord_recv( coord_fd, &m, &payload ) <= 0 || m.type != COORD_WELCOME || m.len != sizeof(coord_welcome_t) )
+    {
+        log_error( "Coordinator %s did not accept this node", addr );
+        free( payload );
+        return -1;
+    }
+    const coord_welcome_t *w = (const coord_welcome_t *)payload;
+    *node = w->node;
+    *nodes = w->nodes;
+    *run_id = w->run_id;
+    free( payload );
+    log_info( "Registered with coordinator %s as node %u of %u", addr, *node, *nodes );
+    return 0;
+}
+
+/* As in NTP: with a request sent at t1 and received at t2, and its reply sent at t3 and
+ * received at t4, the offset is ((t2 - t1) + (t3 - t4)) / 2, assuming symmetric delays, and
+ * the round trip excludes the time spent by the coordinator, t3 - t2 */
+int coord_clock( coord_clock_t *C )
+{
+    coord_msg_t m;
+    uint8_t *payload;
+
+    memset( C, 0, sizeof(*C) );
+    for( unsigned i=0; i < COORD_CLOCK_SAMPLES; i++ )
+    {
+        const int64_t t1 = coord_wall_ns( );
+        if( coord_send( coord_fd, COORD_TIME, 0, NULL, 0 ) < 0 )
+        {
+            return -1;
+        }
+        const int ret = coord_recv( coord_fd, &m, &payload );
+        const int64_t t4 = coord_wall_ns( );
+        if( ret <= 0 || m.type != COORD_TIME || m.len != sizeof(coord_time_t) )
+        {
+            log_error( "Coordinator did not report its clock" );
+            free( payload );
+            return -1;
+        }
+        const coord_time_t *T = (const coord_time_t *)payload;
+        const int64_t rtt = (t4 - t1) - (T->sent - T->received);
+        if( C->rtt == 0 || (rtt > 0 && (uint64_t)rtt < C->rtt) )
+        {
+            C->offset = ((T->received - t1) + (T->sent - t4)) / 2;
+            C->rtt = rtt > 0 ? rtt : 1;
+            C->when = t1 + (t4 - t1) / 2;
+        }
+        free( payload );
+    }
+    log_debug( "clock offset from coordinator %+.3fus, round trip %.3fus", C->offset / 1e3, C->rtt / 1e3 );
+    return 0;
+}
+
+double coord_drift( const coord_clock_t *start, const coord_clock_t *end )
+{
+    if( start->rtt == 0 || end->rtt == 0 || end->when <= start->when )
+    {
+        return 0.0;
+    }
+    return (double)(end->offset - start->offset) / (end->when - start->when) * 1e6;
+}
+
+int coord_barrier( const unsigned id )
+{
+    coord_msg_t m;
+    uint8_t *payload;
+
+    if( coord_send( coord_fd, COORD_BARRIER, id, NULL, 0 ) < 0 )
+    {
+        return -1;
+    }
+    const int ret = coord_recv( coord_fd, &m, &payload );
+    free( payload );
+    if( ret <= 0 || m.type != COORD_RELEASE || m.arg != id )
+    {
+        log_error( "Run aborted by the coordinator at barrier %u", id );
+        return -1;
+    }
+    log_debug( "released from barrier %u", id );
+    return 0;
+}
+
+/* Send a file, if it can be read.  Files too large for a message are refused, not truncated */
+static int coord_send_file( const coord_file_t kind, const char *path )
+{
+    struct stat st;
+    FILE *fp = fopen( path, "r" );
+    if( fp == NULL )
+    {
+        log_warn( "Could not open %s to send to the coordinator: %s", path, strerror(errno) );
+        return 0;
+    }
+    if( fstat( fileno( fp ), &st ) < 0 )
+    {
+        log_error( "Could not stat %s to send to the coordinator: %s", path, strerror(errno) );
+        fclose( fp );
+        return -1;
+    }
+    if( st.st_size > COORD_PAYLOAD_MAX )
+    {
+        log_error( "%s is too large to send to the coordinator (%lld bytes, limit %u)", path,
+                   (long long)st.st_size, COORD_PAYLOAD_MAX );
+        fclose( fp );
+        return -1;
+    }
+
+    const size_t len = st.st_size;
+    uint8_t *buf = malloc( len ? len : 1 );
+    if( buf == NULL )
+    {
+        log_error( "Could not allocate %zu bytes to send %s", len, path );
+        fclose( fp );
+        return -1;
+    }
+    if( fread( buf, 1, len, fp ) != len )
+    {
+        log_error( "Could not read %s to send to the coordinator", path );
+        free( buf );
+        fclose( fp );
+        return -1;
+    }
+    fclose( fp );
+
+    const int ret = coord_send( coord_fd, COORD_FILE, kind, buf, len );
+    free( buf );
+    return ret;
+}
+
+int coord_report( const coord_result_t *R, const char *paths[COORD_NFILES] )
+{
+    if( coord_send( coord_fd, COORD_RESULT, 0, R, sizeof(*R) ) < 0 )
+    {
+        return -1;
+    }
+    for( unsigned f=0; f < COORD_NFILES; f++ )
+    {
+        if( paths[f] != NULL && coord_send_file( f, paths[f] ) < 0 )
+        {
+            return -1;
+        }
+    }
+    return coord_send( coord_fd, COORD_DONE, 0, NULL, 0 );
+}
+
+void coord_close( void )
+{
+    if( coord_fd >= 0 )
+    {
+        close( coord_fd );
+        coord_fd = -1;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Coordinator */
+
+typedef struct coord_node {
+    int fd;                     /* Connection, or -1 once closed */
+    bool registered, reported, done;
+    char host[COORD_HOST_LEN];
+    uint32_t tasks;
+    unsigned nbarrier;          /* Barriers reached */
+    coord_result_t result;
+    char *path[COORD_NFILES];   /* Files received */
+} coord_node_t;
+
+/* Results of a phase across nodes.  As the phase starts on all nodes together, its window
+ * spans the longest of theirs: clocks of different nodes are not compared */
+static void coord_phase_json( FILE *fp, const coord_node_t *node, const unsigned nodes,
+                              const stats_phase_t ph, const histogram_t *H )
+{
+    uint64_t ops = 0, bytes = 0, errors = 0, invalid = 0;
+    unsigned reported = 0, tasks = 0;
+    int64_t elapsed = 0;
+
+    for( unsigned i=0; i < nodes; i++ )
+    {
+        const stats_result_t *R = &node[i].result.phase[ph];
+        if( R->workers == 0 )
+        {
+            continue;
+        }
+        reported++;
+        tasks += R->workers;
+        ops += R->ops;
+        bytes += R->bytes;
+        errors += R->errors;
+        invalid += R->invalid;
+        if( R->last - R->first > elapsed )
+        {
+            elapsed = R->last - R->first;
+        }
+    }
+
+    const double secs = elapsed / 1e9;
+    fprintf( fp, "{\"nodes\": %u, \"tasks\": %u, \"elapsed\": %.9f, \"ops\": %lu, \"bytes\": %lu, "
+             "\"errors\": %lu, \"invalid\": %lu, \"iops\": %.3f, \"bytes_per_sec\": %.3f",
+             reported, tasks, secs, (unsigned long)ops, (unsigned long)bytes, (unsigned long)errors,
+             (unsigned long)invalid, secs > 0.0 ? ops / secs : 0.0, secs > 0.0 ? bytes / secs : 0.0 );
+    if( H != NULL )
+    {
+        fprintf( fp, ",\n      \"latency_ns\": {\"count\": %lu, \"mean\": %.1f, \"min\": %lu, \"p50\": %lu, "
+                 "\"p90\": %lu, \"p99\": %lu, \"p99.9\": %lu, \"max\": %lu}",
+                 (unsigned long)H->count, H->count ? (double)H->sum / H->count : 0.0,
+                 (unsigned long)(H->count ? H->min : 0),
+                 (unsigned long)histogram_percentile( H, 50.0 ), (unsigned long)histogram_percentile( H, 90.0 ),
+                 (unsigned long)histogram_percentile( H, 99.0 ), (unsigned long)histogram_percentile( H, 99.9 ),
+                 (unsigned long)H->max );
+    }
+    fprintf( fp, "}" );
+}
+
+/* Merge the histograms of all nodes, and write the aggregate results */
+static int coord_aggregate( const coord_node_t *node, const unsigned nodes, const char *outdir,
+                            const uint64_t run_id )
+{
+    static const trace_type_t phase_op[STATS_NPHASES] = { TRACE_WRITE, TRACE_READ };
+    static const char *phase_str[STATS_NPHASES] = { "write", "read" };
+    const char *names[TRACE_NTYPES];
+    char path[PATH_MAX];
+    unsigned merged = 0, failed = 0;
+
+    histogram_t *H = malloc( TRACE_NTYPES * sizeof(histogram_t) );
+    if( H == NULL )
+    {
+        log_error( "Could not allocate histograms to merge" );
+        return -1;
+    }
+    for( unsigned t=0; t < TRACE_NTYPES; t++ )
+    {
+        names[t] = trace_type_str( t );
+        histogram_init( &H[t] );
+    }
+    for( unsigned i=0; i < nodes; i++ )
+    {
+        failed += node[i].result.failed;
+        if( node[i].path[COORD_FILE_HIST] != NULL &&
+            histogram_read( node[i].path[COORD_FILE_HIST], names, H, TRACE_NTYPES ) >= 0 )
+        {
+            merged++;
+        }
+    }
+    if( merged > 0 )
+    {
+        snprintf( path, sizeof(path), "%s/motif_1.hst", outdir );
+        histogram_write( path, names, H, TRACE_NTYPES );
+    }
+
+    snprintf( path, sizeof(path), "%s/coordinator-summary.json", outdir );
+    FILE *fp = fopen( path, "w" );
+    if( fp == NULL )
+    {
+        log_error( "Could not create summary file %s: %s", path, strerror(errno) );
+        free( H );
+        return -1;
+    }
+    fprintf( fp, "{\n  \"run_id\": \"%016lx\",\n  \"nodes\": %u,\n  \"failed_tasks\": %u,\n  \"phases\": {",
+             (unsigned long)run_id, nodes, failed );
+    for( unsigned ph=0; ph < STATS_NPHASES; ph++ )
+    {
+        fprintf( fp, "%s\n    \"%s\": ", ph ? "," : "", phase_str[ph] );
+        coord_phase_json( fp, node, nodes, ph, merged == nodes ? &H[phase_op[ph]] : NULL );
+    }
+    fprintf( fp, "\n  },\n  \"node_results\": [" );
+    for( unsigned i=0; i < nodes; i++ )
+    {
+        fprintf( fp, "%s\n    {\"node\": %u, \"host\": ", i ? "," : "", i );
+        json_str( fp, node[i].host );
+        fprintf( fp, ", \"tasks\": %u, \"failed_tasks\": %u", node[i].tasks, node[i].result.failed );
+        const coord_clock_t *C = node[i].result.clock;
+        fprintf( fp, ",\n     \"clock\": {\"offset_ns\": %ld, \"rtt_ns\": %lu, \"end_offset_ns\": %ld, "
+                 "\"end_rtt_ns\": %lu, \"drift_ppm\": %.3f}",
+                 (long)C[COORD_CLOCK_START].offset, (unsigned long)C[COORD_CLOCK_START].rtt,
+                 (long)C[COORD_CLOCK_END].offset, (unsigned long)C[COORD_CLOCK_END].rtt,
+                 coord_drift( &C[COORD_CLOCK_START], &C[COORD_CLOCK_END] ) );
+        for( unsigned ph=0; ph < STATS_NPHASES; ph++ )
+        {
+            fprintf( fp, ",\n     \"%s\": ", phase_str[ph] );
+            coord_phase_json( fp, &node[i], 1, ph, NULL );
+        }
+        fprintf( fp, "}" );
+    }
+    fprintf( fp, "\n  ]\n}\n" );
+    free( H );
+
+    if( fclose( fp ) != 0 )
+    {
+        log_error( "Could not write summary file %s: %s", path, strerror(errno) );
+        return -1;
+    }
+    log_info( "Results of %u nodes written to %s", nodes, path );
+    if( failed > 0 )
+    {
+        log_warn( "%u tasks failed", failed );
+    }
+    return 0;
+}
+
+/* Handle a message from a node.  Returns 0, or -1 if the node has failed */
+static int coord_handle( coord_node_t *node, const unsigned nodes, const unsigned i, const char *outdir,
+                         const uint64_t run_id )
+{
+    coord_node_t *N = &node[i];
+    coord_msg_t m;
+    uint8_t *payload;
+    int ret = coord_recv( N->fd, &m, &payload );
+    const int64_t received = coord_wall_ns( );
+    if( ret <= 0 )
+    {
+        log_error( "Node %u (%s) disconnected", i, N->registered ? N->host : "unregistered" );
+        return -1;
+    }
+
+    switch( m.type )
+    {
+    case COORD_HELLO: {
+        snprintf( N->host, sizeof(N->host), "%s", (char *)payload );
+        N->tasks = m.arg;
+        N->registered = true;
+        const coord_welcome_t w = { .node = i, .nodes = nodes, .run_id = run_id };
+        ret = coord_send( N->fd, COORD_WELCOME, 0, &w, sizeof(w) );
+        log_info( "Node %u registered: %s, %u tasks", i, N->host, N->tasks );
+        break;
+    }
+
+    case COORD_TIME: {
+        coord_time_t T = { .received = received };
+        T.sent = coord_wall_ns( );
+        ret = coord_send( N->fd, COORD_TIME, 0, &T, sizeof(T) );
+        break;
+    }
+
+    case COORD_BARRIER: {
+        if( !N->registered || m.arg != N->nbarrier )
+        {
+            log_error( "Node %u reached barrier %lu out of order", i, (unsigned long)m.arg );
+            ret = -1;
+            break;
+        }
+        N->nbarrier++;
+
+        /* Release every node once the last has arrived */
+        unsigned arrived = 0;
+        for( unsigned j=0; j < nodes; j++ )
+        {
+            arrived += node[j].registered && node[j].nbarrier > m.arg;
+        }
+        if( arrived == nodes )
+        {
+            log_info( "Barrier %lu: releasing %u nodes", (unsigned long)m.arg, nodes );
+            for( unsigned j=0; j < nodes && ret >= 0; j++ )
+            {
+                ret = coord_send( node[j].fd, COORD_RELEASE, m.arg, NULL, 0 );
+            }
+        }
+        break;
+    }
+
+    case COORD_RESULT:
+        if( m.len != sizeof(coord_result_t) )
+        {
+            ret = -1;
+            break;
+        }
+        memcpy( &N->result, payload, sizeof(coord_result_t) );
+        N->reported = true;
+        break;
+
+    case COORD_FILE: {
+        char path[PATH_MAX];
+        if( m.arg >= COORD_NFILES )
+        {
+            ret = -1;
+            break;
+        }
+        snprintf( path, sizeof(path), "%s/node%u.%s", outdir, i, coord_file_str[m.arg] );
+        FILE *fp = fopen( path, "w" );
+        if( fp == NULL || fwrite( payload, 1, m.len, fp ) != m.len || fclose( fp ) != 0 )
+        {
+            log_error( "Could not save %s: %s", path, strerror(errno) );
+            ret = -1;
+            break;
+        }
+        free( N->path[m.arg] );
+        N->path[m.arg] = strdup( path );
+        break;
+    }
+
+    case COORD_DONE:
+        N->done = true;
+        close( N->fd );
+        N->fd = -1;
+        log_info( "Node %u (%s) has reported", i, N->host );
+        break;
+
+    default:
+        log_error( "Unexpected message %u from node %u", m.type, i );
+        ret = -1;
+    }
+
+    free( payload );
+    return ret < 0 ? -1 : 0;
+}
+
+int coord_serve( const char *addr, const unsigned nodes, const char *outdir )
+{
+    coord_node_t *node = calloc( nodes, sizeof(coord_node_t) );
+    struct pollfd *pfd = calloc( nodes + 1, sizeof(struct pollfd) );
+    unsigned connected = 0, done = 0;
+    int result = 0;
+
+    if( node == NULL || pfd == NULL )
+    {
+        log_error( "Could not allocate state for %u nodes", nodes );
+        return -1;
+    }
+    const int lfd = coord_socket( addr, true );
+    if( lfd < 0 )
+    {
+        return -1;
+    }
+
+    struct timespec wall;
+    clock_gettime( CLOCK_REALTIME, &wall );
+    const uint64_t run_id = ((uint64_t)wall.tv_sec << 32) ^ (uint64_t)wall.tv_nsec ^ (uint64_t)getpid();
+    log_info( "Coordinating %u nodes on %s, run %016lx", nodes, addr, (unsigned long)run_id );
+
+    while( done < nodes )
+    {
+        /* Accept connections until every node has connected */
+        pfd[0].fd = connected < nodes ? lfd : -1;
+        pfd[0].events = POLLIN;
+        for( unsigned i=0; i < nodes; i++ )
+        {
+            pfd[i + 1].fd = i < connected ? node[i].fd : -1;
+            pfd[i + 1].events = POLLIN;
+        }
+        if( poll( pfd, nodes + 1, -1 ) < 0 )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+            log_error( "poll failed: %s", strerror(errno) );
+            result = -1;
+            break;
+        }
+
+        if( pfd[0].revents & POLLIN )
+        {
+            const int fd = accept( lfd, NULL, NULL );
+            if( fd >= 0 )
+            {
+                const int one = 1;
+                setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+                node[connected++].fd = fd;
+            }
+        }
+
+        for( unsigned i=0; i < connected && result == 0; i++ )
+        {
+            if( pfd[i + 1].fd >= 0 && pfd[i + 1].revents != 0 )
+            {
+                result = coord_handle( node, nodes, i, outdir, run_id );
+                done += node[i].done;
+            }
+        }
+        if( result < 0 )
+        {
+            break;
+        }
+    }
+
+    /* Abandon the run if any node has failed */
+    for( unsigned i=0; i < connected; i++ )
+    {
+        if( node[i].fd >= 0 )
+        {
+            coord_send( node[i].fd, COORD_ABORT, 0, NULL, 0 );
+            close( node[i].fd );
+        }
+    }
+    close( lfd );
+    if( strncmp( addr, COORD_UNIX_PREFIX, strlen(COORD_UNIX_PREFIX) ) == 0 )
+    {
+        unlink( addr + strlen(COORD_UNIX_PREFIX) );
+    }
+
+    if( result == 0 )
+    {
+        result = coord_aggregate( node, nodes, outdir, run_id );
+    }
+    for( unsigned i=0; i < nodes; i++ )
+    {
+        for( unsigned f=0; f < COORD_NFILES; f++ )
+        {
+            free( node[i].path[f] );
+        }
+    }
+    free( node );
+    free( pfd );
+    return result;
+}
@@ -0,0 +1,44 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Coordinate a run of motif instances on several nodes: start each phase on all nodes
+ * together, and collect their results. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "utils.h"
+#include "coord.h"
+
+/* Handle argument parsing error */
+void fail( char *cmd )
+{
+    fprintf( stderr, "Usage: %s -N <nodes> [-o <output_dir>] <host:port | unix:path>\n\n", cmd );
+    fprintf( stderr, "\t-N Number of nodes taking part in the run\n" );
+    fprintf( stderr, "\t-o Directory for the results of the nodes, and their aggregate (default .)\n" );
+    exit( 1 );
+}
+
+int main( int argc, char **argv )
+{
+    const char *outdir = ".";
+    int nodes = 0, c;
+
+    opterr = 0;
+    while (( c = getopt (argc, argv, "N:o:" )) != -1 ) {
+        switch (c)
+        {
+        case 'N':
+            nodes = atoi( optarg );
+            break;
+        case 'o':
+            outdir = optarg;
+            break;
+        default:
+           fail(argv[0]);
+        }
+    }
+    if ( optind != argc - 1 || nodes <= 0 ) {
+        fail(argv[0]);
+    }
+
+    return coord_serve( argv[optind], nodes, outdir ) < 0 ? 1 : 0;
+}
@@ -10,4 +10,4 @@ reader = csv.DictReader( sys.stdin, fieldnames = ( "timestamp","duration","opera
 out = json.dumps( [ row for row in reader ], indent=4 )  
 
 # Output the resulting json
-print out
+print( out )
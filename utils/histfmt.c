@@ -0,0 +1,116 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Merge latency histogram files and report percentiles */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "utils.h"
+
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+
+typedef enum {
+    TEXT_MODE = 0,
+    CSV_MODE
+} output_mode_t;
+
+/* Output latency percentiles in human readable format */
+void print_hist( const char *name, const histogram_t *H )
+{
+    printf( "%s: %lu ops, min %.3fus, mean %.3fus, max %.3fus\n", name, (unsigned long)H->count,
+            H->min / 1000.0, (double)H->sum / H->count / 1000.0, H->max / 1000.0 );
+    for( unsigned i=0; i < ARRAYLEN(percentiles); i++ )
+    {
+        printf( "  p%-6g %12.3fus\n", percentiles[i], histogram_percentile( H, percentiles[i] ) / 1000.0 );
+    }
+}
+
+/* Output latency percentiles in csv format, in ns */
+void csv_hist( const char *name, const histogram_t *H )
+{
+    printf( "%s,%lu,%lu,%lu", name, (unsigned long)H->count, (unsigned long)H->min, (unsigned long)H->max );
+    for( unsigned i=0; i < ARRAYLEN(percentiles); i++ )
+    {
+        printf( ",%lu", (unsigned long)histogram_percentile( H, percentiles[i] ) );
+    }
+    printf( "\n" );
+}
+
+/* Handle argument parsing error */
+void fail( char *cmd )
+{
+    fprintf( stderr, "Usage: %s [-c] [-t] [-o <merged_file>] <path_to_file>...\n\n", cmd );
+    fprintf( stderr, "\t-c Output in CSV format\n" );
+    fprintf( stderr, "\t-t Output in text format\n" );
+    fprintf( stderr, "\t-o Write the merged histograms to a file\n" );
+    exit( 1 );
+}
+
+/* Read and merge histogram files, and output percentiles in desired format */
+int main( int argc, char **argv )
+{
+    output_mode_t m = TEXT_MODE;
+    const char *out = NULL;
+    const char *names[TRACE_NTYPES];
+    histogram_t *H;
+    int c;
+
+    opterr = 0;
+
+    while (( c = getopt (argc, argv, "cto:" )) != -1 ) {
+        switch (c)
+        {
+        case 'c':
+            m = CSV_MODE;
+            break;
+        case 't':
+            m = TEXT_MODE;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        default:
+           fail(argv[0]);
+        }
+    }
+
+    if ( optind == argc ) {
+        fail(argv[0]);
+    }
+
+    if ( (H = malloc( TRACE_NTYPES * sizeof(histogram_t) )) == NULL ) {
+        log_error( "Insufficient memory for histograms" );
+        return( -1 );
+    }
+    for ( unsigned i=0; i < TRACE_NTYPES; i++ ) {
+        names[i] = trace_type_str( i );
+        histogram_init( &H[i] );
+    }
+
+    for ( int i=optind; i < argc; i++ ) {
+        if ( histogram_read( argv[i], names, H, TRACE_NTYPES ) < 0 ) {
+            return( -1 );
+        }
+    }
+
+    if ( m == CSV_MODE ) {
+        printf( "op,count,min,max" );
+        for ( unsigned i=0; i < ARRAYLEN(percentiles); i++ ) {
+            printf( ",p%g", percentiles[i] );
+        }
+        printf( "\n" );
+    }
+    for ( unsigned i=0; i < TRACE_NTYPES; i++ ) {
+        if ( H[i].count == 0 )
+            continue;
+        if ( m == TEXT_MODE )
+            print_hist( names[i], &H[i] );
+        else
+            csv_hist( names[i], &H[i] );
+    }
+
+    if ( out != NULL && histogram_write( out, names, H, TRACE_NTYPES ) < 0 ) {
+        return( -1 );
+    }
+    free( H );
+    return 0;
+}
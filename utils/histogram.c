@@ -0,0 +1,243 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Latency histograms:
+ * Log-linear bucketed histograms of nanosecond latencies, mergeable across workers and hosts. */
+/* Begun 2019, StackHPC Ltd */
+
+#define _DEFAULT_SOURCE                 /* For MAP_ANONYMOUS */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <sys/mman.h>
+
+#include "utils.h"
+#include "histogram.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+#define HIST_MAGIC          "MOTIFHST"
+#define HIST_VERSION        1
+#define HIST_ENDIAN         0x01020304U
+
+/* Header for binary histogram files.
+ * Each histogram follows as a NUL-padded name of HIST_NAME_LEN bytes, then a histogram_t. */
+typedef struct histogram_file_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;            /* Reads as HIST_ENDIAN on hosts of the same byte order */
+    uint32_t sub_bits;
+    uint32_t max_bits;
+    uint32_t nhist;
+    uint32_t pad;
+} histogram_file_hdr_t;
+
+void histogram_init( histogram_t *H )
+{
+    memset( H, 0, sizeof(histogram_t) );
+    H->min = UINT64_MAX;
+}
+
+/* Smallest and largest values that map to a bucket */
+static uint64_t histogram_lowest( const unsigned idx )
+{
+    if( idx < HIST_SUB_COUNT )      return idx;
+
+    const unsigned shift = (idx >> HIST_SUB_BITS) - 1;
+    return ((uint64_t)((idx & (HIST_SUB_COUNT - 1)) | HIST_SUB_COUNT)) << shift;
+}
+
+static uint64_t histogram_highest( const unsigned idx )
+{
+    return idx + 1 < HIST_NBUCKETS ? histogram_lowest( idx + 1 ) - 1 : UINT64_MAX;
+}
+
+void histogram_merge( histogram_t *dst, const histogram_t *src )
+{
+    if( src->count == 0 )
+    {
+        return;
+    }
+
+    for( unsigned i=0; i < HIST_NBUCKETS; i++ )
+    {
+        if( src->bucket[i] )
+        {
+            __atomic_add_fetch( &dst->bucket[i], src->bucket[i], __ATOMIC_RELAXED );
+        }
+    }
+    __atomic_add_fetch( &dst->count, src->count, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &dst->sum, src->sum, __ATOMIC_RELAXED );
+
+    uint64_t v = __atomic_load_n( &dst->min, __ATOMIC_RELAXED );
+    while( src->min < v &&
+           !__atomic_compare_exchange_n( &dst->min, &v, src->min, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+    v = __atomic_load_n( &dst->max, __ATOMIC_RELAXED );
+    while( src->max > v &&
+           !__atomic_compare_exchange_n( &dst->max, &v, src->max, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+}
+
+uint64_t histogram_percentile( const histogram_t *H, const double pct )
+{
+    if( H->count == 0 )
+    {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)ceil( pct / 100.0 * (double)H->count );
+    if( target == 0 )               target = 1;
+
+    uint64_t seen = 0;
+    for( unsigned i=0; i < HIST_NBUCKETS; i++ )
+    {
+        seen += H->bucket[i];
+        if( seen >= target )
+        {
+            const uint64_t v = histogram_highest( i );
+            return v < H->max ? v : H->max;
+        }
+    }
+    return H->max;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+histogram_t *histogram_shared_create( const unsigned n )
+{
+    histogram_t *H = mmap( NULL, n * sizeof(histogram_t), PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( H == MAP_FAILED )
+    {
+        log_error( "Could not map %u shared histograms: %s", n, strerror(errno) );
+        return NULL;
+    }
+    for( unsigned i=0; i < n; i++ )
+    {
+        histogram_init( &H[i] );
+    }
+    return H;
+}
+
+void histogram_shared_destroy( histogram_t *H, const unsigned n )
+{
+    if( H != NULL )
+    {
+        munmap( H, n * sizeof(histogram_t) );
+    }
+}
+
+void histogram_report( const char *name, const histogram_t *H )
+{
+    if( H->count == 0 )
+    {
+        return;
+    }
+
+    log_info( "%-5s %lu ops, latency (us): mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f",
+              name, (unsigned long)H->count, (double)H->sum / H->count / 1000.0,
+              histogram_percentile( H, 50.0 ) / 1000.0, histogram_percentile( H, 90.0 ) / 1000.0,
+              histogram_percentile( H, 99.0 ) / 1000.0, histogram_percentile( H, 99.9 ) / 1000.0,
+              H->max / 1000.0 );
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+int histogram_write( const char *path, const char *names[], const histogram_t *H, const unsigned n )
+{
+    FILE *fp = fopen( path, "w" );
+    if( fp == NULL )
+    {
+        log_error( "Could not create histogram file %s: %s", path, strerror(errno) );
+        return -1;
+    }
+
+    histogram_file_hdr_t hdr = {
+        .version = HIST_VERSION, .endian = HIST_ENDIAN,
+        .sub_bits = HIST_SUB_BITS, .max_bits = HIST_MAX_BITS, .nhist = n,
+    };
+    memcpy( hdr.magic, HIST_MAGIC, sizeof(hdr.magic) );
+
+    int result = fwrite( &hdr, sizeof(hdr), 1, fp ) == 1 ? 0 : -1;
+    for( unsigned i=0; i < n && result == 0; i++ )
+    {
+        /* Write each record separately to avoid a large stack copy */
+        char name[HIST_NAME_LEN] = { 0 };
+        strncpy( name, names[i], sizeof(name) - 1 );
+        if( fwrite( name, sizeof(name), 1, fp ) != 1 || fwrite( &H[i], sizeof(histogram_t), 1, fp ) != 1 )
+        {
+            result = -1;
+        }
+    }
+    if( fclose( fp ) != 0 )
+    {
+        result = -1;
+    }
+    if( result < 0 )
+    {
+        log_error( "Error writing histogram file %s: %s", path, strerror(errno) );
+    }
+    return result;
+}
+
+int histogram_read( const char *path, const char *names[], histogram_t *H, const unsigned n )
+{
+    histogram_file_hdr_t hdr;
+    FILE *fp = fopen( path, "r" );
+    if( fp == NULL )
+    {
+        log_error( "Could not open histogram file %s: %s", path, strerror(errno) );
+        return -1;
+    }
+
+    if( fread( &hdr, sizeof(hdr), 1, fp ) != 1 || memcmp( hdr.magic, HIST_MAGIC, sizeof(hdr.magic) ) != 0 )
+    {
+        log_error( "%s is not a histogram file", path );
+        fclose( fp );
+        return -1;
+    }
+    if( hdr.version != HIST_VERSION || hdr.endian != HIST_ENDIAN ||
+        hdr.sub_bits != HIST_SUB_BITS || hdr.max_bits != HIST_MAX_BITS )
+    {
+        log_error( "Histogram file %s has an incompatible format (version %u)", path, hdr.version );
+        fclose( fp );
+        return -1;
+    }
+
+    histogram_t *rec = malloc( sizeof(histogram_t) );
+    if( rec == NULL )
+    {
+        fclose( fp );
+        return -1;
+    }
+
+    unsigned nread;
+    for( nread = 0; nread < hdr.nhist; nread++ )
+    {
+        char name[HIST_NAME_LEN];
+        if( fread( name, sizeof(name), 1, fp ) != 1 || fread( rec, sizeof(histogram_t), 1, fp ) != 1 )
+        {
+            log_error( "Histogram file %s is truncated", path );
+            break;
+        }
+        name[HIST_NAME_LEN - 1] = '\0';
+
+        unsigned i;
+        for( i=0; i < n && strcmp( names[i], name ) != 0; i++ )
+            ;
+        if( i < n )
+        {
+            histogram_merge( &H[i], rec );
+        }
+        else
+        {
+            log_warn( "Ignoring unknown histogram %s in %s", name, path );
+        }
+    }
+    free( rec );
+    fclose( fp );
+    return nread == hdr.nhist ? (int)nread : -1;
+}
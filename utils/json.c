@@ -0,0 +1,23 @@
+/*------------------------------------------------------------------------------------------------*/
+/* JSON output: shared by the run summary, the coordinator's aggregate and trace analysis. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+
+#include "utils.h"
+
+/* Output a string as a JSON string literal (empty, if it is NULL) */
+void json_str( FILE *fp, const char *str )
+{
+    fputc( '"', fp );
+    for( ; str != NULL && *str; str++ )
+    {
+        if( *str == '"' || *str == '\\' )
+            fprintf( fp, "\\%c", *str );
+        else if( (unsigned char)*str < 0x20 )
+            fprintf( fp, "\\u%04x", (unsigned char)*str );
+        else
+            fputc( *str, fp );
+    }
+    fputc( '"', fp );
+}
@@ -0,0 +1,185 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Dataset manifests:
+ * Creation of a manifest shared by the tasks writing its objects, and reading it back.
+ * The header is written last, so that a manifest of a run which failed is never valid. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "manifest.h"
+
+static manifest_t *manifest_map( const char *path, const int fd, const size_t len, const int prot )
+{
+    manifest_t *M = calloc( 1, sizeof(manifest_t) );
+    if( M == NULL || (M->path = strdup( path )) == NULL )
+    {
+        log_error( "Could not allocate state for manifest %s", path );
+        free( M );
+        return NULL;
+    }
+    M->len = len;
+    M->base = mmap( NULL, len, prot, MAP_SHARED, fd, 0 );
+    if( M->base == MAP_FAILED )
+    {
+        log_error( "Could not map manifest %s: %s", path, strerror(errno) );
+        free( M->path );
+        free( M );
+        return NULL;
+    }
+    M->hdr = M->base;
+    return M;
+}
+
+static void manifest_unmap( manifest_t *M )
+{
+    munmap( M->base, M->len );
+    free( M->path );
+    free( M );
+}
+
+manifest_t *manifest_create( const char *path, const unsigned tasks, const unsigned count )
+{
+    const uint64_t nobj = (uint64_t)tasks * count;
+    const size_t len = sizeof(manifest_hdr_t) + nobj * sizeof(manifest_obj_t);
+
+    const int fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( fd < 0 || ftruncate( fd, len ) < 0 )
+    {
+        log_error( "Could not create manifest %s: %s", path, strerror(errno) );
+        if( fd >= 0 )
+        {
+            close( fd );
+        }
+        return NULL;
+    }
+    manifest_t *M = manifest_map( path, fd, len, PROT_READ | PROT_WRITE );
+    close( fd );
+    if( M == NULL )
+    {
+        return NULL;
+    }
+
+    /* Until complete, the header holds only what the tasks need to record their objects */
+    M->hdr->count = count;
+    M->obj = (manifest_obj_t *)((char *)M->base + sizeof(manifest_hdr_t));
+    M->nobj = nobj;
+    return M;
+}
+
+int manifest_finish( manifest_t *M, const manifest_hdr_t *hdr )
+{
+    manifest_hdr_t H = *hdr;
+
+    memcpy( H.magic, MANIFEST_MAGIC, sizeof(H.magic) );
+    H.version = MANIFEST_VERSION;
+    H.endian = MANIFEST_ENDIAN;
+    H.hdr_len = sizeof(manifest_hdr_t);
+    H.count = M->hdr->count;
+    H.nobj = M->nobj;
+    H.bytes = H.max_len = 0;
+    for( uint64_t i=0; i < M->nobj; i++ )
+    {
+        H.bytes += M->obj[i].len;
+        if( M->obj[i].len > H.max_len )
+        {
+            H.max_len = M->obj[i].len;
+        }
+    }
+    H.created = time( NULL );
+    if( gethostname( H.host, sizeof(H.host) - 1 ) < 0 )
+    {
+        strcpy( H.host, "unknown" );
+    }
+
+    /* Entries must reach the file before the header that makes it valid */
+    int ret = msync( M->base, M->len, MS_SYNC );
+    if( ret == 0 )
+    {
+        *M->hdr = H;
+        ret = msync( M->base, sizeof(manifest_hdr_t), MS_SYNC );
+    }
+    if( ret < 0 )
+    {
+        log_error( "Could not write manifest %s: %s", M->path, strerror(errno) );
+    }
+    else
+    {
+        log_info( "Manifest %s lists %lu objects, %lu bytes", M->path, (unsigned long)H.nobj,
+                  (unsigned long)H.bytes );
+    }
+    manifest_unmap( M );
+    return ret;
+}
+
+void manifest_discard( manifest_t *M )
+{
+    unlink( M->path );
+    manifest_unmap( M );
+}
+
+manifest_t *manifest_open( const char *path )
+{
+    struct stat st;
+
+    const int fd = open( path, O_RDONLY );
+    if( fd < 0 || fstat( fd, &st ) < 0 )
+    {
+        log_error( "Could not open manifest %s: %s", path, strerror(errno) );
+        if( fd >= 0 )
+        {
+            close( fd );
+        }
+        return NULL;
+    }
+    if( (size_t)st.st_size < sizeof(manifest_hdr_t) )
+    {
+        log_error( "%s is not a manifest", path );
+        close( fd );
+        return NULL;
+    }
+    manifest_t *M = manifest_map( path, fd, st.st_size, PROT_READ );
+    close( fd );
+    if( M == NULL )
+    {
+        return NULL;
+    }
+
+    const manifest_hdr_t *H = M->hdr;
+    if( memcmp( H->magic, MANIFEST_MAGIC, sizeof(H->magic) ) != 0 || H->endian != MANIFEST_ENDIAN )
+    {
+        log_error( "%s is not a complete manifest from a host of this byte order", path );
+    }
+    else if( H->version != MANIFEST_VERSION || H->hdr_len < sizeof(manifest_hdr_t) )
+    {
+        log_error( "Manifest %s is of unsupported version %u", path, H->version );
+    }
+    else if( H->nobj == 0 || (M->len - H->hdr_len) / sizeof(manifest_obj_t) < H->nobj )
+    {
+        log_error( "Manifest %s is truncated: %lu objects expected", path, (unsigned long)H->nobj );
+    }
+    else
+    {
+        M->obj = (manifest_obj_t *)((char *)M->base + H->hdr_len);
+        M->nobj = H->nobj;
+        return M;
+    }
+    manifest_unmap( M );
+    return NULL;
+}
+
+void manifest_close( manifest_t *M )
+{
+    if( M != NULL )
+    {
+        manifest_unmap( M );
+    }
+}
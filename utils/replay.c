@@ -0,0 +1,661 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Trace-driven replay:
+ * Loading of .trc and CSV traces, and planning of their replay: naming the versions of the
+ * objects, finding those to create beforehand, and sharing out the streams between workers in
+ * groups of those addressing the same objects. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "tracefile.h"
+#include "replay.h"
+
+/* A record of the trace as loaded, before planning */
+typedef struct replay_rec {
+    uint64_t when;              /* ns, from the trace's own origin */
+    uint64_t seq;               /* Order in the trace, so that sorting by time is stable */
+    uint64_t key;               /* Identity of the object */
+    uint32_t stream;
+    uint32_t op;
+    uint32_t len;
+} replay_rec_t;
+
+typedef struct replay_recs {
+    replay_rec_t *rec;
+    uint64_t n, cap;
+} replay_recs_t;
+
+/* Map of 64-bit keys to dense indices, by open addressing */
+typedef struct replay_map {
+    uint64_t *key;
+    uint32_t *val;              /* Index + 1 (0: empty) */
+    uint64_t cap, n;
+} replay_map_t;
+
+#define REPLAY_MAP_INIT         1024
+#define REPLAY_FNV_BASIS        0xcbf29ce484222325ULL
+#define REPLAY_FNV_PRIME        0x100000001b3ULL
+
+/* In motif traces, stream reads made before the stream has written anything address objects
+ * of their own, in a range of object keys apart from those written */
+#define REPLAY_TRC_PRELOAD      0x80000000U
+
+/*------------------------------------------------------------------------------------------------*/
+
+static inline uint64_t replay_mix64( uint64_t x )
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* Object IDs of successive versions: a bijection, so that each is unique, spreading names
+ * (and directories of the DIRTREE driver) as the PRNG sequences of motif_1 do */
+static inline uint32_t replay_name( uint32_t v )
+{
+    v ^= v >> 16;
+    v *= 0x85ebca6bU;
+    v ^= v >> 13;
+    v *= 0xc2b2ae35U;
+    v ^= v >> 16;
+    return v;
+}
+
+static uint64_t replay_hash( const char *s, uint64_t h )
+{
+    for( ; *s; s++ )
+    {
+        h = (h ^ (unsigned char)*s) * REPLAY_FNV_PRIME;
+    }
+    return h;
+}
+
+static void replay_map_free( replay_map_t *M )
+{
+    free( M->key );
+    free( M->val );
+    memset( M, 0, sizeof(*M) );
+}
+
+static int replay_map_grow( replay_map_t *M )
+{
+    replay_map_t G = { .cap = M->cap ? M->cap * 2 : REPLAY_MAP_INIT, .n = M->n };
+    G.key = malloc( G.cap * sizeof(uint64_t) );
+    G.val = calloc( G.cap, sizeof(uint32_t) );
+    if( G.key == NULL || G.val == NULL )
+    {
+        replay_map_free( &G );
+        return -1;
+    }
+    for( uint64_t i=0; i < M->cap; i++ )
+    {
+        if( M->val[i] != 0 )
+        {
+            uint64_t h = replay_mix64( M->key[i] ) & (G.cap - 1);
+            while( G.val[h] != 0 )
+            {
+                h = (h + 1) & (G.cap - 1);
+            }
+            G.key[h] = M->key[i];
+            G.val[h] = M->val[i];
+        }
+    }
+    replay_map_free( M );
+    *M = G;
+    return 0;
+}
+
+/* Index of a key, added as the next index if it is new.  Returns -1 if out of memory */
+static int64_t replay_map_intern( replay_map_t *M, const uint64_t key, bool *added )
+{
+    if( (M->n + 1) * 2 > M->cap && replay_map_grow( M ) < 0 )
+    {
+        return -1;
+    }
+    uint64_t h = replay_mix64( key ) & (M->cap - 1);
+    while( M->val[h] != 0 )
+    {
+        if( M->key[h] == key )
+        {
+            *added = false;
+            return M->val[h] - 1;
+        }
+        h = (h + 1) & (M->cap - 1);
+    }
+    M->key[h] = key;
+    M->val[h] = ++M->n;
+    *added = true;
+    return M->n - 1;
+}
+
+static replay_rec_t *replay_recs_add( replay_recs_t *L )
+{
+    if( L->n == L->cap )
+    {
+        const uint64_t cap = L->cap ? L->cap * 2 : 4096;
+        replay_rec_t *rec = realloc( L->rec, cap * sizeof(replay_rec_t) );
+        if( rec == NULL )
+        {
+            log_error( "Could not allocate space for %lu trace records", (unsigned long)cap );
+            return NULL;
+        }
+        L->rec = rec;
+        L->cap = cap;
+    }
+    replay_rec_t *r = &L->rec[L->n];
+    r->seq = L->n++;
+    return r;
+}
+
+static int replay_rec_cmp( const void *a, const void *b )
+{
+    const replay_rec_t *ra = a, *rb = b;
+    if( ra->when != rb->when )
+    {
+        return ra->when < rb->when ? -1 : 1;
+    }
+    return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Motif traces */
+
+static int replay_load_trc( replay_t *R, replay_recs_t *L, const char *path )
+{
+    trace_entry_t te;
+    unsigned nsource;
+    int ret;
+
+    trace_reader_t *T = trace_reader_open( path );
+    if( T == NULL )
+    {
+        log_error( "Could not open trace %s", path );
+        return -1;
+    }
+    const trace_file_hdr_t *H = trace_reader_header( T );
+    const trace_source_t *sources = trace_reader_sources( T, &nsource );
+    if( H->version >= 2 && H->sample_mode != TRACE_SAMPLE_ALL )
+    {
+        log_warn( "Trace %s was sampled: %lu of %lu operations can be replayed", path,
+                  (unsigned long)H->sample_kept, (unsigned long)H->sample_seen );
+    }
+
+    while( (ret = trace_reader_next( T, &te )) > 0 )
+    {
+        if( te.info.op != TRACE_READ && te.info.op != TRACE_WRITE )
+        {
+            /* Components of operations are not operations in their own right */
+            if( te.info.op == TRACE_MISC )
+            {
+                R->nignored++;
+            }
+            continue;
+        }
+        const trace_source_t *src = trace_reader_source( T );
+        replay_rec_t *r = replay_recs_add( L );
+        if( r == NULL || src == NULL )
+        {
+            ret = -1;
+            break;
+        }
+        r->when = (uint64_t)te.timestamp.tv_sec * 1000000000ULL + te.timestamp.tv_nsec;
+        r->stream = src - sources;
+        r->op = te.info.op;
+        r->len = 0;
+    }
+    trace_reader_close( T );
+    if( ret < 0 )
+    {
+        log_error( "Trace %s is corrupt", path );
+        return -1;
+    }
+
+    /* Within each stream, writes create objects and reads cycle through those written so far */
+    uint32_t *count = calloc( 3 * (size_t)nsource, sizeof(uint32_t) );
+    if( count == NULL )
+    {
+        log_error( "Could not allocate state for %u streams", nsource );
+        return -1;
+    }
+    uint32_t *written = count, *read = count + nsource, *preload = count + 2 * nsource;
+    qsort( L->rec, L->n, sizeof(replay_rec_t), replay_rec_cmp );
+    for( uint64_t i=0; i < L->n; i++ )
+    {
+        replay_rec_t *r = &L->rec[i];
+        uint32_t obj;
+        if( r->op == TRACE_WRITE )
+            obj = written[r->stream]++;
+        else if( written[r->stream] > 0 )
+            obj = read[r->stream]++ % written[r->stream];
+        else
+            obj = REPLAY_TRC_PRELOAD | preload[r->stream]++;
+        r->key = (uint64_t)r->stream << 32 | obj;
+    }
+    free( count );
+    R->nstream = nsource;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* CSV traces: timestamp (seconds), op, object, size[, stream] */
+
+static char *replay_trim( char *s )
+{
+    while( isspace( (unsigned char)*s ) )
+    {
+        s++;
+    }
+    char *end = s + strlen( s );
+    while( end > s && isspace( (unsigned char)end[-1] ) )
+    {
+        *--end = '\0';
+    }
+    return s;
+}
+
+/* Seconds, with up to nine decimal places, in ns */
+static int replay_parse_time( const char *s, uint64_t *ns )
+{
+    uint64_t sec = 0, frac = 0, scale = 1000000000ULL;
+
+    if( !isdigit( (unsigned char)*s ) )
+    {
+        return -1;
+    }
+    for( ; isdigit( (unsigned char)*s ); s++ )
+    {
+        sec = sec * 10 + (*s - '0');
+    }
+    if( *s == '.' )
+    {
+        for( s++; isdigit( (unsigned char)*s ); s++ )
+        {
+            if( scale > 1 )
+            {
+                scale /= 10;
+                frac += (*s - '0') * scale;
+            }
+        }
+    }
+    if( *s != '\0' || sec > UINT64_MAX / 1000000000ULL - 1 )
+    {
+        return -1;
+    }
+    *ns = sec * 1000000000ULL + frac;
+    return 0;
+}
+
+static int replay_parse_op( const char *s, uint32_t *op )
+{
+    static const char *reads[] = { "read", "r", "get" };
+    static const char *writes[] = { "write", "w", "put" };
+
+    for( unsigned i=0; i < ARRAYLEN(reads); i++ )
+    {
+        if( strcasecmp( s, reads[i] ) == 0 )
+        {
+            *op = TRACE_READ;
+            return 0;
+        }
+        if( strcasecmp( s, writes[i] ) == 0 )
+        {
+            *op = TRACE_WRITE;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int replay_load_csv( replay_t *R, replay_recs_t *L, const char *path )
+{
+    replay_map_t streams = { 0 };
+    char *line = NULL, *field[5];
+    size_t line_cap = 0;
+    unsigned lineno = 0, records = 0;
+    int ret = 0;
+
+    FILE *fp = fopen( path, "r" );
+    if( fp == NULL )
+    {
+        log_error( "Could not open trace %s: %s", path, strerror(errno) );
+        return -1;
+    }
+
+    while( ret == 0 && getline( &line, &line_cap, fp ) >= 0 )
+    {
+        unsigned nfield = 0;
+        uint64_t when, len = 0;
+        uint32_t op;
+        char *p = line, *end;
+
+        lineno++;
+        if( *replay_trim( line ) == '\0' || *replay_trim( line ) == '#' )
+        {
+            continue;
+        }
+        while( p != NULL && nfield < ARRAYLEN(field) )
+        {
+            field[nfield++] = p;
+            if( (p = strchr( p, ',' )) != NULL )
+            {
+                *p++ = '\0';
+            }
+            field[nfield - 1] = replay_trim( field[nfield - 1] );
+        }
+        if( replay_parse_time( field[0], &when ) < 0 )
+        {
+            /* The first record may be a header */
+            if( records++ == 0 )
+            {
+                continue;
+            }
+            log_error( "%s:%u: invalid timestamp '%s'", path, lineno, field[0] );
+            ret = -1;
+            break;
+        }
+        records++;
+        if( nfield < 4 || p != NULL || *field[2] == '\0' )
+        {
+            log_error( "%s:%u: expected timestamp, op, object, size[, stream]", path, lineno );
+            ret = -1;
+            break;
+        }
+        if( replay_parse_op( field[1], &op ) < 0 )
+        {
+            R->nignored++;
+            continue;
+        }
+        if( *field[3] != '\0' && ((len = strtoull( field[3], &end, 10 )) > UINT32_MAX || *end != '\0') )
+        {
+            log_error( "%s:%u: invalid size '%s'", path, lineno, field[3] );
+            ret = -1;
+            break;
+        }
+
+        /* Operations without a stream are ordered only with others on the same object */
+        const uint64_t key = replay_hash( field[2], REPLAY_FNV_BASIS );
+        bool added;
+        const int64_t stream = replay_map_intern( &streams, nfield == 5 ? replay_hash( field[4], ~REPLAY_FNV_BASIS )
+                                                                        : key, &added );
+        replay_rec_t *r = replay_recs_add( L );
+        if( r == NULL || stream < 0 )
+        {
+            ret = -1;
+            break;
+        }
+        r->when = when;
+        r->key = key;
+        r->stream = stream;
+        r->op = op;
+        r->len = len;
+    }
+    free( line );
+    fclose( fp );
+
+    qsort( L->rec, L->n, sizeof(replay_rec_t), replay_rec_cmp );
+    R->nstream = streams.n;
+    replay_map_free( &streams );
+    return ret;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Planning */
+
+/* Current version of each object: its name and length, and the first stream to address it */
+typedef struct replay_obj {
+    uint32_t client_id, obj_id, len;
+    uint32_t stream;
+    bool exists;
+} replay_obj_t;
+
+/* Streams which address the same objects are joined into groups, each led by its lowest stream,
+ * which every other stream of the group follows through lower ones */
+static uint32_t replay_find( uint32_t *leader, uint32_t s )
+{
+    while( leader[s] != s )
+    {
+        s = leader[s] = leader[leader[s]];
+    }
+    return s;
+}
+
+static void replay_join( uint32_t *leader, const uint32_t a, const uint32_t b )
+{
+    const uint32_t la = replay_find( leader, a ), lb = replay_find( leader, b );
+    if( la < lb )       leader[lb] = la;
+    else if( lb < la )  leader[la] = lb;
+}
+
+/* Share out the operations between workers by group of streams, keeping the order of each
+ * worker's */
+static int replay_group( replay_op_t **ops, uint64_t **first, const uint64_t n, const uint32_t *group,
+                         const unsigned workers )
+{
+    replay_op_t *out = malloc( (n ? n : 1) * sizeof(replay_op_t) );
+    uint64_t *f = calloc( workers + 1, sizeof(uint64_t) );
+    if( out == NULL || f == NULL )
+    {
+        log_error( "Could not allocate space for %lu operations", (unsigned long)n );
+        free( out );
+        free( f );
+        return -1;
+    }
+    for( uint64_t i=0; i < n; i++ )
+    {
+        f[group[(*ops)[i].stream] % workers + 1]++;
+    }
+    for( unsigned w=0; w < workers; w++ )
+    {
+        f[w + 1] += f[w];
+    }
+    for( uint64_t i=0; i < n; i++ )
+    {
+        out[f[group[(*ops)[i].stream] % workers]++] = (*ops)[i];
+    }
+
+    /* Each count has been advanced to the start of the next worker's operations */
+    memmove( f + 1, f, workers * sizeof(uint64_t) );
+    f[0] = 0;
+    free( *ops );
+    *ops = out;
+    *first = f;
+    return 0;
+}
+
+static int replay_plan( replay_t *R, const replay_recs_t *L )
+{
+    replay_map_t objects = { 0 };
+    replay_obj_t *obj = NULL;
+    uint64_t nobj_cap = 0;
+    int ret = 0;
+
+    R->op = malloc( (L->n ? L->n : 1) * sizeof(replay_op_t) );
+    R->preload = malloc( (L->n ? L->n : 1) * sizeof(replay_op_t) );
+    uint32_t *group = malloc( (R->nstream ? R->nstream : 1) * sizeof(uint32_t) );
+    if( R->op == NULL || R->preload == NULL || group == NULL )
+    {
+        log_error( "Could not allocate space for %lu operations", (unsigned long)L->n );
+        free( group );
+        return -1;
+    }
+    for( uint32_t s=0; s < R->nstream; s++ )
+    {
+        group[s] = s;
+    }
+
+    const uint64_t origin = L->n > 0 ? L->rec[0].when : 0;
+    for( uint64_t i=0; i < L->n; i++ )
+    {
+        const replay_rec_t *r = &L->rec[i];
+        bool added;
+        const int64_t idx = replay_map_intern( &objects, r->key, &added );
+        if( idx < 0 )
+        {
+            ret = -1;
+            break;
+        }
+        if( (uint64_t)idx >= nobj_cap )
+        {
+            const uint64_t cap = nobj_cap ? nobj_cap * 2 : 4096;
+            replay_obj_t *o = realloc( obj, cap * sizeof(replay_obj_t) );
+            if( o == NULL )
+            {
+                ret = -1;
+                break;
+            }
+            obj = o;
+            nobj_cap = cap;
+        }
+        replay_obj_t *o = &obj[idx];
+        if( added )
+        {
+            o->stream = r->stream;
+            o->exists = false;
+        }
+
+        /* A read may follow a write of another stream: both must be replayed by one worker */
+        replay_join( group, o->stream, r->stream );
+
+        /* Writes, and reads of objects not yet written, create a version of their own */
+        if( r->op == TRACE_WRITE || !o->exists )
+        {
+            if( R->nversion > UINT32_MAX )
+            {
+                log_error( "Too many objects to name uniquely" );
+                ret = -1;
+                break;
+            }
+            o->client_id = r->stream;
+            o->obj_id = replay_name( R->nversion++ );
+            o->len = r->len;
+            o->exists = true;
+            if( r->len > R->max_len )
+            {
+                R->max_len = r->len;
+            }
+            if( r->op == TRACE_READ )
+            {
+                R->preload[R->npreload++] = (replay_op_t){ .stream = r->stream, .op = TRACE_WRITE,
+                    .client_id = o->client_id, .obj_id = o->obj_id, .len = o->len };
+            }
+        }
+        if( r->op == TRACE_READ )   R->nread++;
+        else                        R->nwrite++;
+        R->op[R->nop++] = (replay_op_t){ .when = r->when - origin, .stream = r->stream, .op = r->op,
+            .client_id = o->client_id, .obj_id = o->obj_id, .len = o->len };
+    }
+    free( obj );
+    replay_map_free( &objects );
+    if( ret < 0 )
+    {
+        log_error( "Could not allocate state for the objects of the trace" );
+        free( group );
+        return -1;
+    }
+    R->duration = R->nop > 0 ? L->rec[L->n - 1].when - origin : 0;
+
+    /* Number the groups in order of their leaders.  Each stream follows a lower one in its group,
+     * which has been numbered already */
+    for( uint32_t s=0; s < R->nstream; s++ )
+    {
+        group[s] = group[s] == s ? R->ngroup++ : group[group[s]];
+    }
+
+    if( replay_group( &R->op, &R->op_first, R->nop, group, R->nworker ) < 0 ||
+        replay_group( &R->preload, &R->preload_first, R->npreload, group, R->nworker ) < 0 )
+    {
+        ret = -1;
+    }
+    free( group );
+    return ret;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+int replay_timing_parse( const char *spec, double *speed )
+{
+    char *end;
+
+    if( strcasecmp( spec, "fast" ) == 0 )
+    {
+        *speed = 0.0;
+        return 0;
+    }
+    if( strcasecmp( spec, "original" ) == 0 )
+    {
+        *speed = 1.0;
+        return 0;
+    }
+    if( strncasecmp( spec, "scale:", 6 ) == 0 )
+    {
+        *speed = strtod( spec + 6, &end );
+        if( end != spec + 6 && *end == '\0' && *speed > 0.0 )
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int replay_load( replay_t *R, const char *path, const unsigned workers )
+{
+    replay_recs_t L = { 0 };
+    char magic[sizeof(TRACE_MAGIC) - 1];
+
+    memset( R, 0, sizeof(*R) );
+    R->nworker = workers;
+
+    /* Motif traces are identified by their header, or for version 1 files, by their name */
+    FILE *fp = fopen( path, "r" );
+    if( fp == NULL )
+    {
+        log_error( "Could not open trace %s: %s", path, strerror(errno) );
+        return -1;
+    }
+    const bool is_trc = (fread( magic, 1, sizeof(magic), fp ) == sizeof(magic) &&
+                         memcmp( magic, TRACE_MAGIC, sizeof(magic) ) == 0) ||
+                        (strlen( path ) > 4 && strcmp( path + strlen( path ) - 4, ".trc" ) == 0);
+    fclose( fp );
+
+    int ret = is_trc ? replay_load_trc( R, &L, path ) : replay_load_csv( R, &L, path );
+    if( ret == 0 && L.n == 0 )
+    {
+        log_error( "Trace %s has no reads or writes to replay", path );
+        ret = -1;
+    }
+    if( ret == 0 )
+    {
+        ret = replay_plan( R, &L );
+    }
+    free( L.rec );
+    if( ret < 0 )
+    {
+        replay_free( R );
+        return -1;
+    }
+
+    log_info( "Replaying %lu reads and %lu writes of %u streams in %u groups over %.3fs from %s "
+              "(%lu objects created beforehand, %lu other operations ignored)", (unsigned long)R->nread,
+              (unsigned long)R->nwrite, R->nstream, R->ngroup, R->duration / 1e9, path,
+              (unsigned long)R->npreload, (unsigned long)R->nignored );
+    return 0;
+}
+
+void replay_free( replay_t *R )
+{
+    free( R->op );
+    free( R->op_first );
+    free( R->preload );
+    free( R->preload_first );
+    memset( R, 0, sizeof(*R) );
+}
@@ -0,0 +1,271 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Live interval statistics:
+ * Per-worker running totals in shared memory, sampled by the parent process. */
+/* Begun 2019, StackHPC Ltd */
+
+#define _DEFAULT_SOURCE                 /* For MAP_ANONYMOUS */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include "utils.h"
+#include "stats.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+stats_slot_t *stats_self = NULL;
+
+/* State of the previous sample, held by the sampling process */
+static struct
+{
+    stats_counter_t total[TRACE_NTYPES];
+    struct timespec when;
+    unsigned count;             /* Number of samples taken */
+} prev;
+
+stats_slot_t *stats_create( const unsigned n )
+{
+    stats_slot_t *slots = mmap( NULL, n * sizeof(stats_slot_t), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( slots == MAP_FAILED )
+    {
+        log_error( "Could not map %u statistics slots: %s", n, strerror(errno) );
+        return NULL;
+    }
+
+    /* Anonymous mappings are zero-filled */
+    memset( &prev, 0, sizeof(prev) );
+    time_now( &prev.when );
+    return slots;
+}
+
+void stats_destroy( stats_slot_t *slots, const unsigned n )
+{
+    if( slots != NULL )
+    {
+        munmap( slots, n * sizeof(stats_slot_t) );
+    }
+}
+
+void stats_attach( stats_slot_t *slots, const unsigned ordinal )
+{
+    stats_self = slots != NULL ? &slots[ordinal] : NULL;
+}
+
+void stats_sample( const stats_slot_t *slots, const unsigned n, FILE *fp )
+{
+    stats_counter_t total[TRACE_NTYPES];
+    struct timespec now, delta, elapsed;
+
+    time_now( &now );
+    memset( total, 0, sizeof(total) );
+    for( unsigned i=0; i < n; i++ )
+    {
+        for( unsigned t=0; t < TRACE_NTYPES; t++ )
+        {
+            const stats_counter_t *c = &slots[i].c[t];
+            total[t].ops += __atomic_load_n( &c->ops, __ATOMIC_RELAXED );
+            total[t].bytes += __atomic_load_n( &c->bytes, __ATOMIC_RELAXED );
+            total[t].errors += __atomic_load_n( &c->errors, __ATOMIC_RELAXED );
+            total[t].latency += __atomic_load_n( &c->latency, __ATOMIC_RELAXED );
+        }
+    }
+
+    time_delta( &prev.when, &now, &delta );
+    time_delta( &time_benchmark, &now, &elapsed );
+    const double secs = (double)delta.tv_sec + (double)delta.tv_nsec / 1000000000.0;
+    const double t = (double)elapsed.tv_sec + (double)elapsed.tv_nsec / 1000000000.0;
+
+    if( fp != NULL && prev.count == 0 )
+    {
+        fprintf( fp, "elapsed,op,ops,iops,mbytes_per_sec,mean_latency_us,errors\n" );
+    }
+    for( unsigned tt=0; tt < TRACE_NTYPES; tt++ )
+    {
+        const uint64_t ops = total[tt].ops - prev.total[tt].ops;
+        const uint64_t bytes = total[tt].bytes - prev.total[tt].bytes;
+        const uint64_t errors = total[tt].errors - prev.total[tt].errors;
+        const uint64_t latency = total[tt].latency - prev.total[tt].latency;
+        if( ops == 0 && errors == 0 )
+        {
+            continue;
+        }
+
+        const double iops = secs > 0.0 ? ops / secs : 0.0;
+        const double mbps = secs > 0.0 ? bytes / secs / 1048576.0 : 0.0;
+        const double mean = ops ? (double)latency / ops / 1000.0 : 0.0;
+        log_info( "%8.1fs %-5s %10.0f ops/s %9.2f MiB/s mean %9.1fus %lu errors",
+                  t, trace_type_str( tt ), iops, mbps, mean, (unsigned long)errors );
+        if( fp != NULL )
+        {
+            fprintf( fp, "%.3f,%s,%lu,%.1f,%.3f,%.3f,%lu\n", t, trace_type_str( tt ),
+                     (unsigned long)ops, iops, mbps, mean, (unsigned long)errors );
+        }
+    }
+    if( fp != NULL )
+    {
+        fflush( fp );
+    }
+
+    memcpy( prev.total, total, sizeof(total) );
+    prev.when = now;
+    prev.count++;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Summary of a completed run */
+
+static const trace_type_t stats_phase_op[STATS_NPHASES] = { TRACE_WRITE, TRACE_READ };
+static const char *stats_phase_str[STATS_NPHASES] = { "write", "read" };
+
+static int64_t stats_ns( const struct timespec *ts )
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+void stats_result( const stats_slot_t *slots, const unsigned n, const stats_phase_t ph, stats_result_t *R )
+{
+    memset( R, 0, sizeof(*R) );
+    for( unsigned i=0; i < n; i++ )
+    {
+        const stats_window_t *w = &slots[i].phase[ph];
+        const int64_t start = stats_ns( &w->start ), end = stats_ns( &w->end );
+        if( end == 0 )
+        {
+            continue;
+        }
+        if( R->workers++ == 0 || start < R->first )     R->first = start;
+        if( end > R->last )                             R->last = end;
+
+        const stats_counter_t *c = &slots[i].c[stats_phase_op[ph]];
+        R->ops += c->ops;
+        R->bytes += c->bytes;
+        R->errors += c->errors;
+        if( ph == STATS_PHASE_READ )
+        {
+            R->invalid += slots[i].invalid;
+        }
+    }
+}
+
+/* Minimum, maximum, mean and standard deviation of a per-worker rate */
+static void stats_spread( FILE *fp, const char *name, const double *v, const unsigned n )
+{
+    double min = 0.0, max = 0.0, sum = 0.0, sumsq = 0.0;
+    for( unsigned i=0; i < n; i++ )
+    {
+        if( i == 0 || v[i] < min )  min = v[i];
+        if( i == 0 || v[i] > max )  max = v[i];
+        sum += v[i];
+        sumsq += v[i] * v[i];
+    }
+    const double mean = n > 0 ? sum / n : 0.0;
+    const double var = n > 1 ? (sumsq - sum * sum / n) / (n - 1) : 0.0;
+    const double sd = var > 0.0 ? sqrt( var ) : 0.0;
+    fprintf( fp, "\"%s\": {\"min\": %.3f, \"max\": %.3f, \"mean\": %.3f, \"sd\": %.3f, \"cv\": %.4f}",
+             name, min, max, mean, sd, mean > 0.0 ? sd / mean : 0.0 );
+}
+
+void stats_summary( FILE *fp, const stats_slot_t *slots, const unsigned n, const histogram_t *hist )
+{
+    double *iops = calloc( n, sizeof(double) ), *bps = calloc( n, sizeof(double) );
+    if( iops == NULL || bps == NULL )
+    {
+        log_error( "Could not allocate summary of %u workers", n );
+        free( iops );
+        free( bps );
+        return;
+    }
+
+    /* Phase windows are relative to the earliest start of any phase by any worker */
+    int64_t origin = INT64_MAX;
+    for( unsigned i=0; i < n; i++ )
+    {
+        for( unsigned ph=0; ph < STATS_NPHASES; ph++ )
+        {
+            const int64_t start = stats_ns( &slots[i].phase[ph].start );
+            if( stats_ns( &slots[i].phase[ph].end ) > 0 && start < origin )
+            {
+                origin = start;
+            }
+        }
+    }
+
+    fprintf( fp, "  \"phases\": {" );
+    for( unsigned ph=0; ph < STATS_NPHASES; ph++ )
+    {
+        const trace_type_t tt = stats_phase_op[ph];
+        const histogram_t *H = &hist[tt];
+        stats_result_t R;
+        unsigned workers = 0;
+
+        stats_result( slots, n, ph, &R );
+        for( unsigned i=0; i < n; i++ )
+        {
+            const stats_window_t *w = &slots[i].phase[ph];
+            const int64_t start = stats_ns( &w->start ), end = stats_ns( &w->end );
+            if( end == 0 )
+            {
+                continue;
+            }
+            const stats_counter_t *c = &slots[i].c[tt];
+            const double secs = (end - start) / 1e9;
+            iops[workers] = secs > 0.0 ? c->ops / secs : 0.0;
+            bps[workers] = secs > 0.0 ? c->bytes / secs : 0.0;
+            workers++;
+        }
+
+        const double secs = (R.last - R.first) / 1e9;
+        fprintf( fp, "%s\n    \"%s\": {\"workers\": %u, \"start\": %.9f, \"elapsed\": %.9f, "
+                 "\"ops\": %lu, \"bytes\": %lu, \"errors\": %lu, \"invalid\": %lu, "
+                 "\"iops\": %.3f, \"bytes_per_sec\": %.3f,\n      ",
+                 ph ? "," : "", stats_phase_str[ph], R.workers, R.workers ? (R.first - origin) / 1e9 : 0.0,
+                 secs, (unsigned long)R.ops, (unsigned long)R.bytes, (unsigned long)R.errors,
+                 (unsigned long)R.invalid, secs > 0.0 ? R.ops / secs : 0.0, secs > 0.0 ? R.bytes / secs : 0.0 );
+        stats_spread( fp, "worker_iops", iops, workers );
+        fprintf( fp, ",\n      " );
+        stats_spread( fp, "worker_bytes_per_sec", bps, workers );
+        fprintf( fp, ",\n      \"latency_ns\": {\"count\": %lu, \"mean\": %.1f, \"min\": %lu, \"p50\": %lu, "
+                 "\"p90\": %lu, \"p99\": %lu, \"p99.9\": %lu, \"max\": %lu}}",
+                 (unsigned long)H->count, H->count ? (double)H->sum / H->count : 0.0,
+                 (unsigned long)(H->count ? H->min : 0),
+                 (unsigned long)histogram_percentile( H, 50.0 ), (unsigned long)histogram_percentile( H, 90.0 ),
+                 (unsigned long)histogram_percentile( H, 99.0 ), (unsigned long)histogram_percentile( H, 99.9 ),
+                 (unsigned long)H->max );
+    }
+    fprintf( fp, "\n  },\n" );
+
+    fprintf( fp, "  \"workers\": [" );
+    for( unsigned i=0; i < n; i++ )
+    {
+        fprintf( fp, "%s\n    {\"ordinal\": %u, \"invalid\": %lu", i ? "," : "", i,
+                 (unsigned long)slots[i].invalid );
+        for( unsigned ph=0; ph < STATS_NPHASES; ph++ )
+        {
+            const stats_window_t *w = &slots[i].phase[ph];
+            const stats_counter_t *c = &slots[i].c[stats_phase_op[ph]];
+            const int64_t start = stats_ns( &w->start ), end = stats_ns( &w->end );
+            if( end == 0 )
+            {
+                fprintf( fp, ", \"%s\": null", stats_phase_str[ph] );
+                continue;
+            }
+            const double secs = (end - start) / 1e9;
+            fprintf( fp, ",\n     \"%s\": {\"start\": %.9f, \"elapsed\": %.9f, \"ops\": %lu, \"bytes\": %lu, "
+                     "\"errors\": %lu, \"iops\": %.3f, \"bytes_per_sec\": %.3f, \"mean_latency_ns\": %.1f}",
+                     stats_phase_str[ph], (start - origin) / 1e9, secs, (unsigned long)c->ops,
+                     (unsigned long)c->bytes, (unsigned long)c->errors, secs > 0.0 ? c->ops / secs : 0.0,
+                     secs > 0.0 ? c->bytes / secs : 0.0, c->ops ? (double)c->latency / c->ops : 0.0 );
+        }
+        fprintf( fp, "}" );
+    }
+    fprintf( fp, "\n  ]" );
+
+    free( iops );
+    free( bps );
+}
@@ -0,0 +1,196 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Concurrency sweeps:
+ * Choose the number of tasks for each step from the measurements of the steps before it. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "utils.h"
+#include "sweep.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+int sweep_parse( sweep_t *W, const char *spec )
+{
+    static const char *series_str[] = SWEEP_SERIES_STR;
+    char buf[256], *term, *save, *end;
+
+    memset( W, 0, sizeof(*W) );
+    W->factor = 2.0;
+    W->min_gain = 0.05;
+    W->phase_time = SWEEP_PHASE_TIME;
+    W->knee = -1;
+
+    if( strlen( spec ) >= sizeof(buf) )
+    {
+        log_error( "Sweep specification is too long" );
+        return -1;
+    }
+    strcpy( buf, spec );
+
+    bool chosen = false;
+    for( term = strtok_r( buf, ",", &save ); term != NULL; term = strtok_r( NULL, ",", &save ) )
+    {
+        if( strncmp( term, "gain:", 5 ) == 0 )
+        {
+            const double pct = strtod( term + 5, &end );
+            if( *end != '\0' || !(pct >= 0.0) )
+            {
+                goto invalid;
+            }
+            W->min_gain = pct / 100.0;
+            continue;
+        }
+        if( strncmp( term, "slo:", 4 ) == 0 )
+        {
+            const double usecs = strtod( term + 4, &end );
+            if( *end != '\0' || !(usecs > 0.0) )
+            {
+                goto invalid;
+            }
+            W->slo = usecs * 1e3;
+            continue;
+        }
+        if( strncmp( term, "time:", 5 ) == 0 )
+        {
+            const double secs = strtod( term + 5, &end );
+            if( *end != '\0' || !(secs >= 0.0) )
+            {
+                goto invalid;
+            }
+            W->phase_time = secs;
+            continue;
+        }
+
+        unsigned s;
+        for( s=0; s < ARRAYLEN(series_str); s++ )
+        {
+            const size_t len = strlen( series_str[s] );
+            if( strncmp( term, series_str[s], len ) == 0 && term[len] == ':' )
+            {
+                break;
+            }
+        }
+        if( s == ARRAYLEN(series_str) || chosen )
+        {
+            goto invalid;
+        }
+        W->series = s;
+        W->start = strtoul( term + strlen( series_str[s] ) + 1, &end, 10 );
+        if( *end != ':' || W->start == 0 )
+        {
+            goto invalid;
+        }
+        W->max = strtoul( end + 1, &end, 10 );
+        if( *end == ':' )
+        {
+            W->factor = strtod( end + 1, &end );
+        }
+        if( *end != '\0' || W->max < W->start || !(W->factor > 1.0) )
+        {
+            goto invalid;
+        }
+        chosen = true;
+    }
+    if( !chosen )
+    {
+        log_error( "Sweep specification '%s' has no series", spec );
+        return -1;
+    }
+
+    W->next = W->start;
+    return 0;
+
+invalid:
+    log_error( "Invalid sweep term '%s'", term );
+    return -1;
+}
+
+unsigned sweep_next( const sweep_t *W )
+{
+    return W->next;
+}
+
+/* Next concurrency of the geometric series, which always grows by at least one task */
+static unsigned sweep_step( const sweep_t *W, const unsigned tasks )
+{
+    const double next = ceil( tasks * W->factor );
+    return next < (double)W->max ? (unsigned)next : W->max;
+}
+
+int sweep_record( sweep_t *W, const unsigned tasks, const double iops, const double bytes_per_sec,
+                  const uint64_t p99 )
+{
+    sweep_point_t *pt = realloc( W->pt, (W->npt + 1) * sizeof(sweep_point_t) );
+    if( pt == NULL )
+    {
+        log_error( "Could not allocate sweep point %u", W->npt );
+        return -1;
+    }
+    W->pt = pt;
+
+    /* Gain is relative to the knee so far: while bisecting, that is the lower bracket */
+    sweep_point_t *P = &W->pt[W->npt];
+    const sweep_point_t *ref = W->knee >= 0 ? &W->pt[W->knee] : NULL;
+    memset( P, 0, sizeof(*P) );
+    P->tasks = tasks;
+    P->iops = iops;
+    P->bytes_per_sec = bytes_per_sec;
+    P->p99 = p99;
+    P->within_slo = W->slo == 0 || p99 <= W->slo;
+    if( ref != NULL && ref->iops > 0.0 && tasks > ref->tasks )
+    {
+        /* Normalise to a step of FACTOR, so that smaller steps need proportionately less gain */
+        const double steps = log( (double)tasks / ref->tasks ) / log( W->factor );
+        P->gain = (iops / ref->iops - 1.0) / steps;
+    }
+    const bool scaling = P->within_slo && (ref == NULL || P->gain >= W->min_gain);
+    const int idx = W->npt++;
+
+    if( W->lo == 0 )
+    {
+        /* Stepping through the geometric series */
+        if( scaling )
+        {
+            W->knee = idx;
+            W->next = tasks < W->max ? sweep_step( W, tasks ) : 0;
+            return 0;
+        }
+        W->saturated = true;
+        if( W->series == SWEEP_GEOMETRIC || W->knee < 0 )
+        {
+            W->next = 0;
+            return 0;
+        }
+        W->lo = W->pt[W->knee].tasks;
+        W->hi = tasks;
+    }
+    else if( scaling )
+    {
+        W->knee = idx;
+        W->lo = tasks;
+    }
+    else
+    {
+        W->hi = tasks;
+    }
+
+    /* Bisect between the last concurrency that scaled and the first that did not */
+    W->next = W->hi - W->lo > 1 ? W->lo + (W->hi - W->lo) / 2 : 0;
+    return 0;
+}
+
+const sweep_point_t *sweep_knee( const sweep_t *W )
+{
+    return W->knee >= 0 ? &W->pt[W->knee] : NULL;
+}
+
+void sweep_fini( sweep_t *W )
+{
+    free( W->pt );
+    W->pt = NULL;
+    W->npt = 0;
+}
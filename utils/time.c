@@ -7,6 +7,10 @@
 
 #include "utils.h"
 
+#ifdef TIME_HAVE_TSC
+#include <cpuid.h>
+#endif
+
 struct timespec time_start, time_benchmark;
 
 /* Get current time in seconds and nanoseconds */
@@ -14,8 +18,9 @@ void time_now( struct timespec *ts )
 {
     /* CLOCK_MONOTONIC is better because it cannot be changed (and therefore never goes backwards).
      * However, we also expect to be comparing data across multiple hosts.
-     * Solution: assume a start time synchronised across all hosts is sufficient
-     * and use timestamps relative to this event on all hosts. */
+     * Solution: use timestamps relative to the start of the benchmark on all hosts, and record
+     * the wall clock time of that event.  In coordinated runs, the offset of each host's wall
+     * clock from the coordinator's is measured (see coord_clock), to align their traces. */
     clock_gettime( CLOCK_MONOTONIC, ts );
 }
 
@@ -34,3 +39,113 @@ void time_delta( const struct timespec *t1, const struct timespec *t2, struct ti
     }
 }
 
+
+/*------------------------------------------------------------------------------------------------*/
+/* Tick counts, from the selected time source */
+
+#define TIME_CALIBRATE_NS       50000000L   /* Period over which to calibrate the TSC */
+#define TIME_DRIFT_PPM          100.0       /* Drift from CLOCK_MONOTONIC worth a warning */
+
+time_source_t time_source = TIME_MONOTONIC;
+uint64_t time_tsc_mult = 1ULL << 32;
+uint64_t time_benchmark_tick;
+
+/* Reference point for calibration: a TSC reading and the monotonic time at which it was taken */
+static struct
+{
+    uint64_t tsc;
+    uint64_t ns;
+} time_ref;
+
+static inline uint64_t time_mono_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef TIME_HAVE_TSC
+/* The TSC is usable if it runs at a constant rate, whatever the power state (CPUID 0x80000007) */
+static int time_tsc_invariant( void )
+{
+    unsigned eax, ebx, ecx, edx;
+    if( !__get_cpuid( 0x80000000, &eax, &ebx, &ecx, &edx ) || eax < 0x80000007 )
+    {
+        return 0;
+    }
+    __get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx );
+    return (edx >> 8) & 1;
+}
+
+/* Take a TSC reading paired with CLOCK_MONOTONIC, bracketing the clock read by two TSC reads */
+static void time_tsc_pair( uint64_t *tsc, uint64_t *ns )
+{
+    const uint64_t t0 = time_tick( );
+    *ns = time_mono_ns( );
+    const uint64_t t1 = time_tick( );
+    *tsc = t0 + (t1 - t0) / 2;
+}
+#endif
+
+time_source_t time_source_select( const time_source_t src )
+{
+    time_source = TIME_MONOTONIC;
+    time_tsc_mult = 1ULL << 32;
+    if( src != TIME_TSC )
+    {
+        return time_source;
+    }
+
+#ifdef TIME_HAVE_TSC
+    if( !time_tsc_invariant( ) )
+    {
+        log_warn( "TSC is not invariant: using CLOCK_MONOTONIC" );
+        return time_source;
+    }
+
+    const struct timespec period = { 0, TIME_CALIBRATE_NS };
+    uint64_t tsc, ns;
+
+    time_source = TIME_TSC;
+    time_tsc_pair( &time_ref.tsc, &time_ref.ns );
+    nanosleep( &period, NULL );
+    time_tsc_pair( &tsc, &ns );
+
+    if( tsc <= time_ref.tsc )
+    {
+        log_warn( "TSC did not advance during calibration: using CLOCK_MONOTONIC" );
+        time_source = TIME_MONOTONIC;
+        return time_source;
+    }
+    time_tsc_mult = ((ns - time_ref.ns) << 32) / (tsc - time_ref.tsc);
+    log_debug( "TSC calibrated at %.6f GHz", 4294967296.0 / time_tsc_mult );
+#else
+    log_warn( "No TSC on this architecture: using CLOCK_MONOTONIC" );
+#endif
+    return time_source;
+}
+
+double time_source_check( void )
+{
+    if( time_source != TIME_TSC )
+    {
+        return 0.0;
+    }
+
+    uint64_t tsc = 0, ns = 0;
+#ifdef TIME_HAVE_TSC
+    time_tsc_pair( &tsc, &ns );
+#endif
+    const double actual = (double)(ns - time_ref.ns);
+    const double predicted = (double)time_tick_ns( tsc - time_ref.tsc );
+    const double ppm = actual > 0.0 ? (predicted - actual) / actual * 1e6 : 0.0;
+    if( ppm > TIME_DRIFT_PPM || ppm < -TIME_DRIFT_PPM )
+    {
+        log_warn( "TSC drifted by %.1f ppm from CLOCK_MONOTONIC over %.1fs", ppm, actual / 1e9 );
+    }
+    else
+    {
+        log_debug( "TSC drift %.1f ppm from CLOCK_MONOTONIC over %.1fs", ppm, actual / 1e9 );
+    }
+    return ppm;
+}
@@ -3,11 +3,18 @@
  * Generating telemetry streams during benchmark execution */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <string.h>
-#include <errno.h>
+#include <assert.h>
 #include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/eventfd.h>
 #include "utils.h"
+#include "stats.h"
+#include "tracefile.h"
 #include "pthread.h"
 
 /* Trace data needs to hold the following components:
@@ -20,45 +27,100 @@
  */
 
 /* Implementation:
- * - binary log records are assumed
- * - 8-byte alignment should be maintained
- * - It should be fine to emit a logfile per type of IOP, with IOP type implicit.
+ * - Records are buffered in memory with times as recorded (ticks from the time source, or
+ *   ns), and converted and encoded by the flush thread into the compact version 2 file
+ *   format (see tracefile.h).
+ * - The trace buffer is a lock-free single-producer single-consumer ring.  The benchmark
+ *   thread advances the head; the flush thread advances the tail.  The flush thread sleeps on
+ *   an eventfd, which the producer only signals when the flush thread is idle.
+ * - No records are overwritten: if the ring is full the producer stalls until space is freed,
+ *   and the number of stalls is reported.
+ * - Sampling is applied by the producer, to each operation and its components together,
+ *   after the operation is counted in the histograms and statistics.  A reservoir sample is
+ *   held back until its interval ends, so it follows any slow operations kept meanwhile.
  */
 
-#define TRACE_MAXENT 		65536		/* Must fit in uint16_t */
-#define TRACE_NENT   		TRACE_MAXENT 	/* TODO - paramterize   */
-#define TRACE_MOD_ADD(x, y) 	((unsigned)((x)+(y)) % TRACE_NENT)
-#define TRACE_MOD_INC(x)    	TRACE_MOD_ADD((x), 1)
+#define TRACE_NENT_DEFAULT 	65536		/* Default ring size, in entries */
 
+/* File write control */
+#define TRACE_WRITE_SIZE 	8192
+#define TRACE_BLOCK 		(TRACE_WRITE_SIZE/sizeof(trace_raw_t))
 
-/* Trace buffer management strutures  */
-typedef enum trace_req {
-    TRACE_NONE = 0,		/* No pending operation */
-    TRACE_FLUSH,		/* Flush the current trace buffer */
-    TRACE_EXIT			/* Flush trace buffer and exit */
-} trace_req_t;
-  
+/* Ring entries, converted to trace_entry_t by the flush thread */
+typedef struct trace_raw {
+    uint8_t op;			/* trace_type_t, with TRACE_RAW_TICKS if times are in ticks */
+    char tag[7];
+    uint64_t start;		/* Tick count, or ns relative to the benchmark start */
+    uint64_t duration;		/* Ticks, or ns */
+} trace_raw_t;
+
+#define TRACE_RAW_TICKS 	0x80
+
+/* Ring indices increase monotonically: the ring size must be a power of 2 */
 typedef struct traceinfo {
     pthread_t ti_flushthread;	/* Handle for buffer flush thread */
-    trace_req_t ti_req;		/* Current pending flush operationn */
     FILE *ti_fp;		/* Output file pointer */
-    uint16_t ti_nextent;	/* Next trace entry to fill */
-    uint16_t ti_lastflush;	/* Last flushed entry (head pointer) */
-    uint16_t ti_nextflush;	/* Next flush marker (tail pointer */
-    trace_entry_t ti_tracebuf[TRACE_NENT];
+    uint32_t ti_id;		/* Identifier of this trace, recorded in the file header */
+    trace_file_hdr_t ti_hdr;	/* File header, rewritten with sampling totals at exit */
+    uint8_t *ti_encbuf;		/* Block encoding buffer for the flush thread */
+    int ti_efd;			/* eventfd for waking the flush thread */
+    uint64_t ti_nent;		/* Number of entries in the ring */
+    trace_raw_t *ti_tracebuf;	/* Ring of trace entries */
+
+    /* Producer state (benchmark thread) */
+    uint64_t ti_head __attribute__((aligned(64)));	/* Next trace entry to fill */
+    uint64_t ti_tail_cache;	/* Last observed value of ti_tail */
+    uint64_t ti_stalls;		/* Records delayed waiting for space in the ring */
+    struct timespec ti_stall_time;	/* Total time stalled */
+
+    /* Consumer state (flush thread) */
+    uint64_t ti_tail __attribute__((aligned(64)));	/* Next trace entry to flush */
+    uint64_t ti_dropped;	/* Records discarded after a write failure */
+    int ti_idle;		/* Flush thread is waiting on the eventfd */
+    int ti_req;			/* Pending flush or exit request */
 } trace_info_t;
 
-static trace_info_t ti;		/* Active trace state */
+/* Trace buffer requests */
+typedef enum trace_req {
+    TRACE_NONE = 0,		/* No pending operation */
+    TRACE_FLUSH,		/* Flush the current trace buffer */
+    TRACE_EXIT			/* Flush trace buffer and exit */
+} trace_req_t;
 
-/* Synchronization structures to manage flush thread */
-static pthread_mutex_t trace_flush_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  trace_cond        = PTHREAD_COND_INITIALIZER;
+/* Records of an operation and its components, held in the reservoir */
+typedef struct trace_group {
+    uint64_t seq;		/* Order in which the operation was traced */
+    unsigned n;
+    trace_raw_t rec[1 + TRACE_SPAN_MAX];
+} trace_group_t;
+
+/* Sampling policy, and its state (benchmark thread) */
+typedef struct tracesample {
+    trace_sample_t ts_mode;
+    uint32_t ts_n;		/* 1-in-N, or reservoir size */
+    uint64_t ts_interval;	/* Reservoir interval, in ns */
+    uint64_t ts_slow;		/* Keep operations at least this slow, in ns (0: none) */
+    uint64_t ts_seen;		/* Operations traced */
+    uint64_t ts_kept;		/* Operations recorded */
+    uint64_t ts_count;		/* Operations since the last 1-in-N sample */
+
+    /* Reservoir sampling (Algorithm R) */
+    trace_group_t *ts_slot;	/* ts_n slots */
+    uint64_t ts_filled;		/* Slots in use */
+    uint64_t ts_period_seen;	/* Operations offered to the reservoir this interval */
+    uint64_t ts_period_start;	/* Start of the interval, in ticks */
+    uint64_t ts_period_ticks;	/* Length of the interval, in ticks */
+    uint64_t ts_rng;		/* xorshift64 state */
+} trace_sample_info_t;
 
-/* File write control */
-#define TRACE_WRITE_SIZE 	8192	
-#define TRACE_BLOCK 		(TRACE_WRITE_SIZE/sizeof(trace_entry_t)) 
+static trace_info_t ti;		/* Active trace state */
+static trace_sample_info_t tsi = { .ts_mode = TRACE_SAMPLE_ALL };	/* Sampling policy and state */
+static histogram_t trace_hist[TRACE_NTYPES];	/* Latencies of all operations traced */
+static uint64_t trace_nent = TRACE_NENT_DEFAULT;
+static int trace_spans = 0;	/* Trace the components of each operation */
 
-void *trace_sync ( void );	/* Flush thread */
+static void *trace_sync ( void *arg );	/* Flush thread */
+static int trace_reservoir_flush( void );
 
 const char *trace_type_str( const trace_type_t T )
 {
@@ -67,6 +129,12 @@ const char *trace_type_str( const trace_type_t T )
 	{ TRACE_READ, "READ" },
 	{ TRACE_WRITE, "WRITE" },
 	{ TRACE_MISC, "MISC" },
+	{ TRACE_OPEN, "OPEN" },
+	{ TRACE_DATA, "DATA" },
+	{ TRACE_CLOSE, "CLOSE" },
+	{ TRACE_FSYNC, "FSYNC" },
+	{ TRACE_MKDIR, "MKDIR" },
+	{ TRACE_WEIGHT, "WEIGHT" },
     };
     for( unsigned i=0; i < ARRAYLEN(table); i++ )
     {
@@ -75,6 +143,89 @@ const char *trace_type_str( const trace_type_t T )
     return "????";
 }
 
+/* Set the number of entries in the trace ring (rounded up to a power of 2) */
+void trace_set_size( const size_t nent )
+{
+    trace_nent = 1;
+    while( trace_nent < nent || trace_nent < TRACE_BLOCK * 2 )
+    {
+        trace_nent <<= 1;
+    }
+}
+
+/* Parse a sampling specification: see utils.h */
+int trace_set_sampling( const char *spec )
+{
+    trace_sample_t mode = TRACE_SAMPLE_ALL;
+    uint64_t n = 0, interval = 0, slow = 0;
+    bool chosen = false;
+    char buf[256], *term, *save, *end;
+
+    if ( strlen( spec ) >= sizeof(buf) ) {
+        log_error( "Trace sampling specification is too long" );
+        return -1;
+    }
+    strcpy( buf, spec );
+
+    for ( term = strtok_r( buf, ",", &save ); term != NULL; term = strtok_r( NULL, ",", &save ) ) {
+        if ( strcmp( term, "all" ) == 0 ) {
+            mode = TRACE_SAMPLE_ALL;
+        } else if ( strcmp( term, "none" ) == 0 ) {
+            mode = TRACE_SAMPLE_NONE;
+        } else if ( strncmp( term, "nth:", 4 ) == 0 ) {
+            n = strtoull( term + 4, &end, 10 );
+            if ( *end != '\0' || n == 0 || n > UINT32_MAX ) {
+                goto invalid;
+            }
+            mode = TRACE_SAMPLE_NTH;
+        } else if ( strncmp( term, "reservoir:", 10 ) == 0 ) {
+            n = strtoull( term + 10, &end, 10 );
+            if ( *end != ':' || n == 0 || n > UINT32_MAX ) {
+                goto invalid;
+            }
+            const double secs = strtod( end + 1, &end );
+            if ( *end != '\0' || !(secs > 0.0) ) {
+                goto invalid;
+            }
+            interval = secs * 1e9;
+            mode = TRACE_SAMPLE_RESERVOIR;
+        } else if ( strncmp( term, "slow:", 5 ) == 0 ) {
+            const double usecs = strtod( term + 5, &end );
+            if ( *end != '\0' || !(usecs > 0.0) ) {
+                goto invalid;
+            }
+            slow = usecs * 1e3;
+            continue;
+        } else {
+            goto invalid;
+        }
+        chosen = true;
+    }
+
+    tsi.ts_mode = chosen || slow == 0 ? mode : TRACE_SAMPLE_NONE;
+    tsi.ts_n = n;
+    tsi.ts_interval = interval;
+    tsi.ts_slow = slow;
+    return 0;
+
+invalid:
+    log_error( "Invalid trace sampling term '%s'", term );
+    return -1;
+}
+
+/* Wake the flush thread, if it is waiting */
+static void trace_wake( void )
+{
+    if( __atomic_exchange_n( &ti.ti_idle, 0, __ATOMIC_SEQ_CST ) )
+    {
+        const uint64_t one = 1;
+        if( write( ti.ti_efd, &one, sizeof(one) ) != sizeof(one) )
+        {
+            log_error( "trace wakeup failed - %d", errno );
+        }
+    }
+}
+
 /* 
  * Initialize trace state. This includes creation of trace log file and 
  * spawn of trace buffer flush thread.
@@ -95,14 +246,56 @@ int trace_init( const char *trace_dir, const uint32_t trace_id )
     }
 
     /* Initialize trace state */
-    ti.ti_lastflush = ti.ti_nextflush = (uint16_t)(TRACE_NENT-1);
-    ti.ti_nextent = 0;
+    ti.ti_nent = trace_nent;
+    assert( (ti.ti_nent & (ti.ti_nent - 1)) == 0 );    /* The ring is indexed by masking */
+    ti.ti_id = trace_id;
+    ti.ti_tracebuf = malloc( ti.ti_nent * sizeof(trace_raw_t) );
+    ti.ti_encbuf = malloc( TRACE_BLOCK_MAX );
+    if ( ti.ti_tracebuf == NULL || ti.ti_encbuf == NULL ) {
+        log_error( "could not allocate %lu trace entries", (unsigned long)ti.ti_nent );
+        free( ti.ti_tracebuf );
+        free( ti.ti_encbuf );
+        fclose( ti.ti_fp );
+        return -1;
+    }
+    if ( (ti.ti_efd = eventfd( 0, 0 )) < 0 ) {
+        log_error( "eventfd failed - %d", errno );
+        free( ti.ti_tracebuf );
+        free( ti.ti_encbuf );
+        fclose( ti.ti_fp );
+        return -1;
+    }
+    ti.ti_head = ti.ti_tail = ti.ti_tail_cache = 0;
+    ti.ti_stalls = ti.ti_dropped = 0;
+    ti.ti_stall_time.tv_sec = ti.ti_stall_time.tv_nsec = 0;
+    ti.ti_idle = 0;
     ti.ti_req = TRACE_NONE;
+    for ( unsigned i=0; i < TRACE_NTYPES; i++ ) {
+        histogram_init( &trace_hist[i] );
+    }
+
+    /* Initialize sampling state */
+    tsi.ts_seen = tsi.ts_kept = tsi.ts_count = 0;
+    tsi.ts_filled = tsi.ts_period_seen = 0;
+    if ( tsi.ts_mode == TRACE_SAMPLE_RESERVOIR ) {
+        if ( (tsi.ts_slot = malloc( tsi.ts_n * sizeof(trace_group_t) )) == NULL ) {
+            log_error( "could not allocate a reservoir of %u operations", tsi.ts_n );
+            free( ti.ti_tracebuf );
+            free( ti.ti_encbuf );
+            close( ti.ti_efd );
+            fclose( ti.ti_fp );
+            return -1;
+        }
+        tsi.ts_period_start = 0;
+        tsi.ts_period_ticks = time_source == TIME_MONOTONIC ? tsi.ts_interval :
+            (uint64_t)(((unsigned __int128)tsi.ts_interval << 32) / time_tsc_mult);
+        tsi.ts_rng = (time_tick( ) ^ ((uint64_t)trace_id << 32)) | 1;
+    }
 
     /* Spawn flush thread */
     log_debug( "spawn" );
-    if ( (ret = pthread_create( &ti.ti_flushthread, NULL, (void*)trace_sync, 
-                                (void*)&ti )) < 0 ) {
+    if ( (ret = pthread_create( &ti.ti_flushthread, NULL, trace_sync, 
+                                (void*)&ti )) != 0 ) {
         log_error( "pthread_create failed - %d", ret );
         return -1;
     }
@@ -116,158 +309,449 @@ int trace_fini( void )
 {
     log_debug( "trace_fini" );
 
+    /* Record the sample of the final, partial interval */
+    if ( tsi.ts_mode == TRACE_SAMPLE_RESERVOIR ) {
+        trace_reservoir_flush( );
+        free( tsi.ts_slot );
+        tsi.ts_slot = NULL;
+    }
+
     /* Send final flush / exit request to trace thread */
-    pthread_mutex_lock( &trace_flush_mutex );
-    log_debug( "trigger flush at %d", ti.ti_nextent-1 );
-    ti.ti_req = TRACE_EXIT;
-    ti.ti_nextflush = ti.ti_nextent-1;
-    pthread_cond_signal( &trace_cond );
-    pthread_mutex_unlock( &trace_flush_mutex );
+    log_debug( "trigger flush at %lu", (unsigned long)ti.ti_head );
+    __atomic_store_n( &ti.ti_req, TRACE_EXIT, __ATOMIC_SEQ_CST );
+    trace_wake( );
 
     /* Wait for logging thread to terminate */
     log_debug( "wait for thread to terminate" );
     pthread_join( ti.ti_flushthread, NULL );
+    close( ti.ti_efd );
+    free( ti.ti_tracebuf );
+    free( ti.ti_encbuf );
+    ti.ti_tracebuf = NULL;
+    ti.ti_encbuf = NULL;
+
+    if ( ti.ti_stalls || ti.ti_dropped ) {
+        log_warn( "trace: %lu records, %lu stalled for %ld.%09lds waiting for flush, %lu dropped",
+                  (unsigned long)ti.ti_head, (unsigned long)ti.ti_stalls,
+                  ti.ti_stall_time.tv_sec, ti.ti_stall_time.tv_nsec,
+                  (unsigned long)ti.ti_dropped );
+    } else {
+        log_debug( "trace: %lu records, none stalled or dropped", (unsigned long)ti.ti_head );
+    }
+    if ( tsi.ts_mode != TRACE_SAMPLE_ALL ) {
+        log_debug( "trace: %lu of %lu operations sampled", (unsigned long)tsi.ts_kept,
+                   (unsigned long)tsi.ts_seen );
+    }
     return 0;
 }
 
+/* Retrieve counts of records traced, stalled and dropped */
+void trace_stats( trace_stats_t *st )
+{
+    st->records = ti.ti_head;
+    st->stalls = ti.ti_stalls;
+    st->stall_time = ti.ti_stall_time;
+    st->dropped = __atomic_load_n( &ti.ti_dropped, __ATOMIC_RELAXED );
+    st->ops = tsi.ts_seen;
+    st->kept = tsi.ts_kept;
+}
+
+/* Retrieve the latency histogram for an operation type */
+const histogram_t *trace_histogram( const trace_type_t tt )
+{
+    return &trace_hist[tt];
+}
+
 /* Utility function to request trace buffer flush */
 void trace_flush()
 {
     log_debug( "trace_flush" );
 
     /* Send flush request to logging thread */
-    pthread_mutex_lock( &trace_flush_mutex );
-    ti.ti_req = TRACE_FLUSH;
-    pthread_cond_signal( &trace_cond );
-    pthread_mutex_unlock( &trace_flush_mutex );
+    __atomic_store_n( &ti.ti_req, TRACE_FLUSH, __ATOMIC_SEQ_CST );
+    trace_wake( );
+}
+
+/* Wait for the flush thread to free space in a full ring */
+static void trace_stall( void )
+{
+    struct timespec t_start, t_end, t_delta;
+
+    time_now( &t_start );
+    ti.ti_stalls++;
+    do {
+        trace_wake( );
+        sched_yield( );
+        ti.ti_tail_cache = __atomic_load_n( &ti.ti_tail, __ATOMIC_ACQUIRE );
+    } while ( ti.ti_head - ti.ti_tail_cache >= ti.ti_nent );
+    time_now( &t_end );
+
+    time_delta( &t_start, &t_end, &t_delta );
+    ti.ti_stall_time.tv_sec += t_delta.tv_sec;
+    ti.ti_stall_time.tv_nsec += t_delta.tv_nsec;
+    if ( ti.ti_stall_time.tv_nsec >= 1000000000L ) {
+        ti.ti_stall_time.tv_sec++;
+        ti.ti_stall_time.tv_nsec -= 1000000000L;
+    }
 }
 
 /* 
- * Create trace entry. Flush outstanding trace entries periodically 
- * (based on TRACE_BLOCK) 
+ * Create trace entry. The flush thread is woken once per TRACE_BLOCK entries,
+ * and only if it is idle.
  */
-int trace( const trace_type_t tt, const struct timespec *ts, 
-           const struct timespec *iop, const char *tag )
+static inline int trace_put( const uint8_t op, const uint64_t start, const uint64_t duration,
+                             const char *tag )
 {
-    uint16_t next = ti.ti_nextent;
-    trace_entry_t *te = &ti.ti_tracebuf[ti.ti_nextent];
-
-    ti.ti_nextent = TRACE_MOD_INC(ti.ti_nextent);
+    const uint64_t head = ti.ti_head;
 
-    log_debug( "got trace request %d", next );
+    /* Check for space, refreshing our view of the tail only when the ring appears full */
+    if ( head - ti.ti_tail_cache >= ti.ti_nent ) {
+        ti.ti_tail_cache = __atomic_load_n( &ti.ti_tail, __ATOMIC_ACQUIRE );
+        if ( head - ti.ti_tail_cache >= ti.ti_nent ) {
+            trace_stall( );
+        }
+    }
 
     /* Create trace entry */
-    te->info.op = tt;
-    te->timestamp = *ts;
-    te->duration = *iop;
+    trace_raw_t *te = &ti.ti_tracebuf[head & (ti.ti_nent - 1)];
+    te->op = op;
+    te->start = start;
+    te->duration = duration;
 
     /* Add tag to entry if appropriate */
     if ( tag ) {
-        strncpy(&te->info.tag[0], tag, 7);
+        strncpy(&te->tag[0], tag, 7);
     } else {
-        te->info.tag[0] = 0;
+        te->tag[0] = 0;
     }
 
+    /* Publish the entry to the flush thread */
+    __atomic_store_n( &ti.ti_head, head + 1, __ATOMIC_RELEASE );
+
     /* Request buffer flush if enough entries have accumulated */
-    if (( ti.ti_nextent % TRACE_BLOCK) == 0 ) {
-        log_debug( "trigger flush at %d", ti.ti_nextent-1 );
-        pthread_mutex_lock( &trace_flush_mutex );
-        ti.ti_req = TRACE_FLUSH;
-        ti.ti_nextflush = te - &ti.ti_tracebuf[0];
-        pthread_cond_signal( &trace_cond );
-        pthread_mutex_unlock( &trace_flush_mutex );
+    if ( ((head + 1) % TRACE_BLOCK) == 0 ) {
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+        if ( __atomic_load_n( &ti.ti_idle, __ATOMIC_RELAXED ) ) {
+            trace_wake( );
+        }
     }
 
     return 0;
 }
 
+/* Count an operation or component in the histograms and statistics, whether sampled or not */
+static inline void trace_account( const trace_type_t tt, const uint64_t duration_ns )
+{
+    histogram_record( &trace_hist[tt], duration_ns );
+    stats_op( tt, duration_ns );
+}
+
+/* Record an operation and its components */
+static int trace_keep( const trace_raw_t *rec, const unsigned n )
+{
+    int result = 0;
+
+    tsi.ts_kept++;
+    for ( unsigned i=0; i < n; i++ ) {
+        result |= trace_put( rec[i].op, rec[i].start, rec[i].duration, rec[i].tag );
+    }
+    return result;
+}
+
+static int trace_group_cmp( const void *a, const void *b )
+{
+    const trace_group_t *A = a, *B = b;
+    return A->seq < B->seq ? -1 : A->seq > B->seq;
+}
+
+/* Record the reservoir sample of an interval, preceded by its weight, and empty the reservoir */
+static int trace_reservoir_flush( void )
+{
+    int result;
+
+    if ( tsi.ts_period_seen == 0 ) {
+        return 0;
+    }
+    result = trace_put( TRACE_WEIGHT | TRACE_RAW_TICKS, tsi.ts_period_start, tsi.ts_period_seen, NULL );
+
+    /* Record the sample in the order the operations were traced */
+    qsort( tsi.ts_slot, tsi.ts_filled, sizeof(trace_group_t), trace_group_cmp );
+    for ( uint64_t i=0; i < tsi.ts_filled; i++ ) {
+        result |= trace_keep( tsi.ts_slot[i].rec, tsi.ts_slot[i].n );
+    }
+    tsi.ts_filled = tsi.ts_period_seen = 0;
+    return result;
+}
+
+/* Offer an operation to the reservoir, recording the sample of any interval that has ended */
+static int trace_reservoir( const trace_raw_t *rec, const unsigned n )
+{
+    const uint64_t now = time_tick( );
+    trace_group_t *g;
+    int result = 0;
+
+    /* Intervals are aligned with the start of the benchmark, if it is known */
+    if ( tsi.ts_period_start == 0 ) {
+        tsi.ts_period_start = time_benchmark_tick != 0 && time_benchmark_tick <= now ?
+                              time_benchmark_tick : now;
+    }
+    if ( now - tsi.ts_period_start >= tsi.ts_period_ticks ) {
+        result = trace_reservoir_flush( );
+        tsi.ts_period_start += (now - tsi.ts_period_start) / tsi.ts_period_ticks * tsi.ts_period_ticks;
+    }
+
+    /* Keep the first n operations, then replace a random one with probability n/seen */
+    tsi.ts_period_seen++;
+    if ( tsi.ts_filled < tsi.ts_n ) {
+        g = &tsi.ts_slot[tsi.ts_filled++];
+    } else {
+        tsi.ts_rng ^= tsi.ts_rng << 13;
+        tsi.ts_rng ^= tsi.ts_rng >> 7;
+        tsi.ts_rng ^= tsi.ts_rng << 17;
+        const uint64_t j = tsi.ts_rng % tsi.ts_period_seen;
+        if ( j >= tsi.ts_n ) {
+            return result;
+        }
+        g = &tsi.ts_slot[j];
+    }
+    g->seq = tsi.ts_seen;
+    g->n = n;
+    memcpy( g->rec, rec, n * sizeof(trace_raw_t) );
+    return result;
+}
+
+/* Apply the sampling policy to an operation and its components */
+static inline int trace_sample( const trace_raw_t *rec, const unsigned n, const uint64_t duration_ns )
+{
+    tsi.ts_seen++;
+    if ( tsi.ts_mode == TRACE_SAMPLE_ALL || (tsi.ts_slow != 0 && duration_ns >= tsi.ts_slow) ) {
+        return trace_keep( rec, n );
+    }
+
+    switch ( tsi.ts_mode ) {
+    case TRACE_SAMPLE_NTH:
+        if ( ++tsi.ts_count < tsi.ts_n ) {
+            return 0;
+        }
+        tsi.ts_count = 0;
+        return trace_keep( rec, n );
+    case TRACE_SAMPLE_RESERVOIR:
+        return trace_reservoir( rec, n );
+    default:
+        return 0;
+    }
+}
+
+int trace( const trace_type_t tt, const struct timespec *ts, 
+           const struct timespec *iop, const char *tag )
+{
+    trace_raw_t rec = { .op = tt, .start = histogram_ns( ts ), .duration = histogram_ns( iop ) };
+
+    if ( ti.ti_tracebuf == NULL ) {
+        return 0;
+    }
+    if ( tag ) {
+        strncpy( rec.tag, tag, sizeof(rec.tag) );
+    }
+    trace_account( tt, rec.duration );
+    return trace_sample( &rec, 1, rec.duration );
+}
+
+/* Enable or disable tracing of operation components */
+void trace_set_spans( const int enable )
+{
+    trace_spans = enable;
+}
+
+/* Start timing an object operation */
+void trace_op_begin( trace_op_t *op, const trace_type_t tt )
+{
+    op->type = tt;
+    op->nspan = 0;
+    op->start = op->mark = time_tick( );
+}
+
+/* Complete a component of an object operation */
+void trace_op_span( trace_op_t *op, const trace_type_t span )
+{
+    if ( !trace_spans || op->nspan == TRACE_SPAN_MAX ) {
+        return;
+    }
+    const uint64_t now = time_tick( );
+    op->span[op->nspan].type = span;
+    op->span[op->nspan].start = op->mark;
+    op->span[op->nspan].duration = now - op->mark;
+    op->nspan++;
+    op->mark = now;
+}
+
+/* Complete an object operation, tracing it and then its components.  Operations outside an
+ * active trace (such as setting up a replay, before trace_init) are neither traced nor counted */
+int trace_op_end( trace_op_t *op )
+{
+    trace_raw_t rec[1 + TRACE_SPAN_MAX];
+
+    if ( ti.ti_tracebuf == NULL ) {
+        return 0;
+    }
+
+    /* The last component ended with the operation */
+    const uint64_t end = op->nspan > 0 ? op->mark : time_tick( );
+    const uint64_t duration_ns = time_tick_ns( end - op->start );
+    rec[0] = (trace_raw_t){ .op = op->type | TRACE_RAW_TICKS, .start = op->start,
+                            .duration = end - op->start };
+    trace_account( op->type, duration_ns );
+
+    for ( unsigned i=0; i < op->nspan; i++ ) {
+        rec[1 + i] = (trace_raw_t){ .op = op->span[i].type | TRACE_RAW_TICKS,
+                                    .start = op->span[i].start, .duration = op->span[i].duration };
+        trace_account( op->span[i].type, time_tick_ns( op->span[i].duration ) );
+    }
+    return trace_sample( rec, 1 + op->nspan, duration_ns );
+}
+
+/* Convert a ring entry to a trace record, with times in ns relative to the benchmark start */
+static void trace_convert( const trace_raw_t *tr, trace_entry_t *te )
+{
+    uint64_t start = tr->start, duration = tr->duration;
+
+    if ( tr->op & TRACE_RAW_TICKS ) {
+        const int64_t since = (int64_t)(tr->start - time_benchmark_tick);
+        start = since >= 0 ? time_tick_ns( since ) : -time_tick_ns( -since );
+
+        /* The duration of a weight record is a count of operations */
+        if ( (tr->op & ~TRACE_RAW_TICKS) != TRACE_WEIGHT ) {
+            duration = time_tick_ns( tr->duration );
+        }
+    }
+    te->info.op = tr->op & ~TRACE_RAW_TICKS;
+    memcpy( te->info.tag, tr->tag, sizeof(te->info.tag) );
+    te->timestamp.tv_sec = (int64_t)start / 1000000000LL;
+    te->timestamp.tv_nsec = (int64_t)start % 1000000000LL;
+    if ( te->timestamp.tv_nsec < 0 ) {
+        te->timestamp.tv_sec--;
+        te->timestamp.tv_nsec += 1000000000L;
+    }
+    te->duration.tv_sec = duration / 1000000000ULL;
+    te->duration.tv_nsec = duration % 1000000000ULL;
+}
+
+/* Encode and write out ring entries [from, to), in blocks of at most TRACE_BLOCK_NREC */
+static int trace_write_range( uint64_t from, const uint64_t to )
+{
+    while ( from != to ) {
+        uint64_t nflush = to - from, prev_ns = 0;
+        if ( nflush > TRACE_BLOCK_NREC ) {
+            nflush = TRACE_BLOCK_NREC;
+        }
+
+        uint8_t *p = ti.ti_encbuf;
+        for ( uint64_t i = from; i < from + nflush; i++ ) {
+            trace_entry_t te;
+            trace_convert( &ti.ti_tracebuf[i & (ti.ti_nent - 1)], &te );
+            p = trace_record_encode( p, &te, &prev_ns );
+        }
+
+        log_trace( "writing %lu records from %lu", (unsigned long)nflush, (unsigned long)from );
+        if ( trace_block_write( ti.ti_fp, ti.ti_encbuf, p - ti.ti_encbuf, nflush ) < 0 ) {
+            return -1;
+        }
+        from += nflush;
+    }
+    return 0;
+}
+
+/* Write the file header, once the benchmark start time is known */
+static int trace_write_header( void )
+{
+    trace_header_init( &ti.ti_hdr, ti.ti_id );
+    ti.ti_hdr.sample_mode = tsi.ts_mode;
+    ti.ti_hdr.sample_n = tsi.ts_n;
+    ti.ti_hdr.sample_interval = tsi.ts_interval;
+    ti.ti_hdr.sample_slow = tsi.ts_slow;
+    return fwrite( &ti.ti_hdr, sizeof(ti.ti_hdr), 1, ti.ti_fp ) == 1 ? 0 : -1;
+}
+
+/* Rewrite the file header with the number of operations traced and kept */
+static int trace_finish_header( void )
+{
+    ti.ti_hdr.sample_seen = tsi.ts_seen;
+    ti.ti_hdr.sample_kept = tsi.ts_kept;
+    if ( fseek( ti.ti_fp, 0, SEEK_SET ) < 0 ||
+         fwrite( &ti.ti_hdr, sizeof(ti.ti_hdr), 1, ti.ti_fp ) != 1 ) {
+        return -1;
+    }
+    return 0;
+}
+
 /* 
- * Trace persistence thread. The thread waits for flush requests from the main
- * task and handles them accordingly. If an exit request is observed, the thread
- * will flush any outstanding trace data and terminate.
+ * Trace persistence thread. The thread writes out entries whenever a block has
+ * accumulated, and sleeps on the eventfd otherwise. If an exit request is observed,
+ * the thread will flush any outstanding trace data and terminate.
  */
-void *trace_sync ( )
+static void *trace_sync ( void *arg )
 {
+    uint64_t tail = ti.ti_tail;
+    bool failed = false, started = false;
+
     log_debug( "in thread" );
     
     for (;;) {
-        trace_req_t req;
-        trace_entry_t *tbp;
-        uint16_t lastflush;
-        uint16_t nextflush;
-
-        /* Wait for dump request */
-        pthread_mutex_lock( &trace_flush_mutex );
-        log_debug( "wait for req - %d", ti.ti_req );
-        req = ti.ti_req;
-        lastflush = ti.ti_lastflush;
-        nextflush = ti.ti_nextflush;
-
-        /* 
-         * If no operation request pending, wait for request to arrive. 
-         * Otherwise, we update the buffer pointers to determine flush 
-         * range while we have the lock.
-         */
-        ti.ti_req = TRACE_NONE;
-        if ( req == TRACE_NONE ) {
-            pthread_cond_wait( &trace_cond, &trace_flush_mutex );
-        } 
-        pthread_mutex_unlock( &trace_flush_mutex );
-        switch (req) {
-            int thisflush;
-            uint16_t nflush;
-
-            case TRACE_EXIT:
-            case TRACE_FLUSH:
-                thisflush = TRACE_MOD_INC(lastflush);
-
-                log_debug( "got flush request %hu<-->%hu", 
-                            thisflush, nextflush );
-                tbp = &ti.ti_tracebuf[thisflush];
-
-                /* Handle wrap */
-                if ( thisflush > nextflush ) 
-                {
-                    nflush = TRACE_NENT - thisflush;
-                    ti.ti_lastflush = TRACE_MOD_ADD(ti.ti_lastflush, nflush);
-
-                    log_debug( "writing %hu records from %hu", 
-                                nflush, thisflush);
-                    if (nflush && (nflush != 
-                                   fwrite( tbp, sizeof(trace_entry_t), 
-                                          nflush, ti.ti_fp ))) 
-                    {
-                        log_error( "trace buffer write failed - %d", errno );
-                        return (void*)-1;
-                    }
-                    tbp = &ti.ti_tracebuf[0];
-                    nflush = nextflush + 1;
-                    thisflush = 0;
-                } else {
-                    nflush = (nextflush - thisflush) + 1;
-                }
+        const uint64_t head = __atomic_load_n( &ti.ti_head, __ATOMIC_ACQUIRE );
+        const int req = __atomic_exchange_n( &ti.ti_req, TRACE_NONE, __ATOMIC_ACQUIRE );
+
+        if ( !started && (head != tail || req == TRACE_EXIT) ) {
+            if ( trace_write_header( ) < 0 ) {
+                log_error( "trace header write failed - %d", errno );
+                failed = true;
+            }
+            started = true;
+        }
 
-                ti.ti_lastflush = TRACE_MOD_ADD(ti.ti_lastflush, nflush);
+        if ( head != tail && (head - tail >= TRACE_BLOCK || req != TRACE_NONE) ) {
+            if ( !failed && trace_write_range( tail, head ) < 0 ) {
+                log_error( "trace buffer write failed - %d", errno );
+                failed = true;
+            }
+            if ( failed ) {
+                /* Keep draining, so that the benchmark is not stalled, but count the loss */
+                __atomic_add_fetch( &ti.ti_dropped, head - tail, __ATOMIC_RELAXED );
+            }
+            tail = head;
+            __atomic_store_n( &ti.ti_tail, tail, __ATOMIC_RELEASE );
+        }
 
-                /* Flush any remaining entries */
-                log_debug( "writing %hu records from %d", nflush, thisflush);
-                if (nflush && (nflush != fwrite( tbp, sizeof(trace_entry_t), 
-                                      nflush, ti.ti_fp )))
-                {
-                    log_error( "trace buffer write failed - %d", errno );
-                    return (void*)-1;
+        /* Terminate if requested, once the ring is empty */
+        if ( req == TRACE_EXIT ) {
+            __atomic_store_n( &ti.ti_req, TRACE_EXIT, __ATOMIC_RELAXED );
+            if ( __atomic_load_n( &ti.ti_head, __ATOMIC_ACQUIRE ) == tail ) {
+                log_debug( "got exit request" );
+                if ( started && !failed && trace_finish_header( ) < 0 ) {
+                    log_error( "trace header update failed - %d", errno );
                 }
+                fclose( ti.ti_fp );
+                return (void*)0;
+            }
+            continue;
+        }
+        if ( req == TRACE_FLUSH ) {
+            fflush( ti.ti_fp );
+        }
 
-                /* Terminate if requested */
-                if ( req == TRACE_EXIT ) {
-                    log_debug( "got exit request" );
-                    fclose( ti.ti_fp );
-                    return (void*)0;
-                }
-                break;
-            default:
-		log_debug( "unknown req %d", req);
-                break;
+        /* Go idle, then check again for work that raced with doing so */
+        __atomic_store_n( &ti.ti_idle, 1, __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+        if ( __atomic_load_n( &ti.ti_head, __ATOMIC_RELAXED ) - tail >= TRACE_BLOCK ||
+             __atomic_load_n( &ti.ti_req, __ATOMIC_RELAXED ) != TRACE_NONE ) {
+            __atomic_store_n( &ti.ti_idle, 0, __ATOMIC_RELAXED );
+            continue;
+        }
+
+        uint64_t events;
+        if ( read( ti.ti_efd, &events, sizeof(events) ) < 0 && errno != EINTR ) {
+            log_error( "trace wait failed - %d", errno );
+            return (void*)-1;
         }
+        __atomic_store_n( &ti.ti_idle, 0, __ATOMIC_RELAXED );
      }
 }
@@ -0,0 +1,593 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Trace file format:
+ * Encoding and decoding of version 2 trace files, and reading of either version. */
+/* Begun 2019, StackHPC Ltd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef TRACE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "utils.h"
+#include "tracefile.h"
+
+/*------------------------------------------------------------------------------------------------*/
+
+static uint64_t trace_run_id;
+static int64_t trace_clock_offset;
+static uint64_t trace_clock_rtt;
+
+void trace_set_run_id( const uint64_t run_id )
+{
+    trace_run_id = run_id;
+}
+
+void trace_set_clock_offset( const int64_t offset, const uint64_t rtt )
+{
+    trace_clock_offset = offset;
+    trace_clock_rtt = rtt;
+}
+
+void trace_header_init( trace_file_hdr_t *hdr, const uint32_t ordinal )
+{
+    struct timespec wall, mono, since;
+
+    memset( hdr, 0, sizeof(trace_file_hdr_t) );
+    memcpy( hdr->magic, TRACE_MAGIC, sizeof(hdr->magic) );
+    hdr->version = TRACE_VERSION;
+    hdr->endian = TRACE_ENDIAN;
+    hdr->hdr_len = sizeof(trace_file_hdr_t);
+    hdr->ordinal = ordinal;
+    hdr->run_id = trace_run_id;
+    hdr->clock_offset = trace_clock_offset;
+    hdr->clock_rtt = trace_clock_rtt;
+    hdr->clock = time_source == TIME_TSC ? TRACE_CLOCK_TSC : TRACE_CLOCK_MONOTONIC;
+    if( gethostname( hdr->host, sizeof(hdr->host) - 1 ) < 0 )
+    {
+        strcpy( hdr->host, "unknown" );
+    }
+
+    /* Timestamps are relative to the start of the benchmark: record when that was */
+    clock_gettime( CLOCK_REALTIME, &wall );
+    time_now( &mono );
+    time_delta( &time_benchmark, &mono, &since );
+    hdr->epoch_sec = wall.tv_sec - since.tv_sec;
+    hdr->epoch_nsec = wall.tv_nsec - since.tv_nsec;
+    if( hdr->epoch_nsec < 0 )
+    {
+        hdr->epoch_sec--;
+        hdr->epoch_nsec += 1000000000L;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+static inline uint8_t *varint_put( uint8_t *p, uint64_t v )
+{
+    while( v >= 0x80 )
+    {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* Returns NULL if the varint runs past end */
+static inline const uint8_t *varint_get( const uint8_t *p, const uint8_t *end, uint64_t *v )
+{
+    uint64_t result = 0;
+    for( unsigned shift = 0; p < end && shift < 64; shift += 7 )
+    {
+        const uint8_t b = *p++;
+        result |= (uint64_t)(b & 0x7f) << shift;
+        if( !(b & 0x80) )
+        {
+            *v = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline uint64_t ts_ns( const struct timespec *ts )
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+static inline void ns_ts( const uint64_t ns, struct timespec *ts )
+{
+    ts->tv_sec = (int64_t)ns / 1000000000LL;
+    ts->tv_nsec = (int64_t)ns % 1000000000LL;
+    if( ts->tv_nsec < 0 )
+    {
+        ts->tv_sec--;
+        ts->tv_nsec += 1000000000L;
+    }
+}
+
+static inline uint8_t *trace_record_encode_tag( uint8_t *p, const trace_entry_t *te )
+{
+    const size_t taglen = strnlen( te->info.tag, sizeof(te->info.tag) );
+    *p++ = (te->info.op & 0xf) | (uint8_t)(taglen << 4);
+    memcpy( p, te->info.tag, taglen );
+    return p + taglen;
+}
+
+static inline uint8_t *trace_record_encode_times( uint8_t *p, const trace_entry_t *te, uint64_t *prev_ns )
+{
+    /* Records are usually in start time order, but need not be */
+    const uint64_t start = ts_ns( &te->timestamp );
+    const int64_t delta = (int64_t)(start - *prev_ns);
+    p = varint_put( p, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63) );
+    *prev_ns = start;
+
+    return varint_put( p, ts_ns( &te->duration ) );
+}
+
+uint8_t *trace_record_encode( uint8_t *p, const trace_entry_t *te, uint64_t *prev_ns )
+{
+    p = trace_record_encode_tag( p, te );
+    return trace_record_encode_times( p, te, prev_ns );
+}
+
+uint8_t *trace_record_encode_source( uint8_t *p, const trace_entry_t *te, const uint32_t src,
+                                     uint64_t *prev_ns )
+{
+    p = trace_record_encode_tag( p, te );
+    p = varint_put( p, src );
+    return trace_record_encode_times( p, te, prev_ns );
+}
+
+int trace_block_write( FILE *fp, const uint8_t *raw, const size_t len, const unsigned nrec )
+{
+    trace_block_hdr_t bh = { .nrec = nrec, .flags = 0, .raw_len = len, .stored_len = len };
+    const uint8_t *data = raw;
+
+#ifdef TRACE_ZLIB
+    /* Only the flush thread writes blocks, so one buffer will do */
+    static uint8_t *zbuf = NULL;
+    uLongf zlen = compressBound( TRACE_BLOCK_MAX );
+    if( zbuf == NULL )
+    {
+        zbuf = malloc( zlen );
+    }
+    if( zbuf != NULL && compress2( zbuf, &zlen, raw, len, Z_BEST_SPEED ) == Z_OK && zlen < len )
+    {
+        bh.flags |= TRACE_BLOCK_ZLIB;
+        bh.stored_len = zlen;
+        data = zbuf;
+    }
+#endif
+
+    if( fwrite( &bh, sizeof(bh), 1, fp ) != 1 || fwrite( data, 1, bh.stored_len, fp ) != bh.stored_len )
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int trace_block_decode( const trace_block_hdr_t *bh, const uint8_t *data, uint8_t *scratch,
+                        const uint32_t flags, trace_entry_t *te, uint32_t *src )
+{
+    if( bh->nrec > TRACE_BLOCK_NREC || bh->raw_len > TRACE_BLOCK_MAX )
+    {
+        return -1;
+    }
+    if( bh->flags & TRACE_BLOCK_ZLIB )
+    {
+#ifdef TRACE_ZLIB
+        uLongf len = bh->raw_len;
+        if( uncompress( scratch, &len, data, bh->stored_len ) != Z_OK || len != bh->raw_len )
+        {
+            return -1;
+        }
+        data = scratch;
+#else
+        log_error( "Compressed trace blocks need a build with TRACE_ZLIB=1" );
+        return -1;
+#endif
+    }
+    else if( bh->stored_len != bh->raw_len )
+    {
+        return -1;
+    }
+
+    const uint8_t *p = data, *end = data + bh->raw_len;
+    uint64_t prev = 0;
+    for( unsigned i=0; i < bh->nrec; i++ )
+    {
+        uint64_t delta, duration;
+        if( p >= end )
+        {
+            return -1;
+        }
+        const unsigned taglen = *p >> 4;
+        memset( &te[i].info, 0, sizeof(te[i].info) );
+        te[i].info.op = *p++ & 0xf;
+        if( taglen > sizeof(te[i].info.tag) || p + taglen > end )
+        {
+            return -1;
+        }
+        memcpy( te[i].info.tag, p, taglen );
+        p += taglen;
+
+        if( flags & TRACE_FLAG_MERGED )
+        {
+            uint64_t index;
+            if( (p = varint_get( p, end, &index )) == NULL || index > UINT32_MAX )
+            {
+                return -1;
+            }
+            if( src != NULL )
+            {
+                src[i] = index;
+            }
+        }
+
+        if( (p = varint_get( p, end, &delta )) == NULL || (p = varint_get( p, end, &duration )) == NULL )
+        {
+            return -1;
+        }
+        prev += (delta >> 1) ^ -(delta & 1);
+        ns_ts( prev, &te[i].timestamp );
+        ns_ts( duration, &te[i].duration );
+    }
+    return p == end ? (int)bh->nrec : -1;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+#define TRACE_SOURCE_MAX        (1U << 24)      /* Sanity limit on merged traces */
+
+/* Check a file header, given the first n bytes of the file in hdr.
+ * Version 1 files have no header: hdr is cleared, with version set to 1. */
+static int trace_header_check( trace_file_hdr_t *hdr, const size_t n, const char *path )
+{
+    if( n < sizeof(hdr->magic) || memcmp( hdr->magic, TRACE_MAGIC, sizeof(hdr->magic) ) != 0 )
+    {
+        memset( hdr, 0, sizeof(trace_file_hdr_t) );
+        hdr->version = 1;
+        return 0;
+    }
+
+    if( n < offsetof(trace_file_hdr_t, host) + TRACE_HOST_LEN ||
+        hdr->version != TRACE_VERSION || hdr->endian != TRACE_ENDIAN ||
+        hdr->hdr_len < offsetof(trace_file_hdr_t, host) + TRACE_HOST_LEN ||
+        (hdr->flags & ~TRACE_FLAGS_KNOWN) != 0 )
+    {
+        log_error( "Trace file %s has an unsupported format (version %u)", path, hdr->version );
+        return -1;
+    }
+
+    /* Clear fields added since the file was written */
+    if( hdr->hdr_len < sizeof(trace_file_hdr_t) )
+    {
+        memset( (char *)hdr + hdr->hdr_len, 0, sizeof(trace_file_hdr_t) - hdr->hdr_len );
+    }
+    hdr->host[TRACE_HOST_LEN - 1] = '\0';
+
+    if( (hdr->flags & TRACE_FLAG_MERGED) &&
+        (hdr->nsource == 0 || hdr->nsource > TRACE_SOURCE_MAX || hdr->source_off < sizeof(trace_file_hdr_t) ||
+         hdr->source_off + (uint64_t)hdr->nsource * sizeof(trace_source_t) > hdr->hdr_len) )
+    {
+        log_error( "Trace file %s has a corrupt source table", path );
+        return -1;
+    }
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+struct trace_reader
+{
+    FILE *fp;
+    trace_file_hdr_t hdr;
+    trace_source_t *source;     /* Source table, or the file's own identity if not merged */
+    trace_entry_t *te;          /* Records of the current block */
+    uint32_t *src;              /* Sources of the records of the current block */
+    unsigned nrec, next;
+    uint8_t *data, *scratch;    /* Stored and decompressed block data (version 2), allocated */
+    size_t data_len;            /* as needed, so that many files can be read at once */
+};
+
+trace_reader_t *trace_reader_open( const char *path )
+{
+    trace_reader_t *R = calloc( 1, sizeof(trace_reader_t) );
+    if( R == NULL )
+    {
+        return NULL;
+    }
+    R->te = malloc( TRACE_BLOCK_NREC * sizeof(trace_entry_t) );
+    R->src = calloc( TRACE_BLOCK_NREC, sizeof(uint32_t) );
+    if( R->te == NULL || R->src == NULL )
+    {
+        trace_reader_close( R );
+        return NULL;
+    }
+
+    if( (R->fp = fopen( path, "r" )) == NULL )
+    {
+        log_error( "open of trace file (%s) failed, (%d) ", path, errno );
+        trace_reader_close( R );
+        return NULL;
+    }
+
+    /* Version 1 files have no header, and start with a record */
+    const size_t n = fread( &R->hdr, 1, sizeof(R->hdr), R->fp );
+    if( trace_header_check( &R->hdr, n, path ) < 0 )
+    {
+        trace_reader_close( R );
+        return NULL;
+    }
+
+    /* Load the source table, or describe the file itself as the only source */
+    const unsigned nsource = (R->hdr.flags & TRACE_FLAG_MERGED) ? R->hdr.nsource : 1;
+    if( (R->source = calloc( nsource, sizeof(trace_source_t) )) == NULL )
+    {
+        trace_reader_close( R );
+        return NULL;
+    }
+    if( R->hdr.flags & TRACE_FLAG_MERGED )
+    {
+        if( fseek( R->fp, R->hdr.source_off, SEEK_SET ) < 0 ||
+            fread( R->source, sizeof(trace_source_t), nsource, R->fp ) != nsource )
+        {
+            log_error( "Trace file %s is truncated", path );
+            trace_reader_close( R );
+            return NULL;
+        }
+        for( unsigned i=0; i < nsource; i++ )
+        {
+            R->source[i].host[TRACE_HOST_LEN - 1] = '\0';
+        }
+    }
+    else
+    {
+        memcpy( R->source->host, R->hdr.host, TRACE_HOST_LEN );
+        R->source->ordinal = R->hdr.ordinal;
+        R->source->clock = R->hdr.clock;
+        R->source->run_id = R->hdr.run_id;
+    }
+
+    /* Skip any fields added by later writers */
+    if( fseek( R->fp, R->hdr.version == 1 ? 0 : R->hdr.hdr_len, SEEK_SET ) < 0 )
+    {
+        trace_reader_close( R );
+        return NULL;
+    }
+    return R;
+}
+
+void trace_reader_close( trace_reader_t *R )
+{
+    if( R != NULL )
+    {
+        if( R->fp != NULL )     fclose( R->fp );
+        free( R->source );
+        free( R->te );
+        free( R->src );
+        free( R->data );
+        free( R->scratch );
+        free( R );
+    }
+}
+
+const trace_file_hdr_t *trace_reader_header( const trace_reader_t *R )
+{
+    return &R->hdr;
+}
+
+/* Load the next block of records */
+static int trace_reader_fill( trace_reader_t *R )
+{
+    R->next = R->nrec = 0;
+    if( R->hdr.version == 1 )
+    {
+        R->nrec = fread( R->te, sizeof(trace_entry_t), TRACE_BLOCK_NREC, R->fp );
+        return ferror( R->fp ) ? -1 : 0;
+    }
+
+    trace_block_hdr_t bh;
+    const size_t n = fread( &bh, 1, sizeof(bh), R->fp );
+    if( n == 0 && feof( R->fp ) )
+    {
+        return 0;
+    }
+    if( n != sizeof(bh) || bh.stored_len > TRACE_BLOCK_MAX )
+    {
+        log_error( "Trace file is truncated" );
+        return -1;
+    }
+    if( bh.stored_len > R->data_len )
+    {
+        uint8_t *data = realloc( R->data, bh.stored_len );
+        if( data == NULL )
+        {
+            log_error( "Could not allocate trace block buffer" );
+            return -1;
+        }
+        R->data = data;
+        R->data_len = bh.stored_len;
+    }
+    if( (bh.flags & TRACE_BLOCK_ZLIB) && R->scratch == NULL &&
+        (R->scratch = malloc( TRACE_BLOCK_MAX )) == NULL )
+    {
+        log_error( "Could not allocate trace block buffer" );
+        return -1;
+    }
+    if( fread( R->data, 1, bh.stored_len, R->fp ) != bh.stored_len )
+    {
+        log_error( "Trace file is truncated" );
+        return -1;
+    }
+
+    const int nrec = trace_block_decode( &bh, R->data, R->scratch, R->hdr.flags, R->te, R->src );
+    if( nrec < 0 )
+    {
+        log_error( "Trace file has a corrupt block" );
+        return -1;
+    }
+    R->nrec = nrec;
+    return 0;
+}
+
+int trace_reader_next( trace_reader_t *R, trace_entry_t *te )
+{
+    while( R->next == R->nrec )
+    {
+        if( trace_reader_fill( R ) < 0 )
+        {
+            return -1;
+        }
+        if( R->nrec == 0 && (R->hdr.version == 1 || feof( R->fp )) )
+        {
+            return 0;
+        }
+    }
+    *te = R->te[R->next++];
+    return 1;
+}
+
+const trace_source_t *trace_reader_source( const trace_reader_t *R )
+{
+    if( !(R->hdr.flags & TRACE_FLAG_MERGED) )
+    {
+        return R->source;
+    }
+    const uint32_t src = R->next > 0 ? R->src[R->next - 1] : 0;
+    return src < R->hdr.nsource ? &R->source[src] : NULL;
+}
+
+const trace_source_t *trace_reader_sources( const trace_reader_t *R, unsigned *n )
+{
+    *n = (R->hdr.flags & TRACE_FLAG_MERGED) ? R->hdr.nsource : 1;
+    return R->source;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+
+int trace_map_open( trace_map_t *M, const char *path )
+{
+    struct stat sb;
+    int fd;
+
+    memset( M, 0, sizeof(trace_map_t) );
+    if( (fd = open( path, O_RDONLY )) < 0 || fstat( fd, &sb ) < 0 )
+    {
+        log_error( "open of trace file (%s) failed, (%d) ", path, errno );
+        if( fd >= 0 )   close( fd );
+        return -1;
+    }
+    M->len = sb.st_size;
+    if( M->len > 0 )
+    {
+        void *base = mmap( NULL, M->len, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( base == MAP_FAILED )
+        {
+            log_error( "mmap of trace file (%s) failed, (%d) ", path, errno );
+            close( fd );
+            return -1;
+        }
+        posix_madvise( base, M->len, POSIX_MADV_SEQUENTIAL );
+        M->base = base;
+    }
+    close( fd );
+
+    const size_t n = M->len < sizeof(M->hdr) ? M->len : sizeof(M->hdr);
+    if( n > 0 )
+    {
+        memcpy( &M->hdr, M->base, n );
+    }
+    if( trace_header_check( &M->hdr, n, path ) < 0 )
+    {
+        trace_map_close( M );
+        return -1;
+    }
+    M->first = M->hdr.version == 1 ? 0 : M->hdr.hdr_len;
+    return 0;
+}
+
+void trace_map_close( trace_map_t *M )
+{
+    if( M->base != NULL )
+    {
+        munmap( (void *)M->base, M->len );
+        M->base = NULL;
+    }
+}
+
+/* Version 1 files are divided into blocks of TRACE_BLOCK_NREC records */
+size_t trace_map_skip( const trace_map_t *M, const size_t off )
+{
+    if( M->hdr.version == 1 )
+    {
+        const size_t len = TRACE_BLOCK_NREC * sizeof(trace_entry_t);
+        return M->len - off > len ? off + len : M->len;
+    }
+
+    trace_block_hdr_t bh;
+    if( M->len - off < sizeof(bh) )
+    {
+        return M->len;
+    }
+    memcpy( &bh, M->base + off, sizeof(bh) );
+    return M->len - off - sizeof(bh) > bh.stored_len ? off + sizeof(bh) + bh.stored_len : M->len;
+}
+
+int trace_map_block( const trace_map_t *M, size_t *off, uint8_t *scratch, trace_entry_t *te,
+                     uint32_t *src )
+{
+    const size_t at = *off;
+
+    if( at >= M->len )
+    {
+        return 0;
+    }
+    if( M->hdr.version == 1 )
+    {
+        const unsigned nrec = (trace_map_skip( M, at ) - at) / sizeof(trace_entry_t);
+        memcpy( te, M->base + at, nrec * sizeof(trace_entry_t) );
+        if( src != NULL )
+        {
+            memset( src, 0, nrec * sizeof(uint32_t) );
+        }
+        *off = trace_map_skip( M, at );
+        return nrec;
+    }
+
+    trace_block_hdr_t bh;
+    if( M->len - at < sizeof(bh) )
+    {
+        log_error( "Trace file is truncated" );
+        return -1;
+    }
+    memcpy( &bh, M->base + at, sizeof(bh) );
+    if( bh.stored_len > TRACE_BLOCK_MAX || M->len - at - sizeof(bh) < bh.stored_len )
+    {
+        log_error( "Trace file is truncated" );
+        return -1;
+    }
+
+    const uint8_t *data = M->base + at + sizeof(bh);
+    const int nrec = trace_block_decode( &bh, data, scratch, M->hdr.flags, te, src );
+    if( nrec < 0 )
+    {
+        log_error( "Trace file has a corrupt block" );
+        return -1;
+    }
+    if( src != NULL && !(M->hdr.flags & TRACE_FLAG_MERGED) )
+    {
+        memset( src, 0, nrec * sizeof(uint32_t) );
+    }
+    *off = at + sizeof(bh) + bh.stored_len;
+    return nrec;
+}
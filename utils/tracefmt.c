@@ -7,19 +7,24 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include "utils.h"
+#include "tracefile.h"
 
-trace_entry_t tracebuf[100];
-char *trace_op_by_name[] = {"READ", "WRITE", "MISC"};
-#define TRACE_OP_NAME(x) trace_op_by_name[(x)]
+#define TRACE_OP_NAME(x) trace_type_str(x)
 
 typedef enum {
     TEXT_MODE = 0,
-    CSV_MODE
+    CSV_MODE,
+    JSON_MODE
 } output_mode_t;
 
-/* Output trace in human readable format */
-void print_trace( trace_entry_t *tp )
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+
+/* Output trace in human readable format, with its source if merged */
+void print_trace( trace_entry_t *tp, const trace_source_t *src )
 {
     char buf[8];
     char *tbp = &tp->info.tag[0];
@@ -27,17 +32,20 @@ void print_trace( trace_entry_t *tp )
 
     strncpy(buf, tbp, sizeof(tp->info.tag));
 
-    printf( "timestamp:%d.%09ld, duration:%d.%09ld, operation:%s, tag:%s\n", 
+    printf( "timestamp:%d.%09ld, duration:%d.%09ld, operation:%s, tag:%s", 
            (unsigned)tp->timestamp.tv_sec,
-           (unsigned)tp->timestamp.tv_nsec,
+           tp->timestamp.tv_nsec,
            (unsigned)tp->duration.tv_sec,
-           (unsigned)tp->duration.tv_nsec,
+           tp->duration.tv_nsec,
            TRACE_OP_NAME(tp->info.op),
            buf);
+    if ( src != NULL )
+        printf( ", host:%s, ordinal:%u", src->host, src->ordinal );
+    printf( "\n" );
 }
 
-/* Output trace in csv format */
-void csv_trace( trace_entry_t *tp )
+/* Output trace in csv format, with its source if merged */
+void csv_trace( trace_entry_t *tp, const trace_source_t *src )
 {
     char buf[8];
     char *tbp = &tp->info.tag[0];
@@ -45,35 +53,616 @@ void csv_trace( trace_entry_t *tp )
 
     strncpy(buf, tbp, sizeof(tp->info.tag));
 
-    printf( "%d.%d,%d.%d,%s,%s\n", 
+    printf( "%d.%09ld,%d.%09ld,%s,%s", 
            (unsigned)tp->timestamp.tv_sec,
-           (unsigned)tp->timestamp.tv_nsec,
+           tp->timestamp.tv_nsec,
            (unsigned)tp->duration.tv_sec,
-           (unsigned)tp->duration.tv_nsec,
+           tp->duration.tv_nsec,
            TRACE_OP_NAME(tp->info.op),
            buf);
+    if ( src != NULL )
+        printf( ",%s,%u", src->host, src->ordinal );
+    printf( "\n" );
+}
+
+/* Output trace in json format, as an element of an array, with its source if merged */
+void json_trace( trace_entry_t *tp, const trace_source_t *src, const int first )
+{
+    char buf[8];
+    buf[7] = 0;
+
+    strncpy(buf, &tp->info.tag[0], sizeof(tp->info.tag));
+
+    printf( "%s\n  {\"timestamp\": %ld.%09ld, \"duration\": %ld.%09ld, \"operation\": \"%s\", \"tag\": ",
+            first ? "" : ",", (long)tp->timestamp.tv_sec, tp->timestamp.tv_nsec,
+            (long)tp->duration.tv_sec, tp->duration.tv_nsec, TRACE_OP_NAME(tp->info.op) );
+    json_str( stdout, buf );
+    if ( src != NULL ) {
+        printf( ", \"host\": " );
+        json_str( stdout, src->host );
+        printf( ", \"ordinal\": %u", src->ordinal );
+    }
+    printf( "}" );
 }
 
 /* Handle argument parsing error */
 void fail( char *cmd )
 {
-    fprintf( stderr, "Usage: %s [-c] [-t] <path_to_file>\n\n", cmd );
+    fprintf( stderr, "Usage: %s [-c] [-t] [-j] [-i] <path_to_file>\n", cmd );
+    fprintf( stderr, "       %s -a [-c] [-t] [-j] [-i] [-b <seconds>] [-p <threads>] <path_to_file>...\n\n", cmd );
     fprintf( stderr, "\t-c Output in CSV format\n" );
     fprintf( stderr, "\t-t Output in text format\n" );
+    fprintf( stderr, "\t-j Output in JSON format\n" );
+    fprintf( stderr, "\t-i Output the trace file header\n" );
+    fprintf( stderr, "\t-a Analyse the files: latency percentiles, throughput and per-worker summaries\n" );
+    fprintf( stderr, "\t-b Width of throughput time series bins, in seconds (default 1)\n" );
+    fprintf( stderr, "\t-p Number of analysis threads (default one per CPU)\n" );
     exit( 1 );
 }
 
-/* Read trace file and output in desired format */
+/* Output the trace file header */
+void print_header( const trace_file_hdr_t *hdr )
+{
+    static const char *clock_str[] = TRACE_CLOCK_STR;
+    static const char *sample_str[] = TRACE_SAMPLE_STR;
+
+    printf( "# version:%u", hdr->version );
+    if ( hdr->version >= 2 ) {
+        printf( "%s, run:%016lx, ordinal:%u, host:%s, clock:%s, epoch:%ld.%09ld",
+                hdr->flags & TRACE_FLAG_MERGED ? ", merged" : "",
+                (unsigned long)hdr->run_id, hdr->ordinal, hdr->host,
+                hdr->clock < ARRAYLEN(clock_str) ? clock_str[hdr->clock] : "unknown",
+                (long)hdr->epoch_sec, (long)hdr->epoch_nsec );
+        printf( ", sampling:%s", hdr->sample_mode < ARRAYLEN(sample_str) ? sample_str[hdr->sample_mode] : "unknown" );
+        if ( hdr->sample_mode == TRACE_SAMPLE_NTH ) {
+            printf( ":%u", hdr->sample_n );
+        } else if ( hdr->sample_mode == TRACE_SAMPLE_RESERVOIR ) {
+            printf( ":%u:%.3f", hdr->sample_n, hdr->sample_interval / 1e9 );
+        }
+        if ( hdr->sample_slow ) {
+            printf( ", slow:%.3fus", hdr->sample_slow / 1e3 );
+        }
+        if ( hdr->sample_mode != TRACE_SAMPLE_ALL ) {
+            printf( ", kept:%lu/%lu", (unsigned long)hdr->sample_kept, (unsigned long)hdr->sample_seen );
+        }
+        if ( hdr->clock_rtt ) {
+            printf( ", offset:%+.3fus(rtt:%.3fus)", hdr->clock_offset / 1e3, hdr->clock_rtt / 1e3 );
+        }
+    }
+    printf( "\n" );
+}
+
+/*------------------------------------------------------------------------------------------------*/
+/* Analysis:
+ * Trace files are mapped into memory and divided into chunks of blocks, which are decoded and
+ * summarised by a pool of threads.  The results of each thread are merged once all are done.
+ * Sampled operations are weighted by the number of operations they stand for. */
+
+#define CHUNK_BLOCKS        64          /* Blocks per unit of work */
+
+/* Summary of the operations of one type */
+typedef struct op_summary {
+    double ops;                 /* Operations, weighted for sampling */
+    double latency;             /* Sum of latencies, in ns, weighted for sampling */
+    uint64_t max;               /* Greatest latency, in ns */
+    int64_t first, last;        /* Earliest start and latest end, in ns */
+} op_summary_t;
+
+/* A unit of work: a run of blocks of one file */
+typedef struct chunk {
+    unsigned file;
+    size_t from, to;            /* Offsets of the first block and the block following */
+    op_summary_t op[TRACE_NTYPES];
+} chunk_t;
+
+/* Throughput time series bin */
+typedef struct bin {
+    double ops[TRACE_NTYPES];
+    double latency[TRACE_NTYPES];
+} bin_t;
+
+/* State of an analysis thread */
+typedef struct analyser {
+    pthread_t thread;
+    histogram_t hist[TRACE_NTYPES];
+    bin_t *bin;
+    size_t nbin;
+    trace_entry_t *te;          /* Records of the current block */
+    uint32_t *src;              /* and the trace each came from */
+    uint8_t *scratch;
+    int failed;
+} analyser_t;
+
+static struct {
+    char **path;
+    trace_map_t *map;
+    unsigned nmap;
+    chunk_t *chunk;
+    size_t nchunk;
+    size_t next;                /* Next chunk to be analysed */
+    uint64_t bin_ns;            /* Width of time series bins */
+} A;
+
+/* Sampling weights of each trace in a file: a merged file interleaves the records of traces
+ * sampled independently, so each record is weighted by the state of its own trace */
+typedef struct source_weight {
+    double reservoir;           /* Weight of the trace's current reservoir sample */
+    double weight;              /* Weight of the trace's last operation, which its components share */
+} source_weight_t;
+
+/* Number of operations a record stands for, given the weight of the current reservoir sample */
+static double sample_weight( const trace_file_hdr_t *hdr, const uint64_t duration, const double reservoir )
+{
+    if ( hdr->sample_slow != 0 && duration >= hdr->sample_slow ) {
+        return 1.0;
+    }
+    switch ( hdr->sample_mode ) {
+    case TRACE_SAMPLE_NTH:
+        return hdr->sample_n;
+    case TRACE_SAMPLE_RESERVOIR:
+        return reservoir;
+    default:
+        return 1.0;
+    }
+}
+
+/* Find the time series bin for a time, growing the series if necessary */
+static bin_t *analyse_bin( analyser_t *T, const int64_t t )
+{
+    const size_t idx = t > 0 ? (uint64_t)t / A.bin_ns : 0;
+
+    if ( idx >= T->nbin ) {
+        size_t n = T->nbin ? T->nbin : 64;
+        while ( n <= idx ) {
+            n *= 2;
+        }
+        bin_t *bin = realloc( T->bin, n * sizeof(bin_t) );
+        if ( bin == NULL ) {
+            return NULL;
+        }
+        memset( bin + T->nbin, 0, (n - T->nbin) * sizeof(bin_t) );
+        T->bin = bin;
+        T->nbin = n;
+    }
+    return &T->bin[idx];
+}
+
+static int analyse_chunk( analyser_t *T, chunk_t *C )
+{
+    const trace_map_t *M = &A.map[C->file];
+    const unsigned nsource = M->hdr.flags & TRACE_FLAG_MERGED ? M->hdr.nsource : 1;
+    size_t off = C->from;
+    int n;
+
+    source_weight_t *W = malloc( nsource * sizeof(source_weight_t) );
+    if ( W == NULL ) {
+        fprintf( stderr, "Out of memory for the sampling weights\n" );
+        return -1;
+    }
+    /* Components at the start of a chunk belong to an operation in the previous one: take it to
+     * have been sampled, as all but slow operations are */
+    for ( unsigned s=0; s < nsource; s++ ) {
+        W[s].reservoir = 1.0;
+        W[s].weight = sample_weight( &M->hdr, 0, W[s].reservoir );
+    }
+
+    for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+        C->op[op].first = INT64_MAX;
+        C->op[op].last = INT64_MIN;
+    }
+
+    while ( off < C->to && (n = trace_map_block( M, &off, T->scratch, T->te, T->src )) > 0 ) {
+        for ( int i=0; i < n; i++ ) {
+            const trace_entry_t *te = &T->te[i];
+            const unsigned op = te->info.op;
+            const uint64_t duration = histogram_ns( &te->duration );
+            const int64_t start = (int64_t)te->timestamp.tv_sec * 1000000000LL + te->timestamp.tv_nsec;
+
+            if ( T->src[i] >= nsource ) {
+                fprintf( stderr, "Record of unknown trace %u\n", T->src[i] );
+                free( W );
+                return -1;
+            }
+            source_weight_t *w = &W[T->src[i]];
+
+            /* A reservoir sample is preceded by the number of operations it was drawn from */
+            if ( op == TRACE_WEIGHT ) {
+                const uint64_t kept = duration < M->hdr.sample_n ? duration : M->hdr.sample_n;
+                w->reservoir = kept ? (double)duration / kept : 1.0;
+                continue;
+            }
+            if ( op >= TRACE_NTYPES ) {
+                continue;
+            }
+
+            /* Components are sampled with their operation, which precedes them in its trace,
+             * so they carry its weight */
+            if ( op < TRACE_OPEN ) {
+                w->weight = sample_weight( &M->hdr, duration, w->reservoir );
+            }
+            const double weight = w->weight;
+
+            op_summary_t *S = &C->op[op];
+            S->ops += weight;
+            S->latency += weight * duration;
+            if ( duration > S->max )                        S->max = duration;
+            if ( start < S->first )                         S->first = start;
+            if ( start + (int64_t)duration > S->last )      S->last = start + duration;
+
+            const uint64_t count = llround( weight );
+            histogram_record_n( &T->hist[op], duration, count ? count : 1 );
+
+            bin_t *B = analyse_bin( T, start );
+            if ( B == NULL ) {
+                fprintf( stderr, "Out of memory for the time series\n" );
+                free( W );
+                return -1;
+            }
+            B->ops[op] += weight;
+            B->latency[op] += weight * duration;
+        }
+    }
+    free( W );
+    return n < 0 ? -1 : 0;
+}
+
+static void *analyse_thread( void *arg )
+{
+    analyser_t *T = arg;
+    size_t idx;
+
+    while ( (idx = __atomic_fetch_add( &A.next, 1, __ATOMIC_RELAXED )) < A.nchunk ) {
+        if ( analyse_chunk( T, &A.chunk[idx] ) < 0 ) {
+            fprintf( stderr, "Analysis of %s failed\n", A.path[A.chunk[idx].file] );
+            T->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+/* Divide the mapped files into chunks */
+static int analyse_split( void )
+{
+    size_t max = 0;
+
+    for ( unsigned f=0; f < A.nmap; f++ ) {
+        const trace_map_t *M = &A.map[f];
+
+        /* The weight of a reservoir sample is found at its start: such files are not split */
+        const unsigned nblocks = M->hdr.sample_mode == TRACE_SAMPLE_RESERVOIR ? UINT_MAX : CHUNK_BLOCKS;
+        size_t off = M->first;
+
+        while ( off < M->len ) {
+            if ( A.nchunk == max ) {
+                max = max ? max * 2 : 256;
+                chunk_t *chunk = realloc( A.chunk, max * sizeof(chunk_t) );
+                if ( chunk == NULL ) {
+                    fprintf( stderr, "Out of memory for the analysis\n" );
+                    return -1;
+                }
+                A.chunk = chunk;
+            }
+
+            chunk_t *C = &A.chunk[A.nchunk++];
+            memset( C, 0, sizeof(chunk_t) );
+            C->file = f;
+            C->from = off;
+            for ( unsigned b=0; b < nblocks && off < M->len; b++ ) {
+                off = trace_map_skip( M, off );
+            }
+            C->to = off;
+        }
+    }
+    return 0;
+}
+
+static void summary_merge( op_summary_t *dst, const op_summary_t *src )
+{
+    dst->ops += src->ops;
+    dst->latency += src->latency;
+    if ( src->max > dst->max )          dst->max = src->max;
+    if ( src->first < dst->first )      dst->first = src->first;
+    if ( src->last > dst->last )        dst->last = src->last;
+}
+
+/* Output latency percentiles of each operation type */
+static void report_latency( const histogram_t *H, const output_mode_t m )
+{
+    switch ( m ) {
+    case TEXT_MODE:
+        printf( "Latency (us):\n%-6s %14s %10s", "op", "ops", "mean" );
+        for ( unsigned i=0; i < ARRAYLEN(percentiles); i++ ) {
+            char label[16];
+            snprintf( label, sizeof(label), "p%g", percentiles[i] );
+            printf( " %10s", label );
+        }
+        printf( " %10s\n", "max" );
+        break;
+    case CSV_MODE:
+        printf( "latency,op,ops,mean_us" );
+        for ( unsigned i=0; i < ARRAYLEN(percentiles); i++ )
+            printf( ",p%g_us", percentiles[i] );
+        printf( ",max_us\n" );
+        break;
+    case JSON_MODE:
+        printf( "  \"latency\": [" );
+        break;
+    }
+
+    int first = 1;
+    for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+        if ( H[op].count == 0 ) {
+            continue;
+        }
+        const double mean = (double)H[op].sum / H[op].count / 1000.0;
+        switch ( m ) {
+        case TEXT_MODE:
+            printf( "%-6s %14lu %10.1f", TRACE_OP_NAME(op), (unsigned long)H[op].count, mean );
+            for ( unsigned i=0; i < ARRAYLEN(percentiles); i++ )
+                printf( " %10.1f", histogram_percentile( &H[op], percentiles[i] ) / 1000.0 );
+            printf( " %10.1f\n", H[op].max / 1000.0 );
+            break;
+        case CSV_MODE:
+            printf( "latency,%s,%lu,%.3f", TRACE_OP_NAME(op), (unsigned long)H[op].count, mean );
+            for ( unsigned i=0; i < ARRAYLEN(percentiles); i++ )
+                printf( ",%.3f", histogram_percentile( &H[op], percentiles[i] ) / 1000.0 );
+            printf( ",%.3f\n", H[op].max / 1000.0 );
+            break;
+        case JSON_MODE:
+            printf( "%s\n    {\"op\": \"%s\", \"ops\": %lu, \"mean_us\": %.3f",
+                    first ? "" : ",", TRACE_OP_NAME(op), (unsigned long)H[op].count, mean );
+            for ( unsigned i=0; i < ARRAYLEN(percentiles); i++ )
+                printf( ", \"p%g_us\": %.3f", percentiles[i], histogram_percentile( &H[op], percentiles[i] ) / 1000.0 );
+            printf( ", \"max_us\": %.3f}", H[op].max / 1000.0 );
+            break;
+        }
+        first = 0;
+    }
+    printf( m == JSON_MODE ? "\n  ],\n" : "\n" );
+}
+
+/* Output the throughput of each operation type in each time series bin */
+static void report_series( const bin_t *bin, const size_t nbin, const output_mode_t m )
+{
+    const double secs = A.bin_ns / 1e9;
+    int active[TRACE_NTYPES] = { 0 };
+
+    for ( size_t b=0; b < nbin; b++ )
+        for ( unsigned op=0; op < TRACE_NTYPES; op++ )
+            active[op] |= bin[b].ops[op] > 0.0;
+
+    switch ( m ) {
+    case TEXT_MODE:
+        printf( "Throughput (ops/s) in %gs intervals:\n%10s", secs, "time" );
+        for ( unsigned op=0; op < TRACE_NTYPES; op++ )
+            if ( active[op] )   printf( " %12s", TRACE_OP_NAME(op) );
+        printf( "\n" );
+        break;
+    case CSV_MODE:
+        printf( "series,time,op,ops,ops_per_sec,mean_us\n" );
+        break;
+    case JSON_MODE:
+        printf( "  \"bin_seconds\": %g,\n  \"series\": [", secs );
+        break;
+    }
+
+    int first = 1;
+    for ( size_t b=0; b < nbin; b++ ) {
+        if ( m == TEXT_MODE )   printf( "%10.3f", b * secs );
+        for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+            const double ops = bin[b].ops[op];
+            const double mean = ops > 0.0 ? bin[b].latency[op] / ops / 1000.0 : 0.0;
+            if ( !active[op] ) {
+                continue;
+            }
+            switch ( m ) {
+            case TEXT_MODE:
+                printf( " %12.1f", ops / secs );
+                break;
+            case CSV_MODE:
+                printf( "series,%.3f,%s,%.0f,%.1f,%.3f\n", b * secs, TRACE_OP_NAME(op), ops, ops / secs, mean );
+                break;
+            case JSON_MODE:
+                printf( "%s\n    {\"time\": %.3f, \"op\": \"%s\", \"ops\": %.0f, \"ops_per_sec\": %.1f, \"mean_us\": %.3f}",
+                        first ? "" : ",", b * secs, TRACE_OP_NAME(op), ops, ops / secs, mean );
+                break;
+            }
+            first = 0;
+        }
+        if ( m == TEXT_MODE )   printf( "\n" );
+    }
+    printf( m == JSON_MODE ? "\n  ],\n" : "\n" );
+}
+
+/* Output a summary of each operation type for each worker (trace file) */
+static void report_workers( const op_summary_t *W, const output_mode_t m )
+{
+    switch ( m ) {
+    case TEXT_MODE:
+        printf( "Workers:\n%-24s %-16s %7s %-6s %14s %12s %10s %10s\n",
+                "file", "host", "ordinal", "op", "ops", "ops/s", "mean(us)", "max(us)" );
+        break;
+    case CSV_MODE:
+        printf( "worker,file,host,ordinal,op,ops,ops_per_sec,mean_us,max_us\n" );
+        break;
+    case JSON_MODE:
+        printf( "  \"workers\": [" );
+        break;
+    }
+
+    int first = 1;
+    for ( unsigned f=0; f < A.nmap; f++ ) {
+        const trace_file_hdr_t *hdr = &A.map[f].hdr;
+        for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+            const op_summary_t *S = &W[f * TRACE_NTYPES + op];
+            if ( S->ops == 0.0 ) {
+                continue;
+            }
+            const double secs = (S->last - S->first) / 1e9;
+            const double rate = secs > 0.0 ? S->ops / secs : 0.0;
+            const double mean = S->latency / S->ops / 1000.0;
+            switch ( m ) {
+            case TEXT_MODE:
+                printf( "%-24s %-16s %7u %-6s %14.0f %12.1f %10.1f %10.1f\n", A.path[f], hdr->host,
+                        hdr->ordinal, TRACE_OP_NAME(op), S->ops, rate, mean, S->max / 1000.0 );
+                break;
+            case CSV_MODE:
+                printf( "worker,%s,%s,%u,%s,%.0f,%.1f,%.3f,%.3f\n", A.path[f], hdr->host,
+                        hdr->ordinal, TRACE_OP_NAME(op), S->ops, rate, mean, S->max / 1000.0 );
+                break;
+            case JSON_MODE:
+                printf( "%s\n    {\"file\": ", first ? "" : "," );
+                json_str( stdout, A.path[f] );
+                printf( ", \"host\": " );
+                json_str( stdout, hdr->host );
+                printf( ", \"ordinal\": %u, \"op\": \"%s\", \"ops\": %.0f, \"ops_per_sec\": %.1f, "
+                        "\"mean_us\": %.3f, \"max_us\": %.3f}",
+                        hdr->ordinal, TRACE_OP_NAME(op), S->ops, rate, mean, S->max / 1000.0 );
+                break;
+            }
+            first = 0;
+        }
+    }
+    printf( m == JSON_MODE ? "\n  ]\n" : "" );
+}
+
+/* Analyse trace files, and output the results in the desired format */
+int analyse( char **path, const unsigned npath, const unsigned nthread, const output_mode_t m, const int info )
+{
+    analyser_t *T = calloc( nthread, sizeof(analyser_t) );
+    histogram_t *H = malloc( TRACE_NTYPES * sizeof(histogram_t) );
+    op_summary_t *W = NULL;
+    bin_t *bin = NULL;
+    size_t nbin = 0;
+    int ret = -1;
+
+    A.path = path;
+    A.map = calloc( npath, sizeof(trace_map_t) );
+    if ( T == NULL || H == NULL || A.map == NULL ) {
+        fprintf( stderr, "Out of memory for the analysis\n" );
+        goto out;
+    }
+    for ( A.nmap=0; A.nmap < npath; A.nmap++ ) {
+        if ( trace_map_open( &A.map[A.nmap], path[A.nmap] ) < 0 ) {
+            goto out;
+        }
+        if ( info ) {
+            print_header( &A.map[A.nmap].hdr );
+        }
+    }
+    if ( analyse_split( ) < 0 ) {
+        goto out;
+    }
+
+    /* Analyse the chunks in parallel */
+    unsigned started;
+    for ( started=0; started < nthread; started++ ) {
+        analyser_t *t = &T[started];
+        for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+            histogram_init( &t->hist[op] );
+        }
+        t->te = malloc( TRACE_BLOCK_NREC * sizeof(trace_entry_t) );
+        t->src = malloc( TRACE_BLOCK_NREC * sizeof(uint32_t) );
+        t->scratch = malloc( TRACE_BLOCK_MAX );
+        if ( t->te == NULL || t->src == NULL || t->scratch == NULL ||
+             pthread_create( &t->thread, NULL, analyse_thread, t ) != 0 ) {
+            fprintf( stderr, "Could not start analysis thread %u\n", started );
+            free( t->te );
+            free( t->src );
+            free( t->scratch );
+            break;
+        }
+    }
+    for ( unsigned i=0; i < started; i++ ) {
+        pthread_join( T[i].thread, NULL );
+        free( T[i].te );
+        free( T[i].src );
+        free( T[i].scratch );
+    }
+    if ( started < nthread ) {
+        goto out;
+    }
+
+    /* Merge the results of each thread and each chunk */
+    for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+        histogram_init( &H[op] );
+    }
+    for ( unsigned i=0; i < nthread; i++ ) {
+        if ( T[i].failed ) {
+            goto out;
+        }
+        for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+            histogram_merge( &H[op], &T[i].hist[op] );
+        }
+        if ( T[i].nbin > nbin ) {
+            bin_t *b = realloc( bin, T[i].nbin * sizeof(bin_t) );
+            if ( b == NULL ) {
+                goto out;
+            }
+            memset( b + nbin, 0, (T[i].nbin - nbin) * sizeof(bin_t) );
+            bin = b;
+            nbin = T[i].nbin;
+        }
+        for ( size_t b=0; b < T[i].nbin; b++ ) {
+            for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+                bin[b].ops[op] += T[i].bin[b].ops[op];
+                bin[b].latency[op] += T[i].bin[b].latency[op];
+            }
+        }
+    }
+    while ( nbin > 0 && memcmp( &bin[nbin - 1], &(bin_t){ { 0 } }, sizeof(bin_t) ) == 0 ) {
+        nbin--;
+    }
+
+    if ( (W = malloc( A.nmap * TRACE_NTYPES * sizeof(op_summary_t) )) == NULL ) {
+        goto out;
+    }
+    for ( size_t i=0; i < A.nmap * TRACE_NTYPES; i++ ) {
+        W[i] = (op_summary_t){ .first = INT64_MAX, .last = INT64_MIN };
+    }
+    for ( size_t c=0; c < A.nchunk; c++ ) {
+        for ( unsigned op=0; op < TRACE_NTYPES; op++ ) {
+            summary_merge( &W[A.chunk[c].file * TRACE_NTYPES + op], &A.chunk[c].op[op] );
+        }
+    }
+
+    if ( m == JSON_MODE )   printf( "{\n" );
+    report_latency( H, m );
+    report_series( bin, nbin, m );
+    report_workers( W, m );
+    if ( m == JSON_MODE )   printf( "}\n" );
+    ret = 0;
+
+out:
+    for ( unsigned i=0; T != NULL && i < nthread; i++ ) {
+        free( T[i].bin );
+    }
+    for ( unsigned f=0; f < A.nmap; f++ ) {
+        trace_map_close( &A.map[f] );
+    }
+    free( A.map );
+    free( A.chunk );
+    free( T );
+    free( H );
+    free( W );
+    free( bin );
+    return ret;
+}
+
+/* Read trace file and output in desired format, or analyse trace files */
 int main( int argc, char **argv )
 {
-    FILE *fp;
+    trace_reader_t *R;
+    trace_entry_t te;
     output_mode_t m = TEXT_MODE;
     char *file = NULL;
-    int c, nent;
+    int c, ret, info = 0, analysis = 0;
+    long nthread = sysconf( _SC_NPROCESSORS_ONLN );
+    double bin_secs = 1.0;
 
     opterr = 0;
     
-    while (( c = getopt (argc, argv, "ct" )) != -1 ) {
+    while (( c = getopt (argc, argv, "ctjiab:p:" )) != -1 ) {
         switch (c)
         {
         case 'c':
@@ -82,28 +671,67 @@ int main( int argc, char **argv )
         case 't':
             m = TEXT_MODE;
             break;
+        case 'j':
+            m = JSON_MODE;
+            break;
+        case 'i':
+            info = 1;
+            break;
+        case 'a':
+            analysis = 1;
+            break;
+        case 'b':
+            if ( (bin_secs = atof( optarg )) < 1e-6 )
+                fail(argv[0]);
+            break;
+        case 'p':
+            if ( (nthread = atoi( optarg )) <= 0 )
+                fail(argv[0]);
+            break;
         default:
            fail(argv[0]);
         }
     }
 
+    if ( analysis && optind < argc ) {
+        A.bin_ns = bin_secs * 1e9;
+        return analyse( &argv[optind], argc - optind, nthread > 0 ? nthread : 1, m, info ) < 0 ? -1 : 0;
+    }
     if ( optind == (argc - 1) ) {
         file = argv[ optind ];
     } else {
         fail(argv[0]);
     }
 
-    if ( (fp=fopen(file, "r")) == NULL ) {
-        log_error("open of trace file (%s) failed, (%d) ", file, errno);
+    /* Both the original (version 1) and compact (version 2) formats are read */
+    if ( (R = trace_reader_open( file )) == NULL ) {
         return( -1 );
     }
-
-    while ((nent = fread( &tracebuf[0], sizeof(trace_entry_t), 100, fp ))) {
-        for (int i=0; i<nent; i++) {
-            if ( m == TEXT_MODE )
-                print_trace( &tracebuf[i] );
-            else 
-                csv_trace( &tracebuf[i] );
+    if ( info ) {
+        unsigned nsource;
+        const trace_source_t *source = trace_reader_sources( R, &nsource );
+        print_header( trace_reader_header( R ) );
+        for ( unsigned i=0; (trace_reader_header( R )->flags & TRACE_FLAG_MERGED) && i < nsource; i++ ) {
+            printf( "# source:%u, run:%016lx, ordinal:%u, host:%s, offset:%.9f\n", i,
+                    (unsigned long)source[i].run_id, source[i].ordinal, source[i].host,
+                    source[i].offset / 1e9 );
         }
     }
+
+    if ( m == JSON_MODE )
+        printf( "[" );
+    const int merged = trace_reader_header( R )->flags & TRACE_FLAG_MERGED;
+    for ( int n=0; (ret = trace_reader_next( R, &te )) > 0; n++ ) {
+        const trace_source_t *src = merged ? trace_reader_source( R ) : NULL;
+        if ( m == TEXT_MODE )
+            print_trace( &te, src );
+        else if ( m == CSV_MODE )
+            csv_trace( &te, src );
+        else
+            json_trace( &te, src, n == 0 );
+    }
+    if ( m == JSON_MODE )
+        printf( "\n]\n" );
+    trace_reader_close( R );
+    return ret < 0 ? -1 : 0;
 }
@@ -0,0 +1,433 @@
+/*------------------------------------------------------------------------------------------------*/
+/* Merge the trace files of many workers, possibly on several hosts, into a single file
+ * ordered by start time.  Each record is annotated with the trace it came from.
+ * Times are brought onto the reference clock by the offsets measured by coordinated runs
+ * and recorded in the trace headers, unless overridden for a host.
+ *
+ * Reservoir sampled traces are not in order of start time (each interval's sample is written
+ * after the slow operations kept meanwhile), and weight their records by position.  Their
+ * records are held in order of start time until no later record of the trace can start before
+ * them: every operation traced after an interval's sample was recorded starts after those
+ * recorded until then.  So at most the samples of two intervals, and the slow operations kept
+ * meanwhile, are held at once.  Each record is written after a TRACE_WEIGHT record of its own
+ * trace whenever its weight differs from the last one written. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "utils.h"
+#include "tracefile.h"
+
+/* Clock offset of a host: added to its times to bring them onto the reference clock */
+typedef struct host_offset {
+    const char *host;
+    int64_t offset;             /* ns */
+    int used;
+} host_offset_t;
+
+/* A record of a reservoir sampled trace, with the weight of its sample */
+typedef struct held {
+    trace_entry_t te;
+    uint64_t seen;              /* Operations its sample was drawn from (0: not sampled) */
+    uint64_t seq;               /* Position in the trace */
+} held_t;
+
+/* An input trace, and its next record */
+typedef struct input {
+    trace_reader_t *R;
+    trace_entry_t te;
+    int64_t base;               /* Reference time of the trace's timestamp zero, in ns */
+    int64_t at;                 /* Reference time of the start of te, in ns */
+    uint64_t te_seen;           /* Weight of te */
+    uint64_t seen;              /* Weight last written for the trace */
+
+    /* Reservoir sampled traces: records held back, by start time, until none can precede them */
+    const trace_file_hdr_t *hdr;        /* (NULL: not reservoir sampled) */
+    held_t *held;               /* Heap of records, earliest first */
+    size_t nheld, max_held;
+    uint64_t nread;             /* Records read, to keep those with the same start time in order */
+    uint64_t weight, sample;    /* Weight of the current operation, and of the current sample */
+    int64_t latest;             /* Latest start read, in trace ns */
+    int64_t latest_sample;      /* ... when the current sample's weight was read */
+    int64_t mark;               /* No record still to be read starts before this */
+    int eof;
+} input_t;
+
+static input_t *in;
+static unsigned *heap;          /* Inputs with records remaining, ordered by their next record */
+static unsigned nheap;
+
+static inline int64_t ts_ns( const struct timespec *ts )
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/* Earlier records first, and records with the same start time in input order */
+static inline int before( const unsigned a, const unsigned b )
+{
+    return in[a].at < in[b].at || (in[a].at == in[b].at && a < b);
+}
+
+static void heap_down( unsigned i )
+{
+    for (;;) {
+        unsigned least = i;
+        const unsigned l = 2 * i + 1, r = 2 * i + 2;
+        if ( l < nheap && before( heap[l], heap[least] ) )   least = l;
+        if ( r < nheap && before( heap[r], heap[least] ) )   least = r;
+        if ( least == i ) {
+            return;
+        }
+        const unsigned t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+static inline int held_before( const held_t *a, const held_t *b )
+{
+    const int64_t ta = ts_ns( &a->te.timestamp ), tb = ts_ns( &b->te.timestamp );
+    return ta < tb || (ta == tb && a->seq < b->seq);
+}
+
+static int held_push( input_t *I, const trace_entry_t *te, const uint64_t seen )
+{
+    if ( I->nheld == I->max_held ) {
+        const size_t max = I->max_held ? I->max_held * 2 : 4096;
+        held_t *held = realloc( I->held, max * sizeof(held_t) );
+        if ( held == NULL ) {
+            log_error( "Could not allocate %zu records of a sampled trace", max );
+            return -1;
+        }
+        I->held = held;
+        I->max_held = max;
+    }
+
+    size_t i = I->nheld++;
+    const held_t h = { .te = *te, .seen = seen, .seq = I->nread++ };
+    while ( i > 0 && held_before( &h, &I->held[(i - 1) / 2] ) ) {
+        I->held[i] = I->held[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    I->held[i] = h;
+    return 0;
+}
+
+static held_t held_pop( input_t *I )
+{
+    const held_t top = I->held[0], last = I->held[--I->nheld];
+    size_t i = 0;
+
+    for (;;) {
+        size_t least = 2 * i + 1;
+        if ( least >= I->nheld ) {
+            break;
+        }
+        if ( least + 1 < I->nheld && held_before( &I->held[least + 1], &I->held[least] ) ) {
+            least++;
+        }
+        if ( !held_before( &I->held[least], &last ) ) {
+            break;
+        }
+        I->held[i] = I->held[least];
+        i = least;
+    }
+    I->held[i] = last;
+    return top;
+}
+
+/* Read records of a reservoir sampled trace until the earliest held can be released, giving
+ * each the weight of the sample it belongs to (components that of their operation, and slow
+ * operations none).  Operations traced after a sample was recorded start after every record
+ * read before its TRACE_WEIGHT, so on reaching the next one, those held until then are final. */
+static int input_fill( input_t *I )
+{
+    trace_entry_t te;
+    int ret;
+
+    while ( !I->eof && (I->nheld == 0 || ts_ns( &I->held[0].te.timestamp ) > I->mark) ) {
+        if ( (ret = trace_reader_next( I->R, &te )) <= 0 ) {
+            if ( ret < 0 ) {
+                return -1;
+            }
+            I->eof = 1;
+            break;
+        }
+
+        const uint64_t duration = ts_ns( &te.duration );
+        if ( te.info.op == TRACE_WEIGHT ) {
+            I->mark = I->latest_sample;
+            I->latest_sample = I->latest;
+            I->sample = duration;
+            continue;
+        }
+        if ( te.info.op < TRACE_OPEN ) {
+            I->weight = I->hdr->sample_slow != 0 && duration >= I->hdr->sample_slow ? 0 : I->sample;
+        }
+        if ( ts_ns( &te.timestamp ) > I->latest ) {
+            I->latest = ts_ns( &te.timestamp );
+        }
+        if ( held_push( I, &te, I->weight ) < 0 ) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Read the next record of an input.  Returns 1 if there is one, 0 at end of file, or -1 */
+static int input_next( input_t *I )
+{
+    int ret;
+
+    if ( I->hdr != NULL ) {
+        if ( input_fill( I ) < 0 ) {
+            return -1;
+        }
+        if ( I->nheld == 0 ) {
+            return 0;
+        }
+        const held_t h = held_pop( I );
+        I->te = h.te;
+        I->te_seen = h.seen;
+        ret = 1;
+    } else {
+        ret = trace_reader_next( I->R, &I->te );
+    }
+    if ( ret > 0 ) {
+        I->at = I->base + ts_ns( &I->te.timestamp );
+    }
+    return ret;
+}
+
+/* Handle argument parsing error */
+void fail( char *cmd )
+{
+    fprintf( stderr, "Usage: %s [-o <merged_file>] [-O <host>=<seconds>]... <path_to_file>...\n\n", cmd );
+    fprintf( stderr, "\t-o Write the merged trace to a file (default merged.trc)\n" );
+    fprintf( stderr, "\t-O Add an offset to the clock of a host, to bring it onto the reference clock\n" );
+    fprintf( stderr, "\t   (in place of any offset recorded in its traces)\n" );
+    exit( 1 );
+}
+
+/* Read trace files, and write their records to a single file in order of start time */
+int main( int argc, char **argv )
+{
+    const char *out = "merged.trc";
+    host_offset_t *offsets;
+    unsigned noffsets = 0;
+    int c;
+
+    opterr = 0;
+    offsets = calloc( argc, sizeof(host_offset_t) );
+
+    while (( c = getopt (argc, argv, "o:O:" )) != -1 ) {
+        switch (c)
+        {
+        case 'o':
+            out = optarg;
+            break;
+        case 'O': {
+            char *eq = strrchr( optarg, '=' ), *end;
+            if ( eq == NULL || eq == optarg ) {
+                fail(argv[0]);
+            }
+            *eq = '\0';
+            const double secs = strtod( eq + 1, &end );
+            if ( *end != '\0' || end == eq + 1 ) {
+                fail(argv[0]);
+            }
+            offsets[noffsets].host = optarg;
+            offsets[noffsets++].offset = secs * 1e9;
+            break;
+        }
+        default:
+           fail(argv[0]);
+        }
+    }
+    if ( optind == argc ) {
+        fail(argv[0]);
+    }
+
+    const unsigned n = argc - optind;
+    trace_file_hdr_t hdr;
+    trace_source_t *source = calloc( n, sizeof(trace_source_t) );
+    in = calloc( n, sizeof(input_t) );
+    heap = calloc( n, sizeof(unsigned) );
+    if ( in == NULL || heap == NULL || source == NULL || offsets == NULL ) {
+        log_error( "Could not allocate state for %u traces", n );
+        return -1;
+    }
+
+    /* Open each trace, and find where its timestamp zero falls on the reference clock.
+     * Merged timestamps are relative to the earliest of these. */
+    int64_t epoch = INT64_MAX;
+    memset( &hdr, 0, sizeof(hdr) );
+    for ( unsigned i=0; i < n; i++ ) {
+        const char *path = argv[optind + i];
+        if ( (in[i].R = trace_reader_open( path )) == NULL ) {
+            return -1;
+        }
+
+        const trace_file_hdr_t *h = trace_reader_header( in[i].R );
+        if ( h->version < 2 ) {
+            log_error( "%s has no header identifying its host and start time", path );
+            return -1;
+        }
+        if ( h->flags & TRACE_FLAG_MERGED ) {
+            log_error( "%s is already merged", path );
+            return -1;
+        }
+
+        int64_t offset = h->clock_offset;
+        for ( unsigned o=0; o < noffsets; o++ ) {
+            if ( strcmp( offsets[o].host, h->host ) == 0 ) {
+                offset = offsets[o].offset;
+                offsets[o].used = 1;
+            }
+        }
+        in[i].base = h->epoch_sec * 1000000000LL + h->epoch_nsec + offset;
+        source[i] = *trace_reader_source( in[i].R );
+        source[i].offset = offset;
+
+        /* The merged file keeps what its traces have in common */
+        if ( i == 0 ) {
+            hdr = *h;
+        } else {
+            if ( h->run_id != hdr.run_id )              hdr.run_id = 0;
+            if ( h->clock != hdr.clock )                hdr.clock = TRACE_CLOCK_MONOTONIC;
+            if ( h->sample_mode != hdr.sample_mode || h->sample_n != hdr.sample_n ||
+                 h->sample_interval != hdr.sample_interval || h->sample_slow != hdr.sample_slow ) {
+                log_warn( "%s is sampled differently from %s: the merged trace cannot be re-weighted",
+                          path, argv[optind] );
+                hdr.sample_mode = TRACE_SAMPLE_ALL;
+                hdr.sample_n = 0;
+                hdr.sample_interval = hdr.sample_slow = 0;
+            }
+            hdr.sample_seen += h->sample_seen;
+            hdr.sample_kept += h->sample_kept;
+            if ( h->clock_rtt > hdr.clock_rtt )         hdr.clock_rtt = h->clock_rtt;
+        }
+        if ( in[i].base < epoch ) {
+            epoch = in[i].base;
+        }
+
+        if ( h->sample_mode == TRACE_SAMPLE_RESERVOIR ) {
+            in[i].hdr = h;
+            in[i].latest = in[i].latest_sample = in[i].mark = INT64_MIN;
+        }
+        const int ret = input_next( &in[i] );
+        if ( ret < 0 ) {
+            log_error( "read of %s failed", path );
+            return -1;
+        }
+        if ( ret > 0 ) {
+            heap[nheap++] = i;
+        }
+    }
+    for ( unsigned o=0; o < noffsets; o++ ) {
+        if ( !offsets[o].used ) {
+            log_warn( "No trace is from host %s", offsets[o].host );
+        }
+    }
+    for ( int i = nheap / 2 - 1; i >= 0; i-- ) {
+        heap_down( i );
+    }
+
+    /* Write the header, followed by the source table */
+    hdr.epoch_sec = epoch / 1000000000LL;
+    hdr.epoch_nsec = epoch % 1000000000LL;
+    hdr.flags |= TRACE_FLAG_MERGED;
+    hdr.ordinal = 0;
+    hdr.clock_offset = 0;       /* Already applied: the round trip bounds the error of alignment */
+    hdr.nsource = n;
+    hdr.source_off = sizeof(hdr);
+    hdr.hdr_len = sizeof(hdr) + n * sizeof(trace_source_t);
+    if ( gethostname( hdr.host, sizeof(hdr.host) - 1 ) < 0 ) {
+        strcpy( hdr.host, "unknown" );
+    }
+
+    FILE *fp = fopen( out, "w" );
+    uint8_t *buf = malloc( TRACE_BLOCK_MAX );
+    if ( fp == NULL || buf == NULL ) {
+        log_error( "open of merged trace file (%s) failed, (%d) ", out, errno );
+        return -1;
+    }
+    if ( fwrite( &hdr, sizeof(hdr), 1, fp ) != 1 || fwrite( source, sizeof(trace_source_t), n, fp ) != n ) {
+        log_error( "write of merged trace file (%s) failed, (%d) ", out, errno );
+        return -1;
+    }
+
+    /* Merge, writing a block whenever it is full */
+    uint8_t *p = buf;
+    uint64_t prev_ns = 0, total = 0;
+    unsigned nrec = 0;
+    int failed = 0;
+    while ( nheap > 0 || nrec > 0 ) {
+        if ( nheap > 0 ) {
+            const unsigned i = heap[0];
+            trace_entry_t te = in[i].te;
+            const int64_t t = in[i].at - epoch;
+            te.timestamp.tv_sec = t / 1000000000LL;
+            te.timestamp.tv_nsec = t % 1000000000LL;
+            if ( te.timestamp.tv_nsec < 0 ) {
+                te.timestamp.tv_sec--;
+                te.timestamp.tv_nsec += 1000000000L;
+            }
+
+            /* Records of a reservoir sample follow a record of its weight, in their own trace */
+            if ( in[i].te_seen != 0 && in[i].te_seen != in[i].seen ) {
+                trace_entry_t w;
+                memset( &w, 0, sizeof(w) );
+                w.info.op = TRACE_WEIGHT;
+                w.timestamp = te.timestamp;
+                w.duration.tv_sec = in[i].te_seen / 1000000000ULL;
+                w.duration.tv_nsec = in[i].te_seen % 1000000000ULL;
+                p = trace_record_encode_source( p, &w, i, &prev_ns );
+                nrec++;
+                in[i].seen = in[i].te_seen;
+            }
+            p = trace_record_encode_source( p, &te, i, &prev_ns );
+            nrec++;
+
+            const int ret = input_next( &in[i] );
+            if ( ret < 0 ) {
+                log_error( "read of %s failed", argv[optind + i] );
+                failed = 1;
+            }
+            if ( ret <= 0 ) {
+                heap[0] = heap[--nheap];
+            }
+            heap_down( 0 );
+        }
+
+        if ( nrec >= TRACE_BLOCK_NREC - 1 || (nrec > 0 && nheap == 0) ) {
+            if ( trace_block_write( fp, buf, p - buf, nrec ) < 0 ) {
+                log_error( "write of merged trace file (%s) failed, (%d) ", out, errno );
+                return -1;
+            }
+            total += nrec;
+            p = buf;
+            prev_ns = 0;
+            nrec = 0;
+        }
+    }
+    if ( fclose( fp ) != 0 ) {
+        log_error( "write of merged trace file (%s) failed, (%d) ", out, errno );
+        return -1;
+    }
+
+    log_info( "merged %lu records of %u traces into %s", (unsigned long)total, n, out );
+    for ( unsigned i=0; i < n; i++ ) {
+        trace_reader_close( in[i].R );
+        free( in[i].held );
+    }
+    free( source );
+    free( in );
+    free( heap );
+    free( offsets );
+    free( buf );
+    return failed ? -1 : 0;
+}